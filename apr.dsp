@@ -664,6 +664,10 @@ SOURCE=.\strmatch\apr_strmatch.c
 # PROP Default_Filter ""
 # Begin Source File
 
+SOURCE=.\tables\apr_chash.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\tables\apr_hash.c
 # End Source File
 # Begin Source File
@@ -748,12 +752,24 @@ SOURCE=.\util-misc\apr_reslist.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\util-misc\apr_ringbuf.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\util-misc\apr_rmm.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\util-misc\apr_slab.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\util-misc\apr_thread_pool.c
 # End Source File
+# Begin Source File
+
+SOURCE=.\util-misc\apr_timer_wheel.c
+# End Source File
 # End Group
 # Begin Group "xlate"
 
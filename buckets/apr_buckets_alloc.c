@@ -203,6 +203,43 @@ APR_DECLARE_NONSTD(void *) apr_bucket_alloc(apr_size_t in_size,
     return ((char *)node) + SIZEOF_NODE_HEADER_T;
 }
 
+APR_DECLARE_NONSTD(void *) apr_bucket_alloc_aligned(apr_size_t in_size,
+                                                    apr_size_t alignment,
+                                                    apr_bucket_alloc_t *list)
+{
+    node_header_t *node;
+    apr_memnode_t *memnode;
+    apr_size_t size;
+    char *mem;
+
+    if (alignment <= APR_ALIGN_DEFAULT(1)) {
+        return apr_bucket_alloc(in_size, list);
+    }
+    if ((alignment & (alignment - 1)) || alignment > apr_allocator_page_size()) {
+        return NULL;
+    }
+
+    /* Always a memnode of its own, so that the header can be placed right
+     * before the aligned address (and the block not mistaken for a small
+     * node by apr_bucket_free()).
+     */
+    size = in_size + SIZEOF_NODE_HEADER_T + alignment;
+    if (size < in_size) {
+        return NULL;
+    }
+    memnode = apr_allocator_alloc(list->allocator, size);
+    if (!memnode) {
+        return NULL;
+    }
+    mem = (char *)APR_ALIGN((apr_uintptr_t)memnode->first_avail
+                            + SIZEOF_NODE_HEADER_T, alignment);
+    node = (node_header_t *)(mem - SIZEOF_NODE_HEADER_T);
+    node->alloc = list;
+    node->memnode = memnode;
+    node->size = memnode->endp - (char *)node;
+    return mem;
+}
+
 #ifdef APR_BUCKET_DEBUG
 #if APR_HAVE_STDLIB_H
 #include <stdlib.h>
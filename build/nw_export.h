@@ -48,6 +48,7 @@
 #include "apr_random.h"
 #include "apr_reslist.h"
 #include "apr_ring.h"
+#include "apr_ringbuf.h"
 #include "apr_rmm.h"
 #include "apr_sdbm.h"
 #include "apr_sha1.h"
@@ -55,6 +56,7 @@
 #include "apr_signal.h"
 #include "apr_siphash.h"
 #include "apr_skiplist.h"
+#include "apr_slab.h"
 #include "apr_strings.h"
 #include "apr_strmatch.h"
 #include "apr_support.h"
@@ -65,6 +67,7 @@
 #include "apr_thread_proc.h"
 #include "apr_thread_rwlock.h"
 #include "apr_time.h"
+#include "apr_timer_wheel.h"
 #include "apr_uri.h"
 #include "apr_user.h"
 #include "apr_uuid.h"
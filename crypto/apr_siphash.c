@@ -128,6 +128,25 @@ APR_DECLARE(void) apr_siphash_auth(unsigned char out[APR_SIPHASH_DSIZE],
     U64TO8_LE(out, h);
 }
 
+APR_DECLARE(apr_uint64_t) apr_siphash13(const void *src, apr_size_t len,
+                               const unsigned char key[APR_SIPHASH_KSIZE])
+{
+    apr_uint64_t h;
+
+#undef  cROUNDS
+#define cROUNDS \
+        SIPROUND();
+
+#undef  dROUNDS
+#define dROUNDS \
+        SIPROUND(); \
+        SIPROUND(); \
+        SIPROUND();
+
+    SIPHASH(h, src, len, key);
+    return h;
+}
+
 APR_DECLARE(apr_uint64_t) apr_siphash24(const void *src, apr_size_t len,
                                const unsigned char key[APR_SIPHASH_KSIZE])
 {
@@ -66,6 +66,23 @@ struct apr_memnode_t {
 /** Symbolic constants */
 #define APR_ALLOCATOR_MAX_FREE_UNLIMITED 0
 
+/** Flags for apr_allocator_create_ex() */
+#define APR_ALLOCATOR_ARENAS     0x01 /**< Carve the blocks out of large
+                                       *   (2MB) aligned arenas */
+#define APR_ALLOCATOR_HUGEPAGES  0x02 /**< Back the arenas with huge pages
+                                       *   (implies APR_ALLOCATOR_ARENAS) */
+#define APR_ALLOCATOR_NUMA_BIND  0x04 /**< Place the memory on a NUMA node,
+                                       *   see APR_ALLOCATOR_NUMA_NODE() */
+
+/**
+ * Flags for apr_allocator_create_ex() to place the allocator's memory on
+ * the given NUMA node (implies APR_ALLOCATOR_ARENAS where NUMA placement
+ * is supported).
+ * @param node The node number, below apr_allocator_numa_nodes()
+ */
+#define APR_ALLOCATOR_NUMA_NODE(node) \
+    (APR_ALLOCATOR_NUMA_BIND | (((apr_uint32_t)(node) & 0xffff) << 16))
+
 /**
  * Create a new allocator
  * @param allocator The allocator we have just created.
@@ -74,6 +91,64 @@ struct apr_memnode_t {
 APR_DECLARE(apr_status_t) apr_allocator_create(apr_allocator_t **allocator)
                           __attribute__((nonnull(1)));
 
+/**
+ * Create a new allocator with the given flags
+ * @param allocator The allocator we have just created.
+ * @param flags A bitmask of APR_ALLOCATOR_ARENAS, APR_ALLOCATOR_HUGEPAGES,
+ *        APR_ALLOCATOR_NUMA_NODE() or 0 (same as apr_allocator_create()).
+ * @return APR_SUCCESS, APR_ENOTIMPL if arenas are not supported on
+ *         this platform, or APR_EINVAL if the NUMA node does not exist.
+ * @remark With APR_ALLOCATOR_ARENAS, the blocks are carved out of large
+ *         anonymous mappings instead of being malloc()ed (or mmap()ed) one
+ *         by one.  When the free memory limit is reached (see
+ *         apr_allocator_max_free_set()), the memory of the blocks is given
+ *         back to the system with madvise() but the blocks stay mapped for
+ *         reuse; the arenas are unmapped only by apr_allocator_destroy().
+ * @remark With APR_ALLOCATOR_HUGEPAGES, the arenas are mapped with
+ *         MAP_HUGETLB when some huge pages are reserved, otherwise they
+ *         are advised MADV_HUGEPAGE (transparent huge pages).
+ * @remark With APR_ALLOCATOR_NUMA_NODE(), the arenas are set to prefer the
+ *         node's memory (mbind() on Linux) before they are first touched,
+ *         so the allocator's memory stays there whichever thread uses it.
+ *         Where NUMA placement is not supported, only node 0 is accepted
+ *         and the allocator is a plain one.
+ */
+APR_DECLARE(apr_status_t) apr_allocator_create_ex(apr_allocator_t **allocator,
+                                                  apr_uint32_t flags)
+                          __attribute__((nonnull(1)));
+
+/**
+ * Create one allocator per NUMA node.
+ * @param allocators The array of allocators created, allocators[N] being
+ *        placed on node N.
+ * @param count The number of allocators to create, usually
+ *        apr_allocator_numa_nodes().
+ * @param flags Other flags for apr_allocator_create_ex().
+ * @return APR_SUCCESS, or the first error of apr_allocator_create_ex()
+ *         in which case no allocator is left created.
+ * @remark A thread would then use allocators[apr_allocator_numa_node_current()]
+ *         for its pools, preferably with its CPU affinity set to the node.
+ */
+APR_DECLARE(apr_status_t) apr_allocator_create_numa(apr_allocator_t **allocators,
+                                                    unsigned int count,
+                                                    apr_uint32_t flags)
+                          __attribute__((nonnull(1)));
+
+/**
+ * Get the number of NUMA nodes of the system.
+ * @return The number of nodes, 1 if the system (or APR) does not support
+ *         NUMA placement.
+ */
+APR_DECLARE(unsigned int) apr_allocator_numa_nodes(void);
+
+/**
+ * Get the NUMA node the calling thread is currently running on.
+ * @return The node, 0 if unknown.
+ * @remark Unless the thread is bound to the CPUs of a node, it may be
+ *         running on another one by the time this returns.
+ */
+APR_DECLARE(unsigned int) apr_allocator_numa_node_current(void);
+
 /**
  * Destroy an allocator
  * @param allocator The allocator to be destroyed
@@ -163,8 +238,99 @@ APR_DECLARE(void) apr_allocator_max_free_set(apr_allocator_t *allocator,
                                              apr_size_t size)
                   __attribute__((nonnull(1)));
 
+/**
+ * Set the number of free blocks of each size that every thread may keep
+ * in a cache of its own, in front of the allocator.
+ * @param allocator The allocator to set the cache size on
+ * @param count The maximum number of blocks per size.  0 == no cache.
+ * @return APR_SUCCESS, APR_ENOTIMPL if per-thread caches are not
+ *         supported on this platform, or an error creating the thread key.
+ * @remark Blocks allocated and freed through the cache do not need the
+ *         allocator's mutex, which is only taken to refill (or flush)
+ *         half of a thread's cache at once.  Blocks larger than 80K
+ *         (20 pages) are never cached.
+ * @remark The cached blocks are given back to the allocator when the
+ *         thread exits, or released by apr_allocator_destroy().
+ * @remark Should be set before the allocator is shared between threads.
+ */
+APR_DECLARE(apr_status_t) apr_allocator_thread_cache_set(
+                                             apr_allocator_t *allocator,
+                                             apr_size_t count)
+                          __attribute__((nonnull(1)));
+
+/** Number of block sizes reported by apr_allocator_stats_get() */
+#define APR_ALLOCATOR_STATS_SLOTS 21
+
+/** Allocator statistics, see apr_allocator_stats_get() */
+typedef struct apr_allocator_stats_t {
+    /** Number of free blocks held by the allocator, per size: slot N
+     *  counts the blocks of N+1 pages, the last slot the larger ones */
+    apr_size_t   free_blocks[APR_ALLOCATOR_STATS_SLOTS];
+    /** Total size of the free blocks held by the allocator */
+    apr_size_t   free_bytes;
+    /** Number of free blocks in the per-thread caches, per size */
+    apr_size_t   cached_blocks[APR_ALLOCATOR_STATS_SLOTS];
+    /** Total size of the free blocks in the per-thread caches */
+    apr_size_t   cached_bytes;
+    /** Size of all the blocks obtained from the system and not given
+     *  back yet (in use or free) */
+    apr_size_t   held_bytes;
+    /** Highest value of held_bytes so far */
+    apr_size_t   peak_bytes;
+    /** The threshold set by apr_allocator_max_free_set() (0 == unlimited) */
+    apr_size_t   max_free_bytes;
+    /** Number of allocations served by a free block (or a thread cache) */
+    apr_uint64_t hits;
+    /** Number of allocations which needed memory from the system */
+    apr_uint64_t misses;
+    /** Total size of the blocks given back to the system so far */
+    apr_uint64_t released_bytes;
+} apr_allocator_stats_t;
+
+/**
+ * Get the current statistics of the allocator.
+ * @param allocator The allocator
+ * @param stats The statistics filled in by the call
+ * @remark The counters are updated under the allocator's mutex (if any),
+ *         apart from the hits in the per-thread caches which are only
+ *         approximate while other threads are allocating.
+ */
+APR_DECLARE(void) apr_allocator_stats_get(apr_allocator_t *allocator,
+                                          apr_allocator_stats_t *stats)
+                  __attribute__((nonnull(1,2)));
+
 #include "apr_thread_mutex.h"
 
+/**
+ * Set the allocator to give back the free memory it does not need,
+ * gradually, as apr_allocator_trim() is called.
+ * @param allocator The allocator to set the half-life on
+ * @param half_life The time after which half of the unneeded free memory
+ *        is given back.  0 == never (the default).
+ * @remark The memory that stayed free since the previous trim, i.e. above
+ *         the high-water mark of the demand during that time, is given
+ *         back little by little, so a spike of traffic does not leave the
+ *         allocator hoarding its memory forever while the steady state
+ *         keeps on reusing its blocks.  This is independent of (and can be
+ *         combined with) the apr_allocator_max_free_set() ceiling.
+ */
+APR_DECLARE(void) apr_allocator_decay_set(apr_allocator_t *allocator,
+                                          apr_interval_time_t half_life)
+                  __attribute__((nonnull(1)));
+
+/**
+ * Give the free memory decayed since the previous call back to the system.
+ * @param allocator The allocator to trim
+ * @return The number of bytes given back.
+ * @remark This is the maintenance call for apr_allocator_decay_set(), to
+ *         be run regularly (e.g. every second or so) from a timer or a
+ *         thread of its own; it does nothing if no half-life is set.  The
+ *         blocks cached by the threads (see apr_allocator_thread_cache_set())
+ *         are not affected.
+ */
+APR_DECLARE(apr_size_t) apr_allocator_trim(apr_allocator_t *allocator)
+                        __attribute__((nonnull(1)));
+
 #if APR_HAS_THREADS
 /**
  * Set a mutex for the allocator to use
@@ -1014,6 +1014,23 @@ APR_DECLARE_NONSTD(void *) apr_bucket_alloc(apr_size_t size,
                                             apr_bucket_alloc_t *list)
                            __attribute__((nonnull(2)));
 
+/**
+ * Allocate memory for use by the buckets, aligned on the given boundary.
+ * @param size The amount to allocate.
+ * @param alignment The alignment of the memory, a power of two no larger
+ *        than apr_allocator_page_size().
+ * @param list The allocator from which to allocate the memory.
+ * @return The memory, or NULL if @a alignment is invalid or on failure.
+ * @remark Unless @a alignment is the default one, the memory always comes
+ *         from a block of its own, so this is meant for sizeable buffers
+ *         (e.g. for SIMD or direct I/O) rather than small structures.  It
+ *         is freed with apr_bucket_free() like any bucket memory.
+ */
+APR_DECLARE_NONSTD(void *) apr_bucket_alloc_aligned(apr_size_t size,
+                                                    apr_size_t alignment,
+                                                    apr_bucket_alloc_t *list)
+                           __attribute__((nonnull(3)));
+
 /**
  * Free memory previously allocated with apr_bucket_alloc().
  * @param block The block of memory to be freed.
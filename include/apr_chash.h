@@ -0,0 +1,197 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef APR_CHASH_H
+#define APR_CHASH_H
+
+/**
+ * @file apr_chash.h
+ * @brief APR Concurrent Hash Maps
+ */
+
+#include "apr.h"
+#include "apr_pools.h"
+#include "apr_errno.h"
+
+#if APR_HAS_THREADS
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * @defgroup apr_chash Concurrent Hash Maps
+ * @ingroup APR
+ * @{
+ */
+
+/**
+ * Opaque concurrent hash map structure.
+ *
+ * A concurrent hash map can be used by any number of threads at once
+ * without locking around it.  Lookups take no lock and write nothing
+ * shared but a per-thread-group counter; insertions and deletions lock
+ * one of several stripes of the map, so that only writers hashing to the
+ * same stripe wait for each other.
+ *
+ * The entries removed from the map (deleted, replaced or evicted) are
+ * only reclaimed once no lookup which may still see them is in progress
+ * (epoch-based reclamation), hence the values returned by lookups stay
+ * valid until the end of the enclosing read section, see
+ * apr_chash_read_begin().
+ */
+typedef struct apr_chash_t apr_chash_t;
+
+/**
+ * Callback called when an entry is reclaimed.
+ * @param baton The baton given to apr_chash_create()
+ * @param key The key of the entry
+ * @param klen The length of the key
+ * @param val The value of the entry
+ * @remark It is called with a stripe of the map locked, and so must not
+ *         use the map.
+ */
+typedef void (apr_chash_free_fn_t)(void *baton, const void *key,
+                                   apr_ssize_t klen, void *val);
+
+/**
+ * Callback functions for apr_chash_do().
+ * @param rec The data passed as the first argument to apr_chash_do()
+ * @param key The key of the entry
+ * @param klen The length of the key
+ * @param val The value of the entry
+ * @return Non-zero to continue the iteration, zero to stop it
+ */
+typedef int (apr_chash_do_callback_fn_t)(void *rec, const void *key,
+                                         apr_ssize_t klen, const void *val);
+
+/**
+ * Create a concurrent hash map.
+ * @param ht The new map
+ * @param max The maximum number of entries, or zero for no limit
+ * @param free_fn The function to call when an entry is reclaimed, or NULL
+ * @param baton The first argument of @a free_fn
+ * @param pool The pool to allocate the map from
+ * @return APR_SUCCESS, or an error creating the locks or the memory
+ * @remark With a maximum number of entries, the map is a bounded cache:
+ *         inserting into a full stripe evicts its least recently used
+ *         entry, approximated with the "second chance" (clock) algorithm
+ *         since lookups only mark the entries they find as used.  The
+ *         limit is enforced per stripe, so the map may evict a bit
+ *         before holding @a max entries.
+ * @remark The keys and values are not copied, @a free_fn is called for
+ *         the entries deleted, replaced or evicted once they can't be
+ *         seen anymore, and for those left when the pool is cleared or
+ *         destroyed.
+ * @remark The map uses its own allocators for its entries, the pool is
+ *         only used at creation time and need not be thread-safe.
+ */
+APR_DECLARE(apr_status_t) apr_chash_create(apr_chash_t **ht,
+                                           apr_size_t max,
+                                           apr_chash_free_fn_t *free_fn,
+                                           void *baton,
+                                           apr_pool_t *pool);
+
+/**
+ * Enter a read section.
+ * @param ht The map
+ * @return The token to pass to apr_chash_read_end()
+ * @remark The values found by apr_chash_get() and apr_chash_do() in a
+ *         read section are not reclaimed before the section ends, even
+ *         if they are removed from the map meanwhile.  Read sections can
+ *         be nested, and should be short: no entry removed from the map
+ *         can be reclaimed while they last.
+ */
+APR_DECLARE(unsigned int) apr_chash_read_begin(apr_chash_t *ht);
+
+/**
+ * Leave a read section.
+ * @param ht The map
+ * @param token The value returned by apr_chash_read_begin()
+ */
+APR_DECLARE(void) apr_chash_read_end(apr_chash_t *ht, unsigned int token);
+
+/**
+ * Look up the value associated with a key in a map, without locking.
+ * @param ht The map
+ * @param key Pointer to the key
+ * @param klen Length of the key, or APR_HASH_KEY_STRING to use the string
+ *        length
+ * @return The value, or NULL if the key is not present
+ * @remark The value may be reclaimed as soon as it is removed from the
+ *         map, unless the call is made in a read section.
+ */
+APR_DECLARE(void *) apr_chash_get(apr_chash_t *ht, const void *key,
+                                  apr_ssize_t klen);
+
+/**
+ * Associate a value with a key in a map.
+ * @param ht The map
+ * @param key Pointer to the key
+ * @param klen Length of the key, or APR_HASH_KEY_STRING to use the string
+ *        length
+ * @param val Value to associate with the key, or NULL to delete the entry
+ * @return APR_SUCCESS, or APR_ENOMEM
+ * @remark A replaced entry is reclaimed like a deleted one, the new one
+ *         uses the given key.
+ */
+APR_DECLARE(apr_status_t) apr_chash_set(apr_chash_t *ht, const void *key,
+                                        apr_ssize_t klen, void *val);
+
+/**
+ * Look up the value associated with a key in a map, or associate it with
+ * a value if there is none.
+ * @param ht The map
+ * @param key Pointer to the key
+ * @param klen Length of the key, or APR_HASH_KEY_STRING to use the string
+ *        length
+ * @param val Value to associate with the key if it is not present
+ * @return The value associated with the key (possibly @a val), or NULL if
+ *         it could not be inserted
+ */
+APR_DECLARE(void *) apr_chash_get_or_set(apr_chash_t *ht, const void *key,
+                                         apr_ssize_t klen, void *val);
+
+/**
+ * Get the number of entries in a map.
+ * @param ht The map
+ * @return The number of entries, which may be changing meanwhile
+ */
+APR_DECLARE(apr_size_t) apr_chash_count(apr_chash_t *ht);
+
+/**
+ * Iterate over the entries of a map, without locking.
+ * @param comp The callback function to call for each entry
+ * @param rec The data passed as the first argument to @a comp
+ * @param ht The map
+ * @return FALSE if one of the calls to @a comp returned zero, TRUE
+ *         otherwise
+ * @remark The iteration runs in a read section.  The entries inserted or
+ *         removed while it runs may or may not be seen, the others are
+ *         seen exactly once.
+ */
+APR_DECLARE(int) apr_chash_do(apr_chash_do_callback_fn_t *comp, void *rec,
+                              apr_chash_t *ht);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APR_HAS_THREADS */
+
+#endif /* !APR_CHASH_H */
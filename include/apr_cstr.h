@@ -176,6 +176,20 @@ APR_DECLARE(int) apr_cstr_casecmpn(const char *str1,
                                    const char *str2,
                                    apr_size_t n);
 
+/**
+ * Compute a case-insensitive hash of the string @a str, such that the
+ * strings which compare equal with apr_cstr_casecmp() have the same hash.
+ *
+ * The hash is meant for hash tables, it is not keyed and so should not be
+ * used with keys chosen by an attacker.  It may change between releases.
+ *
+ * @remark Like apr_cstr_casecmp() and apr_cstr_casecmpn(), it processes
+ * 16 bytes at a time with SSE2 or NEON where available.
+ *
+ * @since New in 2.0.
+ */
+APR_DECLARE(apr_uint32_t) apr_cstr_casehash(const char *str);
+
 /**
  * Parse the C string @a str into a 64 bit number, and return it in @a *n.
  * Assume that the number is represented in base @a base.
@@ -70,6 +70,29 @@ typedef unsigned int (*apr_hashfunc_t)(const char *key, apr_ssize_t *klen);
 APR_DECLARE_NONSTD(unsigned int) apr_hashfunc_default(const char *key,
                                                       apr_ssize_t *klen);
 
+/**
+ * @defgroup apr_hash_algo Hash table algorithms
+ * @{
+ */
+/** The historical "times 33" hash, seeded per table (the default) */
+#define APR_HASH_ALGO_TIMES33   0
+/** SipHash-1-3 with a secret key per table, processing the keys a word at
+ * a time: faster on long keys, better distributed on structured ones
+ * (URLs, header names...), and resistant to collision attacks.
+ */
+#define APR_HASH_ALGO_SIPHASH13 1
+/** @} */
+
+/**
+ * Set the algorithm used to hash the keys of the tables created from now
+ * on (without a custom hash function).
+ * @param algo One of the @ref apr_hash_algo
+ * @return APR_SUCCESS, or APR_EINVAL for an unknown algorithm
+ * @remark This is global to the process, it should be called at startup
+ *         before any thread creates a hash table.
+ */
+APR_DECLARE(apr_status_t) apr_hash_algo_default_set(int algo);
+
 /**
  * Create a hash table.
  * @param pool The pool to allocate the hash table out of
@@ -86,6 +109,64 @@ APR_DECLARE(apr_hash_t *) apr_hash_make(apr_pool_t *pool);
 APR_DECLARE(apr_hash_t *) apr_hash_make_custom(apr_pool_t *pool, 
                                                apr_hashfunc_t hash_func);
 
+/**
+ * Create a flat hash table.
+ * @param pool The pool to allocate the hash table out of
+ * @return The hash table just created, or NULL if out of memory
+ * @remark A flat hash table is used through the same functions as the
+ *         others, but its entries live in a single array probed by open
+ *         addressing (matching a group of slots at once, with SIMD where
+ *         available), which is more cache friendly than the chains of
+ *         apr_hash_make()'s tables for large tables with many lookups.
+ *         Deleted slots are reused without leaving tombstones, so the
+ *         table only grows with the number of entries it holds at once.
+ * @remark As with the other hash tables, the current entry can be deleted
+ *         while iterating.
+ */
+APR_DECLARE(apr_hash_t *) apr_hash_make_flat(apr_pool_t *pool);
+
+/**
+ * Create a flat hash table with a custom hash function
+ * @param pool The pool to allocate the hash table out of
+ * @param hash_func A custom hash function.
+ * @return The hash table just created, or NULL if out of memory
+ * @see apr_hash_make_flat()
+ */
+APR_DECLARE(apr_hash_t *) apr_hash_make_flat_custom(apr_pool_t *pool,
+                                                    apr_hashfunc_t hash_func);
+
+/**
+ * Make a hash table grow incrementally.
+ * @param ht The hash table
+ * @param step The number of buckets to move to the grown table on each
+ *        insertion, or zero to grow the table at once (the default)
+ * @return APR_SUCCESS, or APR_ENOTIMPL for a flat hash table
+ * @remark When a hash table grows, all its entries are normally rehashed
+ *         by the insertion which made it too full, which takes a time
+ *         proportional to the size of the table.  In incremental mode
+ *         the old buckets are kept aside and moved to the new ones a
+ *         few at a time by the following insertions, so that none of
+ *         them takes much longer than the others.  A step of 1 is enough
+ *         for the move to complete before the table has to grow again.
+ * @remark Lookups, replacements and deletions never move entries, so the
+ *         table can still be iterated and its current entry deleted
+ *         while it is growing.
+ * @remark Setting a step of zero completes any ongoing move.
+ */
+APR_DECLARE(apr_status_t) apr_hash_incremental_set(apr_hash_t *ht,
+                                                   unsigned int step);
+
+/**
+ * Set the algorithm used to hash the keys of a hash table.
+ * @param ht The hash table, still empty
+ * @param algo One of the @ref apr_hash_algo
+ * @return APR_SUCCESS, APR_EINVAL for an unknown algorithm or APR_EBUSY if
+ *         the table is not empty
+ * @remark This has no effect on tables created with a custom hash function.
+ * @see apr_hash_algo_default_set()
+ */
+APR_DECLARE(apr_status_t) apr_hash_algo_set(apr_hash_t *ht, int algo);
+
 /**
  * Make a copy of a hash table
  * @param pool The pool from which to allocate the new hash table
@@ -118,6 +199,26 @@ APR_DECLARE(void) apr_hash_set(apr_hash_t *ht, const void *key,
 APR_DECLARE(void *) apr_hash_get(apr_hash_t *ht, const void *key,
                                  apr_ssize_t klen);
 
+/**
+ * Look up the values associated with several keys in a hash table.
+ * @param ht The hash table
+ * @param keys The keys
+ * @param klens The lengths of the keys (each can be APR_HASH_KEY_STRING),
+ *        or NULL if they are all strings
+ * @param vals Where to store the value of each key, or NULL if the key is
+ *        not present
+ * @param n The number of keys
+ * @return The number of keys present.
+ * @remark This gives the same results as calling apr_hash_get() for each
+ *         key, but hashes the keys by batches and prefetches their buckets
+ *         before looking them up, so that the cache misses of a batch
+ *         overlap rather than add up.
+ */
+APR_DECLARE(apr_size_t) apr_hash_get_many(apr_hash_t *ht,
+                                          const void *const *keys,
+                                          const apr_ssize_t *klens,
+                                          void **vals, apr_size_t n);
+
 /**
  * Look up the value associated with a key in a hash table, or if none exists
  * associate a value.
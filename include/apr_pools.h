@@ -388,6 +388,66 @@ APR_DECLARE(void) apr_pool_destroy_debug(apr_pool_t *p,
     apr_pool_destroy_debug(p, APR_POOL__FILE_LINE__)
 #endif
 
+/** A position in a pool, see apr_pool_mark() */
+typedef struct apr_pool_mark_t apr_pool_mark_t;
+
+/**
+ * The position of a pool saved by apr_pool_mark().
+ * @remark The fields are private to the pool implementation, the structure
+ *         is public only so that it can be allocated by the caller (e.g. on
+ *         the stack).
+ */
+struct apr_pool_mark_t {
+    /** @internal the enclosing mark */
+    apr_pool_mark_t *prev;
+    /** @internal the memory node active at the time of the mark */
+    void *node;
+    /** @internal the position in the node */
+    char *first_avail;
+    /** @internal the number of allocations in the node (debug) */
+    apr_size_t index;
+    /** @internal the cleanups registered at the time of the mark */
+    void *cleanups;
+    /** @internal the pre-cleanups registered at the time of the mark */
+    void *pre_cleanups;
+    /** @internal the free cleanup structures at the time of the mark */
+    void *free_cleanups;
+};
+
+/**
+ * Save the current position of the pool, so that the memory allocated
+ * after that can be given back with apr_pool_rewind().
+ * @param p The pool
+ * @param mark The position saved, valid until apr_pool_rewind() is
+ *        called for it (or for an enclosing mark) or the pool is cleared
+ * @remark This is a cheaper alternative to creating and destroying a
+ *         subpool for some scratch memory: marking and rewinding are O(1)
+ *         in the number of allocations, and the memory nodes used in
+ *         between are kept by the pool for its next allocations instead of
+ *         being given back to the allocator.
+ * @remark Marks can be nested, and must be rewound in the reverse order;
+ *         rewinding a mark also rewinds the marks set after it.  Every
+ *         mark should be rewound, the pool may use its memory less
+ *         efficiently while it has a mark.
+ */
+APR_DECLARE(void) apr_pool_mark(apr_pool_t *p, apr_pool_mark_t *mark)
+                  __attribute__((nonnull(1,2)));
+
+/**
+ * Give back to the pool all the memory allocated since the mark.
+ * @param p The pool
+ * @param mark The position saved by apr_pool_mark()
+ * @remark The cleanups registered since the mark are run (in the reverse
+ *         order of their registration).  Subpools created since the mark
+ *         are not affected.
+ * @warning Nothing allocated since the mark may be used afterwards; that
+ *          includes the data attached with apr_pool_userdata_set() and the
+ *          subprocesses noted with apr_pool_note_subprocess(), so these
+ *          functions must not be used on the pool while it has a mark.
+ */
+APR_DECLARE(void) apr_pool_rewind(apr_pool_t *p, apr_pool_mark_t *mark)
+                  __attribute__((nonnull(1,2)));
+
 
 /*
  * Memory allocation
@@ -454,6 +514,74 @@ APR_DECLARE(void *) apr_pcalloc_debug(apr_pool_t *p, apr_size_t size,
     apr_pcalloc_debug(p, size, APR_POOL__FILE_LINE__)
 #endif
 
+/**
+ * Allocate a block of memory from a pool, aligned on the given boundary
+ * @param p The pool to allocate from
+ * @param size The amount of memory to allocate
+ * @param alignment The alignment of the memory, a power of two up to
+ *        the page size (see apr_allocator_page_size())
+ * @return The allocated memory, or NULL if @a alignment is not valid
+ * @remark When the current block of the pool has no room for the padding,
+ *         up to @a alignment bytes more than @a size are taken from the
+ *         pool.
+ */
+APR_DECLARE(void *) apr_palloc_aligned(apr_pool_t *p, apr_size_t size,
+                                       apr_size_t alignment)
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 4))
+                    __attribute__((alloc_size(2)))
+#endif
+                    __attribute__((nonnull(1)));
+
+/**
+ * Debug version of apr_palloc_aligned
+ * @param p See: apr_palloc_aligned
+ * @param size See: apr_palloc_aligned
+ * @param alignment See: apr_palloc_aligned
+ * @param file_line Where the function is called from.
+ *        This is usually APR_POOL__FILE_LINE__.
+ * @return See: apr_palloc_aligned
+ */
+APR_DECLARE(void *) apr_palloc_aligned_debug(apr_pool_t *p, apr_size_t size,
+                                             apr_size_t alignment,
+                                             const char *file_line)
+                    __attribute__((nonnull(1)));
+
+#if APR_POOL_DEBUG
+#define apr_palloc_aligned(p, size, alignment) \
+    apr_palloc_aligned_debug(p, size, alignment, APR_POOL__FILE_LINE__)
+#endif
+
+/**
+ * Allocate a block of memory from a pool, aligned on the given boundary,
+ * and set all of the memory to 0
+ * @param p The pool to allocate from
+ * @param size The amount of memory to allocate
+ * @param alignment See: apr_palloc_aligned
+ * @return The allocated memory, or NULL if @a alignment is not valid
+ */
+APR_DECLARE(void *) apr_pcalloc_aligned(apr_pool_t *p, apr_size_t size,
+                                        apr_size_t alignment)
+                    __attribute__((nonnull(1)));
+
+/**
+ * Debug version of apr_pcalloc_aligned
+ * @param p See: apr_pcalloc_aligned
+ * @param size See: apr_pcalloc_aligned
+ * @param alignment See: apr_pcalloc_aligned
+ * @param file_line Where the function is called from.
+ *        This is usually APR_POOL__FILE_LINE__.
+ * @return See: apr_pcalloc_aligned
+ */
+APR_DECLARE(void *) apr_pcalloc_aligned_debug(apr_pool_t *p, apr_size_t size,
+                                              apr_size_t alignment,
+                                              const char *file_line)
+                    __attribute__((nonnull(1)));
+
+#if APR_POOL_DEBUG
+#define apr_pcalloc_aligned(p, size, alignment) \
+    apr_pcalloc_aligned_debug(p, size, alignment, APR_POOL__FILE_LINE__)
+#endif
+
 
 /*
  * Pool Properties
@@ -516,6 +644,31 @@ APR_DECLARE(void) apr_pool_tag(apr_pool_t *pool, const char *tag)
 APR_DECLARE(const char *) apr_pool_get_tag(apr_pool_t *pool)
                   __attribute__((nonnull(1)));
 
+/** Pool statistics, see apr_pool_stats_get() */
+typedef struct apr_pool_stats_t {
+    /** The tag of the pool (may be NULL) */
+    const char *tag;
+    /** Memory currently held by the pool (not including its subpools) */
+    apr_size_t  bytes;
+    /** Highest value of bytes since the pool was created */
+    apr_size_t  peak_bytes;
+    /** Memory held by the pool but not allocated yet */
+    apr_size_t  avail_bytes;
+    /** Number of memory nodes held by the pool (with APR_POOL_DEBUG, the
+     *  number of allocations since the pool was last cleared) */
+    apr_size_t  nodes;
+} apr_pool_stats_t;
+
+/**
+ * Get the current statistics of the pool.
+ * @param pool The pool
+ * @param stats The statistics filled in by the call
+ * @remark The statistics of the pool are not updated atomically, so this
+ *         function should be called by the thread using the pool.
+ */
+APR_DECLARE(void) apr_pool_stats_get(apr_pool_t *pool, apr_pool_stats_t *stats)
+                  __attribute__((nonnull(1,2)));
+
 /*
  * User data management
  */
@@ -57,6 +57,32 @@ APR_DECLARE(apr_status_t) apr_queue_create(apr_queue_t **queue,
                                            unsigned int queue_capacity, 
                                            apr_pool_t *a);
 
+/**
+ * Flag for apr_queue_create_ex(): lock-free queue
+ */
+#define APR_QUEUE_LOCKFREE 0x01
+
+/**
+ * create a FIFO queue with options
+ * @param queue The new queue
+ * @param queue_capacity maximum size of the queue
+ * @param flags Zero or APR_QUEUE_LOCKFREE
+ * @param a pool to allocate queue from
+ * @returns APR_EINVAL if @a queue_capacity is 0 or above 2^30 with
+ * APR_QUEUE_LOCKFREE
+ * @remark With APR_QUEUE_LOCKFREE, the pushers and poppers don't take a
+ * lock but claim their slot of a ring atomically, and block (sleep) only
+ * when the queue is full or empty, which scales with the number of threads.
+ * The queue works the same otherwise, though a capacity which is a power
+ * of two is faster. The producers and consumers may however see the queue
+ * full (or empty) for a short while after a slot is claimed by a pop (or a
+ * push) which is not finished yet.
+ */
+APR_DECLARE(apr_status_t) apr_queue_create_ex(apr_queue_t **queue,
+                                              unsigned int queue_capacity,
+                                              apr_uint32_t flags,
+                                              apr_pool_t *a);
+
 /**
  * push/add an object to the queue, blocking if the queue is already full
  *
@@ -135,6 +161,126 @@ APR_DECLARE(apr_status_t) apr_queue_timedpush(apr_queue_t *queue, void *data,
 APR_DECLARE(apr_status_t) apr_queue_timedpop(apr_queue_t *queue, void **data,
                                              apr_interval_time_t timeout);
 
+/**
+ * push/add up to n objects to the queue, blocking if the queue is already
+ * full
+ *
+ * @param queue the queue
+ * @param data the array of data, pushed in order
+ * @param n the number of data in the array
+ * @param pushed the number of data pushed, as many as the queue has room for
+ * @returns APR_EINTR the blocking was interrupted (try again)
+ * @returns APR_EINVAL n is 0
+ * @returns APR_EOF the queue has been terminated
+ * @returns APR_SUCCESS on a successful push (of one object at least)
+ * @remark The objects are pushed all at once (under a single lock, or a
+ * single atomic claim with APR_QUEUE_LOCKFREE), and the blocking poppers
+ * are woken up once, so pushing by batches saves most of the per object
+ * synchronization costs of apr_queue_push().
+ */
+APR_DECLARE(apr_status_t) apr_queue_push_batch(apr_queue_t *queue,
+                                               void **data, unsigned int n,
+                                               unsigned int *pushed);
+
+/**
+ * pop/get up to n objects from the queue, blocking if the queue is already
+ * empty
+ *
+ * @param queue the queue
+ * @param data the array for the data, popped in order
+ * @param n the number of data the array can hold
+ * @param popped the number of data popped, as many as the queue holds
+ * @returns APR_EINTR the blocking was interrupted (try again)
+ * @returns APR_EINVAL n is 0
+ * @returns APR_EOF the queue has been terminated
+ * @returns APR_SUCCESS on a successful pop (of one object at least)
+ * @remark The objects are popped all at once, like for
+ * apr_queue_push_batch().
+ */
+APR_DECLARE(apr_status_t) apr_queue_pop_batch(apr_queue_t *queue,
+                                              void **data, unsigned int n,
+                                              unsigned int *popped);
+
+/**
+ * push/add up to n objects to the queue, returning immediately if the queue
+ * is full
+ *
+ * @param queue the queue
+ * @param data the array of data, pushed in order
+ * @param n the number of data in the array
+ * @param pushed the number of data pushed, as many as the queue has room for
+ * @returns APR_EINTR the blocking operation was interrupted (try again)
+ * @returns APR_EINVAL n is 0
+ * @returns APR_EAGAIN the queue is full
+ * @returns APR_EOF the queue has been terminated
+ * @returns APR_SUCCESS on a successful push (of one object at least)
+ */
+APR_DECLARE(apr_status_t) apr_queue_trypush_batch(apr_queue_t *queue,
+                                                  void **data, unsigned int n,
+                                                  unsigned int *pushed);
+
+/**
+ * pop/get up to n objects from the queue, returning immediately if the queue
+ * is empty
+ *
+ * @param queue the queue
+ * @param data the array for the data, popped in order
+ * @param n the number of data the array can hold
+ * @param popped the number of data popped, as many as the queue holds
+ * @returns APR_EINTR the blocking operation was interrupted (try again)
+ * @returns APR_EINVAL n is 0
+ * @returns APR_EAGAIN the queue is empty
+ * @returns APR_EOF the queue has been terminated
+ * @returns APR_SUCCESS on a successful pop (of one object at least)
+ */
+APR_DECLARE(apr_status_t) apr_queue_trypop_batch(apr_queue_t *queue,
+                                                 void **data, unsigned int n,
+                                                 unsigned int *popped);
+
+/**
+ * push/add up to n objects to the queue, waiting a maximum of timeout
+ * microseconds before returning if the queue is full
+ *
+ * @param queue the queue
+ * @param data the array of data, pushed in order
+ * @param n the number of data in the array
+ * @param pushed the number of data pushed, as many as the queue has room for
+ * @param timeout the timeout
+ * @returns APR_EINTR the blocking operation was interrupted (try again)
+ * @returns APR_EINVAL n is 0
+ * @returns APR_EAGAIN the queue is full and timeout is 0
+ * @returns APR_TIMEUP the queue is full and the timeout expired
+ * @returns APR_EOF the queue has been terminated
+ * @returns APR_SUCCESS on a successful push (of one object at least)
+ */
+APR_DECLARE(apr_status_t) apr_queue_timedpush_batch(apr_queue_t *queue,
+                                                    void **data,
+                                                    unsigned int n,
+                                                    unsigned int *pushed,
+                                                    apr_interval_time_t timeout);
+
+/**
+ * pop/get up to n objects from the queue, waiting a maximum of timeout
+ * microseconds before returning if the queue is empty
+ *
+ * @param queue the queue
+ * @param data the array for the data, popped in order
+ * @param n the number of data the array can hold
+ * @param popped the number of data popped, as many as the queue holds
+ * @param timeout the timeout
+ * @returns APR_EINTR the blocking operation was interrupted (try again)
+ * @returns APR_EINVAL n is 0
+ * @returns APR_EAGAIN the queue is empty and timeout is 0
+ * @returns APR_TIMEUP the queue is empty and the timeout expired
+ * @returns APR_EOF the queue has been terminated
+ * @returns APR_SUCCESS on a successful pop (of one object at least)
+ */
+APR_DECLARE(apr_status_t) apr_queue_timedpop_batch(apr_queue_t *queue,
+                                                   void **data,
+                                                   unsigned int n,
+                                                   unsigned int *popped,
+                                                   apr_interval_time_t timeout);
+
 /**
  * returns the size of the queue.
  *
@@ -192,6 +192,66 @@ APR_DECLARE(apr_status_t) apr_reslist_maintain(apr_reslist_t *reslist);
 APR_DECLARE(void) apr_reslist_cleanup_order_set(apr_reslist_t *reslist,
                                                 apr_uint32_t mode);
 
+/** Maximum number of resources in a per-thread cache */
+#define APR_RESLIST_THREAD_CACHE_MAX 2
+
+/**
+ * Enable the lock-free path of the resource list, with a cache of idle
+ * resources in each thread.
+ * @param reslist The resource list.
+ * @param count The number of resources each thread may keep in its cache
+ *              (up to APR_RESLIST_THREAD_CACHE_MAX), 0 for none.
+ * @return APR_SUCCESS, APR_EINVAL if count is out of range, APR_ENOTIMPL
+ *         if per-thread caches are not supported on this platform, or an
+ *         error creating the thread key.
+ * @remark Once enabled, apr_reslist_release() puts the resource in the
+ *         calling thread's cache, or in a lock-free stack shared by all
+ *         the threads, and apr_reslist_acquire() takes it from there
+ *         first.  The list lock is only taken when both are empty (or
+ *         full), to create a resource or to wait for one.  An acquirer
+ *         which would otherwise block steals the resources cached by the
+ *         other threads.
+ * @remark Acquiring with APR_RESLIST_ACQUIRE_FIFO always goes through the
+ *         list, falling back to the lock-free path when it is empty.
+ * @remark The min, smax, hmax and ttl limits account for the resources
+ *         in the caches and the stack too.  Expired resources are never
+ *         handed out, but those of the stack and caches are not expired
+ *         in order of age by the maintenance.
+ * @remark The cached resources are given back to the stack when the
+ *         thread exits, or destroyed with the resource list.
+ * @remark Should be called before the resource list is shared between
+ *         threads, and can't be disabled afterwards.
+ */
+APR_DECLARE(apr_status_t) apr_reslist_thread_cache_set(apr_reslist_t *reslist,
+                                                       int count);
+
+/**
+ * Run the maintenance of the resource list in a background thread,
+ * rather than within apr_reslist_release() and apr_reslist_acquire().
+ * @param reslist The resource list.
+ * @param interval The interval between two maintenances, or 0 to stop
+ *                 the background maintenance.
+ * @return APR_SUCCESS, APR_EINVAL if interval is negative, APR_ENOTIMPL
+ *         if APR has been compiled without thread support, or an error
+ *         creating the thread.
+ * @remark The maintenance thread creates resources until min of them are
+ *         available (prewarming), and destroys the ones that reached
+ *         their ttl beyond smax.  It is also woken up early when an
+ *         acquire leaves fewer than min resources available.
+ * @remark The requests don't run the constructor for prewarming nor the
+ *         destructor for expiry anymore, but still destroy the expired
+ *         resources they come across rather than handing them out.
+ * @remark The maintenance thread calls the constructor and destructor
+ *         without holding the lock of the list, so they may run
+ *         concurrently with the ones of the requests, and with a pool
+ *         of its own (living as long as the list) rather than the pool
+ *         of the list.
+ * @remark The thread is stopped by apr_reslist_destroy(), or before the
+ *         subpools of the pool used to create the reslist are destroyed.
+ */
+APR_DECLARE(apr_status_t) apr_reslist_maintenance_set(apr_reslist_t *reslist,
+                                                      apr_interval_time_t interval);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,276 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef APR_RINGBUF_H
+#define APR_RINGBUF_H
+
+/**
+ * @file apr_ringbuf.h
+ * @brief APR Lock-free Ring Buffers
+ */
+
+#include "apr.h"
+#include "apr_pools.h"
+#include "apr_errno.h"
+#include "apr_time.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * @defgroup apr_ringbuf Lock-free Ring Buffers
+ * @ingroup APR
+ * @{
+ */
+
+/**
+ * @remark The ring buffers hand fixed-size elements over from one
+ * producer to one consumer (apr_ring_spsc_t), or from any number of
+ * producers to one consumer (apr_ring_mpsc_t), in FIFO order and without
+ * any lock: the producers and the consumer only share their positions in
+ * the ring, on cache lines of their own, so a single producer and the
+ * consumer hand elements over without any atomic read-modify-write, and
+ * the producers of an apr_ring_mpsc_t claim their places with one CAS.
+ * The elements are copied into the ring and out of it, by batches.
+ *
+ * @remark Unlike apr_queue_t, it's up to the caller to respect the roles:
+ * the elements must be enqueued by a single thread at a time for an
+ * apr_ring_spsc_t, and dequeued by a single thread at a time for both.
+ *
+ * @remark A ring holds no pointer, so it can live in an apr_shm_t segment
+ * (see apr_ring_spsc_init() and apr_ring_spsc_attach()) and hand elements
+ * over between processes, provided that the elements themselves make
+ * sense in all of them (e.g. offsets in the segment rather than pointers).
+ *
+ * @remark The producer and the consumer may wait for the ring to have room
+ * or elements, with a timeout, first yielding the processor a few times.
+ * Then the waiters of rings created with APR_RING_BLOCKING sleep until
+ * woken up by the other side (on the futexes of Linux), at the cost of a
+ * memory barrier per operation to find out whether the other side is
+ * sleeping. The waiters of other rings (or where futexes are not
+ * available) poll, sleeping for a growing while, which wastes no cycles on
+ * the hand over when waiting is rare.
+ */
+
+/** Opaque single producer, single consumer ring buffer */
+typedef struct apr_ring_spsc_t apr_ring_spsc_t;
+
+/** Opaque multiple producers, single consumer ring buffer */
+typedef struct apr_ring_mpsc_t apr_ring_mpsc_t;
+
+/**
+ * Flag for the creation of a ring: the waiting producers and consumer
+ * sleep until woken up by the other side, instead of polling.
+ */
+#define APR_RING_BLOCKING 0x01
+
+/**
+ * Compute the size of the memory needed by a single producer, single
+ * consumer ring.
+ * @param capacity The number of elements of the ring, rounded up to a
+ *        power of two
+ * @param elt_size The size of the elements
+ * @return The size, or 0 if @a capacity or @a elt_size is 0, or
+ *         @a capacity is above 2^30.
+ */
+APR_DECLARE(apr_size_t) apr_ring_spsc_size(apr_uint32_t capacity,
+                                           apr_size_t elt_size);
+
+/**
+ * Create a single producer, single consumer ring.
+ * @param ring The new ring
+ * @param capacity The number of elements of the ring, rounded up to a
+ *        power of two
+ * @param elt_size The size of the elements
+ * @param flags Zero or APR_RING_BLOCKING
+ * @param pool The pool to allocate the ring from
+ * @return APR_SUCCESS, or APR_EINVAL if @a capacity or @a elt_size is 0,
+ *         or @a capacity is above 2^30.
+ */
+APR_DECLARE(apr_status_t) apr_ring_spsc_create(apr_ring_spsc_t **ring,
+                                               apr_uint32_t capacity,
+                                               apr_size_t elt_size,
+                                               apr_uint32_t flags,
+                                               apr_pool_t *pool);
+
+/**
+ * Create a single producer, single consumer ring in the given memory, for
+ * instance the base address of an apr_shm_t segment, for other processes
+ * to attach to it.
+ * @param ring The new ring
+ * @param mem The memory, of apr_ring_spsc_size() bytes at least, and
+ *        preferably aligned on a cache line (like apr_shm_t segments are)
+ * @param size The size of the memory
+ * @param capacity The number of elements of the ring, rounded up to a
+ *        power of two
+ * @param elt_size The size of the elements
+ * @param flags Zero or APR_RING_BLOCKING
+ * @return APR_SUCCESS, or APR_EINVAL if the memory is too small for the
+ *         ring, @a capacity or @a elt_size is 0, or @a capacity is above
+ *         2^30.
+ * @remark The ring must not be used anymore when the memory is released.
+ */
+APR_DECLARE(apr_status_t) apr_ring_spsc_init(apr_ring_spsc_t **ring,
+                                             void *mem, apr_size_t size,
+                                             apr_uint32_t capacity,
+                                             apr_size_t elt_size,
+                                             apr_uint32_t flags);
+
+/**
+ * Attach to the single producer, single consumer ring created in the
+ * given memory by apr_ring_spsc_init().
+ * @param ring The ring
+ * @param mem The memory of the ring
+ * @return APR_SUCCESS, or APR_EINVAL if the memory does not hold a single
+ *         producer, single consumer ring.
+ */
+APR_DECLARE(apr_status_t) apr_ring_spsc_attach(apr_ring_spsc_t **ring,
+                                               void *mem);
+
+/**
+ * Enqueue up to n elements, as many as the ring has room for.
+ * @param ring The ring
+ * @param elts The array of elements, enqueued in order
+ * @param n The number of elements in the array
+ * @param count The number of elements enqueued
+ * @param timeout The maximum time to wait for the ring to have room, 0
+ *        to not wait, or negative to wait until it has
+ * @return APR_SUCCESS when one element at least is enqueued, APR_EAGAIN
+ *         if the ring is full and @a timeout is 0, APR_TIMEUP if it is
+ *         still full when the timeout expires, APR_EOF if the ring is
+ *         closed, or APR_EINVAL if @a n is 0.
+ */
+APR_DECLARE(apr_status_t) apr_ring_spsc_enqueue(apr_ring_spsc_t *ring,
+                                                const void *elts,
+                                                apr_uint32_t n,
+                                                apr_uint32_t *count,
+                                                apr_interval_time_t timeout);
+
+/**
+ * Dequeue up to n elements, as many as the ring holds.
+ * @param ring The ring
+ * @param elts The array for the elements, dequeued in order
+ * @param n The number of elements the array can hold
+ * @param count The number of elements dequeued
+ * @param timeout The maximum time to wait for the ring to have elements,
+ *        0 to not wait, or negative to wait until it has
+ * @return APR_SUCCESS when one element at least is dequeued, APR_EAGAIN
+ *         if the ring is empty and @a timeout is 0, APR_TIMEUP if it is
+ *         still empty when the timeout expires, APR_EOF if the ring is
+ *         empty and closed, or APR_EINVAL if @a n is 0.
+ */
+APR_DECLARE(apr_status_t) apr_ring_spsc_dequeue(apr_ring_spsc_t *ring,
+                                                void *elts,
+                                                apr_uint32_t n,
+                                                apr_uint32_t *count,
+                                                apr_interval_time_t timeout);
+
+/**
+ * Get the number of elements in the ring.
+ * @param ring The ring
+ * @return The number of elements, which may have changed already when
+ *         the producer or the consumer are running.
+ */
+APR_DECLARE(apr_uint32_t) apr_ring_spsc_count(apr_ring_spsc_t *ring);
+
+/**
+ * Close the ring: the producer can't enqueue anymore, and the consumer
+ * gets APR_EOF once it has dequeued the elements left. The waiting
+ * producer and consumer are woken up.
+ * @param ring The ring
+ */
+APR_DECLARE(void) apr_ring_spsc_close(apr_ring_spsc_t *ring);
+
+/**
+ * Compute the size of the memory needed by a multiple producers, single
+ * consumer ring.
+ * @see apr_ring_spsc_size()
+ */
+APR_DECLARE(apr_size_t) apr_ring_mpsc_size(apr_uint32_t capacity,
+                                           apr_size_t elt_size);
+
+/**
+ * Create a multiple producers, single consumer ring.
+ * @see apr_ring_spsc_create()
+ */
+APR_DECLARE(apr_status_t) apr_ring_mpsc_create(apr_ring_mpsc_t **ring,
+                                               apr_uint32_t capacity,
+                                               apr_size_t elt_size,
+                                               apr_uint32_t flags,
+                                               apr_pool_t *pool);
+
+/**
+ * Create a multiple producers, single consumer ring in the given memory.
+ * @see apr_ring_spsc_init()
+ */
+APR_DECLARE(apr_status_t) apr_ring_mpsc_init(apr_ring_mpsc_t **ring,
+                                             void *mem, apr_size_t size,
+                                             apr_uint32_t capacity,
+                                             apr_size_t elt_size,
+                                             apr_uint32_t flags);
+
+/**
+ * Attach to the multiple producers, single consumer ring created in the
+ * given memory by apr_ring_mpsc_init().
+ * @see apr_ring_spsc_attach()
+ */
+APR_DECLARE(apr_status_t) apr_ring_mpsc_attach(apr_ring_mpsc_t **ring,
+                                               void *mem);
+
+/**
+ * Enqueue up to n elements, as many as the ring has room for. The
+ * elements of one call are contiguous in the ring, but those of the
+ * concurrent producers may be dequeued in any order.
+ * @see apr_ring_spsc_enqueue()
+ */
+APR_DECLARE(apr_status_t) apr_ring_mpsc_enqueue(apr_ring_mpsc_t *ring,
+                                                const void *elts,
+                                                apr_uint32_t n,
+                                                apr_uint32_t *count,
+                                                apr_interval_time_t timeout);
+
+/**
+ * Dequeue up to n elements, as many as the ring holds. An element whose
+ * producer is still copying it in stops the batch (it and the next ones
+ * are dequeued by the next call).
+ * @see apr_ring_spsc_dequeue()
+ */
+APR_DECLARE(apr_status_t) apr_ring_mpsc_dequeue(apr_ring_mpsc_t *ring,
+                                                void *elts,
+                                                apr_uint32_t n,
+                                                apr_uint32_t *count,
+                                                apr_interval_time_t timeout);
+
+/**
+ * Get the number of elements in the ring.
+ * @see apr_ring_spsc_count()
+ */
+APR_DECLARE(apr_uint32_t) apr_ring_mpsc_count(apr_ring_mpsc_t *ring);
+
+/**
+ * Close the ring.
+ * @see apr_ring_spsc_close()
+ */
+APR_DECLARE(void) apr_ring_mpsc_close(apr_ring_mpsc_t *ring);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !APR_RINGBUF_H */
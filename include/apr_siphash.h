@@ -88,6 +88,19 @@ APR_DECLARE(void) apr_siphash_auth(unsigned char out[APR_SIPHASH_DSIZE],
                              const unsigned char key[APR_SIPHASH_KSIZE],
                                    unsigned int c, unsigned int d);
 
+/**
+ * @brief Computes SipHash-1-3, producing a 64bit (APR_SIPHASH_DSIZE) hash
+ * from a message and a 128bit (APR_SIPHASH_KSIZE) secret key.
+ * @param src The message to hash
+ * @param len The length of the message
+ * @param key The secret key
+ * @return The hash value as a 64bit unsigned integer
+ * @remark This variant trades some security margin for speed, it is meant
+ *         for hash tables' keys (as used by apr_hash_t) rather than MACs.
+ */
+APR_DECLARE(apr_uint64_t) apr_siphash13(const void *src, apr_size_t len,
+                               const unsigned char key[APR_SIPHASH_KSIZE]);
+
 /**
  * @brief Computes SipHash-2-4, producing a 64bit (APR_SIPHASH_DSIZE) hash
  * from a message and a 128bit (APR_SIPHASH_KSIZE) secret key.
@@ -84,6 +84,8 @@ APR_DECLARE(void *) apr_skiplist_alloc(apr_skiplist *sl, size_t size);
  * to operations on the skip list or to other calls to apr_skiplist_alloc().
  * Otherwise, memory will be freed using the  C standard library heap
  * functions.
+ * @remark @a mem must have been allocated by apr_skiplist_alloc() for
+ * the same skip list.
  */
 APR_DECLARE(void) apr_skiplist_free(apr_skiplist *sl, void *mem);
 
@@ -0,0 +1,138 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef APR_SLAB_H
+#define APR_SLAB_H
+
+/**
+ * @file apr_slab.h
+ * @brief APR Fixed-size Object Allocator
+ */
+
+#include "apr.h"
+#include "apr_pools.h"
+#include "apr_errno.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * @defgroup apr_slab Fixed-size Object Allocator
+ * @ingroup APR
+ * @{
+ */
+
+/**
+ * The size of a cache line, for use as the alignment of objects which
+ * must not share a cache line with their neighbours.
+ */
+#define APR_SLAB_CACHELINE 64
+
+/** Opaque slab structure */
+typedef struct apr_slab_t apr_slab_t;
+
+/** Slab statistics, see apr_slab_stats_get() */
+typedef struct apr_slab_stats_t {
+    /** The size of the objects (including the alignment padding) */
+    apr_size_t   object_size;
+    /** Number of objects currently allocated */
+    apr_size_t   objects;
+    /** Number of objects freed and ready for reuse */
+    apr_size_t   free_objects;
+    /** Number of chunks allocated from the pool */
+    apr_size_t   chunks;
+    /** Total size of the chunks allocated from the pool */
+    apr_size_t   bytes;
+    /** Number of calls to apr_slab_alloc() */
+    apr_uint64_t allocs;
+    /** Number of calls to apr_slab_free() */
+    apr_uint64_t frees;
+} apr_slab_stats_t;
+
+/**
+ * Create a slab of objects of the given size.
+ * @param slab The new slab
+ * @param size The size of the objects
+ * @param align The alignment of the objects, a power of two (e.g.
+ *        APR_SLAB_CACHELINE), or 0 for the pools' default alignment
+ * @param pool The pool to allocate the slab and its objects from
+ * @return APR_SUCCESS, APR_EINVAL if @a align is not a power of two, or
+ *         APR_ENOMEM.
+ * @remark The objects are carved out of chunks allocated from the pool,
+ *         which grow geometrically up to some pages; no memory is taken
+ *         from the pool until the first allocation.
+ * @remark The objects freed with apr_slab_free() are reused by the next
+ *         allocations (last freed first), so a structure which keeps on
+ *         allocating and freeing its objects does not make the pool grow.
+ *         All the memory is given back when the pool is cleared or
+ *         destroyed.
+ * @remark A slab is not thread-safe, like the pool it is allocated from.
+ */
+APR_DECLARE(apr_status_t) apr_slab_create(apr_slab_t **slab, apr_size_t size,
+                                          apr_size_t align, apr_pool_t *pool)
+                          __attribute__((nonnull(1,4)));
+
+/**
+ * Allocate an object from the slab.
+ * @param slab The slab
+ * @return The object (uninitialized), or NULL if the pool could not
+ *         provide the memory.
+ */
+APR_DECLARE(void *) apr_slab_alloc(apr_slab_t *slab)
+                    __attribute__((nonnull(1)));
+
+/**
+ * Allocate an object from the slab and set it to zero.
+ * @param slab The slab
+ * @return The object, or NULL if the pool could not provide the memory.
+ */
+APR_DECLARE(void *) apr_slab_calloc(apr_slab_t *slab)
+                    __attribute__((nonnull(1)));
+
+/**
+ * Give an object back to the slab.
+ * @param slab The slab the object was allocated from
+ * @param mem The object (NULL is ignored)
+ */
+APR_DECLARE(void) apr_slab_free(apr_slab_t *slab, void *mem)
+                  __attribute__((nonnull(1)));
+
+/**
+ * Get the size of the objects of the slab.
+ * @param slab The slab
+ * @return The size requested by apr_slab_create(), rounded up to the
+ *         alignment.
+ */
+APR_DECLARE(apr_size_t) apr_slab_object_size(const apr_slab_t *slab)
+                        __attribute__((nonnull(1)));
+
+/**
+ * Get the current statistics of the slab.
+ * @param slab The slab
+ * @param stats The statistics filled in by the call
+ */
+APR_DECLARE(void) apr_slab_stats_get(const apr_slab_t *slab,
+                                     apr_slab_stats_t *stats)
+                  __attribute__((nonnull(1,2)));
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !APR_SLAB_H */
@@ -63,6 +63,23 @@ typedef struct apr_thread_pool apr_thread_pool_t;
 #define APR_THREAD_TASK_PRIORITY_HIGH 191
 #define APR_THREAD_TASK_PRIORITY_HIGHEST 255
 
+/**
+ * Flag for apr_thread_pool_create_ex(): schedule the tasks by work stealing.
+ */
+#define APR_THREAD_POOL_WORK_STEALING 0x01
+
+/**
+ * Flag for apr_thread_pool_create_ex(): collect the statistics returned by
+ * apr_thread_pool_stats_get().
+ */
+#define APR_THREAD_POOL_STATS 0x02
+
+/**
+ * Flag for apr_thread_pool_create_ex(): give each thread a pool allocating
+ * on the NUMA node it runs on, see apr_thread_pool_node_pool_get().
+ */
+#define APR_THREAD_POOL_NUMA 0x04
+
 /**
  * Create a thread pool
  * @param me The pointer in which to return the newly created apr_thread_pool
@@ -79,6 +96,96 @@ APR_DECLARE(apr_status_t) apr_thread_pool_create(apr_thread_pool_t **me,
                                                  apr_size_t max_threads,
                                                  apr_pool_t *pool);
 
+/**
+ * Create a thread pool with options
+ * @param me The pointer in which to return the newly created apr_thread_pool
+ * object, or NULL if thread pool creation fails.
+ * @param init_threads The number of threads to be created initially, this number
+ * will also be used as the initial value for the maximum number of idle threads.
+ * @param max_threads The maximum number of threads that can be created
+ * @param flags Zero, APR_THREAD_POOL_WORK_STEALING, APR_THREAD_POOL_STATS
+ * and/or APR_THREAD_POOL_NUMA
+ * @param pool The pool to use
+ * @return APR_SUCCESS if the thread pool was created successfully. Otherwise,
+ * the error code.
+ * @remark With APR_THREAD_POOL_WORK_STEALING, each thread has its own deques of
+ * tasks (one per priority segment of 64 priorities), where the tasks pushed by
+ * the tasks running in the thread go without taking the lock of the pool. The
+ * tasks pushed from outside of the pool go to the shared, ordered, queue. An
+ * idle thread takes the tasks of the highest segment available, first from its
+ * own deques (last pushed first), then from the shared queue, then steals from
+ * the other threads (first pushed first), and sleeps when none is left. The
+ * owners and apr_thread_pool_tasks_cancel() work the same in both modes, but
+ * the order of the priorities is only kept between the segments for the tasks
+ * pushed by tasks, and apr_thread_pool_top() is the same as
+ * apr_thread_pool_push() for them.
+ * @remark With APR_THREAD_POOL_WORK_STEALING, the maximum number of threads
+ * can't be raised above @a max_threads afterwards.
+ */
+APR_DECLARE(apr_status_t) apr_thread_pool_create_ex(apr_thread_pool_t **me,
+                                                    apr_size_t init_threads,
+                                                    apr_size_t max_threads,
+                                                    apr_uint32_t flags,
+                                                    apr_pool_t *pool);
+
+/**
+ * The function called by each thread of a pool when it starts.
+ * @param thd The thread
+ * @param index The index of the thread in the pool, the lowest one not
+ *        used by another thread (from 0 to the maximum number of threads)
+ * @param data The data given in the options of the pool
+ */
+typedef void (*apr_thread_pool_init_fn_t)(apr_thread_t *thd,
+                                          apr_size_t index, void *data);
+
+/**
+ * The options of apr_thread_pool_create_opt(), where zero (or NULL)
+ * fields keep the defaults.
+ */
+typedef struct apr_thread_pool_options_t {
+    /** Zero, APR_THREAD_POOL_WORK_STEALING, APR_THREAD_POOL_STATS and/or
+     *  APR_THREAD_POOL_NUMA */
+    apr_uint32_t flags;
+    /** The numbers of the CPUs the threads run on (any if NULL) */
+    const int *cpus;
+    /** The number of CPUs in @a cpus */
+    apr_size_t ncpus;
+    /** The number of CPUs per thread: the thread of index i runs on the
+     *  (i modulo ncpus / cpus_per_thread)-th group of cpus_per_thread CPUs
+     *  of @a cpus, or all the threads run on all of them if 0 */
+    apr_size_t cpus_per_thread;
+    /** The name of the threads, suffixed by "-<index>" (the names of the
+     *  threads are truncated to 15 characters), or NULL to not name them */
+    const char *name;
+    /** The function called by each thread when it starts, or NULL */
+    apr_thread_pool_init_fn_t thread_init;
+    /** The data passed to @a thread_init */
+    void *thread_init_data;
+} apr_thread_pool_options_t;
+
+/**
+ * Create a thread pool with options
+ * @param me The pointer in which to return the newly created apr_thread_pool
+ * object, or NULL if thread pool creation fails.
+ * @param init_threads The number of threads to be created initially, this number
+ * will also be used as the initial value for the maximum number of idle threads.
+ * @param max_threads The maximum number of threads that can be created
+ * @param options The options, copied
+ * @param pool The pool to use
+ * @return APR_SUCCESS if the thread pool was created successfully. Otherwise,
+ * the error code.
+ * @remark Each thread sets its name and affinity, then calls the
+ * thread_init function, before running any task. Setting the name or the
+ * affinity is best effort, it may not be supported by the platform (see
+ * apr_thread_name_set() and apr_thread_affinity_set()).
+ * @see apr_thread_pool_create_ex()
+ */
+APR_DECLARE(apr_status_t) apr_thread_pool_create_opt(apr_thread_pool_t **me,
+                                    apr_size_t init_threads,
+                                    apr_size_t max_threads,
+                                    const apr_thread_pool_options_t *options,
+                                    apr_pool_t *pool);
+
 /**
  * Destroy the thread pool and stop all the threads
  * @return APR_SUCCESS if all threads are stopped.
@@ -280,6 +387,22 @@ APR_DECLARE(apr_size_t) apr_thread_pool_threshold_set(apr_thread_pool_t *me,
  */
 APR_DECLARE(apr_size_t) apr_thread_pool_threshold_get(apr_thread_pool_t * me);
 
+/**
+ * Get the pool of a thread of a pool created with APR_THREAD_POOL_NUMA, whose
+ * allocator places the memory on the NUMA node the thread started on (see
+ * APR_ALLOCATOR_NUMA_NODE()).
+ * @param thd The thread, as given to the tasks and the thread_init function
+ * @return The pool, or NULL if the thread pool was created without
+ *         APR_THREAD_POOL_NUMA.
+ * @remark The pool is destroyed with the thread, so the tasks can use it for
+ *         memory that does not outlive them, from their thread only.
+ *         The threads should be pinned to the CPUs of a node (see the cpus
+ *         of apr_thread_pool_options_t) for the memory to stay local.
+ * @remark Where NUMA placement is not supported, it is a pool with an
+ *         allocator of its own.
+ */
+APR_DECLARE(apr_pool_t *) apr_thread_pool_node_pool_get(apr_thread_t *thd);
+
 /**
  * Get owner of the task currently been executed by the thread.
  * @param thd The thread is executing a task
@@ -289,6 +412,184 @@ APR_DECLARE(apr_size_t) apr_thread_pool_threshold_get(apr_thread_pool_t * me);
 APR_DECLARE(apr_status_t) apr_thread_pool_task_owner_get(apr_thread_t *thd,
                                                          void **owner);
 
+/** The number of buckets of the histograms of apr_thread_pool_stats_t */
+#define APR_THREAD_POOL_STATS_BUCKETS 24
+
+/**
+ * Histogram of durations, in microseconds.
+ */
+typedef struct apr_thread_pool_histogram_t {
+    /** The number of durations */
+    apr_uint64_t count;
+    /** Their sum */
+    apr_uint64_t total;
+    /** The longest */
+    apr_uint64_t max;
+    /** The number of durations of 0, in buckets[0], of [2^(i-1), 2^i) in
+     *  buckets[i], and of 2^(APR_THREAD_POOL_STATS_BUCKETS - 2) or more in
+     *  the last one */
+    apr_uint64_t buckets[APR_THREAD_POOL_STATS_BUCKETS];
+} apr_thread_pool_histogram_t;
+
+/**
+ * The statistics of the tasks of an owner.
+ */
+typedef struct apr_thread_pool_owner_stats_t {
+    /** The owner */
+    void *owner;
+    /** The time the tasks waited to be run (since pushed, or due) */
+    apr_thread_pool_histogram_t wait;
+    /** The time the tasks ran */
+    apr_thread_pool_histogram_t run;
+} apr_thread_pool_owner_stats_t;
+
+/**
+ * The statistics of a thread pool created with APR_THREAD_POOL_STATS.
+ */
+typedef struct apr_thread_pool_stats_t {
+    /** The time the tasks waited to be run, per priority segment
+     *  (priority / 64, scheduled tasks are in the first one) */
+    apr_thread_pool_histogram_t wait[4];
+    /** The time the tasks ran, per priority segment */
+    apr_thread_pool_histogram_t run[4];
+    /** The statistics of the first owners seen (up to 16) */
+    apr_thread_pool_owner_stats_t *owners;
+    /** The number of @a owners */
+    apr_size_t nowners;
+    /** The statistics of the other owners, together (owner is NULL) */
+    apr_thread_pool_owner_stats_t other_owners;
+    /** The number of times the lock of the pool was taken */
+    apr_uint64_t lock_acquired;
+    /** The number of times it was held by another thread already */
+    apr_uint64_t lock_contended;
+    /** The time spent waiting for the lock in those cases */
+    apr_interval_time_t lock_wait;
+    /** The time the threads spent running tasks */
+    apr_interval_time_t busy_time;
+    /** The time the threads spent waiting for tasks */
+    apr_interval_time_t idle_time;
+} apr_thread_pool_stats_t;
+
+/**
+ * Get the statistics of a thread pool created with APR_THREAD_POOL_STATS.
+ * @param me The thread pool
+ * @param stats The statistics, since the creation of the pool
+ * @param pool The pool to allocate the statistics from
+ * @return APR_SUCCESS, or APR_ENOTIMPL if the thread pool does not collect
+ *         statistics.
+ * @remark Each thread accounts the tasks it runs on its own, without
+ * synchronization, and the accounts are merged on read, so collecting the
+ * statistics costs two clock reads per task, around its run once it is
+ * dequeued (and one on push), plus a trylock before taking the lock of the
+ * pool. The updates of the running threads may be seen a bit late.
+ */
+APR_DECLARE(apr_status_t) apr_thread_pool_stats_get(apr_thread_pool_t *me,
+                                            apr_thread_pool_stats_t **stats,
+                                            apr_pool_t *pool);
+
+/** Opaque handle of a task submitted by apr_thread_pool_submit(). */
+typedef struct apr_task_handle_t apr_task_handle_t;
+
+/**
+ * Add a task to the thread pool, like apr_thread_pool_push(), and get a
+ * handle to wait for its completion and get its result.
+ * @param me The thread pool
+ * @param handle The handle of the task
+ * @param func The task function, whose return value is the result
+ * @param param The parameter for the task function
+ * @param priority The priority of the task.
+ * @param owner Owner of this task.
+ * @param pool The pool to allocate the handle from
+ * @return APR_SUCCESS if the task had been scheduled successfully
+ * @remark The handle must stay alive (its pool not destroyed) until the task
+ * is completed or cancelled. A cancelled task (see
+ * apr_thread_pool_tasks_cancel(), or the destruction of the thread pool)
+ * is never run, and waiting for its handle returns APR_EOF.
+ */
+APR_DECLARE(apr_status_t) apr_thread_pool_submit(apr_thread_pool_t *me,
+                                                 apr_task_handle_t **handle,
+                                                 apr_thread_start_t func,
+                                                 void *param,
+                                                 apr_byte_t priority,
+                                                 void *owner,
+                                                 apr_pool_t *pool);
+
+/**
+ * Wait for a task to complete.
+ * @param handle The handle of the task
+ * @param result The value returned by the task function (may be NULL)
+ * @param timeout The maximum time to wait, 0 to not wait, or negative to
+ *        wait until the task completes
+ * @return APR_SUCCESS if the task completed, APR_EAGAIN if it has not and
+ *         @a timeout is 0, APR_TIMEUP if it has not when the timeout
+ *         expires, or APR_EOF if the task was cancelled.
+ */
+APR_DECLARE(apr_status_t) apr_task_handle_wait(apr_task_handle_t *handle,
+                                               void **result,
+                                               apr_interval_time_t timeout);
+
+/**
+ * Wait for one of the tasks to complete.
+ * @param handles The handles of the tasks, submitted to the same pool
+ * @param n The number of handles
+ * @param index The index of the (first) handle of a completed task
+ * @param timeout The maximum time to wait, 0 to not wait, or negative to
+ *        wait until a task completes
+ * @return APR_SUCCESS if the task at @a index completed, APR_EOF if it was
+ *         cancelled, APR_EAGAIN if none completed and @a timeout is 0,
+ *         APR_TIMEUP if none completed when the timeout expires, or
+ *         APR_EINVAL if @a n is 0.
+ */
+APR_DECLARE(apr_status_t) apr_task_handle_wait_any(
+                                        apr_task_handle_t *const *handles,
+                                        apr_size_t n, apr_size_t *index,
+                                        apr_interval_time_t timeout);
+
+/**
+ * Wait for all the tasks to complete.
+ * @param handles The handles of the tasks, submitted to the same pool
+ * @param n The number of handles
+ * @param timeout The maximum time to wait, 0 to not wait, or negative to
+ *        wait until all the tasks complete
+ * @return APR_SUCCESS if all the tasks completed, APR_EOF if one at least
+ *         was cancelled, APR_EAGAIN if some did not complete and
+ *         @a timeout is 0, or APR_TIMEUP if some did not complete when the
+ *         timeout expires.
+ */
+APR_DECLARE(apr_status_t) apr_task_handle_wait_all(
+                                        apr_task_handle_t *const *handles,
+                                        apr_size_t n,
+                                        apr_interval_time_t timeout);
+
+/**
+ * The function run by apr_parallel_for() for each chunk [begin, end) of the
+ * range.
+ */
+typedef apr_status_t (*apr_parallel_for_fn_t)(apr_size_t begin,
+                                              apr_size_t end, void *data);
+
+/**
+ * Run a function over a range, split into chunks run in parallel by the
+ * threads of the pool and the caller.
+ * @param me The thread pool
+ * @param begin The start of the range
+ * @param end The end of the range (excluded)
+ * @param grain The size of the chunks, or 0 for about four chunks per
+ *        thread (and the caller)
+ * @param fn The function to run for each chunk
+ * @param data The data passed to @a fn
+ * @return APR_SUCCESS when all the chunks are run, or the first error
+ *         returned by @a fn (the chunks not started yet are skipped then).
+ * @remark The caller claims and runs chunks like the threads, and returns
+ * when all of them are done, so the range is processed even when all the
+ * threads are busy, and apr_parallel_for() can be called from a task.
+ */
+APR_DECLARE(apr_status_t) apr_parallel_for(apr_thread_pool_t *me,
+                                           apr_size_t begin, apr_size_t end,
+                                           apr_size_t grain,
+                                           apr_parallel_for_fn_t fn,
+                                           void *data);
+
 /** @} */
 
 #ifdef __cplusplus
@@ -256,6 +256,22 @@ APR_DECLARE(apr_status_t) apr_threadattr_stacksize_set(apr_threadattr_t *attr,
 APR_DECLARE(apr_status_t) apr_threadattr_guardsize_set(apr_threadattr_t *attr,
                                                        apr_size_t guardsize);
 
+/**
+ * Set the CPUs newly created threads are allowed to run on.
+ * @param attr The threadattr to affect
+ * @param cpus The array of the numbers of the CPUs (from 0)
+ * @param ncpus The number of CPUs in the array
+ * @return APR_SUCCESS, APR_EINVAL if @a ncpus is 0 or a CPU number is out
+ *         of the range of the system, or APR_ENOTIMPL if the platform can't
+ *         set the affinity of threads at their creation.
+ * @remark Pinning threads to CPUs keeps their data in the caches of those
+ * CPUs (and their memory in the NUMA node of those CPUs), at the cost of
+ * them not being scheduled elsewhere when those CPUs are busy.
+ */
+APR_DECLARE(apr_status_t) apr_threadattr_affinity_set(apr_threadattr_t *attr,
+                                                      const int *cpus,
+                                                      apr_size_t ncpus);
+
 /**
  * Create a new thread of execution
  * @param new_thread The newly created thread handle.
@@ -290,6 +306,31 @@ APR_DECLARE(apr_status_t) apr_thread_join(apr_status_t *retval,
  */
 APR_DECLARE(void) apr_thread_yield(void);
 
+/**
+ * Set the CPUs a thread is allowed to run on.
+ * @param thd The thread, or NULL for the calling thread
+ * @param cpus The array of the numbers of the CPUs (from 0)
+ * @param ncpus The number of CPUs in the array
+ * @return APR_SUCCESS, APR_EINVAL if @a ncpus is 0 or a CPU number is out
+ *         of the range of the system, or APR_ENOTIMPL if the platform can't
+ *         set the affinity of threads.
+ * @see apr_threadattr_affinity_set()
+ */
+APR_DECLARE(apr_status_t) apr_thread_affinity_set(apr_thread_t *thd,
+                                                  const int *cpus,
+                                                  apr_size_t ncpus);
+
+/**
+ * Set the name of a thread, as shown by debuggers and tools like top or
+ * perf.
+ * @param thd The thread, or NULL for the calling thread
+ * @param name The name, truncated to 15 characters
+ * @return APR_SUCCESS, or APR_ENOTIMPL if the platform can't name
+ *         threads (or, on some, other threads than the calling one).
+ */
+APR_DECLARE(apr_status_t) apr_thread_name_set(apr_thread_t *thd,
+                                              const char *name);
+
 /**
  * Initialize the control variable for apr_thread_once.  If this isn't
  * called, apr_initialize won't work.
@@ -0,0 +1,176 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef APR_TIMER_WHEEL_H
+#define APR_TIMER_WHEEL_H
+
+/**
+ * @file apr_timer_wheel.h
+ * @brief APR Hierarchical Timing Wheel
+ */
+
+#include "apr.h"
+#include "apr_pools.h"
+#include "apr_errno.h"
+#include "apr_time.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * @defgroup apr_timer_wheel Hierarchical Timing Wheel
+ * @ingroup APR
+ * @{
+ */
+
+/**
+ * @remark A timing wheel keeps a (large) number of timers, each with the
+ * time at which it expires and a baton, such that adding, resetting or
+ * cancelling a timer costs O(1) whatever the number of timers, and taking
+ * the expired timers costs O(1) amortized per timer.
+ *
+ * @remark The times are rounded up to a resolution given at the creation
+ * of the wheel, so a timer never expires before its time but may expire
+ * up to the resolution after it.  The timers are kept in a hierarchy of
+ * wheels of 64 slots of increasing granularity (one tick of the
+ * resolution, 64 ticks, 4096 ticks, ...), and moved down the hierarchy
+ * as the time comes closer.
+ *
+ * @remark A typical use is the timeouts of the connections of a server,
+ * with the baton being the connection:
+ * <pre>
+ *     apr_timer_wheel_add(wheel, apr_time_now() + timeout, conn, &conn->timer);
+ *     ...
+ *     for (;;) {
+ *         now = apr_time_now();
+ *         while (apr_timer_wheel_expire(wheel, now, &baton) == APR_SUCCESS) {
+ *             conn = baton;
+ *             conn->timer = NULL;
+ *             ... close the connection ...
+ *         }
+ *         rv = apr_pollset_poll(pollset, apr_timer_wheel_timeout(wheel, now),
+ *                               &num, &descs);
+ *         ... apr_timer_wheel_reset() the timers of the active connections,
+ *         apr_timer_wheel_cancel() those of the closed ones ...
+ *     }
+ * </pre>
+ *
+ * @remark A timing wheel is not thread-safe, like the pool it is
+ * allocated from.
+ */
+
+/** Opaque timing wheel structure */
+typedef struct apr_timer_wheel_t apr_timer_wheel_t;
+
+/** Opaque timer structure */
+typedef struct apr_timer_t apr_timer_t;
+
+/**
+ * Create a timing wheel.
+ * @param wheel The new timing wheel
+ * @param resolution The resolution of the timers, or 0 for one millisecond
+ * @param pool The pool to allocate the wheel and its timers from
+ * @return APR_SUCCESS, APR_EINVAL if @a resolution is negative, or
+ *         APR_ENOMEM.
+ * @remark The wheel starts at apr_time_now(), the times given to the
+ *         other functions are expected to be on the same clock.
+ */
+APR_DECLARE(apr_status_t) apr_timer_wheel_create(apr_timer_wheel_t **wheel,
+                                                 apr_interval_time_t resolution,
+                                                 apr_pool_t *pool)
+                          __attribute__((nonnull(1,3)));
+
+/**
+ * Add a timer to the wheel.
+ * @param wheel The timing wheel
+ * @param when The time at which the timer expires
+ * @param baton The baton given back by apr_timer_wheel_expire()
+ * @param timer The new timer, if not NULL
+ * @return APR_SUCCESS or APR_ENOMEM.
+ * @remark A timer whose time has passed already is expired by the next
+ *         call to apr_timer_wheel_expire().
+ */
+APR_DECLARE(apr_status_t) apr_timer_wheel_add(apr_timer_wheel_t *wheel,
+                                              apr_time_t when, void *baton,
+                                              apr_timer_t **timer)
+                          __attribute__((nonnull(1)));
+
+/**
+ * Change the time at which a timer expires.
+ * @param wheel The timing wheel
+ * @param timer The timer, not expired yet
+ * @param when The new time at which the timer expires
+ */
+APR_DECLARE(void) apr_timer_wheel_reset(apr_timer_wheel_t *wheel,
+                                        apr_timer_t *timer, apr_time_t when)
+                  __attribute__((nonnull(1,2)));
+
+/**
+ * Remove a timer from the wheel.
+ * @param wheel The timing wheel
+ * @param timer The timer, not expired yet, which is no longer valid after
+ *        this call
+ */
+APR_DECLARE(void) apr_timer_wheel_cancel(apr_timer_wheel_t *wheel,
+                                         apr_timer_t *timer)
+                  __attribute__((nonnull(1,2)));
+
+/**
+ * Take an expired timer from the wheel.
+ * @param wheel The timing wheel
+ * @param now The current time
+ * @param baton The baton of the expired timer
+ * @return APR_SUCCESS, or APR_EAGAIN if no timer is expired at @a now.
+ * @remark The timers expire in the order of their time (at the resolution
+ *         of the wheel), the expired timer is no longer valid after this
+ *         call.
+ */
+APR_DECLARE(apr_status_t) apr_timer_wheel_expire(apr_timer_wheel_t *wheel,
+                                                 apr_time_t now, void **baton)
+                          __attribute__((nonnull(1,3)));
+
+/**
+ * Get the time to wait for the next timer to expire.
+ * @param wheel The timing wheel
+ * @param now The current time
+ * @return The interval to wait (0 if a timer is expired already), or -1
+ *         if the wheel has no timer, as expected by apr_pollset_poll() or
+ *         apr_thread_cond_timedwait().
+ * @remark The interval may be shorter than the time until the next
+ *         expiry when that timer is far away, in which case waking up
+ *         and calling apr_timer_wheel_expire() refines it.
+ */
+APR_DECLARE(apr_interval_time_t) apr_timer_wheel_timeout(
+                                     apr_timer_wheel_t *wheel, apr_time_t now)
+                                 __attribute__((nonnull(1)));
+
+/**
+ * Get the number of timers in the wheel.
+ * @param wheel The timing wheel
+ * @return The number of timers added and not cancelled nor taken by
+ *         apr_timer_wheel_expire() yet.
+ */
+APR_DECLARE(apr_size_t) apr_timer_wheel_count(const apr_timer_wheel_t *wheel)
+                        __attribute__((nonnull(1)));
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !APR_TIMER_WHEEL_H */
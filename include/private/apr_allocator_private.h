@@ -0,0 +1,62 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef APR_ALLOCATOR_PRIVATE_H
+#define APR_ALLOCATOR_PRIVATE_H
+
+/* Internals of the allocator, shared with its tests. */
+
+#include "apr.h"
+#include "apr_lib.h"
+
+#include <stdlib.h>
+
+/* Maximum number of NUMA nodes (the kernel's own limit on Linux) */
+#define APR_NUMA_MAX_NODES 1024
+
+/* Get the number of NUMA nodes from a list of nodes, in the format of
+ * /sys/devices/system/node/online (e.g. "0-3,8-11"): the highest node
+ * plus one, at most APR_NUMA_MAX_NODES, or 1 if the list is empty.  The
+ * list is parsed up to the first character that is not part of it (e.g.
+ * a trailing newline).
+ */
+static APR_INLINE unsigned int apr__numa_nodes_parse(const char *list)
+{
+    unsigned long first, last, max = 0;
+    char *end;
+
+    /* Comma separated entries, each a node number or a range like "8-11" */
+    while (apr_isdigit(*list)) {
+        first = last = strtoul(list, &end, 10);
+        if (*end == '-') {
+            if (!apr_isdigit(end[1]))
+                break;
+            last = strtoul(end + 1, &end, 10);
+        }
+        if (last < first)
+            last = first;
+        if (last > max)
+            max = last;
+        if (*end != ',')
+            break;
+        list = end + 1;
+    }
+
+    return max < APR_NUMA_MAX_NODES ? (unsigned int)max + 1
+                                    : APR_NUMA_MAX_NODES;
+}
+
+#endif /* APR_ALLOCATOR_PRIVATE_H */
@@ -0,0 +1,119 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef APR_LOCKFREE_PRIVATE_H
+#define APR_LOCKFREE_PRIVATE_H
+
+/* Helpers for the lock-free structures of APR: memory barriers, and
+ * waiting on (waking up) a 32-bit word with the futexes of Linux.
+ * Their users must include apr_private.h first, and fall back to their
+ * mutex and condition variable when APR_HAS_FUTEX is 0.
+ */
+
+#include "apr.h"
+#include "apr_atomic.h"
+#include "apr_errno.h"
+#include "apr_time.h"
+
+#if defined(HAVE_LINUX_FUTEX_H) && defined(HAVE_DECL_SYS_FUTEX) \
+    && HAVE_DECL_SYS_FUTEX && APR_HAS_THREADS
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#define APR_HAS_FUTEX 1
+#else
+#define APR_HAS_FUTEX 0
+#endif
+
+/* Full memory barrier */
+static APR_INLINE void apr__memory_barrier(void)
+{
+#if defined(HAVE_ATOMIC_BUILTINS) && HAVE_ATOMIC_BUILTINS
+    __sync_synchronize();
+#else
+    static volatile apr_uint32_t barrier;
+    apr_atomic_inc32(&barrier);
+#endif
+}
+
+/* Load with acquire semantics, store with release semantics */
+static APR_INLINE apr_uint32_t apr__load_acquire32(volatile apr_uint32_t *p)
+{
+#if defined(__ATOMIC_ACQUIRE)
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#else
+    apr_uint32_t v = *p;
+    apr__memory_barrier();
+    return v;
+#endif
+}
+
+static APR_INLINE void apr__store_release32(volatile apr_uint32_t *p,
+                                            apr_uint32_t v)
+{
+#if defined(__ATOMIC_RELEASE)
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#else
+    apr__memory_barrier();
+    *p = v;
+#endif
+}
+
+#if APR_HAS_FUTEX
+
+/* Wait until woken up while *word == val, for timeout (negative for no
+ * timeout), or spuriously.  The word is shared between processes (in a
+ * shared memory segment) if shared is non-zero.  Returns APR_TIMEUP if
+ * the timeout expired, APR_EINTR if interrupted by a signal, APR_SUCCESS
+ * otherwise (including when *word != val already).
+ */
+static APR_INLINE apr_status_t apr__futex_wait(volatile apr_uint32_t *word,
+                                               apr_uint32_t val,
+                                               apr_interval_time_t timeout,
+                                               int shared)
+{
+    struct timespec ts, *tsp = NULL;
+
+    if (timeout >= 0) {
+        ts.tv_sec = (time_t)apr_time_sec(timeout);
+        ts.tv_nsec = (long)apr_time_usec(timeout) * 1000;
+        tsp = &ts;
+    }
+    if (syscall(SYS_futex, word, shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE,
+                val, tsp, NULL, 0) < 0) {
+        if (errno == ETIMEDOUT) {
+            return APR_TIMEUP;
+        }
+        if (errno == EINTR) {
+            return APR_EINTR;
+        }
+    }
+    return APR_SUCCESS;
+}
+
+/* Wake up to n waiters of the word */
+static APR_INLINE void apr__futex_wake(volatile apr_uint32_t *word, int n,
+                                       int shared)
+{
+    syscall(SYS_futex, word, shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE,
+            n, NULL, NULL, 0);
+}
+
+#endif /* APR_HAS_FUTEX */
+
+#endif /* !APR_LOCKFREE_PRIVATE_H */
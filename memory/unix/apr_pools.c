@@ -28,6 +28,7 @@
 #include "apr_hash.h"
 #include "apr_time.h"
 #include "apr_support.h"
+#include "apr_allocator_private.h"
 #define APR_WANT_MEMFUNC
 #include "apr_want.h"
 #include "apr_env.h"
@@ -44,10 +45,36 @@
 #define APR_ALLOCATOR_USES_MMAP   1
 #endif
 
-#if APR_ALLOCATOR_USES_MMAP
+/*
+ * Allocators created with APR_ALLOCATOR_ARENAS carve their nodes out of
+ * large anonymous mappings, see apr_allocator_create_ex().
+ */
+#if HAVE_MMAP && HAVE_MUNMAP && HAVE_MAP_ANON && !APR_ALLOCATOR_GUARD_PAGES
+#define APR_ALLOCATOR_HAS_ARENAS 1
+#else
+#define APR_ALLOCATOR_HAS_ARENAS 0
+#endif
+
+#if APR_ALLOCATOR_USES_MMAP || APR_ALLOCATOR_HAS_ARENAS
 #include <sys/mman.h>
 #endif
 
+/*
+ * The arenas can be bound to a NUMA node with mbind(), see
+ * APR_ALLOCATOR_NUMA_NODE().  Without it, there is a single node.
+ */
+#if APR_ALLOCATOR_HAS_ARENAS && defined(HAVE_SYS_SYSCALL_H) \
+    && defined(HAVE_DECL_SYS_MBIND) && HAVE_DECL_SYS_MBIND
+#define APR_ALLOCATOR_HAS_NUMA 1
+#include <sys/syscall.h>
+#include <fcntl.h>
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#else
+#define APR_ALLOCATOR_HAS_NUMA 0
+#endif
+
 #if HAVE_VALGRIND
 #define REDZONE APR_ALIGN_DEFAULT(8)
 int apr_running_on_valgrind = 0;
@@ -95,6 +122,21 @@ static unsigned int boundary_size;
 #define GUARDPAGE_SIZE 0
 #endif /* APR_ALLOCATOR_GUARD_PAGES */
 
+/*
+ * Size (and alignment) of the arenas, the usual huge page size.
+ */
+#define ARENA_SIZE  (2 * 1024 * 1024)
+
+/*
+ * Per-thread caches in front of the allocator need native thread keys
+ * (with destructors), see apr_allocator_thread_cache_set().
+ */
+#if APR_HAS_THREADS && APR_HAVE_PTHREAD_H
+#define APR_ALLOCATOR_THREAD_CACHE 1
+#else
+#define APR_ALLOCATOR_THREAD_CACHE 0
+#endif
+
 /* 
  * Timing constants for killing subprocesses
  * There is a total 3-second delay between sending a SIGINT 
@@ -112,6 +154,36 @@ static unsigned int boundary_size;
  * indices, but quantities of BOUNDARY_SIZE big memory blocks.
  */
 
+#if APR_ALLOCATOR_THREAD_CACHE
+typedef struct allocator_cache_t allocator_cache_t;
+
+/*
+ * Per-thread cache of free nodes (magazines), one list per size index
+ * below MAX_INDEX.  Only the owning thread uses the lists, so the nodes
+ * are recycled without taking the allocator's mutex; the lists are
+ * refilled from and flushed to the allocator's free[] in batches.
+ */
+struct allocator_cache_t {
+    apr_allocator_t    *allocator;
+    allocator_cache_t  *next;
+    allocator_cache_t **ref;
+    apr_uint32_t        count[MAX_INDEX];
+    apr_memnode_t      *free[MAX_INDEX];
+    apr_uint64_t        hits;
+};
+#endif /* APR_ALLOCATOR_THREAD_CACHE */
+
+#if APR_ALLOCATOR_HAS_ARENAS
+typedef struct allocator_arena_t allocator_arena_t;
+
+/* A mapping nodes are carved from, unmapped on destroy only */
+struct allocator_arena_t {
+    allocator_arena_t  *next;
+    char               *base;
+    apr_size_t          size;
+};
+#endif /* APR_ALLOCATOR_HAS_ARENAS */
+
 struct apr_allocator_t {
     /** largest used index into free[], always < MAX_INDEX */
     apr_size_t        max_index;
@@ -139,11 +211,56 @@ struct apr_allocator_t {
      * slot  2: size 12288
      * ...
      * slot 19: size 81920
-     * slot 20: nodes larger than 81920
+     * slot 20: nodes larger than 81920, see sink_insert()
      */
     apr_memnode_t      *free[MAX_INDEX + 1];
+#if APR_ALLOCATOR_THREAD_CACHE
+    /** Maximum number of nodes per size index held by each thread's
+     * cache, 0 if per-thread caching is disabled.
+     * @see apr_allocator_thread_cache_set().
+     */
+    apr_uint32_t        cache_max;
+    /** Whether cache_key has been created */
+    int                 cache_key_set;
+    apr_os_threadkey_t  cache_key;
+    /** All the threads' caches, released on destroy */
+    allocator_cache_t  *caches;
+#endif /* APR_ALLOCATOR_THREAD_CACHE */
+#if APR_ALLOCATOR_HAS_ARENAS
+    /** APR_ALLOCATOR_ARENAS, APR_ALLOCATOR_HUGEPAGES and the NUMA node
+     * of APR_ALLOCATOR_NUMA_NODE() */
+    apr_uint32_t        flags;
+    /** The arenas mapped so far */
+    allocator_arena_t  *arenas;
+    /** Unused part of the current arena */
+    char               *arena_avail;
+    char               *arena_endp;
+    /**
+     * Lists of nodes whose memory was given back to the system with
+     * madvise() rather than unmapped, same slots as free[].  They are
+     * reused before carving new nodes and don't count in the free
+     * memory limit.
+     */
+    apr_memnode_t      *purged[MAX_INDEX + 1];
+#endif /* APR_ALLOCATOR_HAS_ARENAS */
+    /** Statistics, see apr_allocator_stats_get() */
+    apr_uint64_t        stat_hits;
+    apr_uint64_t        stat_misses;
+    apr_uint64_t        stat_released;
+    apr_size_t          stat_held;
+    apr_size_t          stat_peak;
+    /** Number of pages in free[], and lowest since the last trim */
+    apr_size_t          free_pages;
+    apr_size_t          free_low;
+    /** See apr_allocator_decay_set() and apr_allocator_trim() */
+    apr_interval_time_t decay_half_life;
+    apr_time_t          decay_last;
 };
 
+#if MAX_INDEX + 1 != APR_ALLOCATOR_STATS_SLOTS
+#error APR_ALLOCATOR_STATS_SLOTS does not match MAX_INDEX
+#endif
+
 #define SIZEOF_ALLOCATOR_T  APR_ALIGN_DEFAULT(sizeof(apr_allocator_t))
 
 
@@ -169,32 +286,321 @@ void allocator_unlock(apr_allocator_t *allocator)
 #endif /* APR_HAS_THREADS */
 }
 
-APR_DECLARE(apr_status_t) apr_allocator_create(apr_allocator_t **allocator)
+/* Account for nodes taken out of free[], must be called with the
+ * allocator locked.
+ */
+static APR_INLINE
+void allocator_free_pages_sub(apr_allocator_t *allocator, apr_size_t pages)
+{
+    allocator->free_pages -= pages;
+    if (allocator->free_low > allocator->free_pages)
+        allocator->free_low = allocator->free_pages;
+}
+
+/*
+ * The oversized nodes (slot MAX_INDEX) are kept in a tree ordered by size,
+ * so that the best fit is found in logarithmic time however many of them
+ * are free.  The tree is a treap: there is a single tree node per size,
+ * the other free nodes of the same size being chained to it through
+ * their next field, and the priorities are a hash of the nodes' address,
+ * which keeps the tree balanced (on average) without having to store
+ * anything but the links.  These live at the start of the free nodes'
+ * memory, oversized nodes are always large enough.
+ */
+typedef struct sink_links_t {
+    apr_memnode_t *left;
+    apr_memnode_t *right;
+} sink_links_t;
+
+#define SINK_LEFT(node) \
+    (((sink_links_t *)((char *)(node) + APR_MEMNODE_T_SIZE))->left)
+#define SINK_RIGHT(node) \
+    (((sink_links_t *)((char *)(node) + APR_MEMNODE_T_SIZE))->right)
+
+static APR_INLINE
+apr_uint32_t sink_priority(const apr_memnode_t *node)
+{
+    return (apr_uint32_t)((apr_uintptr_t)node >> 4) * 2654435761u;
+}
+
+/* Must be called with the allocator locked */
+static void sink_insert(apr_memnode_t **root, apr_memnode_t *node)
+{
+    apr_memnode_t **ref, **left, **right, *t;
+    apr_uint32_t priority;
+
+    APR_VALGRIND_UNDEFINED((char *)node + APR_MEMNODE_T_SIZE,
+                           sizeof(sink_links_t));
+
+    /* Chain the node if its size is already in the tree */
+    t = *root;
+    while (t != NULL && t->index != node->index)
+        t = node->index < t->index ? SINK_LEFT(t) : SINK_RIGHT(t);
+    if (t != NULL) {
+        node->next = t->next;
+        t->next = node;
+        return;
+    }
+
+    /* Otherwise it takes the place of the first node of lower priority,
+     * whose subtree is split into the smaller and larger sizes.
+     */
+    priority = sink_priority(node);
+    ref = root;
+    while ((t = *ref) != NULL && sink_priority(t) >= priority)
+        ref = node->index < t->index ? &SINK_LEFT(t) : &SINK_RIGHT(t);
+
+    left = &SINK_LEFT(node);
+    right = &SINK_RIGHT(node);
+    while (t != NULL) {
+        if (t->index < node->index) {
+            *left = t;
+            left = &SINK_RIGHT(t);
+            t = *left;
+        }
+        else {
+            *right = t;
+            right = &SINK_LEFT(t);
+            t = *right;
+        }
+    }
+    *left = *right = NULL;
+
+    node->next = NULL;
+    *ref = node;
+}
+
+/* Take the smallest node of at least index (+1 pages) out of the tree.
+ * Must be called with the allocator locked.
+ */
+static apr_memnode_t *sink_take(apr_memnode_t **root, apr_size_t index)
+{
+    apr_memnode_t **ref = root, **fit = NULL, *node, *left, *right;
+
+    while ((node = *ref) != NULL) {
+        if (node->index >= index) {
+            fit = ref;
+            if (node->index == index)
+                break;
+            ref = &SINK_LEFT(node);
+        }
+        else {
+            ref = &SINK_RIGHT(node);
+        }
+    }
+    if (fit == NULL)
+        return NULL;
+
+    /* Prefer a chained node, the tree is then left untouched */
+    node = *fit;
+    if (node->next != NULL) {
+        apr_memnode_t *same = node->next;
+        node->next = same->next;
+        return same;
+    }
+
+    /* Otherwise merge the subtrees in place of the node */
+    left = SINK_LEFT(node);
+    right = SINK_RIGHT(node);
+    ref = fit;
+    while (left != NULL && right != NULL) {
+        if (sink_priority(left) > sink_priority(right)) {
+            *ref = left;
+            ref = &SINK_RIGHT(left);
+            left = *ref;
+        }
+        else {
+            *ref = right;
+            ref = &SINK_LEFT(right);
+            right = *ref;
+        }
+    }
+    *ref = left != NULL ? left : right;
+
+    return node;
+}
+
+/* Count the nodes of the tree and their size, for the statistics */
+static void sink_count(const apr_memnode_t *node, apr_size_t *blocks,
+                       apr_size_t *bytes)
+{
+    const apr_memnode_t *same;
+
+    while (node != NULL) {
+        for (same = node; same; same = same->next) {
+            (*blocks)++;
+            *bytes += same->endp - (char *)same;
+        }
+        sink_count(SINK_LEFT(node), blocks, bytes);
+        node = SINK_RIGHT(node);
+    }
+}
+
+APR_DECLARE(apr_status_t) apr_allocator_create_ex(apr_allocator_t **allocator,
+                                                  apr_uint32_t flags)
 {
     apr_allocator_t *new_allocator;
 
     *allocator = NULL;
 
+    if (flags & APR_ALLOCATOR_NUMA_BIND) {
+        if ((flags >> 16) >= apr_allocator_numa_nodes())
+            return APR_EINVAL;
+#if APR_ALLOCATOR_HAS_NUMA
+        flags |= APR_ALLOCATOR_ARENAS;
+#else
+        /* Node 0 is all there is, nothing to bind */
+        flags &= ~APR_ALLOCATOR_NUMA_NODE(0xffff);
+#endif
+    }
+    if (flags & APR_ALLOCATOR_HUGEPAGES)
+        flags |= APR_ALLOCATOR_ARENAS;
+#if !APR_ALLOCATOR_HAS_ARENAS
+    if (flags & APR_ALLOCATOR_ARENAS)
+        return APR_ENOTIMPL;
+#endif
+
     if ((new_allocator = malloc(SIZEOF_ALLOCATOR_T)) == NULL)
         return APR_ENOMEM;
 
     memset(new_allocator, 0, SIZEOF_ALLOCATOR_T);
     new_allocator->max_free_index = APR_ALLOCATOR_MAX_FREE_UNLIMITED;
+#if APR_ALLOCATOR_HAS_ARENAS
+    new_allocator->flags = flags;
+#endif
 
     *allocator = new_allocator;
 
     return APR_SUCCESS;
 }
 
+APR_DECLARE(apr_status_t) apr_allocator_create(apr_allocator_t **allocator)
+{
+    return apr_allocator_create_ex(allocator, 0);
+}
+
+APR_DECLARE(apr_status_t) apr_allocator_create_numa(apr_allocator_t **allocators,
+                                                    unsigned int count,
+                                                    apr_uint32_t flags)
+{
+    apr_status_t rv;
+    unsigned int node;
+
+    flags &= ~APR_ALLOCATOR_NUMA_NODE(0xffff);
+    for (node = 0; node < count; node++) {
+        rv = apr_allocator_create_ex(&allocators[node],
+                                     flags | APR_ALLOCATOR_NUMA_NODE(node));
+        if (rv != APR_SUCCESS) {
+            while (node--) {
+                apr_allocator_destroy(allocators[node]);
+                allocators[node] = NULL;
+            }
+            return rv;
+        }
+    }
+
+    return APR_SUCCESS;
+}
+
+#if APR_ALLOCATOR_HAS_NUMA
+static unsigned int numa_nodes_read(void)
+{
+    char buf[256];
+    ssize_t len;
+    int fd;
+
+    fd = open("/sys/devices/system/node/online", O_RDONLY);
+    if (fd < 0)
+        return 1;
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+        return 1;
+    buf[len] = '\0';
+
+    return apr__numa_nodes_parse(buf);
+}
+#endif /* APR_ALLOCATOR_HAS_NUMA */
+
+APR_DECLARE(unsigned int) apr_allocator_numa_nodes(void)
+{
+#if APR_ALLOCATOR_HAS_NUMA
+    static volatile unsigned int nodes = 0;
+
+    /* Racing threads will read the same thing */
+    if (nodes == 0)
+        nodes = numa_nodes_read();
+    return nodes;
+#else
+    return 1;
+#endif
+}
+
+APR_DECLARE(unsigned int) apr_allocator_numa_node_current(void)
+{
+#if APR_ALLOCATOR_HAS_NUMA && defined(HAVE_DECL_SYS_GETCPU) \
+    && HAVE_DECL_SYS_GETCPU
+    unsigned int cpu, node;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+        return node;
+#endif
+    return 0;
+}
+
 APR_DECLARE(void) apr_allocator_destroy(apr_allocator_t *allocator)
 {
     apr_size_t index;
     apr_memnode_t *node, **ref;
+#if APR_ALLOCATOR_THREAD_CACHE
+    allocator_cache_t *cache;
+
+    /* Threads still alive won't see their cache anymore once the key is
+     * deleted, give all the cached nodes back to free[] to release them
+     * below.
+     */
+    if (allocator->cache_key_set) {
+        pthread_key_delete(allocator->cache_key);
+    }
+    while ((cache = allocator->caches) != NULL) {
+        allocator->caches = cache->next;
+        for (index = 0; index < MAX_INDEX; index++) {
+            while ((node = cache->free[index]) != NULL) {
+                cache->free[index] = node->next;
+                node->next = allocator->free[index];
+                allocator->free[index] = node;
+            }
+        }
+        free(cache);
+    }
+#endif /* APR_ALLOCATOR_THREAD_CACHE */
+
+#if APR_ALLOCATOR_HAS_ARENAS
+    if (allocator->flags & APR_ALLOCATOR_ARENAS) {
+        allocator_arena_t *arena;
+
+        /* All the nodes live in the arenas */
+        while ((arena = allocator->arenas) != NULL) {
+            allocator->arenas = arena->next;
+            munmap(arena->base, arena->size);
+            free(arena);
+        }
+        free(allocator);
+        return;
+    }
+#endif /* APR_ALLOCATOR_HAS_ARENAS */
 
     for (index = 0; index <= MAX_INDEX; index++) {
         ref = &allocator->free[index];
-        while ((node = *ref) != NULL) {
-            *ref = node->next;
+        for (;;) {
+            if (index < MAX_INDEX) {
+                if ((node = *ref) == NULL)
+                    break;
+                *ref = node->next;
+            }
+            else if ((node = sink_take(ref, 0)) == NULL) {
+                break;
+            }
 #if APR_ALLOCATOR_USES_MMAP
             munmap((char *)node - GUARDPAGE_SIZE,
                    2 * GUARDPAGE_SIZE + ((node->index+1) << BOUNDARY_INDEX));
@@ -250,6 +656,18 @@ APR_DECLARE(void) apr_allocator_max_free_set(apr_allocator_t *allocator,
     allocator_unlock(allocator);
 }
 
+APR_DECLARE(void) apr_allocator_decay_set(apr_allocator_t *allocator,
+                                          apr_interval_time_t half_life)
+{
+    allocator_lock(allocator);
+
+    allocator->decay_half_life = half_life > 0 ? half_life : 0;
+    allocator->decay_last = apr_time_now();
+    allocator->free_low = allocator->free_pages;
+
+    allocator_unlock(allocator);
+}
+
 static APR_INLINE
 apr_size_t allocator_align(apr_size_t in_size)
 {
@@ -276,12 +694,422 @@ APR_DECLARE(apr_size_t) apr_allocator_align(apr_allocator_t *allocator,
     return allocator_align(size);
 }
 
+#if APR_ALLOCATOR_THREAD_CACHE
+
+static APR_INLINE
+void allocator_free_shared(apr_allocator_t *allocator, apr_memnode_t *node);
+
+/* Thread key destructor, gives the thread's cached nodes back to the
+ * allocator when the thread exits.
+ */
+static void allocator_cache_destroy(void *data)
+{
+    allocator_cache_t *cache = data;
+    apr_allocator_t *allocator = cache->allocator;
+    apr_memnode_t *node, *freelist = NULL;
+    apr_size_t index;
+
+    for (index = 0; index < MAX_INDEX; index++) {
+        while ((node = cache->free[index]) != NULL) {
+            cache->free[index] = node->next;
+            node->next = freelist;
+            freelist = node;
+        }
+    }
+
+    allocator_lock(allocator);
+
+    if ((*cache->ref = cache->next) != NULL)
+        cache->next->ref = cache->ref;
+    allocator->stat_hits += cache->hits;
+
+    allocator_unlock(allocator);
+
+    free(cache);
+
+    if (freelist)
+        allocator_free_shared(allocator, freelist);
+}
+
+static APR_INLINE
+allocator_cache_t *allocator_cache_get(apr_allocator_t *allocator)
+{
+    allocator_cache_t *cache;
+
+    cache = pthread_getspecific(allocator->cache_key);
+    if (cache == NULL) {
+        if ((cache = calloc(1, sizeof(allocator_cache_t))) == NULL)
+            return NULL;
+        if (pthread_setspecific(allocator->cache_key, cache) != 0) {
+            free(cache);
+            return NULL;
+        }
+        cache->allocator = allocator;
+
+        allocator_lock(allocator);
+
+        if ((cache->next = allocator->caches) != NULL)
+            cache->next->ref = &cache->next;
+        allocator->caches = cache;
+        cache->ref = &allocator->caches;
+
+        allocator_unlock(allocator);
+    }
+
+    return cache;
+}
+
+static APR_INLINE
+apr_memnode_t *allocator_cache_alloc(apr_allocator_t *allocator,
+                                     apr_size_t index)
+{
+    allocator_cache_t *cache;
+    apr_memnode_t *node, **ref;
+    apr_size_t max_index, n;
+
+    if ((cache = allocator_cache_get(allocator)) == NULL)
+        return NULL;
+
+    /* When the thread's list is empty, refill up to half of it at once
+     * from the allocator's list of the same size.
+     */
+    if (cache->free[index] == NULL && allocator->free[index] != NULL) {
+        n = (allocator->cache_max + 1) / 2;
+
+        allocator_lock(allocator);
+
+        while (n-- && (node = allocator->free[index]) != NULL) {
+            allocator->free[index] = node->next;
+            node->next = cache->free[index];
+            cache->free[index] = node;
+            cache->count[index]++;
+
+            allocator->current_free_index += index + 1;
+            allocator_free_pages_sub(allocator, index + 1);
+        }
+        if (allocator->current_free_index > allocator->max_free_index)
+            allocator->current_free_index = allocator->max_free_index;
+
+        /* Find the new highest available index if we emptied it */
+        max_index = allocator->max_index;
+        if (allocator->free[index] == NULL && index >= max_index) {
+            ref = &allocator->free[max_index];
+            while (*ref == NULL && max_index) {
+                ref--;
+                max_index--;
+            }
+            allocator->max_index = max_index;
+        }
+
+        allocator_unlock(allocator);
+    }
+
+    if ((node = cache->free[index]) != NULL) {
+        cache->free[index] = node->next;
+        cache->count[index]--;
+        cache->hits++;
+    }
+
+    return node;
+}
+
+/* Put the given list of nodes in the thread's cache, and return the
+ * ones that should go to the allocator (oversized nodes, or half of a
+ * full list).
+ */
+static APR_INLINE
+apr_memnode_t *allocator_cache_free(apr_allocator_t *allocator,
+                                    apr_memnode_t *node)
+{
+    allocator_cache_t *cache;
+    apr_memnode_t *next, *freelist = NULL;
+    apr_uint32_t cache_max = allocator->cache_max;
+    apr_size_t index;
+
+    if ((cache = allocator_cache_get(allocator)) == NULL)
+        return node;
+
+    do {
+        next = node->next;
+        index = node->index;
+
+        if (index >= MAX_INDEX || !cache_max) {
+            node->next = freelist;
+            freelist = node;
+            continue;
+        }
+
+        if (cache->count[index] >= cache_max) {
+            apr_memnode_t *flushed;
+
+            do {
+                flushed = cache->free[index];
+                cache->free[index] = flushed->next;
+                flushed->next = freelist;
+                freelist = flushed;
+            } while (--cache->count[index] > cache_max / 2);
+        }
+
+        APR_VALGRIND_NOACCESS((char *)node + APR_MEMNODE_T_SIZE,
+                              (node->index+1) << BOUNDARY_INDEX);
+
+        node->next = cache->free[index];
+        cache->free[index] = node;
+        cache->count[index]++;
+    } while ((node = next) != NULL);
+
+    return freelist;
+}
+
+#endif /* APR_ALLOCATOR_THREAD_CACHE */
+
+#if APR_ALLOCATOR_HAS_ARENAS
+
+/* Must be called with the allocator locked */
+static APR_INLINE
+void arena_purged_push(apr_allocator_t *allocator, apr_memnode_t *node)
+{
+    apr_size_t index = node->index;
+
+    if (index >= MAX_INDEX) {
+        sink_insert(&allocator->purged[MAX_INDEX], node);
+        return;
+    }
+    node->next = allocator->purged[index];
+    allocator->purged[index] = node;
+}
+
+/* Must be called with the allocator locked */
+static apr_memnode_t *arena_purged_pop(apr_allocator_t *allocator,
+                                       apr_size_t index)
+{
+    apr_memnode_t *node;
+    apr_size_t i, upper_index;
+
+    /* Same policy as for free[], use nodes of up to twice the
+     * requested size, or the best fitting oversized node.
+     */
+    if (index < MAX_INDEX) {
+        upper_index = 2 * index < MAX_INDEX - 1 ? 2 * index : MAX_INDEX - 1;
+        for (i = index; i <= upper_index; i++) {
+            if ((node = allocator->purged[i]) != NULL) {
+                allocator->purged[i] = node->next;
+                return node;
+            }
+        }
+    }
+
+    node = sink_take(&allocator->purged[MAX_INDEX], index);
+
+    /* Purged memory is as good as new, so split off what's not needed
+     * rather than wasting it (and fragmenting the arenas).
+     */
+    if (node != NULL && ((node->index - index) << BOUNDARY_INDEX) >= MIN_ALLOC) {
+        apr_memnode_t *rest;
+
+        rest = (apr_memnode_t *)((char *)node + ((index + 1) << BOUNDARY_INDEX));
+        APR_VALGRIND_UNDEFINED(rest, APR_MEMNODE_T_SIZE);
+        rest->index = (apr_uint32_t)(node->index - index - 1);
+        rest->endp = node->endp;
+        node->index = (apr_uint32_t)index;
+        node->endp = (char *)rest;
+        arena_purged_push(allocator, rest);
+    }
+
+    return node;
+}
+
+/* Map a new (aligned) arena of at least size bytes.  Must be called with
+ * the allocator locked.
+ */
+static apr_status_t arena_create(apr_allocator_t *allocator, apr_size_t size)
+{
+    allocator_arena_t *arena;
+    apr_size_t arena_size;
+    char *base = NULL, *mem;
+
+    arena_size = APR_ALIGN(size, ARENA_SIZE);
+    if (arena_size < size)
+        return APR_ENOMEM;
+
+    if ((arena = malloc(sizeof(allocator_arena_t))) == NULL)
+        return APR_ENOMEM;
+
+#ifdef MAP_HUGETLB
+    /* Explicit huge pages need to be reserved by the system, fall back
+     * to transparent huge pages otherwise.
+     */
+    if (allocator->flags & APR_ALLOCATOR_HUGEPAGES) {
+        mem = mmap(NULL, arena_size, PROT_READ|PROT_WRITE,
+                   MAP_PRIVATE|MAP_ANON|MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED)
+            base = mem;
+    }
+#endif
+
+    if (base == NULL) {
+        /* Over-map by an arena and trim the excess to get an aligned one */
+        if (arena_size + ARENA_SIZE < arena_size) {
+            free(arena);
+            return APR_ENOMEM;
+        }
+        mem = mmap(NULL, arena_size + ARENA_SIZE, PROT_READ|PROT_WRITE,
+                   MAP_PRIVATE|MAP_ANON, -1, 0);
+        if (mem == MAP_FAILED) {
+            free(arena);
+            return APR_ENOMEM;
+        }
+        base = (char *)APR_ALIGN((apr_uintptr_t)mem, ARENA_SIZE);
+        if (base > mem)
+            munmap(mem, base - mem);
+        if (base < mem + ARENA_SIZE)
+            munmap(base + arena_size, (mem + ARENA_SIZE) - base);
+
+#if HAVE_MADVISE && defined(MADV_HUGEPAGE)
+        if (allocator->flags & APR_ALLOCATOR_HUGEPAGES)
+            madvise(base, arena_size, MADV_HUGEPAGE);
+#endif
+    }
+
+#if APR_ALLOCATOR_HAS_NUMA
+    /* Before the pages are touched, preferred rather than strictly bound
+     * so that a full node does not mean an out-of-memory kill.  Should
+     * the call fail, the memory goes where it is first touched.
+     */
+    if (allocator->flags & APR_ALLOCATOR_NUMA_BIND) {
+        unsigned long mask[APR_NUMA_MAX_NODES
+                           / (8 * sizeof(unsigned long))];
+        unsigned int node = allocator->flags >> 16;
+
+        memset(mask, 0, sizeof(mask));
+        mask[node / (8 * sizeof(unsigned long))] =
+            1UL << (node % (8 * sizeof(unsigned long)));
+        syscall(SYS_mbind, base, arena_size, MPOL_PREFERRED, mask,
+                (unsigned long)node + 2, 0);
+    }
+#endif /* APR_ALLOCATOR_HAS_NUMA */
+
+    /* Keep what's left of the current arena for later, it has not been
+     * touched yet so it is as good as a purged node.
+     */
+    if ((apr_size_t)(allocator->arena_endp - allocator->arena_avail)
+            >= MIN_ALLOC) {
+        apr_memnode_t *node = (apr_memnode_t *)allocator->arena_avail;
+
+        node->index = (apr_uint32_t)(((allocator->arena_endp
+                                       - allocator->arena_avail)
+                                      >> BOUNDARY_INDEX) - 1);
+        node->endp = allocator->arena_endp;
+        arena_purged_push(allocator, node);
+    }
+
+    arena->base = base;
+    arena->size = arena_size;
+    arena->next = allocator->arenas;
+    allocator->arenas = arena;
+    allocator->arena_avail = base;
+    allocator->arena_endp = base + arena_size;
+
+    return APR_SUCCESS;
+}
+
+static APR_INLINE
+apr_memnode_t *arena_alloc(apr_allocator_t *allocator, apr_size_t index,
+                           apr_size_t size)
+{
+    apr_memnode_t *node;
+
+    allocator_lock(allocator);
+
+    if ((node = arena_purged_pop(allocator, index)) == NULL) {
+        if ((apr_size_t)(allocator->arena_endp - allocator->arena_avail)
+                < size && arena_create(allocator, size) != APR_SUCCESS) {
+            allocator_unlock(allocator);
+            return NULL;
+        }
+
+        node = (apr_memnode_t *)allocator->arena_avail;
+        allocator->arena_avail += size;
+        node->index = (apr_uint32_t)index;
+        node->endp = (char *)node + size;
+    }
+
+    allocator->stat_misses++;
+    allocator->stat_held += node->endp - (char *)node;
+    if (allocator->stat_held > allocator->stat_peak)
+        allocator->stat_peak = allocator->stat_held;
+
+    allocator_unlock(allocator);
+
+    return node;
+}
+
+/* Give the memory of the (unlinked) nodes back to the system, but keep
+ * them mapped for reuse.
+ */
+static void arena_purge(apr_allocator_t *allocator, apr_memnode_t *freelist)
+{
+    apr_memnode_t *node, *next;
+
+#if HAVE_MADVISE
+    /* The first page holds the node header, it's not worth giving back
+     * anyway.  MADV_FREE is cheaper, but not supported by all kernels.
+     */
+    for (node = freelist; node != NULL; node = node->next) {
+        char *mem = (char *)node + BOUNDARY_SIZE;
+
+        if (node->endp > mem) {
+#ifdef MADV_FREE
+            if (madvise(mem, node->endp - mem, MADV_FREE) == 0)
+                continue;
+#endif
+#ifdef MADV_DONTNEED
+            madvise(mem, node->endp - mem, MADV_DONTNEED);
+#endif
+        }
+    }
+#endif /* HAVE_MADVISE */
+
+    allocator_lock(allocator);
+
+    for (node = freelist; node != NULL; node = next) {
+        next = node->next;
+        allocator->stat_held -= node->endp - (char *)node;
+        allocator->stat_released += node->endp - (char *)node;
+        arena_purged_push(allocator, node);
+    }
+
+    allocator_unlock(allocator);
+}
+
+#endif /* APR_ALLOCATOR_HAS_ARENAS */
+
+/* Account for a node of the given size about to be allocated from the
+ * system, returns whether it did (the arenas account for their own).
+ * Assumes: that the allocator is locked.
+ */
+static APR_INLINE
+int allocator_stat_miss(apr_allocator_t *allocator, apr_size_t size)
+{
+#if APR_ALLOCATOR_HAS_ARENAS
+    if (allocator->flags & APR_ALLOCATOR_ARENAS)
+        return 0;
+#endif /* APR_ALLOCATOR_HAS_ARENAS */
+
+    allocator->stat_misses++;
+    allocator->stat_held += size;
+    if (allocator->stat_held > allocator->stat_peak)
+        allocator->stat_peak = allocator->stat_held;
+    return 1;
+}
+
 static APR_INLINE
 apr_memnode_t *allocator_alloc(apr_allocator_t *allocator, apr_size_t in_size)
 {
     apr_memnode_t *node, **ref;
     apr_size_t max_index, upper_index;
     apr_size_t size, i, index;
+    int accounted = 0;
 
     /* Round up the block size to the next boundary, but always
      * allocate at least a certain size (MIN_ALLOC).
@@ -300,6 +1128,14 @@ apr_memnode_t *allocator_alloc(apr_allocator_t *allocator, apr_size_t in_size)
         return NULL;
     }
 
+#if APR_ALLOCATOR_THREAD_CACHE
+    /* Try the calling thread's cache first, without locking */
+    if (allocator->cache_max && index < MAX_INDEX
+            && (node = allocator_cache_alloc(allocator, index)) != NULL) {
+        goto have_node;
+    }
+#endif /* APR_ALLOCATOR_THREAD_CACHE */
+
     /* First see if there are any nodes in the area we know
      * our node will fit into.
      */
@@ -349,12 +1185,16 @@ apr_memnode_t *allocator_alloc(apr_allocator_t *allocator, apr_size_t in_size)
             allocator->current_free_index += node->index + 1;
             if (allocator->current_free_index > allocator->max_free_index)
                 allocator->current_free_index = allocator->max_free_index;
+            allocator_free_pages_sub(allocator, node->index + 1);
+            allocator->stat_hits++;
 
             allocator_unlock(allocator);
 
             goto have_node;
         }
 
+        accounted = allocator_stat_miss(allocator, size);
+
         allocator_unlock(allocator);
     }
 
@@ -364,28 +1204,33 @@ apr_memnode_t *allocator_alloc(apr_allocator_t *allocator, apr_size_t in_size)
     else if (allocator->free[MAX_INDEX]) {
         allocator_lock(allocator);
 
-        /* Walk the free list to see if there are
-         * any nodes on it of the requested size
-         */
-        ref = &allocator->free[MAX_INDEX];
-        while ((node = *ref) != NULL && index > node->index)
-            ref = &node->next;
-
-        if (node) {
-            *ref = node->next;
-
+        /* Take the smallest node large enough */
+        if ((node = sink_take(&allocator->free[MAX_INDEX], index)) != NULL) {
             allocator->current_free_index += node->index + 1;
             if (allocator->current_free_index > allocator->max_free_index)
                 allocator->current_free_index = allocator->max_free_index;
+            allocator_free_pages_sub(allocator, node->index + 1);
+            allocator->stat_hits++;
 
             allocator_unlock(allocator);
 
             goto have_node;
         }
 
+        accounted = allocator_stat_miss(allocator, size);
+
         allocator_unlock(allocator);
     }
 
+#if APR_ALLOCATOR_HAS_ARENAS
+    if (allocator->flags & APR_ALLOCATOR_ARENAS) {
+        if ((node = arena_alloc(allocator, index, size)) == NULL)
+            return NULL;
+
+        goto have_node;
+    }
+#endif /* APR_ALLOCATOR_HAS_ARENAS */
+
     /* If we haven't got a suitable node, malloc a new one
      * and initialize it.
      */
@@ -398,18 +1243,25 @@ apr_memnode_t *allocator_alloc(apr_allocator_t *allocator, apr_size_t in_size)
 #else
     if ((node = malloc(size)) == NULL)
 #endif
-        return NULL;
+        goto miss_failed;
 
 #if APR_ALLOCATOR_GUARD_PAGES
     node = (apr_memnode_t *)((char *)node + GUARDPAGE_SIZE);
     if (mprotect(node, size, PROT_READ|PROT_WRITE) != 0) {
         munmap((char *)node - GUARDPAGE_SIZE, size + 2 * GUARDPAGE_SIZE);
-        return NULL;
+        goto miss_failed;
     }
 #endif
     node->index = (apr_uint32_t)index;
     node->endp = (char *)node + size;
 
+    /* Only when no free list was searched (under the lock) above */
+    if (!accounted) {
+        allocator_lock(allocator);
+        allocator_stat_miss(allocator, size);
+        allocator_unlock(allocator);
+    }
+
 have_node:
     node->next = NULL;
     node->first_avail = (char *)node + APR_MEMNODE_T_SIZE;
@@ -417,10 +1269,47 @@ have_node:
     APR_VALGRIND_UNDEFINED(node->first_avail, size - APR_MEMNODE_T_SIZE);
 
     return node;
+
+miss_failed:
+    if (accounted) {
+        /* The peak is left as is, it's an upper bound anyway */
+        allocator_lock(allocator);
+        allocator->stat_misses--;
+        allocator->stat_held -= size;
+        allocator_unlock(allocator);
+    }
+    return NULL;
+}
+
+/* Give the (unlinked) nodes back to the system, must be called with the
+ * allocator unlocked.
+ */
+static void allocator_release(apr_allocator_t *allocator,
+                              apr_memnode_t *freelist)
+{
+    apr_memnode_t *node;
+
+#if APR_ALLOCATOR_HAS_ARENAS
+    if (allocator->flags & APR_ALLOCATOR_ARENAS) {
+        arena_purge(allocator, freelist);
+        return;
+    }
+#endif /* APR_ALLOCATOR_HAS_ARENAS */
+
+    while (freelist != NULL) {
+        node = freelist;
+        freelist = node->next;
+#if APR_ALLOCATOR_USES_MMAP
+        munmap((char *)node - GUARDPAGE_SIZE,
+               2 * GUARDPAGE_SIZE + ((node->index+1) << BOUNDARY_INDEX));
+#else
+        free(node);
+#endif
+    }
 }
 
 static APR_INLINE
-void allocator_free(apr_allocator_t *allocator, apr_memnode_t *node)
+void allocator_free_shared(apr_allocator_t *allocator, apr_memnode_t *node)
 {
     apr_memnode_t *next, *freelist = NULL;
     apr_size_t index, max_index;
@@ -446,6 +1335,13 @@ void allocator_free(apr_allocator_t *allocator, apr_memnode_t *node)
             && index + 1 > current_free_index) {
             node->next = freelist;
             freelist = node;
+#if APR_ALLOCATOR_HAS_ARENAS
+            /* Accounted by arena_purge() */
+            if (allocator->flags & APR_ALLOCATOR_ARENAS)
+                continue;
+#endif
+            allocator->stat_held -= (index + 1) << BOUNDARY_INDEX;
+            allocator->stat_released += (index + 1) << BOUNDARY_INDEX;
         }
         else if (index < MAX_INDEX) {
             /* Add the node to the appropriate 'size' bucket.  Adjust
@@ -456,6 +1352,7 @@ void allocator_free(apr_allocator_t *allocator, apr_memnode_t *node)
                 max_index = index;
             }
             allocator->free[index] = node;
+            allocator->free_pages += index + 1;
             if (current_free_index >= index + 1)
                 current_free_index -= index + 1;
             else
@@ -463,32 +1360,137 @@ void allocator_free(apr_allocator_t *allocator, apr_memnode_t *node)
         }
         else {
             /* This node is too large to keep in a specific size bucket,
-             * just add it to the sink (at index MAX_INDEX).
+             * add it to the sink (at index MAX_INDEX).
              */
-            node->next = allocator->free[MAX_INDEX];
-            allocator->free[MAX_INDEX] = node;
+            sink_insert(&allocator->free[MAX_INDEX], node);
+            allocator->free_pages += index + 1;
             if (current_free_index >= index + 1)
                 current_free_index -= index + 1;
             else
                 current_free_index = 0;
         }
-    } while ((node = next) != NULL);
+    } while ((node = next) != NULL);
+
+    allocator->max_index = max_index;
+    allocator->current_free_index = current_free_index;
+
+    allocator_unlock(allocator);
+
+    if (freelist != NULL)
+        allocator_release(allocator, freelist);
+}
+
+static APR_INLINE
+void allocator_free(apr_allocator_t *allocator, apr_memnode_t *node)
+{
+#if APR_ALLOCATOR_THREAD_CACHE
+    if (allocator->cache_max) {
+        if ((node = allocator_cache_free(allocator, node)) == NULL)
+            return;
+    }
+#endif /* APR_ALLOCATOR_THREAD_CACHE */
+
+    allocator_free_shared(allocator, node);
+}
+
+/* The number of pages out of excess to release after elapsed time,
+ * with 2^-x approximated linearly between the half-lives.
+ */
+static apr_size_t decay_pages(apr_size_t excess, apr_interval_time_t elapsed,
+                              apr_interval_time_t half_life)
+{
+    apr_size_t keep = excess;
+    apr_uint64_t rest;
+
+    if (elapsed / half_life >= (apr_interval_time_t)(8 * sizeof(keep)))
+        return excess;
+    keep >>= elapsed / half_life;
+    rest = (apr_uint64_t)(elapsed % half_life);
+    keep -= (apr_size_t)((apr_uint64_t)keep * rest / (2 * half_life));
+
+    return excess - keep;
+}
+
+APR_DECLARE(apr_size_t) apr_allocator_trim(apr_allocator_t *allocator)
+{
+    apr_memnode_t *node, *freelist = NULL;
+    apr_size_t index, max_index, pages, released = 0;
+    apr_interval_time_t elapsed;
+    apr_time_t now;
+
+    if (!allocator->decay_half_life)
+        return 0;
+
+    now = apr_time_now();
+
+    allocator_lock(allocator);
+
+    elapsed = now - allocator->decay_last;
+    if (!allocator->decay_half_life || elapsed <= 0) {
+        allocator_unlock(allocator);
+        return 0;
+    }
+    allocator->decay_last = now;
+
+    /* The free pages that were not needed since the last trim are above
+     * the high-water mark of the demand, release them as they decay.
+     * Oversized nodes go first, then the largest ones.
+     */
+    pages = decay_pages(allocator->free_low, elapsed,
+                        allocator->decay_half_life);
+    index = MAX_INDEX;
+    while (pages) {
+        if (index == MAX_INDEX) {
+            node = sink_take(&allocator->free[MAX_INDEX], 0);
+            if (node != NULL && node->index + 1 > pages) {
+                sink_insert(&allocator->free[MAX_INDEX], node);
+                node = NULL;
+            }
+        }
+        else if ((node = allocator->free[index]) != NULL
+                 && node->index + 1 <= pages) {
+            allocator->free[index] = node->next;
+        }
+        else {
+            node = NULL;
+        }
+        if (node == NULL) {
+            if (index-- == 0)
+                break;
+            continue;
+        }
+
+        pages -= node->index + 1;
+        allocator_free_pages_sub(allocator, node->index + 1);
+        allocator->current_free_index += node->index + 1;
+        released += (node->index + 1) << BOUNDARY_INDEX;
+#if APR_ALLOCATOR_HAS_ARENAS
+        /* Accounted by arena_purge() */
+        if (!(allocator->flags & APR_ALLOCATOR_ARENAS))
+#endif
+        {
+            allocator->stat_held -= (node->index + 1) << BOUNDARY_INDEX;
+            allocator->stat_released += (node->index + 1) << BOUNDARY_INDEX;
+        }
+        node->next = freelist;
+        freelist = node;
+    }
+    if (allocator->current_free_index > allocator->max_free_index)
+        allocator->current_free_index = allocator->max_free_index;
 
+    max_index = allocator->max_index;
+    while (max_index && allocator->free[max_index] == NULL)
+        max_index--;
     allocator->max_index = max_index;
-    allocator->current_free_index = current_free_index;
+
+    allocator->free_low = allocator->free_pages;
 
     allocator_unlock(allocator);
 
-    while (freelist != NULL) {
-        node = freelist;
-        freelist = node->next;
-#if APR_ALLOCATOR_USES_MMAP
-        munmap((char *)node - GUARDPAGE_SIZE,
-               2 * GUARDPAGE_SIZE + ((node->index+1) << BOUNDARY_INDEX));
-#else
-        free(node);
-#endif
-    }
+    if (freelist != NULL)
+        allocator_release(allocator, freelist);
+
+    return released;
 }
 
 APR_DECLARE(apr_memnode_t *) apr_allocator_alloc(apr_allocator_t *allocator,
@@ -508,6 +1510,80 @@ APR_DECLARE(apr_size_t) apr_allocator_page_size(void)
     return boundary_size;
 }
 
+APR_DECLARE(apr_status_t) apr_allocator_thread_cache_set(
+                                             apr_allocator_t *allocator,
+                                             apr_size_t count)
+{
+#if APR_ALLOCATOR_THREAD_CACHE
+    apr_status_t rv;
+
+    if (count > APR_UINT32_MAX) {
+        count = APR_UINT32_MAX;
+    }
+    if (count && !allocator->cache_key_set) {
+        rv = pthread_key_create(&allocator->cache_key,
+                                allocator_cache_destroy);
+        if (rv != 0) {
+            return rv;
+        }
+        allocator->cache_key_set = 1;
+    }
+    allocator->cache_max = (apr_uint32_t)count;
+
+    return APR_SUCCESS;
+#else
+    (void)allocator;
+    (void)count;
+    return APR_ENOTIMPL;
+#endif /* APR_ALLOCATOR_THREAD_CACHE */
+}
+
+APR_DECLARE(void) apr_allocator_stats_get(apr_allocator_t *allocator,
+                                          apr_allocator_stats_t *stats)
+{
+    apr_memnode_t *node;
+    apr_size_t index;
+#if APR_ALLOCATOR_THREAD_CACHE
+    allocator_cache_t *cache;
+#endif
+
+    memset(stats, 0, sizeof(*stats));
+
+    allocator_lock(allocator);
+
+    for (index = 0; index < MAX_INDEX; index++) {
+        for (node = allocator->free[index]; node; node = node->next) {
+            stats->free_blocks[index]++;
+            stats->free_bytes += node->endp - (char *)node;
+        }
+    }
+    sink_count(allocator->free[MAX_INDEX], &stats->free_blocks[MAX_INDEX],
+               &stats->free_bytes);
+
+#if APR_ALLOCATOR_THREAD_CACHE
+    /* The other threads may be using their cache, so this is a snapshot
+     * at best.
+     */
+    for (cache = allocator->caches; cache; cache = cache->next) {
+        for (index = 0; index < MAX_INDEX; index++) {
+            stats->cached_blocks[index] += cache->count[index];
+            stats->cached_bytes += ((apr_size_t)cache->count[index]
+                                    * (index + 1)) << BOUNDARY_INDEX;
+        }
+        stats->hits += cache->hits;
+    }
+#endif /* APR_ALLOCATOR_THREAD_CACHE */
+
+    stats->hits += allocator->stat_hits;
+    stats->misses = allocator->stat_misses;
+    stats->released_bytes = allocator->stat_released;
+    stats->held_bytes = allocator->stat_held;
+    stats->peak_bytes = allocator->stat_peak;
+    stats->max_free_bytes = allocator->max_free_index << BOUNDARY_INDEX;
+
+    allocator_unlock(allocator);
+}
+
 APR_DECLARE(apr_status_t) apr_allocator_min_order_set(unsigned int order)
 {
     if (order > MAX_ORDER) {
@@ -581,6 +1657,9 @@ struct apr_pool_t {
     apr_abortfunc_t       abort_fn;
     apr_hash_t           *user_data;
     const char           *tag;
+    apr_size_t            stat_bytes; /* memory currently held */
+    apr_size_t            stat_peak;  /* highest stat_bytes since creation */
+    apr_pool_mark_t      *marks;      /* innermost mark, see apr_pool_mark() */
 
 #if !APR_POOL_DEBUG
     apr_memnode_t        *active;
@@ -617,6 +1696,20 @@ struct apr_pool_t {
 
 #define SIZEOF_POOL_T       APR_ALIGN_DEFAULT(sizeof(apr_pool_t))
 
+static APR_INLINE void pool_stat_add(apr_pool_t *pool, apr_size_t size)
+{
+    pool->stat_bytes += size;
+    if (pool->stat_peak < pool->stat_bytes)
+        pool->stat_peak = pool->stat_bytes;
+}
+
+/* Alignments accepted by apr_palloc_aligned(): powers of two up to the
+ * page size.
+ */
+#define alignment_is_valid(alignment_) \
+    ((alignment_) && !((alignment_) & ((alignment_) - 1)) \
+     && (alignment_) <= BOUNDARY_SIZE)
+
 
 /*
  * Variables
@@ -644,6 +1737,7 @@ static apr_status_t apr_pool_cleanup_file_stderr(void *data)
  */
 
 static void run_cleanups(cleanup_t **c);
+static void run_cleanups_since(cleanup_t **c, cleanup_t *last);
 static void free_proc_chain(struct process_chain *procs);
 
 #if APR_POOL_DEBUG
@@ -748,6 +1842,14 @@ APR_DECLARE(void) apr_pool_terminate(void)
     point->ref = &node->next;                   \
 } while (0)
 
+/* list_insert_after() inserts 'node' into the list after 'point'. */
+#define list_insert_after(node, point) do {     \
+    node->next = point->next;                   \
+    node->next->ref = &node->next;              \
+    point->next = node;                         \
+    node->ref = &point->next;                   \
+} while (0)
+
 /* list_remove() removes 'node' from its list. */
 #define list_remove(node) do {                  \
     *node->ref = node->next;                    \
@@ -757,6 +1859,10 @@ APR_DECLARE(void) apr_pool_terminate(void)
 /* Returns the amount of free space in the given node. */
 #define node_free_space(node_) ((apr_size_t)(node_->endp - node_->first_avail))
 
+/* node_is_empty() returns whether nothing was allocated from 'node' */
+#define node_is_empty(node_) \
+    (node_->first_avail == (char *)node_ + APR_MEMNODE_T_SIZE)
+
 /*
  * Helpers to mark pool as in-use/free. Used for finding thread-unsafe
  * concurrent accesses from different threads.
@@ -851,9 +1957,16 @@ APR_DECLARE(void *) apr_palloc(apr_pool_t *pool, apr_size_t in_size)
         goto have_mem;
     }
 
+    /* While the pool is marked, the nodes used since the mark follow the
+     * marked node in the order they are used (see apr_pool_rewind()), so
+     * the next node can be reused only if it is empty, and a new node is
+     * linked after the active one.
+     */
     node = active->next;
-    if (size <= node_free_space(node)) {
-        list_remove(node);
+    if (size <= node_free_space(node)
+            && (!pool->marks || node_is_empty(node))) {
+        if (!pool->marks)
+            list_remove(node);
     }
     else {
         if ((node = allocator_alloc(pool->allocator, size)) == NULL) {
@@ -863,6 +1976,9 @@ APR_DECLARE(void *) apr_palloc(apr_pool_t *pool, apr_size_t in_size)
 
             return NULL;
         }
+        pool_stat_add(pool, node->endp - (char *)node);
+        if (pool->marks)
+            list_insert_after(node, active);
     }
 
     node->free_index = 0;
@@ -870,6 +1986,11 @@ APR_DECLARE(void *) apr_palloc(apr_pool_t *pool, apr_size_t in_size)
     mem = node->first_avail;
     node->first_avail += size;
 
+    if (pool->marks) {
+        pool->active = node;
+        goto have_mem;
+    }
+
     list_insert(node, active);
 
     pool->active = node;
@@ -928,6 +2049,66 @@ APR_DECLARE(void *) apr_pcalloc(apr_pool_t *pool, apr_size_t size)
     return mem;
 }
 
+APR_DECLARE(void *) apr_palloc_aligned(apr_pool_t *pool, apr_size_t in_size,
+                                       apr_size_t alignment)
+{
+    apr_memnode_t *active;
+    apr_size_t size, pad;
+    char *mem;
+
+    if (!alignment_is_valid(alignment))
+        return NULL;
+    if (alignment <= APR_ALIGN_DEFAULT(1))
+        return apr_palloc(pool, in_size);
+
+    size = APR_ALIGN_DEFAULT(in_size);
+#if HAVE_VALGRIND
+    if (apr_running_on_valgrind)
+        goto slow;
+#endif
+    if (size < in_size)
+        goto slow;
+
+    /* If the active node has enough bytes left after the padding, use it. */
+    pool_concurrency_set_used(pool);
+    active = pool->active;
+    pad = (apr_size_t)(-(apr_uintptr_t)active->first_avail) & (alignment - 1);
+    if (pad < node_free_space(active)
+            && size <= node_free_space(active) - pad) {
+        mem = active->first_avail + pad;
+        active->first_avail = mem + size;
+        pool_concurrency_set_idle(pool);
+        return mem;
+    }
+    pool_concurrency_set_idle(pool);
+
+slow:
+    /* Let apr_palloc() find a node with room for the worst padding. */
+    if (in_size + alignment < in_size) {
+        if (pool->abort_fn)
+            pool->abort_fn(APR_ENOMEM);
+
+        return NULL;
+    }
+    mem = apr_palloc(pool, in_size + alignment - APR_ALIGN_DEFAULT(1));
+    if (mem == NULL)
+        return NULL;
+
+    return (void *)APR_ALIGN((apr_uintptr_t)mem, alignment);
+}
+
+APR_DECLARE(void *) apr_pcalloc_aligned(apr_pool_t *pool, apr_size_t size,
+                                        apr_size_t alignment)
+{
+    void *mem;
+
+    if ((mem = apr_palloc_aligned(pool, size, alignment)) != NULL) {
+        memset(mem, 0, size);
+    }
+
+    return mem;
+}
+
 
 /*
  * Pool creation/destruction
@@ -937,6 +2118,9 @@ APR_DECLARE(void) apr_pool_clear(apr_pool_t *pool)
 {
     apr_memnode_t *active;
 
+    /* Forget the marks, all the memory goes */
+    pool->marks = NULL;
+
     /* Run pre destroy cleanups */
     run_cleanups(&pool->pre_cleanups);
 
@@ -969,6 +2153,7 @@ APR_DECLARE(void) apr_pool_clear(apr_pool_t *pool)
      */
     active = pool->active = pool->self;
     active->first_avail = pool->self_first_avail;
+    pool->stat_bytes = active->endp - (char *)active;
 
     APR_IF_VALGRIND(VALGRIND_MEMPOOL_TRIM(pool, pool, 1));
 
@@ -1106,6 +2291,8 @@ APR_DECLARE(apr_status_t) apr_pool_create_ex(apr_pool_t **newpool,
 
     pool->allocator = allocator;
     pool->active = pool->self = node;
+    pool->stat_bytes = pool->stat_peak = node->endp - (char *)node;
+    pool->marks = NULL;
     pool->abort_fn = abort_fn;
     pool->child = NULL;
     pool->cleanups = NULL;
@@ -1185,6 +2372,8 @@ APR_DECLARE(apr_status_t) apr_pool_create_unmanaged_ex(apr_pool_t **newpool,
 
     pool->allocator = pool_allocator;
     pool->active = pool->self = node;
+    pool->stat_bytes = pool->stat_peak = node->endp - (char *)node;
+    pool->marks = NULL;
     pool->abort_fn = abort_fn;
     pool->child = NULL;
     pool->cleanups = NULL;
@@ -1261,7 +2450,17 @@ static int psprintf_flush(apr_vformatter_buff_t *vbuff)
         size = APR_PSPRINTF_MIN_STRINGSIZE;
 
     node = active->next;
-    if (!ps->got_a_new_node && size <= node_free_space(node)) {
+    if (!ps->got_a_new_node && size <= node_free_space(node)
+            && pool->marks && node_is_empty(node)) {
+
+        /* Keep the nodes in order while the pool is marked,
+         * see apr_palloc() */
+        node->free_index = 0;
+
+        pool->active = node;
+    }
+    else if (!ps->got_a_new_node && size <= node_free_space(node)
+             && !pool->marks) {
 
         list_remove(node);
         list_insert(node, active);
@@ -1419,9 +2618,19 @@ APR_DECLARE(char *) apr_pvsprintf(apr_pool_t *pool, const char *fmt, va_list ap)
 
     active = pool->active;
     node = ps.node;
+    pool_stat_add(pool, node->endp - (char *)node);
 
     node->free_index = 0;
 
+    if (pool->marks) {
+        /* Keep the nodes in order while the pool is marked,
+         * see apr_palloc() */
+        list_insert_after(node, active);
+        pool->active = node;
+        pool_concurrency_set_idle(pool);
+        return strp;
+    }
+
     list_insert(node, active);
 
     pool->active = node;
@@ -1777,11 +2986,25 @@ APR_DECLARE(void) apr_pool_terminate(void)
  * Memory allocation (debug)
  */
 
-static void *pool_alloc(apr_pool_t *pool, apr_size_t size)
+static void *pool_alloc_aligned(apr_pool_t *pool, apr_size_t size,
+                                apr_size_t alignment)
 {
     debug_node_t *node;
     void *mem;
 
+    /* Allocate enough for the worst padding, the whole block is recorded
+     * so that it can be found and freed.
+     */
+    if (alignment > APR_ALIGN_DEFAULT(1)) {
+        if (size + alignment < size) {
+            if (pool->abort_fn)
+                pool->abort_fn(APR_ENOMEM);
+
+            return NULL;
+        }
+        size += alignment - 1;
+    }
+
     if ((mem = malloc(size)) == NULL) {
         if (pool->abort_fn)
             pool->abort_fn(APR_ENOMEM);
@@ -1812,10 +3035,19 @@ static void *pool_alloc(apr_pool_t *pool, apr_size_t size)
 
     pool->stat_alloc++;
     pool->stat_total_alloc++;
+    pool_stat_add(pool, size);
+
+    if (alignment > APR_ALIGN_DEFAULT(1))
+        mem = (void *)APR_ALIGN((apr_uintptr_t)mem, alignment);
 
     return mem;
 }
 
+static APR_INLINE void *pool_alloc(apr_pool_t *pool, apr_size_t size)
+{
+    return pool_alloc_aligned(pool, size, 0);
+}
+
 APR_DECLARE(void *) apr_palloc_debug(apr_pool_t *pool, apr_size_t size,
                                      const char *file_line)
 {
@@ -1849,6 +3081,50 @@ APR_DECLARE(void *) apr_pcalloc_debug(apr_pool_t *pool, apr_size_t size,
     return mem;
 }
 
+APR_DECLARE(void *) apr_palloc_aligned_debug(apr_pool_t *pool,
+                                             apr_size_t size,
+                                             apr_size_t alignment,
+                                             const char *file_line)
+{
+    void *mem;
+
+    apr_pool_check_integrity(pool);
+
+    if (!alignment_is_valid(alignment))
+        return NULL;
+
+    mem = pool_alloc_aligned(pool, size, alignment);
+
+#if (APR_POOL_DEBUG & APR_POOL_DEBUG_VERBOSE_ALLOC)
+    apr_pool_log_event(pool, "PALLOC", file_line, 1);
+#endif /* (APR_POOL_DEBUG & APR_POOL_DEBUG_VERBOSE_ALLOC) */
+
+    return mem;
+}
+
+APR_DECLARE(void *) apr_pcalloc_aligned_debug(apr_pool_t *pool,
+                                              apr_size_t size,
+                                              apr_size_t alignment,
+                                              const char *file_line)
+{
+    void *mem;
+
+    apr_pool_check_integrity(pool);
+
+    if (!alignment_is_valid(alignment))
+        return NULL;
+
+    mem = pool_alloc_aligned(pool, size, alignment);
+    if (mem)
+        memset(mem, 0, size);
+
+#if (APR_POOL_DEBUG & APR_POOL_DEBUG_VERBOSE_ALLOC)
+    apr_pool_log_event(pool, "PCALLOC", file_line, 1);
+#endif /* (APR_POOL_DEBUG & APR_POOL_DEBUG_VERBOSE_ALLOC) */
+
+    return mem;
+}
+
 
 /*
  * Pool creation/destruction (debug)
@@ -1861,6 +3137,9 @@ static void pool_clear_debug(apr_pool_t *pool, const char *file_line)
     debug_node_t *node;
     apr_size_t index;
 
+    /* Forget the marks, all the memory goes */
+    pool->marks = NULL;
+
     /* Run pre destroy cleanups */
     run_cleanups(&pool->pre_cleanups);
     pool->pre_cleanups = NULL;
@@ -1910,6 +3189,7 @@ static void pool_clear_debug(apr_pool_t *pool, const char *file_line)
 
     pool->stat_alloc = 0;
     pool->stat_clear++;
+    pool->stat_bytes = 0;
 
 #if (APR_POOL_DEBUG & APR_POOL_DEBUG_VERBOSE)
     apr_pool_log_event(pool, "CLEARED", file_line, 1);
@@ -2250,6 +3530,10 @@ APR_DECLARE(char *) apr_pvsprintf(apr_pool_t *pool, const char *fmt, va_list ap)
     node->endp[node->index] = ps.mem + ps.size;
     node->index++;
 
+    pool->stat_alloc++;
+    pool->stat_total_alloc++;
+    pool_stat_add(pool, ps.size);
+
     return ps.mem;
 }
 
@@ -2482,6 +3766,128 @@ APR_DECLARE(const char *) apr_pool_get_tag(apr_pool_t *pool)
     return pool->tag;
 }
 
+APR_DECLARE(void) apr_pool_stats_get(apr_pool_t *pool, apr_pool_stats_t *stats)
+{
+#if !APR_POOL_DEBUG
+    apr_memnode_t *node;
+#endif
+
+    stats->tag = pool->tag;
+    stats->bytes = pool->stat_bytes;
+    stats->peak_bytes = pool->stat_peak;
+    stats->avail_bytes = 0;
+    stats->nodes = 0;
+
+#if !APR_POOL_DEBUG
+    node = pool->active;
+    do {
+        stats->avail_bytes += node_free_space(node);
+        stats->nodes++;
+        node = node->next;
+    } while (node != pool->active);
+#else
+    stats->nodes = pool->stat_alloc;
+#endif
+}
+
+APR_DECLARE(void) apr_pool_mark(apr_pool_t *pool, apr_pool_mark_t *mark)
+{
+#if APR_POOL_DEBUG
+    apr_pool_check_integrity(pool);
+
+    mark->node = pool->nodes;
+    mark->index = pool->nodes ? pool->nodes->index : 0;
+    mark->first_avail = NULL;
+#else
+    pool_concurrency_set_used(pool);
+
+    mark->node = pool->active;
+    mark->first_avail = pool->active->first_avail;
+    mark->index = 0;
+#endif
+    mark->cleanups = pool->cleanups;
+    mark->pre_cleanups = pool->pre_cleanups;
+    mark->free_cleanups = pool->free_cleanups;
+
+    mark->prev = pool->marks;
+    pool->marks = mark;
+
+#if !APR_POOL_DEBUG
+    pool_concurrency_set_idle(pool);
+#endif
+}
+
+APR_DECLARE(void) apr_pool_rewind(apr_pool_t *pool, apr_pool_mark_t *mark)
+{
+#if APR_POOL_DEBUG
+    debug_node_t *node;
+    apr_size_t index;
+#else
+    apr_memnode_t *marked, *node;
+    apr_size_t free_index;
+#endif
+
+#if APR_POOL_DEBUG
+    apr_pool_check_integrity(pool);
+#endif
+
+    /* Run the cleanups registered since the mark, while their data are
+     * still there.
+     */
+    run_cleanups_since(&pool->pre_cleanups, mark->pre_cleanups);
+    run_cleanups_since(&pool->cleanups, mark->cleanups);
+
+    /* The free cleanups may have been allocated since the mark */
+    if (pool->free_cleanups != mark->free_cleanups)
+        pool->free_cleanups = NULL;
+
+    pool->marks = mark->prev;
+
+#if APR_POOL_DEBUG
+    /* Free the allocations made since the mark, in the reverse order */
+    while ((node = pool->nodes) != NULL) {
+        index = (node == mark->node) ? mark->index : 0;
+        while (node->index > index) {
+            node->index--;
+            pool->stat_bytes -= (char *)node->endp[node->index]
+                                - (char *)node->beginp[node->index];
+            memset(node->beginp[node->index], POOL_POISON_BYTE,
+                   (char *)node->endp[node->index]
+                   - (char *)node->beginp[node->index]);
+            free(node->beginp[node->index]);
+            pool->stat_alloc--;
+        }
+        if (node == mark->node)
+            break;
+
+        pool->nodes = node->next;
+        memset(node, POOL_POISON_BYTE, SIZEOF_DEBUG_NODE_T);
+        free(node);
+    }
+#else /* !APR_POOL_DEBUG */
+    pool_concurrency_set_used(pool);
+
+    /* The nodes used since the mark follow the marked node, up to the
+     * active one.  Reset them, they'll be reused in the same order by
+     * the next allocations.
+     */
+    marked = mark->node;
+    for (node = marked; node != pool->active; ) {
+        node = node->next;
+        node->first_avail = (char *)node + APR_MEMNODE_T_SIZE;
+        free_index = (APR_ALIGN(node->endp - node->first_avail + 1,
+                                BOUNDARY_SIZE) - BOUNDARY_SIZE)
+                     >> BOUNDARY_INDEX;
+        node->free_index = (apr_uint32_t)free_index;
+    }
+
+    marked->first_avail = mark->first_avail;
+    pool->active = marked;
+
+    pool_concurrency_set_idle(pool);
+#endif /* !APR_POOL_DEBUG */
+}
+
 /*
  * User data management
  */
@@ -2560,6 +3966,21 @@ struct cleanup_t {
     apr_status_t (*child_cleanup_fn)(void *data);
 };
 
+/* The cleanup 'c' is about to be unregistered, the marks which remember
+ * it as the last cleanup registered before them move to the previous one.
+ */
+static void pool_marks_cleanup_killed(apr_pool_t *p, cleanup_t *c)
+{
+    apr_pool_mark_t *mark;
+
+    for (mark = p->marks; mark; mark = mark->prev) {
+        if (mark->cleanups == c)
+            mark->cleanups = c->next;
+        if (mark->pre_cleanups == c)
+            mark->pre_cleanups = c->next;
+    }
+}
+
 APR_DECLARE(void) apr_pool_cleanup_register(apr_pool_t *p, const void *data,
                       apr_status_t (*plain_cleanup_fn)(void *data),
                       apr_status_t (*child_cleanup_fn)(void *data))
@@ -2647,6 +4068,8 @@ APR_DECLARE(void) apr_pool_cleanup_kill(apr_pool_t *p, const void *data,
 #endif
 
         if (c->data == data && c->plain_cleanup_fn == cleanup_fn) {
+            if (p->marks)
+                pool_marks_cleanup_killed(p, c);
             *lastp = c->next;
             /* move to freelist */
             c->next = p->free_cleanups;
@@ -2672,6 +4095,8 @@ APR_DECLARE(void) apr_pool_cleanup_kill(apr_pool_t *p, const void *data,
 #endif
 
         if (c->data == data && c->plain_cleanup_fn == cleanup_fn) {
+            if (p->marks)
+                pool_marks_cleanup_killed(p, c);
             *lastp = c->next;
             /* move to freelist */
             c->next = p->free_cleanups;
@@ -2727,6 +4152,17 @@ static void run_cleanups(cleanup_t **cref)
     }
 }
 
+static void run_cleanups_since(cleanup_t **cref, cleanup_t *last)
+{
+    cleanup_t *c = *cref;
+
+    while (c && c != last) {
+        *cref = c->next;
+        (*c->plain_cleanup_fn)((void *)c->data);
+        c = *cref;
+    }
+}
+
 #if !defined(WIN32) && !defined(OS2)
 
 static void run_child_cleanups(cleanup_t **cref)
@@ -2912,6 +4348,22 @@ APR_DECLARE(void *) apr_pcalloc_debug(apr_pool_t *pool, apr_size_t size,
     return apr_pcalloc(pool, size);
 }
 
+APR_DECLARE(void *) apr_palloc_aligned_debug(apr_pool_t *pool,
+                                             apr_size_t size,
+                                             apr_size_t alignment,
+                                             const char *file_line)
+{
+    return apr_palloc_aligned(pool, size, alignment);
+}
+
+APR_DECLARE(void *) apr_pcalloc_aligned_debug(apr_pool_t *pool,
+                                              apr_size_t size,
+                                              apr_size_t alignment,
+                                              const char *file_line)
+{
+    return apr_pcalloc_aligned(pool, size, alignment);
+}
+
 APR_DECLARE(void) apr_pool_clear_debug(apr_pool_t *pool,
                                        const char *file_line)
 {
@@ -2986,6 +4438,26 @@ APR_DECLARE(void *) apr_pcalloc(apr_pool_t *pool, apr_size_t size)
     return apr_pcalloc_debug(pool, size, "undefined");
 }
 
+#undef apr_palloc_aligned
+APR_DECLARE(void *) apr_palloc_aligned(apr_pool_t *pool, apr_size_t size,
+                                       apr_size_t alignment);
+
+APR_DECLARE(void *) apr_palloc_aligned(apr_pool_t *pool, apr_size_t size,
+                                       apr_size_t alignment)
+{
+    return apr_palloc_aligned_debug(pool, size, alignment, "undefined");
+}
+
+#undef apr_pcalloc_aligned
+APR_DECLARE(void *) apr_pcalloc_aligned(apr_pool_t *pool, apr_size_t size,
+                                        apr_size_t alignment);
+
+APR_DECLARE(void *) apr_pcalloc_aligned(apr_pool_t *pool, apr_size_t size,
+                                        apr_size_t alignment)
+{
+    return apr_pcalloc_aligned_debug(pool, size, alignment, "undefined");
+}
+
 #undef apr_pool_clear
 APR_DECLARE(void) apr_pool_clear(apr_pool_t *pool);
 
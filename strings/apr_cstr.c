@@ -27,6 +27,47 @@
 #include "apr_want.h"
 #include "apr_cstr.h"
 
+#if APR_HAVE_STRING_H
+#include <string.h>
+#endif
+
+/* The case-insensitive functions process blocks of CSTR_BLOCK bytes at
+ * once with SSE2 or NEON, and one byte at a time otherwise (or with
+ * EBCDIC).  The blocks are loaded as a whole even if the string ends in
+ * the middle, provided they don't cross a page boundary.
+ */
+#define CSTR_BLOCK 16
+#define CSTR_BLOCK_SAFE(p) \
+    (((apr_uintptr_t)(p) & 4095) <= 4096 - CSTR_BLOCK)
+
+#if !APR_CHARSET_EBCDIC && (defined(__SSE2__) || defined(_M_X64) \
+                            || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define APR_CSTR_SSE2 1
+#define APR_CSTR_NEON 0
+#elif !APR_CHARSET_EBCDIC && (defined(__ARM_NEON) || defined(__ARM_NEON__) \
+                              || defined(_M_ARM64))
+#include <arm_neon.h>
+#define APR_CSTR_SSE2 0
+#define APR_CSTR_NEON 1
+#else
+#define APR_CSTR_SSE2 0
+#define APR_CSTR_NEON 0
+#endif
+#define APR_CSTR_SIMD (APR_CSTR_SSE2 || APR_CSTR_NEON)
+
+/* Reading past the end of the strings is fine, but not for ASan */
+#if defined(__SANITIZE_ADDRESS__)
+#define CSTR_NO_ASAN __attribute__((no_sanitize_address))
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define CSTR_NO_ASAN __attribute__((no_sanitize_address))
+#endif
+#endif
+#ifndef CSTR_NO_ASAN
+#define CSTR_NO_ASAN
+#endif
+
 APR_DECLARE(void) apr_cstr_split_append(apr_array_header_t *array,
                                         const char *input,
                                         const char *sep_chars,
@@ -280,28 +321,172 @@ static const short ucharmap[] = {
 };
 #endif
 
+#if APR_CSTR_SIMD
+
+#if APR_CSTR_SSE2
+/* One bit per byte in the masks */
+#define CSTR_MASK_SHIFT 0
+#else
+/* Four bits per byte in the masks */
+#define CSTR_MASK_SHIFT 2
+#endif
+
+/* The offset of the first byte set in a mask */
+static APR_INLINE unsigned int cstr_mask_first(apr_uint64_t mask)
+{
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_ctzll(mask) >> CSTR_MASK_SHIFT;
+#else
+    unsigned int n = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        n++;
+    }
+    return n >> CSTR_MASK_SHIFT;
+#endif
+}
+
+#if APR_CSTR_SSE2
+
+static APR_INLINE __m128i cstr_fold(__m128i v)
+{
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+/* The mask of the bytes of the blocks at s1 and s2 which differ (case
+ * folded) or are NUL.
+ */
+static APR_INLINE apr_uint64_t cstr_block_stops(const unsigned char *s1,
+                                                const unsigned char *s2)
+{
+    __m128i a = _mm_loadu_si128((const __m128i *)s1);
+    __m128i b = _mm_loadu_si128((const __m128i *)s2);
+    __m128i eq = _mm_cmpeq_epi8(cstr_fold(a), cstr_fold(b));
+    __m128i nul = _mm_cmpeq_epi8(a, _mm_setzero_si128());
+
+    return (apr_uint64_t)(_mm_movemask_epi8(_mm_andnot_si128(nul, eq))
+                          ^ 0xFFFF);
+}
+
+/* Store the block at s case folded in out, up to its first NUL byte and
+ * zero padded, and return the number of bytes before the NUL (if any).
+ */
+static APR_INLINE unsigned int cstr_block_fold(const unsigned char *s,
+                                               void *out)
+{
+    __m128i a = _mm_loadu_si128((const __m128i *)s);
+    unsigned int nul = _mm_movemask_epi8(_mm_cmpeq_epi8(a,
+                                                _mm_setzero_si128()));
+    unsigned int n = nul ? cstr_mask_first(nul) : CSTR_BLOCK;
+    __m128i keep = _mm_cmplt_epi8(_mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8,
+                                                9, 10, 11, 12, 13, 14, 15),
+                                  _mm_set1_epi8((char)n));
+
+    _mm_storeu_si128((__m128i *)out, _mm_and_si128(cstr_fold(a), keep));
+    return n;
+}
+
+#else /* APR_CSTR_NEON */
+
+static APR_INLINE uint8x16_t cstr_fold(uint8x16_t v)
+{
+    uint8x16_t upper = vandq_u8(vcgtq_u8(v, vdupq_n_u8('A' - 1)),
+                                vcltq_u8(v, vdupq_n_u8('Z' + 1)));
+    return vorrq_u8(v, vandq_u8(upper, vdupq_n_u8(0x20)));
+}
+
+static APR_INLINE apr_uint64_t cstr_movemask(uint8x16_t v)
+{
+    uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(v), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+}
+
+static APR_INLINE apr_uint64_t cstr_block_stops(const unsigned char *s1,
+                                                const unsigned char *s2)
+{
+    uint8x16_t a = vld1q_u8(s1);
+    uint8x16_t b = vld1q_u8(s2);
+    uint8x16_t eq = vceqq_u8(cstr_fold(a), cstr_fold(b));
+    uint8x16_t nul = vceqq_u8(a, vdupq_n_u8(0));
+
+    return ~cstr_movemask(vbicq_u8(eq, nul));
+}
+
+static APR_INLINE unsigned int cstr_block_fold(const unsigned char *s,
+                                               void *out)
+{
+    static const uint8_t index[CSTR_BLOCK] = {
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+    };
+    uint8x16_t a = vld1q_u8(s);
+    apr_uint64_t nul = cstr_movemask(vceqq_u8(a, vdupq_n_u8(0)));
+    unsigned int n = nul ? cstr_mask_first(nul) : CSTR_BLOCK;
+    uint8x16_t keep = vcltq_u8(vld1q_u8(index), vdupq_n_u8((uint8_t)n));
+
+    vst1q_u8((uint8_t *)out, vandq_u8(cstr_fold(a), keep));
+    return n;
+}
+
+#endif /* APR_CSTR_NEON */
+
+#endif /* APR_CSTR_SIMD */
+
+CSTR_NO_ASAN
 APR_DECLARE(int) apr_cstr_casecmp(const char *s1, const char *s2)
 {
     const unsigned char *str1 = (const unsigned char *)s1;
     const unsigned char *str2 = (const unsigned char *)s2;
     for (;;)
     {
-        const int c1 = (int)(*str1);
-        const int c2 = (int)(*str2);
-        const int cmp = ucharmap[c1] - ucharmap[c2];
-        /* Not necessary to test for !c2, this is caught by cmp */
-        if (cmp || !c1)
-            return cmp;
-        str1++;
-        str2++;
+        int n;
+#if APR_CSTR_SIMD
+        if (CSTR_BLOCK_SAFE(str1) && CSTR_BLOCK_SAFE(str2)) {
+            apr_uint64_t stops = cstr_block_stops(str1, str2);
+            if (stops) {
+                n = cstr_mask_first(stops);
+                return ucharmap[str1[n]] - ucharmap[str2[n]];
+            }
+            str1 += CSTR_BLOCK;
+            str2 += CSTR_BLOCK;
+            continue;
+        }
+#endif
+        for (n = CSTR_BLOCK; n; n--)
+        {
+            const int c1 = (int)(*str1);
+            const int c2 = (int)(*str2);
+            const int cmp = ucharmap[c1] - ucharmap[c2];
+            /* Not necessary to test for !c2, this is caught by cmp */
+            if (cmp || !c1)
+                return cmp;
+            str1++;
+            str2++;
+        }
     }
 }
 
+CSTR_NO_ASAN
 APR_DECLARE(int) apr_cstr_casecmpn(const char *s1, const char *s2,
                                    apr_size_t n)
 {
     const unsigned char *str1 = (const unsigned char *)s1;
     const unsigned char *str2 = (const unsigned char *)s2;
+#if APR_CSTR_SIMD
+    while (n >= CSTR_BLOCK
+           && CSTR_BLOCK_SAFE(str1) && CSTR_BLOCK_SAFE(str2))
+    {
+        apr_uint64_t stops = cstr_block_stops(str1, str2);
+        if (stops) {
+            unsigned int i = cstr_mask_first(stops);
+            return ucharmap[str1[i]] - ucharmap[str2[i]];
+        }
+        str1 += CSTR_BLOCK;
+        str2 += CSTR_BLOCK;
+        n -= CSTR_BLOCK;
+    }
+#endif
     while (n--)
     {
         const int c1 = (int)(*str1);
@@ -316,6 +501,51 @@ APR_DECLARE(int) apr_cstr_casecmpn(const char *s1, const char *s2,
     return 0;
 }
 
+static APR_INLINE apr_uint64_t cstr_hash_mix(apr_uint64_t h,
+                                             const apr_uint64_t block[2])
+{
+    h = (h ^ block[0]) * APR_UINT64_C(0x9E3779B97F4A7C15);
+    h = ((h >> 29 | h << 35) ^ block[1]) * APR_UINT64_C(0xBF58476D1CE4E5B9);
+    return h ^ (h >> 32);
+}
+
+CSTR_NO_ASAN
+APR_DECLARE(apr_uint32_t) apr_cstr_casehash(const char *s)
+{
+    const unsigned char *str = (const unsigned char *)s;
+    apr_uint64_t h = 0, block[2];
+    apr_size_t len = 0;
+    unsigned int n;
+
+    /* The case folded string is hashed by blocks, padded with zeros */
+    for (;;) {
+#if APR_CSTR_SIMD
+        if (CSTR_BLOCK_SAFE(str)) {
+            n = cstr_block_fold(str, block);
+        }
+        else
+#endif
+        {
+            unsigned char *b = (unsigned char *)block;
+            for (n = 0; n < CSTR_BLOCK && str[n]; n++) {
+                b[n] = (unsigned char)ucharmap[str[n]];
+            }
+            memset(b + n, 0, CSTR_BLOCK - n);
+        }
+        if (n) {
+            h = cstr_hash_mix(h, block);
+            len += n;
+        }
+        if (n < CSTR_BLOCK) {
+            break;
+        }
+        str += CSTR_BLOCK;
+    }
+
+    h ^= len;
+    return (apr_uint32_t)(h ^ (h >> 32));
+}
+
 APR_DECLARE(apr_status_t) apr_cstr_strtoui64(apr_uint64_t *n,
                                              const char *str,
                                              apr_uint64_t minval,
@@ -0,0 +1,671 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "apr_private.h"
+
+#include "apr_general.h"
+#include "apr_pools.h"
+#include "apr_allocator.h"
+#include "apr_atomic.h"
+#include "apr_time.h"
+#include "apr_hash.h"
+#include "apr_siphash.h"
+#include "apr_slab.h"
+#include "apr_chash.h"
+
+#if APR_HAS_THREADS
+
+#include "apr_thread_mutex.h"
+
+#if APR_HAVE_STRING_H
+#include <string.h>
+#endif
+
+/*
+ * The map is an array of buckets, each holding a chain of entries, which
+ * readers walk without locking.  Writers lock the stripe of the key's
+ * hash (the buckets whose index is the same modulo STRIPES), and publish
+ * the entries they insert atomically, fully initialized.  An entry is
+ * never modified once published, except for its next link when the
+ * following one is unlinked and its "used" mark for the cache mode: a
+ * replaced value gets a new entry.
+ *
+ * The entries unlinked from the buckets are retired in their stripe's
+ * limbo list with the current epoch, and reclaimed once the epoch has
+ * advanced twice.  Readers register in the counter of the epoch's parity
+ * (in one of READERS shards, to limit the contention), and the epoch can
+ * only advance from e to e + 1 when no reader is left with the parity of
+ * e - 1.  Hence no reader which could see an entry retired at epoch e is
+ * left at epoch e + 2.
+ *
+ * Growing the map copies all the entries into a larger array with all
+ * the stripes locked, and retires the previous entries (the readers
+ * still walking the previous array see its entries until they leave).
+ */
+
+#define STRIPES 16          /* power of two */
+#define READERS 32          /* power of two */
+
+typedef struct chash_entry_t chash_entry_t;
+
+struct chash_entry_t {
+    chash_entry_t *volatile next;       /* In the bucket */
+    chash_entry_t      *lru_prev;       /* In the stripe's list, or limbo */
+    chash_entry_t      *lru_next;
+    const void         *key;
+    apr_ssize_t         klen;
+    void               *val;
+    unsigned int        hash;
+    volatile apr_uint32_t used;         /* Second chance, for caches */
+    apr_uint32_t        epoch;          /* When retired */
+    int                 moved;          /* Retired by a growth */
+};
+
+typedef struct chash_table_t {
+    chash_entry_t *volatile *buckets;
+    unsigned int        max;
+} chash_table_t;
+
+typedef struct chash_stripe_t {
+    apr_thread_mutex_t *lock;
+    apr_slab_t         *entries;
+    chash_entry_t      *head, *tail;    /* Least recently inserted first */
+    chash_entry_t      *limbo, *limbo_tail;
+    apr_size_t          count;
+} chash_stripe_t;
+
+/* Each on its own cache line(s) */
+typedef union chash_stripe_u {
+    chash_stripe_t      s;
+    char                pad[2 * APR_SLAB_CACHELINE];
+} chash_stripe_u;
+
+typedef union chash_readers_u {
+    volatile apr_uint32_t count[2];
+    char                pad[APR_SLAB_CACHELINE];
+} chash_readers_u;
+
+struct apr_chash_t {
+    apr_pool_t          *pool;
+    apr_pool_t          *tpool;         /* For the tables, all locked */
+    chash_table_t *volatile table;
+    chash_stripe_u      *stripes;
+    chash_readers_u     *readers;
+    volatile apr_uint32_t epoch;
+    apr_size_t           stripe_max;    /* Zero if unbounded */
+    apr_chash_free_fn_t *free_fn;
+    void                *baton;
+    unsigned char        secret[APR_SIPHASH_KSIZE];
+};
+
+#define INITIAL_MAX 63  /* tunable == 2^n - 1, at least STRIPES - 1 */
+
+
+static APR_INLINE unsigned int hash_key(const apr_chash_t *ht,
+                                        const void *key,
+                                        apr_ssize_t *klen)
+{
+    apr_uint64_t hash;
+
+    if (*klen == APR_HASH_KEY_STRING) {
+        *klen = strlen(key);
+    }
+    hash = apr_siphash13(key, *klen, ht->secret);
+    return (unsigned int)(hash ^ (hash >> 32));
+}
+
+static chash_table_t *alloc_table(apr_chash_t *ht, unsigned int max)
+{
+    chash_table_t *t;
+
+    t = apr_palloc(ht->tpool, sizeof(*t));
+    if (t) {
+        t->buckets = apr_pcalloc(ht->tpool, sizeof(*t->buckets) * (max + 1));
+        t->max = max;
+    }
+    return (t && t->buckets) ? t : NULL;
+}
+
+
+/*
+ * The stripes' lists of entries.
+ */
+
+static void lru_unlink(chash_stripe_t *s, chash_entry_t *e)
+{
+    if (e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        s->head = e->lru_next;
+    if (e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        s->tail = e->lru_prev;
+}
+
+static void lru_append(chash_stripe_t *s, chash_entry_t *e)
+{
+    e->lru_next = NULL;
+    e->lru_prev = s->tail;
+    if (s->tail)
+        s->tail->lru_next = e;
+    else
+        s->head = e;
+    s->tail = e;
+}
+
+
+/*
+ * Epoch-based reclamation.
+ */
+
+static APR_INLINE unsigned int reader_shard(void)
+{
+    /* Threads have distinct stacks */
+    int local;
+    apr_uint32_t x = (apr_uint32_t)((apr_uintptr_t)&local >> 12);
+
+    return (x * 0x9E3779B1U) >> (32 - 5) & (READERS - 1);
+}
+
+APR_DECLARE(unsigned int) apr_chash_read_begin(apr_chash_t *ht)
+{
+    unsigned int shard = reader_shard();
+    apr_uint32_t epoch;
+
+    for (;;) {
+        epoch = apr_atomic_read32(&ht->epoch);
+        apr_atomic_inc32(&ht->readers[shard].count[epoch & 1]);
+        /* Registered in time if the epoch didn't advance meanwhile */
+        if (apr_atomic_read32(&ht->epoch) == epoch) {
+            return shard * 2 + (epoch & 1);
+        }
+        apr_atomic_dec32(&ht->readers[shard].count[epoch & 1]);
+    }
+}
+
+APR_DECLARE(void) apr_chash_read_end(apr_chash_t *ht, unsigned int token)
+{
+    apr_atomic_dec32(&ht->readers[token / 2].count[token & 1]);
+}
+
+static void try_advance(apr_chash_t *ht)
+{
+    apr_uint32_t epoch = apr_atomic_read32(&ht->epoch);
+    unsigned int i;
+
+    for (i = 0; i < READERS; i++) {
+        if (apr_atomic_read32(&ht->readers[i].count[(epoch - 1) & 1])) {
+            return;
+        }
+    }
+    apr_atomic_cas32(&ht->epoch, epoch + 1, epoch);
+}
+
+/* Called with the stripe locked, once e is unlinked */
+static void retire(apr_chash_t *ht, chash_stripe_t *s, chash_entry_t *e,
+                   int moved)
+{
+    /* With a full barrier, so that no reader entering the next epochs
+     * may find e.
+     */
+    e->epoch = apr_atomic_add32(&ht->epoch, 0);
+    e->moved = moved;
+    e->lru_next = NULL;
+    if (s->limbo_tail)
+        s->limbo_tail->lru_next = e;
+    else
+        s->limbo = e;
+    s->limbo_tail = e;
+}
+
+static void free_entry(apr_chash_t *ht, chash_stripe_t *s, chash_entry_t *e)
+{
+    if (!e->moved && ht->free_fn) {
+        ht->free_fn(ht->baton, e->key, e->klen, e->val);
+    }
+    apr_slab_free(s->entries, e);
+}
+
+/* Called with the stripe locked */
+static void reclaim(apr_chash_t *ht, chash_stripe_t *s)
+{
+    chash_entry_t *e;
+    int i;
+
+    for (i = 0; s->limbo && i < 2; i++) {
+        if (apr_atomic_read32(&ht->epoch) - s->limbo_tail->epoch >= 2) {
+            break;
+        }
+        try_advance(ht);
+    }
+    while ((e = s->limbo)
+           && apr_atomic_read32(&ht->epoch) - e->epoch >= 2) {
+        s->limbo = e->lru_next;
+        free_entry(ht, s, e);
+    }
+    if (!s->limbo) {
+        s->limbo_tail = NULL;
+    }
+}
+
+
+/*
+ * Creation and destruction.
+ */
+
+static apr_status_t chash_cleanup(void *data)
+{
+    apr_chash_t *ht = data;
+    chash_entry_t *e;
+    int i;
+
+    /* Nobody can use the map anymore */
+    for (i = 0; i < STRIPES; i++) {
+        chash_stripe_t *s = &ht->stripes[i].s;
+        while ((e = s->limbo)) {
+            s->limbo = e->lru_next;
+            free_entry(ht, s, e);
+        }
+        while ((e = s->head)) {
+            s->head = e->lru_next;
+            free_entry(ht, s, e);
+        }
+        s->limbo_tail = s->tail = NULL;
+        s->count = 0;
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t create_pool(apr_pool_t **newpool, apr_pool_t *parent)
+{
+    apr_allocator_t *allocator;
+    apr_status_t rv;
+
+    /* With its own allocator, to be used concurrently with the others */
+    rv = apr_allocator_create(&allocator);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    rv = apr_pool_create_ex(newpool, parent, NULL, allocator);
+    if (rv != APR_SUCCESS) {
+        apr_allocator_destroy(allocator);
+        return rv;
+    }
+    apr_allocator_owner_set(allocator, *newpool);
+    return APR_SUCCESS;
+}
+
+APR_DECLARE(apr_status_t) apr_chash_create(apr_chash_t **pht,
+                                           apr_size_t max,
+                                           apr_chash_free_fn_t *free_fn,
+                                           void *baton,
+                                           apr_pool_t *pool)
+{
+    apr_chash_t *ht;
+    unsigned int size;
+    apr_status_t rv;
+    int i;
+
+    ht = apr_pcalloc(pool, sizeof(*ht));
+    ht->pool = pool;
+    ht->free_fn = free_fn;
+    ht->baton = baton;
+
+    ht->stripes = apr_pcalloc_aligned(pool, STRIPES * sizeof(*ht->stripes),
+                                      APR_SLAB_CACHELINE);
+    ht->readers = apr_pcalloc_aligned(pool, READERS * sizeof(*ht->readers),
+                                      APR_SLAB_CACHELINE);
+    if (!ht->stripes || !ht->readers) {
+        return APR_ENOMEM;
+    }
+
+#if APR_HAS_RANDOM
+    if (apr_generate_random_bytes(ht->secret, sizeof(ht->secret))
+            != APR_SUCCESS)
+#endif
+    {
+        apr_time_t now = apr_time_now();
+        apr_uint64_t k[2];
+        k[0] = (apr_uint64_t)now ^ (apr_uintptr_t)ht;
+        k[1] = (apr_uint64_t)(apr_uintptr_t)&now * 0x9E3779B97F4A7C15ULL;
+        memcpy(ht->secret, k, sizeof(ht->secret));
+    }
+
+    rv = create_pool(&ht->tpool, pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    for (i = 0; i < STRIPES; i++) {
+        chash_stripe_t *s = &ht->stripes[i].s;
+        apr_pool_t *spool;
+
+        rv = apr_thread_mutex_create(&s->lock, APR_THREAD_MUTEX_DEFAULT,
+                                     pool);
+        if (rv == APR_SUCCESS) {
+            rv = create_pool(&spool, pool);
+        }
+        if (rv == APR_SUCCESS) {
+            rv = apr_slab_create(&s->entries, sizeof(chash_entry_t), 0,
+                                 spool);
+        }
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+    }
+
+    /* A bounded map is sized once for all */
+    size = INITIAL_MAX + 1;
+    if (max) {
+        ht->stripe_max = max > STRIPES ? max / STRIPES : 1;
+        while (size < max && size < APR_UINT32_MAX / 4) {
+            size *= 2;
+        }
+    }
+    ht->table = alloc_table(ht, size - 1);
+    if (!ht->table) {
+        return APR_ENOMEM;
+    }
+
+    /* Before the stripes' pools are destroyed */
+    apr_pool_pre_cleanup_register(pool, ht, chash_cleanup);
+
+    *pht = ht;
+    return APR_SUCCESS;
+}
+
+
+/*
+ * Lookups.
+ */
+
+static APR_INLINE chash_entry_t *find(const apr_chash_t *ht,
+                                      const chash_table_t *t,
+                                      const void *key, apr_ssize_t klen,
+                                      unsigned int hash)
+{
+    chash_entry_t *e;
+
+    for (e = t->buckets[hash & t->max]; e; e = e->next) {
+        if (e->hash == hash
+            && e->klen == klen
+            && memcmp(e->key, key, klen) == 0) {
+            if (ht->stripe_max && !e->used) {
+                e->used = 1;
+            }
+            return e;
+        }
+    }
+    return NULL;
+}
+
+APR_DECLARE(void *) apr_chash_get(apr_chash_t *ht, const void *key,
+                                  apr_ssize_t klen)
+{
+    unsigned int hash = hash_key(ht, key, &klen), token;
+    chash_entry_t *e;
+    void *val = NULL;
+
+    token = apr_chash_read_begin(ht);
+    e = find(ht, ht->table, key, klen, hash);
+    if (e) {
+        val = e->val;
+    }
+    apr_chash_read_end(ht, token);
+
+    return val;
+}
+
+APR_DECLARE(int) apr_chash_do(apr_chash_do_callback_fn_t *comp, void *rec,
+                              apr_chash_t *ht)
+{
+    chash_table_t *t;
+    chash_entry_t *e;
+    unsigned int i, token;
+    int rv = TRUE;
+
+    token = apr_chash_read_begin(ht);
+    t = ht->table;
+    for (i = 0; rv && i <= t->max; i++) {
+        for (e = t->buckets[i]; rv && e; e = e->next) {
+            rv = (*comp)(rec, e->key, e->klen, e->val);
+        }
+    }
+    apr_chash_read_end(ht, token);
+
+    return rv ? TRUE : FALSE;
+}
+
+APR_DECLARE(apr_size_t) apr_chash_count(apr_chash_t *ht)
+{
+    apr_size_t count = 0;
+    int i;
+
+    for (i = 0; i < STRIPES; i++) {
+        count += ht->stripes[i].s.count;
+    }
+    return count;
+}
+
+
+/*
+ * Updates.
+ */
+
+static void lock_all(apr_chash_t *ht)
+{
+    int i;
+
+    for (i = 0; i < STRIPES; i++) {
+        apr_thread_mutex_lock(ht->stripes[i].s.lock);
+    }
+}
+
+static void unlock_all(apr_chash_t *ht)
+{
+    int i;
+
+    for (i = STRIPES; i-- > 0; ) {
+        apr_thread_mutex_unlock(ht->stripes[i].s.lock);
+    }
+}
+
+/* Copy all the entries into a table twice as large as t */
+static void grow(apr_chash_t *ht, chash_table_t *t)
+{
+    chash_entry_t *heads[STRIPES], *tails[STRIPES];
+    chash_entry_t *e, *n, *next;
+    chash_table_t *nt;
+    int i;
+
+    lock_all(ht);
+    if (ht->table != t) {
+        /* Someone else did it */
+        unlock_all(ht);
+        return;
+    }
+
+    nt = alloc_table(ht, t->max * 2 + 1);
+    if (!nt) {
+        unlock_all(ht);
+        return;
+    }
+    for (i = 0; i < STRIPES; i++) {
+        chash_stripe_t *s = &ht->stripes[i].s;
+        heads[i] = tails[i] = NULL;
+        for (e = s->head; e; e = e->lru_next) {
+            n = apr_slab_alloc(s->entries);
+            if (!n) {
+                goto undo;
+            }
+            memcpy(n, e, sizeof(*n));
+            n->next = nt->buckets[n->hash & nt->max];
+            nt->buckets[n->hash & nt->max] = n;
+            n->lru_prev = tails[i];
+            n->lru_next = NULL;
+            if (tails[i])
+                tails[i]->lru_next = n;
+            else
+                heads[i] = n;
+            tails[i] = n;
+        }
+    }
+
+    apr_atomic_xchgptr((void *volatile *)&ht->table, nt);
+    for (i = 0; i < STRIPES; i++) {
+        chash_stripe_t *s = &ht->stripes[i].s;
+        for (e = s->head; e; e = next) {
+            next = e->lru_next;
+            retire(ht, s, e, 1);
+        }
+        s->head = heads[i];
+        s->tail = tails[i];
+    }
+    unlock_all(ht);
+    return;
+
+undo:
+    /* Not enough memory, keep the current table */
+    for (; i >= 0; i--) {
+        chash_stripe_t *s = &ht->stripes[i].s;
+        for (n = heads[i]; n; n = next) {
+            next = n->lru_next;
+            apr_slab_free(s->entries, n);
+        }
+    }
+    unlock_all(ht);
+}
+
+/* Evict the least recently used entries of a full stripe (locked) */
+static void evict(apr_chash_t *ht, chash_stripe_t *s, chash_table_t *t)
+{
+    chash_entry_t *volatile *ep;
+    chash_entry_t *e;
+
+    while (s->count > ht->stripe_max) {
+        e = s->head;
+        if (e->used) {
+            /* Second chance */
+            e->used = 0;
+            lru_unlink(s, e);
+            lru_append(s, e);
+            continue;
+        }
+        for (ep = &t->buckets[e->hash & t->max]; *ep != e; ep = &(*ep)->next)
+            ;
+        *ep = e->next;
+        lru_unlink(s, e);
+        s->count--;
+        retire(ht, s, e, 0);
+    }
+}
+
+/* Set or get (replace == 0) the value of key, with val == NULL to delete */
+static void *chash_set(apr_chash_t *ht, const void *key, apr_ssize_t klen,
+                       void *val, int replace, apr_status_t *status)
+{
+    unsigned int hash = hash_key(ht, key, &klen);
+    chash_stripe_t *s = &ht->stripes[hash & (STRIPES - 1)].s;
+    chash_entry_t *volatile *ep;
+    chash_entry_t *e, *n;
+    chash_table_t *t;
+    int full = 0;
+
+    *status = APR_SUCCESS;
+    apr_thread_mutex_lock(s->lock);
+
+    t = ht->table;
+    for (ep = &t->buckets[hash & t->max]; (e = *ep); ep = &e->next) {
+        if (e->hash == hash
+            && e->klen == klen
+            && memcmp(e->key, key, klen) == 0)
+            break;
+    }
+
+    if (e && !replace) {
+        val = e->val;
+        e->used = 1;
+    }
+    else if (e && !val) {
+        /* Delete */
+        *ep = e->next;
+        lru_unlink(s, e);
+        s->count--;
+        retire(ht, s, e, 0);
+    }
+    else if (val) {
+        n = apr_slab_alloc(s->entries);
+        if (!n) {
+            *status = APR_ENOMEM;
+            apr_thread_mutex_unlock(s->lock);
+            return NULL;
+        }
+        n->key = key;
+        n->klen = klen;
+        n->val = val;
+        n->hash = hash;
+        n->used = 0;
+        n->moved = 0;
+        if (e) {
+            /* Replace */
+            n->next = e->next;
+            apr_atomic_xchgptr((void *volatile *)ep, n);
+            lru_unlink(s, e);
+            retire(ht, s, e, 0);
+        }
+        else {
+            /* Insert */
+            n->next = t->buckets[hash & t->max];
+            apr_atomic_xchgptr((void *volatile *)&t->buckets[hash & t->max],
+                               n);
+            s->count++;
+            if (ht->stripe_max) {
+                evict(ht, s, t);
+            }
+            else {
+                full = (s->count > (t->max + 1) / STRIPES);
+            }
+        }
+        lru_append(s, n);
+    }
+
+    reclaim(ht, s);
+    apr_thread_mutex_unlock(s->lock);
+
+    if (full) {
+        grow(ht, t);
+    }
+    return val;
+}
+
+APR_DECLARE(apr_status_t) apr_chash_set(apr_chash_t *ht, const void *key,
+                                        apr_ssize_t klen, void *val)
+{
+    apr_status_t rv;
+
+    chash_set(ht, key, klen, val, 1, &rv);
+    return rv;
+}
+
+APR_DECLARE(void *) apr_chash_get_or_set(apr_chash_t *ht, const void *key,
+                                         apr_ssize_t klen, void *val)
+{
+    apr_status_t rv;
+
+    return chash_set(ht, key, klen, val, 0, &rv);
+}
+
+#endif /* APR_HAS_THREADS */
@@ -19,8 +19,11 @@
 #include "apr_general.h"
 #include "apr_pools.h"
 #include "apr_time.h"
+#include "apr_atomic.h"
 
 #include "apr_hash.h"
+#include "apr_siphash.h"
+#include "apr_slab.h"
 
 #if APR_HAVE_STDLIB_H
 #include <stdlib.h>
@@ -33,6 +36,14 @@
 #include <stdio.h>
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define APR_HASH_FLAT_SSE2 1
+#else
+#define APR_HASH_FLAT_SSE2 0
+#endif
+
 /*
  * The internal form of a hash table.
  *
@@ -52,6 +63,32 @@ struct apr_hash_entry_t {
     const void       *val;
 };
 
+/*
+ * The flat form, see apr_hash_make_flat().
+ *
+ * The entries are stored in an array of slots, in groups of FLAT_GROUP,
+ * and found by open addressing: starting from the group given by the
+ * hash of the key, the groups are probed in turn until the key or a free
+ * slot is found.  Each slot has a control byte in a separate array,
+ * either FLAT_EMPTY or 7 bits of the hash of its key, so that a whole
+ * group is matched at once (with SSE2 if available) and only the slots
+ * whose control byte matches need the key to be compared.
+ *
+ * Deleted entries leave no tombstone: the entries which had to be put
+ * after the freed slot are shifted back into it (see flat_delete()).
+ * This relies on the invariant that all the groups between an entry's
+ * first group and its actual one are full.
+ */
+typedef struct apr_hash_slot_t {
+    unsigned int      hash;
+    apr_ssize_t       klen;
+    const void       *key;
+    const void       *val;
+} apr_hash_slot_t;
+
+#define FLAT_GROUP 16
+#define FLAT_EMPTY 0x80
+
 /*
  * Data structure for iterating through a hash table.
  *
@@ -63,6 +100,8 @@ struct apr_hash_index_t {
     apr_hash_t         *ht;
     apr_hash_entry_t   *this, *next;
     unsigned int        index;
+    apr_hash_slot_t    *slot;       /* Flat tables' current slot */
+    unsigned int        start;      /* and where the walk began */
 };
 
 /*
@@ -71,18 +110,40 @@ struct apr_hash_index_t {
  * modular arithmetic.
  * The count of hash entries may be greater depending on the chosen
  * collision rate.
+ *
+ * While growing incrementally (see apr_hash_incremental_set()), the
+ * previous array is kept in old_array and its buckets from rehash on
+ * still hold entries, still looked up there until moved.
  */
 struct apr_hash_t {
     apr_pool_t          *pool;
     apr_hash_entry_t   **array;
+    apr_hash_entry_t   **old_array;
+    unsigned int         old_max, rehash, rehash_step;
     apr_hash_index_t     iterator;  /* For apr_hash_first(NULL, ...) */
     unsigned int         count, max, seed;
     apr_hashfunc_t       hash_func;
-    apr_hash_entry_t    *free;  /* List of recycled entries */
+    int                  algo;     /* APR_HASH_ALGO_*, without hash_func */
+    unsigned char        key[APR_SIPHASH_KSIZE];
+    apr_slab_t          *entries;  /* Entries, recycled once deleted */
+    unsigned char       *ctrl;     /* Flat tables only (max + 1 slots) */
+    apr_hash_slot_t     *slots;
 };
 
 #define INITIAL_MAX 15 /* tunable == 2^n - 1 */
 
+/* See apr_hash_algo_default_set() */
+static int hash_algo_default = APR_HASH_ALGO_TIMES33;
+
+/* The secret from which the tables' SipHash keys are derived, generated
+ * once (0: not yet, 1: in progress, 2: done).
+ */
+static unsigned char hash_secret[APR_SIPHASH_KSIZE];
+static volatile apr_uint32_t hash_secret_state;
+
+/* The flat tables are grown beyond 7/8 full */
+#define FLAT_FULL(max) ((max) - ((max) >> 3))
+
 
 /*
  * Hash creation functions.
@@ -93,6 +154,50 @@ static apr_hash_entry_t **alloc_array(apr_hash_t *ht, unsigned int max)
    return apr_pcalloc(ht->pool, sizeof(*ht->array) * (max + 1));
 }
 
+static void init_algo(apr_hash_t *ht, int algo)
+{
+    apr_uint32_t state;
+    unsigned int i;
+
+    ht->algo = algo;
+    if (algo != APR_HASH_ALGO_SIPHASH13) {
+        return;
+    }
+
+    state = apr_atomic_cas32(&hash_secret_state, 1, 0);
+    if (state == 0) {
+#if APR_HAS_RANDOM
+        if (apr_generate_random_bytes(hash_secret, sizeof(hash_secret))
+                != APR_SUCCESS) {
+            memset(hash_secret, 0, sizeof(hash_secret));
+        }
+#endif
+        apr_atomic_set32(&hash_secret_state, 2);
+        state = 2;
+    }
+    if (state == 2) {
+        memcpy(ht->key, hash_secret, sizeof(ht->key));
+    }
+    else {
+        /* Racing with the generation, the seed will have to do */
+        memset(ht->key, 0, sizeof(ht->key));
+    }
+    for (i = 0; i < sizeof(ht->seed); i++) {
+        ht->key[i] ^= (unsigned char)(ht->seed >> (i * 8));
+    }
+}
+
+static apr_hash_entry_t *alloc_entry(apr_hash_t *ht)
+{
+    /* Created on first use, many hash tables never get an entry */
+    if (!ht->entries
+            && apr_slab_create(&ht->entries, sizeof(apr_hash_entry_t), 0,
+                               ht->pool) != APR_SUCCESS) {
+        return NULL;
+    }
+    return apr_slab_alloc(ht->entries);
+}
+
 APR_DECLARE(apr_hash_t *) apr_hash_make(apr_pool_t *pool)
 {
     apr_hash_t *ht;
@@ -100,13 +205,18 @@ APR_DECLARE(apr_hash_t *) apr_hash_make(apr_pool_t *pool)
 
     ht = apr_palloc(pool, sizeof(apr_hash_t));
     ht->pool = pool;
-    ht->free = NULL;
+    ht->entries = NULL;
     ht->count = 0;
     ht->max = INITIAL_MAX;
     ht->seed = (unsigned int)((now >> 32) ^ now ^ (apr_uintptr_t)pool ^
                               (apr_uintptr_t)ht ^ (apr_uintptr_t)&now) - 1;
     ht->array = alloc_array(ht, ht->max);
+    ht->old_array = NULL;
+    ht->rehash_step = 0;
     ht->hash_func = NULL;
+    ht->ctrl = NULL;
+    ht->slots = NULL;
+    init_algo(ht, hash_algo_default);
 
     return ht;
 }
@@ -119,19 +229,177 @@ APR_DECLARE(apr_hash_t *) apr_hash_make_custom(apr_pool_t *pool,
     return ht;
 }
 
+static int alloc_flat(apr_hash_t *ht, unsigned int max)
+{
+    ht->ctrl = apr_palloc_aligned(ht->pool, max + 1, FLAT_GROUP);
+    ht->slots = apr_palloc(ht->pool, sizeof(*ht->slots) * (max + 1));
+    if (!ht->ctrl || !ht->slots) {
+        return 0;
+    }
+    memset(ht->ctrl, FLAT_EMPTY, max + 1);
+    ht->max = max;
+    return 1;
+}
+
+APR_DECLARE(apr_hash_t *) apr_hash_make_flat(apr_pool_t *pool)
+{
+    apr_hash_t *ht;
+    apr_time_t now = apr_time_now();
+
+    ht = apr_palloc(pool, sizeof(apr_hash_t));
+    ht->pool = pool;
+    ht->array = NULL;
+    ht->old_array = NULL;
+    ht->rehash_step = 0;
+    ht->entries = NULL;
+    ht->count = 0;
+    ht->seed = (unsigned int)((now >> 32) ^ now ^ (apr_uintptr_t)pool ^
+                              (apr_uintptr_t)ht ^ (apr_uintptr_t)&now) - 1;
+    ht->hash_func = NULL;
+    init_algo(ht, hash_algo_default);
+    if (!alloc_flat(ht, FLAT_GROUP - 1)) {
+        return NULL;
+    }
+
+    return ht;
+}
+
+APR_DECLARE(apr_hash_t *) apr_hash_make_flat_custom(apr_pool_t *pool,
+                                                    apr_hashfunc_t hash_func)
+{
+    apr_hash_t *ht = apr_hash_make_flat(pool);
+    if (ht) {
+        ht->hash_func = hash_func;
+    }
+    return ht;
+}
+
+
+/*
+ * Flat tables' groups matching.
+ */
+
+/* The 7 bits of the hash in the control bytes, mixed so that they don't
+ * depend on the low bits only (which select the group).
+ */
+#define FLAT_H2(hash) ((unsigned char)(((hash) * 0x9E3779B1U) >> 25))
+
+/* Bitmask of the slots of the group whose control byte is c */
+static APR_INLINE unsigned int flat_match(const unsigned char *ctrl,
+                                          unsigned char c)
+{
+#if APR_HASH_FLAT_SSE2
+    __m128i group = _mm_load_si128((const __m128i *)ctrl);
+    return (unsigned int)_mm_movemask_epi8(
+                             _mm_cmpeq_epi8(group, _mm_set1_epi8((char)c)));
+#else
+    unsigned int i, mask = 0;
+    for (i = 0; i < FLAT_GROUP; i++) {
+        mask |= (unsigned int)(ctrl[i] == c) << i;
+    }
+    return mask;
+#endif
+}
+
+/* Bitmask of the empty slots of the group */
+static APR_INLINE unsigned int flat_empty(const unsigned char *ctrl)
+{
+#if APR_HASH_FLAT_SSE2
+    return (unsigned int)_mm_movemask_epi8(
+                                 _mm_load_si128((const __m128i *)ctrl));
+#else
+    unsigned int i, mask = 0;
+    for (i = 0; i < FLAT_GROUP; i++) {
+        mask |= (unsigned int)(ctrl[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+/* Index of the lowest bit set of a (non-zero) mask */
+static APR_INLINE unsigned int flat_first(unsigned int mask)
+{
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_ctz(mask);
+#else
+    unsigned int i = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
 
 /*
  * Hash iteration functions.
  */
 
+/*
+ * The flat tables are walked backward, from the last slot of a group
+ * with an empty slot (that no entry's probing went through) to the slot
+ * following that group.  Deleting the current entry may only shift back
+ * entries already walked, so none is missed.
+ */
+static apr_hash_index_t *flat_next(apr_hash_index_t *hi)
+{
+    apr_hash_t *ht = hi->ht;
+    unsigned int i;
+
+    while (hi->index) {
+        i = (hi->start + --hi->index) & ht->max;
+        if (ht->ctrl[i] != FLAT_EMPTY) {
+            hi->slot = &ht->slots[i];
+            return hi;
+        }
+    }
+    return NULL;
+}
+
+static void flat_first_index(apr_hash_index_t *hi)
+{
+    apr_hash_t *ht = hi->ht;
+    unsigned int g;
+
+    for (g = 0; g <= ht->max; g += FLAT_GROUP) {
+        if (flat_empty(ht->ctrl + g)) {
+            break;
+        }
+    }
+    hi->start = g + FLAT_GROUP;
+    hi->index = ht->max + 1;
+    hi->slot = NULL;
+}
+
+/*
+ * The chains of a table growing incrementally are those of its array
+ * followed by those of its old array (the ones not moved yet are empty).
+ */
+static APR_INLINE unsigned int chains_count(const apr_hash_t *ht)
+{
+    return ht->max + 1 + (ht->old_array ? ht->old_max + 1 : 0);
+}
+
+static APR_INLINE apr_hash_entry_t *chain_at(const apr_hash_t *ht,
+                                             unsigned int i)
+{
+    if (i <= ht->max)
+        return ht->array[i];
+    return ht->old_array[i - ht->max - 1];
+}
+
 APR_DECLARE(apr_hash_index_t *) apr_hash_next(apr_hash_index_t *hi)
 {
+    if (hi->ht->ctrl)
+        return flat_next(hi);
+
     hi->this = hi->next;
     while (!hi->this) {
-        if (hi->index > hi->ht->max)
+        if (hi->index >= chains_count(hi->ht))
             return NULL;
 
-        hi->this = hi->ht->array[hi->index++];
+        hi->this = chain_at(hi->ht, hi->index++);
     }
     hi->next = hi->this->next;
     return hi;
@@ -149,6 +417,8 @@ APR_DECLARE(apr_hash_index_t *) apr_hash_first(apr_pool_t *p, apr_hash_t *ht)
     hi->index = 0;
     hi->this = NULL;
     hi->next = NULL;
+    if (ht->ctrl)
+        flat_first_index(hi);
     return apr_hash_next(hi);
 }
 
@@ -157,6 +427,12 @@ APR_DECLARE(void) apr_hash_this(apr_hash_index_t *hi,
                                 apr_ssize_t *klen,
                                 void **val)
 {
+    if (hi->ht->ctrl) {
+        if (key)  *key  = hi->slot->key;
+        if (klen) *klen = hi->slot->klen;
+        if (val)  *val  = (void *)hi->slot->val;
+        return;
+    }
     if (key)  *key  = hi->this->key;
     if (klen) *klen = hi->this->klen;
     if (val)  *val  = (void *)hi->this->val;
@@ -190,6 +466,27 @@ APR_DECLARE(void *) apr_hash_this_val(apr_hash_index_t *hi)
  * Expanding a hash table
  */
 
+/* Move up to n buckets of the old array to the new one */
+static void rehash_buckets(apr_hash_t *ht, unsigned int n)
+{
+    apr_hash_entry_t *he, *next;
+    unsigned int i;
+
+    while (n-- && ht->old_array) {
+        he = ht->old_array[ht->rehash];
+        ht->old_array[ht->rehash] = NULL;
+        for (; he; he = next) {
+            next = he->next;
+            i = he->hash & ht->max;
+            he->next = ht->array[i];
+            ht->array[i] = he;
+        }
+        if (++ht->rehash > ht->old_max) {
+            ht->old_array = NULL;
+        }
+    }
+}
+
 static void expand_array(apr_hash_t *ht)
 {
     apr_hash_index_t *hi;
@@ -198,6 +495,21 @@ static void expand_array(apr_hash_t *ht)
 
     new_max = ht->max * 2 + 1;
     new_array = alloc_array(ht, new_max);
+
+    if (ht->rehash_step) {
+        /* Finish the previous move (if ever), and start this one */
+        if (ht->old_array) {
+            rehash_buckets(ht, ht->old_max + 1);
+        }
+        ht->old_array = ht->array;
+        ht->old_max = ht->max;
+        ht->rehash = 0;
+        ht->array = new_array;
+        ht->max = new_max;
+        rehash_buckets(ht, ht->rehash_step);
+        return;
+    }
+
     for (hi = apr_hash_first(NULL, ht); hi; hi = apr_hash_next(hi)) {
         unsigned int i = hi->this->hash & new_max;
         hi->this->next = new_array[i];
@@ -273,6 +585,182 @@ APR_DECLARE_NONSTD(unsigned int) apr_hashfunc_default(const char *char_key,
     return hashfunc_default(char_key, klen, 0);
 }
 
+static unsigned int hashfunc_siphash(const char *key, apr_ssize_t *klen,
+                                     const unsigned char *secret)
+{
+    apr_uint64_t hash;
+
+    if (*klen == APR_HASH_KEY_STRING) {
+        *klen = strlen(key);
+    }
+    hash = apr_siphash13(key, *klen, secret);
+    return (unsigned int)(hash ^ (hash >> 32));
+}
+
+static APR_INLINE unsigned int hash_key(const apr_hash_t *ht,
+                                        const void *key,
+                                        apr_ssize_t *klen)
+{
+    if (ht->hash_func)
+        return ht->hash_func(key, klen);
+    else if (ht->algo == APR_HASH_ALGO_SIPHASH13)
+        return hashfunc_siphash(key, klen, ht->key);
+    else
+        return hashfunc_default(key, klen, ht->seed);
+}
+
+/*
+ * Flat tables' lookup, insertion and deletion.
+ */
+
+static apr_hash_slot_t *flat_find(const apr_hash_t *ht,
+                                  const void *key,
+                                  apr_ssize_t klen,
+                                  unsigned int hash)
+{
+    unsigned int gmask = ht->max / FLAT_GROUP;
+    unsigned int g = hash & gmask;
+    unsigned char h2 = FLAT_H2(hash);
+    const unsigned char *ctrl;
+    apr_hash_slot_t *slot;
+    unsigned int mask;
+
+    for (;;) {
+        ctrl = ht->ctrl + g * FLAT_GROUP;
+        for (mask = flat_match(ctrl, h2); mask; mask &= mask - 1) {
+            slot = &ht->slots[g * FLAT_GROUP + flat_first(mask)];
+            if (slot->hash == hash
+                && slot->klen == klen
+                && memcmp(slot->key, key, klen) == 0)
+                return slot;
+        }
+        /* Nothing was put beyond a group which has a free slot */
+        if (flat_empty(ctrl))
+            return NULL;
+        g = (g + 1) & gmask;
+    }
+}
+
+/* Take the first free slot for the given hash, the table must not be
+ * full and the caller must fill the slot.
+ */
+static apr_hash_slot_t *flat_insert(apr_hash_t *ht, unsigned int hash)
+{
+    unsigned int gmask = ht->max / FLAT_GROUP;
+    unsigned int g = hash & gmask;
+    unsigned int mask, i;
+
+    while (!(mask = flat_empty(ht->ctrl + g * FLAT_GROUP)))
+        g = (g + 1) & gmask;
+
+    i = g * FLAT_GROUP + flat_first(mask);
+    ht->ctrl[i] = FLAT_H2(hash);
+    return &ht->slots[i];
+}
+
+static void flat_delete(apr_hash_t *ht, apr_hash_slot_t *slot)
+{
+    unsigned int gmask = ht->max / FLAT_GROUP;
+    unsigned int hole = (unsigned int)(slot - ht->slots);
+    unsigned int hg = hole / FLAT_GROUP;
+    unsigned int g, i, mask, full;
+
+    ht->ctrl[hole] = FLAT_EMPTY;
+    ht->count--;
+
+    /* If the group was not full, no entry was put beyond because of it */
+    if (flat_empty(ht->ctrl + hg * FLAT_GROUP) != 1U << (hole % FLAT_GROUP))
+        return;
+
+    /* Otherwise shift back in the hole the first entry (of each next
+     * group) whose probing went through the hole's group, until a group
+     * which was not full.
+     */
+    for (g = (hg + 1) & gmask;; g = (g + 1) & gmask) {
+        mask = flat_empty(ht->ctrl + g * FLAT_GROUP);
+        full = !mask;
+        for (mask = ~mask & 0xFFFF; mask; mask &= mask - 1) {
+            i = g * FLAT_GROUP + flat_first(mask);
+            if (((g - ht->slots[i].hash) & gmask) >= ((g - hg) & gmask)) {
+                ht->slots[hole] = ht->slots[i];
+                ht->ctrl[hole] = ht->ctrl[i];
+                ht->ctrl[i] = FLAT_EMPTY;
+                hole = i;
+                hg = g;
+                break;
+            }
+        }
+        if (!full)
+            break;
+    }
+}
+
+static void flat_grow(apr_hash_t *ht)
+{
+    unsigned char *ctrl = ht->ctrl;
+    apr_hash_slot_t *slots = ht->slots;
+    unsigned int i, max = ht->max;
+
+    if (!alloc_flat(ht, max * 2 + 1)) {
+        /* Keep on with the current array, it's not full yet */
+        ht->ctrl = ctrl;
+        ht->slots = slots;
+        return;
+    }
+    for (i = 0; i <= max; i++) {
+        if (ctrl[i] != FLAT_EMPTY)
+            *flat_insert(ht, slots[i].hash) = slots[i];
+    }
+}
+
+/* Add an entry whose key is not in the table, NULL if the table is full */
+static apr_hash_slot_t *flat_add(apr_hash_t *ht, const void *key,
+                                 apr_ssize_t klen, unsigned int hash,
+                                 const void *val)
+{
+    apr_hash_slot_t *slot;
+
+    if (ht->count >= FLAT_FULL(ht->max)) {
+        flat_grow(ht);
+        if (ht->count >= ht->max) {
+            /* Really full */
+            return NULL;
+        }
+    }
+    slot = flat_insert(ht, hash);
+    slot->hash = hash;
+    slot->klen = klen;
+    slot->key = key;
+    slot->val = val;
+    ht->count++;
+    return slot;
+}
+
+static void *flat_set(apr_hash_t *ht, const void *key, apr_ssize_t klen,
+                      const void *val, int replace)
+{
+    apr_hash_slot_t *slot;
+    unsigned int hash;
+
+    hash = hash_key(ht, key, &klen);
+    slot = flat_find(ht, key, klen, hash);
+    if (slot) {
+        if (!replace)
+            return (void *)slot->val;
+        if (val)
+            slot->val = val;
+        else
+            flat_delete(ht, slot);
+        return (void *)val;
+    }
+    if (!val)
+        return NULL;
+
+    if (!flat_add(ht, key, klen, hash, val))
+        return NULL;
+    return (void *)val;
+}
+
 /*
  * This is where we keep the details of the hash function and control
  * the maximum collision rate.
@@ -282,35 +770,42 @@ APR_DECLARE_NONSTD(unsigned int) apr_hashfunc_default(const char *char_key,
  * that hash entries can be removed.
  */
 
-static apr_hash_entry_t **find_entry(apr_hash_t *ht,
-                                     const void *key,
-                                     apr_ssize_t klen,
-                                     const void *val)
+static APR_INLINE apr_hash_entry_t **find_bucket(const apr_hash_t *ht,
+                                                  unsigned int hash)
 {
-    apr_hash_entry_t **hep, *he;
-    unsigned int hash;
-
-    if (ht->hash_func)
-        hash = ht->hash_func(key, &klen);
+    /* the old bucket if not moved yet, while growing incrementally */
+    if (ht->old_array && (hash & ht->old_max) >= ht->rehash)
+        return &ht->old_array[hash & ht->old_max];
     else
-        hash = hashfunc_default(key, &klen, ht->seed);
+        return &ht->array[hash & ht->max];
+}
+
+static APR_INLINE apr_hash_entry_t **find_hashed(const apr_hash_t *ht,
+                                                 const void *key,
+                                                 apr_ssize_t klen,
+                                                 unsigned int hash)
+{
+    apr_hash_entry_t **hep, *he;
 
     /* scan linked list */
-    for (hep = &ht->array[hash & ht->max], he = *hep;
+    for (hep = find_bucket(ht, hash), he = *hep;
          he; hep = &he->next, he = *hep) {
         if (he->hash == hash
             && he->klen == klen
             && memcmp(he->key, key, klen) == 0)
             break;
     }
-    if (he || !val)
-        return hep;
+    return hep;
+}
 
-    /* add a new entry for non-NULL values */
-    if ((he = ht->free) != NULL)
-        ht->free = he->next;
-    else
-        he = apr_palloc(ht->pool, sizeof(*he));
+/* Add an entry at the end of the chain found by find_hashed() */
+static void add_entry(apr_hash_t *ht, apr_hash_entry_t **hep,
+                      const void *key, apr_ssize_t klen, unsigned int hash,
+                      const void *val)
+{
+    apr_hash_entry_t *he;
+
+    he = alloc_entry(ht);
     he->next = NULL;
     he->hash = hash;
     he->key  = key;
@@ -318,6 +813,24 @@ static apr_hash_entry_t **find_entry(apr_hash_t *ht,
     he->val  = val;
     *hep = he;
     ht->count++;
+}
+
+static apr_hash_entry_t **find_entry(apr_hash_t *ht,
+                                     const void *key,
+                                     apr_ssize_t klen,
+                                     const void *val)
+{
+    apr_hash_entry_t **hep, *he;
+    unsigned int hash;
+
+    hash = hash_key(ht, key, &klen);
+    hep = find_hashed(ht, key, klen, hash);
+    he = *hep;
+    if (he || !val)
+        return hep;
+
+    /* add a new entry for non-NULL values */
+    add_entry(ht, hep, key, klen, hash, val);
     return hep;
 }
 
@@ -325,28 +838,49 @@ APR_DECLARE(apr_hash_t *) apr_hash_copy(apr_pool_t *pool,
                                         const apr_hash_t *orig)
 {
     apr_hash_t *ht;
-    apr_hash_entry_t *new_vals;
-    unsigned int i, j;
+    unsigned int i;
+
+    if (orig->ctrl) {
+        ht = apr_palloc(pool, sizeof(apr_hash_t));
+        ht->pool = pool;
+        ht->array = NULL;
+        ht->old_array = NULL;
+        ht->rehash_step = 0;
+        ht->entries = NULL;
+        ht->count = orig->count;
+        ht->seed = orig->seed;
+        ht->hash_func = orig->hash_func;
+        ht->algo = orig->algo;
+        memcpy(ht->key, orig->key, sizeof(ht->key));
+        if (!alloc_flat(ht, orig->max)) {
+            return NULL;
+        }
+        memcpy(ht->ctrl, orig->ctrl, ht->max + 1);
+        memcpy(ht->slots, orig->slots, sizeof(*ht->slots) * (ht->max + 1));
+        return ht;
+    }
 
     ht = apr_palloc(pool, sizeof(apr_hash_t) +
-                    sizeof(*ht->array) * (orig->max + 1) +
-                    sizeof(apr_hash_entry_t) * orig->count);
+                    sizeof(*ht->array) * (orig->max + 1));
     ht->pool = pool;
-    ht->free = NULL;
+    ht->entries = NULL;
     ht->count = orig->count;
     ht->max = orig->max;
     ht->seed = orig->seed;
     ht->hash_func = orig->hash_func;
+    ht->algo = orig->algo;
+    memcpy(ht->key, orig->key, sizeof(ht->key));
+    ht->ctrl = NULL;
+    ht->slots = NULL;
     ht->array = (apr_hash_entry_t **)((char *)ht + sizeof(apr_hash_t));
+    ht->old_array = NULL;
+    ht->rehash_step = orig->rehash_step;
 
-    new_vals = (apr_hash_entry_t *)((char *)(ht) + sizeof(apr_hash_t) +
-                                    sizeof(*ht->array) * (orig->max + 1));
-    j = 0;
     for (i = 0; i <= ht->max; i++) {
         apr_hash_entry_t **new_entry = &(ht->array[i]);
         apr_hash_entry_t *orig_entry = orig->array[i];
         while (orig_entry) {
-            *new_entry = &new_vals[j++];
+            *new_entry = alloc_entry(ht);
             (*new_entry)->hash = orig_entry->hash;
             (*new_entry)->key = orig_entry->key;
             (*new_entry)->klen = orig_entry->klen;
@@ -356,6 +890,22 @@ APR_DECLARE(apr_hash_t *) apr_hash_copy(apr_pool_t *pool,
         }
         *new_entry = NULL;
     }
+
+    /* the entries not moved yet go to their new bucket in the copy */
+    for (i = ht->max + 1; i < chains_count(orig); i++) {
+        apr_hash_entry_t *orig_entry, *new_entry;
+        for (orig_entry = chain_at(orig, i); orig_entry;
+             orig_entry = orig_entry->next) {
+            unsigned int j = orig_entry->hash & ht->max;
+            new_entry = alloc_entry(ht);
+            new_entry->hash = orig_entry->hash;
+            new_entry->key = orig_entry->key;
+            new_entry->klen = orig_entry->klen;
+            new_entry->val = orig_entry->val;
+            new_entry->next = ht->array[j];
+            ht->array[j] = new_entry;
+        }
+    }
     return ht;
 }
 
@@ -364,6 +914,15 @@ APR_DECLARE(void *) apr_hash_get(apr_hash_t *ht,
                                  apr_ssize_t klen)
 {
     apr_hash_entry_t *he;
+
+    if (ht->ctrl) {
+        apr_hash_slot_t *slot;
+        unsigned int hash = hash_key(ht, key, &klen);
+
+        slot = flat_find(ht, key, klen, hash);
+        return slot ? (void *)slot->val : NULL;
+    }
+
     he = *find_entry(ht, key, klen, NULL);
     if (he)
         return (void *)he->val;
@@ -371,20 +930,89 @@ APR_DECLARE(void *) apr_hash_get(apr_hash_t *ht,
         return NULL;
 }
 
+#if defined(__GNUC__)
+#define HASH_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define HASH_PREFETCH(addr)
+#endif
+
+/* The number of keys hashed and prefetched at once by apr_hash_get_many() */
+#define GET_MANY_BATCH 16
+
+APR_DECLARE(apr_size_t) apr_hash_get_many(apr_hash_t *ht,
+                                          const void *const *keys,
+                                          const apr_ssize_t *klens,
+                                          void **vals, apr_size_t n)
+{
+    unsigned int hashes[GET_MANY_BATCH];
+    apr_ssize_t lens[GET_MANY_BATCH];
+    apr_size_t i, j, m, found = 0;
+
+    for (i = 0; i < n; i += m) {
+        m = (n - i < GET_MANY_BATCH) ? n - i : GET_MANY_BATCH;
+
+        /* hash the whole batch and prefetch where each key should be */
+        for (j = 0; j < m; j++) {
+            lens[j] = klens ? klens[i + j] : APR_HASH_KEY_STRING;
+            hashes[j] = hash_key(ht, keys[i + j], &lens[j]);
+            if (ht->ctrl) {
+                unsigned int g = hashes[j] & (ht->max / FLAT_GROUP);
+                HASH_PREFETCH(ht->ctrl + g * FLAT_GROUP);
+                HASH_PREFETCH(ht->slots + g * FLAT_GROUP);
+            }
+            else {
+                HASH_PREFETCH(find_bucket(ht, hashes[j]));
+            }
+        }
+        if (!ht->ctrl) {
+            /* then the first entry of each chain */
+            for (j = 0; j < m; j++) {
+                HASH_PREFETCH(*find_bucket(ht, hashes[j]));
+            }
+        }
+
+        for (j = 0; j < m; j++) {
+            const void *val = NULL;
+            if (ht->ctrl) {
+                apr_hash_slot_t *slot;
+                slot = flat_find(ht, keys[i + j], lens[j], hashes[j]);
+                if (slot)
+                    val = slot->val;
+            }
+            else {
+                apr_hash_entry_t *he;
+                he = *find_hashed(ht, keys[i + j], lens[j], hashes[j]);
+                if (he)
+                    val = he->val;
+            }
+            vals[i + j] = (void *)val;
+            if (val)
+                found++;
+        }
+    }
+    return found;
+}
+
 APR_DECLARE(void) apr_hash_set(apr_hash_t *ht,
                                const void *key,
                                apr_ssize_t klen,
                                const void *val)
 {
     apr_hash_entry_t **hep;
+    unsigned int count = ht->count;
+
+    if (ht->ctrl) {
+        flat_set(ht, key, klen, val, 1);
+        return;
+    }
+
     hep = find_entry(ht, key, klen, val);
     if (*hep) {
         if (!val) {
             /* delete entry */
             apr_hash_entry_t *old = *hep;
             *hep = (*hep)->next;
-            old->next = ht->free;
-            ht->free = old;
+            apr_slab_free(ht->entries, old);
             --ht->count;
         }
         else {
@@ -394,6 +1022,9 @@ APR_DECLARE(void) apr_hash_set(apr_hash_t *ht,
             if (ht->count > ht->max) {
                 expand_array(ht);
             }
+            else if (ht->old_array && ht->count != count) {
+                rehash_buckets(ht, ht->rehash_step);
+            }
         }
     }
     /* else key not present and val==NULL */
@@ -405,6 +1036,11 @@ APR_DECLARE(void *) apr_hash_get_or_set(apr_hash_t *ht,
                                         const void *val)
 {
     apr_hash_entry_t **hep;
+    unsigned int count = ht->count;
+
+    if (ht->ctrl)
+        return flat_set(ht, key, klen, val, 0);
+
     hep = find_entry(ht, key, klen, val);
     if (*hep) {
         val = (*hep)->val;
@@ -412,6 +1048,9 @@ APR_DECLARE(void *) apr_hash_get_or_set(apr_hash_t *ht,
         if (ht->count > ht->max) {
             expand_array(ht);
         }
+        else if (ht->old_array && ht->count != count) {
+            rehash_buckets(ht, ht->rehash_step);
+        }
         return (void *)val;
     }
     /* else key not present and val==NULL */
@@ -426,8 +1065,143 @@ APR_DECLARE(unsigned int) apr_hash_count(apr_hash_t *ht)
 APR_DECLARE(void) apr_hash_clear(apr_hash_t *ht)
 {
     apr_hash_index_t *hi;
+
+    if (ht->ctrl) {
+        memset(ht->ctrl, FLAT_EMPTY, ht->max + 1);
+        ht->count = 0;
+        return;
+    }
+
     for (hi = apr_hash_first(NULL, ht); hi; hi = apr_hash_next(hi))
         apr_hash_set(ht, hi->this->key, hi->this->klen, NULL);
+
+    /* nothing left to move */
+    ht->old_array = NULL;
+}
+
+APR_DECLARE(apr_status_t) apr_hash_incremental_set(apr_hash_t *ht,
+                                                   unsigned int step)
+{
+    if (ht->ctrl) {
+        return APR_ENOTIMPL;
+    }
+    if (!step && ht->old_array) {
+        rehash_buckets(ht, ht->old_max + 1);
+    }
+    ht->rehash_step = step;
+    return APR_SUCCESS;
+}
+
+APR_DECLARE(apr_status_t) apr_hash_algo_default_set(int algo)
+{
+    if (algo != APR_HASH_ALGO_TIMES33 && algo != APR_HASH_ALGO_SIPHASH13) {
+        return APR_EINVAL;
+    }
+    hash_algo_default = algo;
+    return APR_SUCCESS;
+}
+
+APR_DECLARE(apr_status_t) apr_hash_algo_set(apr_hash_t *ht, int algo)
+{
+    if (algo != APR_HASH_ALGO_TIMES33 && algo != APR_HASH_ALGO_SIPHASH13) {
+        return APR_EINVAL;
+    }
+    if (ht->count) {
+        return APR_EBUSY;
+    }
+    init_algo(ht, algo);
+    return APR_SUCCESS;
+}
+
+/* Set the (merged) value of an overlay's entry in the result of a merge,
+ * which unlike apr_hash_set() keeps the entry if the value is NULL.
+ */
+static void merge_set(apr_pool_t *p, apr_hash_t *res,
+                      const void *key, apr_ssize_t klen, const void *val,
+                      void * (*merger)(apr_pool_t *p,
+                                       const void *key,
+                                       apr_ssize_t klen,
+                                       const void *h1_val,
+                                       const void *h2_val,
+                                       const void *data),
+                      const void *data)
+{
+    apr_hash_entry_t **hep;
+    apr_hash_slot_t *slot;
+    unsigned int hash, count = res->count;
+
+    hash = hash_key(res, key, &klen);
+
+    if (res->ctrl) {
+        slot = flat_find(res, key, klen, hash);
+        if (!slot) {
+            flat_add(res, key, klen, hash, val);
+        }
+        else if (merger) {
+            slot->val = (*merger)(p, key, klen, val, slot->val, data);
+        }
+        else {
+            slot->val = val;
+        }
+        return;
+    }
+
+    hep = find_hashed(res, key, klen, hash);
+    if (!*hep) {
+        add_entry(res, hep, key, klen, hash, val);
+        /* check that the collision rate isn't too high */
+        if (res->count > res->max) {
+            expand_array(res);
+        }
+        else if (res->old_array && res->count != count) {
+            rehash_buckets(res, res->rehash_step);
+        }
+    }
+    else if (merger) {
+        (*hep)->val = (*merger)(p, key, klen, val, (*hep)->val, data);
+    }
+    else {
+        (*hep)->val = val;
+    }
+}
+
+/* Merge by copying base and setting the entries of overlay in the copy,
+ * when either is flat (the result has the layout of base).
+ */
+static apr_hash_t *merge_generic(apr_pool_t *p,
+                                 const apr_hash_t *overlay,
+                                 const apr_hash_t *base,
+                                 void * (*merger)(apr_pool_t *p,
+                                                  const void *key,
+                                                  apr_ssize_t klen,
+                                                  const void *h1_val,
+                                                  const void *h2_val,
+                                                  const void *data),
+                                 const void *data)
+{
+    apr_hash_t *res;
+    apr_hash_index_t hix, *hi;
+    const void *key;
+    apr_ssize_t klen;
+    void *val;
+
+    res = apr_hash_copy(p, base);
+    if (!res) {
+        return NULL;
+    }
+
+    hix.ht = (apr_hash_t *)overlay;
+    hix.index = 0;
+    hix.this = NULL;
+    hix.next = NULL;
+    if (overlay->ctrl)
+        flat_first_index(&hix);
+    for (hi = apr_hash_next(&hix); hi; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, &key, &klen, &val);
+        merge_set(p, res, key, klen, val, merger, data);
+    }
+
+    return res;
 }
 
 APR_DECLARE(apr_hash_t*) apr_hash_overlay(apr_pool_t *p,
@@ -449,10 +1223,9 @@ APR_DECLARE(apr_hash_t *) apr_hash_merge(apr_pool_t *p,
                                          const void *data)
 {
     apr_hash_t *res;
-    apr_hash_entry_t *new_vals = NULL;
     apr_hash_entry_t *iter;
     apr_hash_entry_t *ent;
-    unsigned int i, j, k, hash;
+    unsigned int i, k, hash;
 
 #if APR_POOL_DEBUG
     /* we don't copy keys and values, so it's necessary that
@@ -471,9 +1244,17 @@ APR_DECLARE(apr_hash_t *) apr_hash_merge(apr_pool_t *p,
     }
 #endif
 
+    if (base->ctrl || overlay->ctrl) {
+        return merge_generic(p, overlay, base, merger, data);
+    }
+
     res = apr_palloc(p, sizeof(apr_hash_t));
     res->pool = p;
-    res->free = NULL;
+    res->entries = NULL;
+    res->ctrl = NULL;
+    res->slots = NULL;
+    res->old_array = NULL;
+    res->rehash_step = base->rehash_step;
     res->hash_func = base->hash_func;
     res->count = base->count;
     res->max = (overlay->max > base->max) ? overlay->max : base->max;
@@ -481,31 +1262,25 @@ APR_DECLARE(apr_hash_t *) apr_hash_merge(apr_pool_t *p,
         res->max = res->max * 2 + 1;
     }
     res->seed = base->seed;
+    res->algo = base->algo;
+    memcpy(res->key, base->key, sizeof(res->key));
     res->array = alloc_array(res, res->max);
-    if (base->count + overlay->count) {
-        new_vals = apr_palloc(p, sizeof(apr_hash_entry_t) *
-                              (base->count + overlay->count));
-    }
-    j = 0;
-    for (k = 0; k <= base->max; k++) {
-        for (iter = base->array[k]; iter; iter = iter->next) {
+    for (k = 0; k < chains_count(base); k++) {
+        for (iter = chain_at(base, k); iter; iter = iter->next) {
             i = iter->hash & res->max;
-            new_vals[j].klen = iter->klen;
-            new_vals[j].key = iter->key;
-            new_vals[j].val = iter->val;
-            new_vals[j].hash = iter->hash;
-            new_vals[j].next = res->array[i];
-            res->array[i] = &new_vals[j];
-            j++;
+            ent = alloc_entry(res);
+            ent->klen = iter->klen;
+            ent->key = iter->key;
+            ent->val = iter->val;
+            ent->hash = iter->hash;
+            ent->next = res->array[i];
+            res->array[i] = ent;
         }
     }
 
-    for (k = 0; k <= overlay->max; k++) {
-        for (iter = overlay->array[k]; iter; iter = iter->next) {
-            if (res->hash_func)
-                hash = res->hash_func(iter->key, &iter->klen);
-            else
-                hash = hashfunc_default(iter->key, &iter->klen, res->seed);
+    for (k = 0; k < chains_count(overlay); k++) {
+        for (iter = chain_at(overlay, k); iter; iter = iter->next) {
+            hash = hash_key(res, iter->key, &iter->klen);
             i = hash & res->max;
             for (ent = res->array[i]; ent; ent = ent->next) {
                 if ((ent->klen == iter->klen) &&
@@ -521,14 +1296,14 @@ APR_DECLARE(apr_hash_t *) apr_hash_merge(apr_pool_t *p,
                 }
             }
             if (!ent) {
-                new_vals[j].klen = iter->klen;
-                new_vals[j].key = iter->key;
-                new_vals[j].val = iter->val;
-                new_vals[j].hash = hash;
-                new_vals[j].next = res->array[i];
-                res->array[i] = &new_vals[j];
+                ent = alloc_entry(res);
+                ent->klen = iter->klen;
+                ent->key = iter->key;
+                ent->val = iter->val;
+                ent->hash = hash;
+                ent->next = res->array[i];
+                res->array[i] = ent;
                 res->count++;
-                j++;
             }
         }
     }
@@ -554,11 +1329,18 @@ APR_DECLARE(int) apr_hash_do(apr_hash_do_callback_fn_t *comp,
     hix.index = 0;
     hix.this  = NULL;
     hix.next  = NULL;
+    if (ht->ctrl)
+        flat_first_index(&hix);
 
     if ((hi = apr_hash_next(&hix))) {
         /* Scan the entire table */
         do {
-            rv = (*comp)(rec, hi->this->key, hi->this->klen, hi->this->val);
+            const void *key;
+            apr_ssize_t klen;
+            void *val;
+
+            apr_hash_this(hi, &key, &klen, &val);
+            rv = (*comp)(rec, key, klen, val);
         } while (rv && (hi = apr_hash_next(hi)));
 
         if (rv == 0) {
@@ -24,6 +24,7 @@
  */
 
 #include "apr_skiplist.h"
+#include "apr_slab.h"
 
 typedef struct {
     apr_skiplistnode **data;
@@ -44,6 +45,7 @@ struct apr_skiplist {
     apr_skiplistnode *bottomend;
     apr_skiplist *index;
     apr_array_header_t *memlist;
+    int memlast; /* the memlist entry used last */
     apr_skiplist_q nodes_q,
                    stack_q;
     apr_pool_t *pool;
@@ -73,56 +75,55 @@ static int get_b_rand(void)
 
 typedef struct {
     size_t size;
-    apr_array_header_t *list;
+    apr_slab_t *slab;
 } memlist_t;
 
-typedef struct {
-    void *ptr;
-    char inuse;
-} chunk_t;
+/* The memory given by apr_skiplist_alloc() is prefixed with the slab it
+ * comes from, so that apr_skiplist_free() does not have to look for it.
+ */
+#define MEMLIST_HDR_SIZE APR_ALIGN_DEFAULT(sizeof(apr_slab_t *))
 
 APR_DECLARE(void *) apr_skiplist_alloc(apr_skiplist *sl, size_t size)
 {
     if (sl->pool) {
-        void *ptr;
-        int found_size = 0;
+        char *ptr;
+        apr_slab_t *slab = NULL;
         int i;
-        chunk_t *newchunk;
         memlist_t *memlist = (memlist_t *)sl->memlist->elts;
-        for (i = 0; i < sl->memlist->nelts; i++) {
-            if (memlist->size == size) {
-                int j;
-                chunk_t *chunk = (chunk_t *)memlist->list->elts;
-                found_size = 1;
-                for (j = 0; j < memlist->list->nelts; j++) {
-                    if (!chunk->inuse) {
-                        chunk->inuse = 1;
-                        return chunk->ptr;
-                    }
-                    chunk++;
+        /* Mostly the same size(s) again, as with a queue of timers */
+        if (sl->memlast < sl->memlist->nelts
+                && memlist[sl->memlast].size == size) {
+            slab = memlist[sl->memlast].slab;
+        }
+        else {
+            for (i = 0; i < sl->memlist->nelts; i++) {
+                if (memlist[i].size == size) {
+                    slab = memlist[i].slab;
+                    sl->memlast = i;
+                    break;
                 }
-                break; /* no free of this size; punt */
             }
-            memlist++;
-        }
-        /* no free chunks */
-        ptr = apr_palloc(sl->pool, size);
-        if (!ptr) {
-            return ptr;
         }
         /*
          * is this a new sized chunk? If so, we need to create a new
-         * array of them. Otherwise, re-use what we already have.
+         * slab for them. Otherwise, re-use what we already have.
          */
-        if (!found_size) {
+        if (!slab) {
+            if (apr_slab_create(&slab, MEMLIST_HDR_SIZE + size, 0,
+                                sl->pool) != APR_SUCCESS) {
+                return NULL;
+            }
+            sl->memlast = sl->memlist->nelts;
             memlist = apr_array_push(sl->memlist);
             memlist->size = size;
-            memlist->list = apr_array_make(sl->pool, 20, sizeof(chunk_t));
+            memlist->slab = slab;
         }
-        newchunk = apr_array_push(memlist->list);
-        newchunk->ptr = ptr;
-        newchunk->inuse = 1;
-        return ptr;
+        ptr = apr_slab_alloc(slab);
+        if (!ptr) {
+            return ptr;
+        }
+        *(apr_slab_t **)ptr = slab;
+        return ptr + MEMLIST_HDR_SIZE;
     }
     else {
         return malloc(size);
@@ -134,21 +135,9 @@ APR_DECLARE(void) apr_skiplist_free(apr_skiplist *sl, void *mem)
     if (!sl->pool) {
         free(mem);
     }
-    else {
-        int i;
-        memlist_t *memlist = (memlist_t *)sl->memlist->elts;
-        for (i = 0; i < sl->memlist->nelts; i++) {
-            int j;
-            chunk_t *chunk = (chunk_t *)memlist->list->elts;
-            for (j = 0; j < memlist->list->nelts; j++) {
-                if (chunk->ptr == mem) {
-                    chunk->inuse = 0;
-                    return;
-                }
-                chunk++;
-            }
-            memlist++;
-        }
+    else if (mem) {
+        char *ptr = (char *)mem - MEMLIST_HDR_SIZE;
+        apr_slab_free(*(apr_slab_t **)ptr, ptr);
     }
 }
 
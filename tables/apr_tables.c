@@ -28,15 +28,13 @@
 #include "apr_tables.h"
 #include "apr_strings.h"
 #include "apr_lib.h"
+#include "apr_cstr.h"
 #if APR_HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
 #if APR_HAVE_STRING_H
 #include <string.h>
 #endif
-#if APR_HAVE_STRINGS_H
-#include <strings.h>
-#endif
 
 #if (APR_POOL_DEBUG || defined(MAKE_TABLE_PROFILE)) && APR_HAVE_STDIO_H
 #include <stdio.h>
@@ -303,7 +301,7 @@ APR_DECLARE(char *) apr_array_pstrcat(apr_pool_t *p,
  * 4 bytes, normalized for case-insensitivity and packed into
  * an int...this checksum allows us to do a single integer
  * comparison as a fast check to determine whether we can
- * skip a strcasecmp
+ * skip a case-insensitive comparison
  */
 #define COMPUTE_KEY_CHECKSUM(key, checksum)    \
 {                                              \
@@ -328,6 +326,30 @@ APR_DECLARE(char *) apr_array_pstrcat(apr_pool_t *p,
     checksum &= CASE_MASK;                     \
 }
 
+/* Tables with more elements than this also get an index of their whole
+ * keys, see struct apr_table_t (tunable).
+ */
+#ifndef TABLE_FULL_INDEX_MIN
+#define TABLE_FULL_INDEX_MIN 64
+#endif
+
+/* How many entries of a key apr_table_unset() fixes the indexes up for,
+ * they are rebuilt beyond (tunable).
+ */
+#ifndef TABLE_UNSET_FIXUP
+#define TABLE_UNSET_FIXUP 8
+#endif
+
+/** A slot of the full key index */
+typedef struct table_slot_t {
+    /** The hash of the key, case-insensitively */
+    apr_uint32_t hash;
+    /** The offset of the first entry with the key */
+    int first;
+    /** The number of entries with the key, zero if the slot is free */
+    int count;
+} table_slot_t;
+
 /** The opaque string-content table type */
 struct apr_table_t {
     /* This has to be first to promote backwards compatibility with
@@ -355,6 +377,20 @@ struct apr_table_t {
     apr_uint32_t index_initialized;
     int index_first[TABLE_HASH_SIZE];
     int index_last[TABLE_HASH_SIZE];
+    /* Past TABLE_FULL_INDEX_MIN elements, the chains of the above index
+     * get long (think of the "Content-" or "X-" headers), so the whole
+     * keys are indexed too:
+     *   - the slot of a key is found by linear probing from
+     *     index_slots[hash & index_mask], where hash is the
+     *     case-insensitive hash of the key, and up to the first free
+     *     slot if the key is not in the table
+     *   - index_mask is zero if the table is not indexed (yet), and
+     *     index_nslots is the number of slots allocated anyway
+     */
+    table_slot_t *index_slots;
+    int index_nslots;
+    int index_mask;
+    int index_keys;
 };
 
 /* keep state for apr_table_getm() */
@@ -387,6 +423,133 @@ static apr_table_entry_t *do_table_push(const char *func, apr_table_t *t)
 #define table_push(t)	((apr_table_entry_t *) apr_array_push_noclear(&(t)->a))
 #endif /* MAKE_TABLE_PROFILE */
 
+/* Find the slot of key in the full index, or the free one where it
+ * would go.
+ */
+static APR_INLINE table_slot_t *table_index_find(const apr_table_t *t,
+                                                 const char *key,
+                                                 apr_uint32_t hash,
+                                                 apr_uint32_t checksum)
+{
+    const apr_table_entry_t *elts = (const apr_table_entry_t *)t->a.elts;
+    table_slot_t *slot;
+    int i = hash & t->index_mask;
+
+    for (;;) {
+        slot = &t->index_slots[i];
+        if (!slot->count
+            || (slot->hash == hash
+                && elts[slot->first].key_checksum == checksum
+                && !apr_cstr_casecmp(elts[slot->first].key, key))) {
+            return slot;
+        }
+        i = (i + 1) & t->index_mask;
+    }
+}
+
+static void table_index_build(apr_table_t *t);
+
+/* Account for the element at offset i in the full index, given the slot
+ * (and hash) of its key if already found, or NULL.  Tables which are not
+ * indexed yet get their index once they are big enough, so i must be the
+ * last element then.
+ */
+static void table_index_add(apr_table_t *t, table_slot_t *slot,
+                            apr_uint32_t hash, int i)
+{
+    const apr_table_entry_t *elt = (const apr_table_entry_t *)t->a.elts + i;
+
+    if (!t->index_mask) {
+        if (t->a.nelts > TABLE_FULL_INDEX_MIN) {
+            table_index_build(t);
+        }
+        return;
+    }
+    if (!slot) {
+        hash = apr_cstr_casehash(elt->key);
+        slot = table_index_find(t, elt->key, hash, elt->key_checksum);
+    }
+    if (!slot->count++) {
+        slot->hash = hash;
+        slot->first = i;
+        /* Keep half of the slots free at least */
+        if (++t->index_keys * 2 > t->index_mask + 1) {
+            table_index_build(t);
+        }
+    }
+}
+
+/* The new offset of the element at offset i once the n elements at the
+ * (increasing) offsets removed are gone, or of the next one if it's gone
+ * too.
+ */
+static APR_INLINE int table_moved(int i, const int *removed, int n)
+{
+    int k = 0;
+
+    while (k < n && removed[k] < i) {
+        k++;
+    }
+    return i - k;
+}
+
+/* Forget the key of slot in the full index, the n elements it had at the
+ * offsets removed being gone from the table already.
+ */
+static void table_index_remove(apr_table_t *t, table_slot_t *slot,
+                               const int *removed, int n)
+{
+    table_slot_t *slots = t->index_slots;
+    int mask = t->index_mask;
+    int i, j, k;
+
+    /* Fill the hole with the next keys of the probe sequence which
+     * can't be found past it otherwise.
+     */
+    i = (int)(slot - slots);
+    for (j = (i + 1) & mask; slots[j].count; j = (j + 1) & mask) {
+        k = slots[j].hash & mask;
+        if (j > i ? (k <= i || k > j) : (k <= i && k > j)) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i].count = 0;
+    t->index_keys--;
+
+    /* The free slots don't care about their offset */
+    if (n == 1) {
+        for (i = 0; i <= mask; i++) {
+            slots[i].first -= (slots[i].first > removed[0]);
+        }
+    }
+    else {
+        for (i = 0; i <= mask; i++) {
+            slots[i].first = table_moved(slots[i].first, removed, n);
+        }
+    }
+}
+
+static void table_index_build(apr_table_t *t)
+{
+    int nslots = TABLE_FULL_INDEX_MIN * 2;
+    int i;
+
+    while (nslots < t->a.nelts * 2) {
+        nslots *= 2;
+    }
+    if (nslots > t->index_nslots) {
+        t->index_slots = apr_palloc(t->a.pool, nslots * sizeof(table_slot_t));
+        t->index_nslots = nslots;
+    }
+    memset(t->index_slots, 0, nslots * sizeof(table_slot_t));
+    t->index_mask = nslots - 1;
+    t->index_keys = 0;
+    for (i = 0; i < t->a.nelts; i++) {
+        table_index_add(t, NULL, 0, i);
+    }
+}
+
 APR_DECLARE(const apr_array_header_t *) apr_table_elts(const apr_table_t *t)
 {
     return (const apr_array_header_t *)t;
@@ -406,6 +569,9 @@ APR_DECLARE(apr_table_t *) apr_table_make(apr_pool_t *p, int nelts)
     t->creator = __builtin_return_address(0);
 #endif
     t->index_initialized = 0;
+    t->index_slots = NULL;
+    t->index_nslots = 0;
+    t->index_mask = 0;
     return t;
 }
 
@@ -428,6 +594,17 @@ APR_DECLARE(apr_table_t *) apr_table_copy(apr_pool_t *p, const apr_table_t *t)
     memcpy(new->index_first, t->index_first, sizeof(int) * TABLE_HASH_SIZE);
     memcpy(new->index_last, t->index_last, sizeof(int) * TABLE_HASH_SIZE);
     new->index_initialized = t->index_initialized;
+    new->index_slots = NULL;
+    new->index_nslots = 0;
+    new->index_mask = t->index_mask;
+    if (t->index_mask) {
+        /* Same offsets */
+        new->index_nslots = t->index_mask + 1;
+        new->index_slots = apr_pmemdup(p, t->index_slots,
+                                       sizeof(table_slot_t)
+                                       * new->index_nslots);
+        new->index_keys = t->index_keys;
+    }
     return new;
 }
 
@@ -460,12 +637,62 @@ static void table_reindex(apr_table_t *t)
             TABLE_SET_INDEX_INITIALIZED(t, hash);
         }
     }
+
+    if (t->a.nelts > TABLE_FULL_INDEX_MIN) {
+        table_index_build(t);
+    }
+    else {
+        t->index_mask = 0;
+    }
+}
+
+/* Fix the indexes of a big table up once the n elements of the key at the
+ * offsets removed are gone, hash and slot being where the key was indexed.
+ * This is cheaper than table_reindex() hashing all the keys again.
+ */
+static void table_unindex(apr_table_t *t, int hash, table_slot_t *slot,
+                          const int *removed, int n)
+{
+    const apr_table_entry_t *elts = (const apr_table_entry_t *)t->a.elts;
+    int h, i, end;
+
+    for (h = 0; h < TABLE_HASH_SIZE; h++) {
+        if (h != hash && TABLE_INDEX_IS_INITIALIZED(t, h)) {
+            t->index_first[h] = table_moved(t->index_first[h], removed, n);
+            t->index_last[h] = table_moved(t->index_last[h], removed, n);
+        }
+    }
+
+    /* Other keys may remain with the same hash, in between */
+    i = table_moved(t->index_first[hash], removed, n);
+    end = table_moved(t->index_last[hash] + 1, removed, n);
+    while (i < end && TABLE_HASH(elts[i].key) != hash) {
+        i++;
+    }
+    if (i < end) {
+        t->index_first[hash] = i;
+        while (TABLE_HASH(elts[end - 1].key) != hash) {
+            end--;
+        }
+        t->index_last[hash] = end - 1;
+    }
+    else {
+        t->index_initialized &= ~(1 << hash);
+    }
+
+    if (t->a.nelts > TABLE_FULL_INDEX_MIN) {
+        table_index_remove(t, slot, removed, n);
+    }
+    else {
+        t->index_mask = 0;
+    }
 }
 
 APR_DECLARE(void) apr_table_clear(apr_table_t *t)
 {
     t->a.nelts = 0;
     t->index_initialized = 0;
+    t->index_mask = 0;
 }
 
 APR_DECLARE(const char *) apr_table_get(const apr_table_t *t, const char *key)
@@ -484,12 +711,21 @@ APR_DECLARE(const char *) apr_table_get(const apr_table_t *t, const char *key)
         return NULL;
     }
     COMPUTE_KEY_CHECKSUM(key, checksum);
+    if (t->index_mask) {
+        table_slot_t *slot = table_index_find(t, key,
+                                              apr_cstr_casehash(key),
+                                              checksum);
+        if (!slot->count) {
+            return NULL;
+        }
+        return ((apr_table_entry_t *) t->a.elts)[slot->first].val;
+    }
     next_elt = ((apr_table_entry_t *) t->a.elts) + t->index_first[hash];;
     end_elt = ((apr_table_entry_t *) t->a.elts) + t->index_last[hash];
 
     for (; next_elt <= end_elt; next_elt++) {
 	if ((checksum == next_elt->key_checksum) &&
-            !strcasecmp(next_elt->key, key)) {
+            !apr_cstr_casecmp(next_elt->key, key)) {
 	    return next_elt->val;
 	}
     }
@@ -504,6 +740,8 @@ APR_DECLARE(void) apr_table_set(apr_table_t *t, const char *key,
     apr_table_entry_t *end_elt;
     apr_table_entry_t *table_end;
     apr_uint32_t checksum;
+    apr_uint32_t khash = 0;
+    table_slot_t *slot = NULL;
     int hash;
 
     COMPUTE_KEY_CHECKSUM(key, checksum);
@@ -513,13 +751,26 @@ APR_DECLARE(void) apr_table_set(apr_table_t *t, const char *key,
         TABLE_SET_INDEX_INITIALIZED(t, hash);
         goto add_new_elt;
     }
+    if (t->index_mask) {
+        khash = apr_cstr_casehash(key);
+        slot = table_index_find(t, key, khash, checksum);
+        if (!slot->count) {
+            goto add_new_elt;
+        }
+        if (slot->count == 1) {
+            next_elt = ((apr_table_entry_t *) t->a.elts) + slot->first;
+            next_elt->val = apr_pstrdup(t->a.pool, val);
+            return;
+        }
+        /* Remove the other instances below */
+    }
     next_elt = ((apr_table_entry_t *) t->a.elts) + t->index_first[hash];;
     end_elt = ((apr_table_entry_t *) t->a.elts) + t->index_last[hash];
     table_end =((apr_table_entry_t *) t->a.elts) + t->a.nelts;
 
     for (; next_elt <= end_elt; next_elt++) {
 	if ((checksum == next_elt->key_checksum) &&
-            !strcasecmp(next_elt->key, key)) {
+            !apr_cstr_casecmp(next_elt->key, key)) {
 
             /* Found an existing entry with the same key, so overwrite it */
 
@@ -531,7 +782,7 @@ APR_DECLARE(void) apr_table_set(apr_table_t *t, const char *key,
             /* Remove any other instances of this key */
             for (next_elt++; next_elt <= end_elt; next_elt++) {
                 if ((checksum == next_elt->key_checksum) &&
-                    !strcasecmp(next_elt->key, key)) {
+                    !apr_cstr_casecmp(next_elt->key, key)) {
                     t->a.nelts--;
                     if (!dst_elt) {
                         dst_elt = next_elt;
@@ -567,6 +818,7 @@ add_new_elt:
     next_elt->key = apr_pstrdup(t->a.pool, key);
     next_elt->val = apr_pstrdup(t->a.pool, val);
     next_elt->key_checksum = checksum;
+    table_index_add(t, slot, khash, t->a.nelts - 1);
 }
 
 APR_DECLARE(void) apr_table_setn(apr_table_t *t, const char *key,
@@ -576,6 +828,8 @@ APR_DECLARE(void) apr_table_setn(apr_table_t *t, const char *key,
     apr_table_entry_t *end_elt;
     apr_table_entry_t *table_end;
     apr_uint32_t checksum;
+    apr_uint32_t khash = 0;
+    table_slot_t *slot = NULL;
     int hash;
 
     COMPUTE_KEY_CHECKSUM(key, checksum);
@@ -585,13 +839,26 @@ APR_DECLARE(void) apr_table_setn(apr_table_t *t, const char *key,
         TABLE_SET_INDEX_INITIALIZED(t, hash);
         goto add_new_elt;
     }
+    if (t->index_mask) {
+        khash = apr_cstr_casehash(key);
+        slot = table_index_find(t, key, khash, checksum);
+        if (!slot->count) {
+            goto add_new_elt;
+        }
+        if (slot->count == 1) {
+            next_elt = ((apr_table_entry_t *) t->a.elts) + slot->first;
+            next_elt->val = (char *)val;
+            return;
+        }
+        /* Remove the other instances below */
+    }
     next_elt = ((apr_table_entry_t *) t->a.elts) + t->index_first[hash];;
     end_elt = ((apr_table_entry_t *) t->a.elts) + t->index_last[hash];
     table_end =((apr_table_entry_t *) t->a.elts) + t->a.nelts;
 
     for (; next_elt <= end_elt; next_elt++) {
 	if ((checksum == next_elt->key_checksum) &&
-            !strcasecmp(next_elt->key, key)) {
+            !apr_cstr_casecmp(next_elt->key, key)) {
 
             /* Found an existing entry with the same key, so overwrite it */
 
@@ -603,7 +870,7 @@ APR_DECLARE(void) apr_table_setn(apr_table_t *t, const char *key,
             /* Remove any other instances of this key */
             for (next_elt++; next_elt <= end_elt; next_elt++) {
                 if ((checksum == next_elt->key_checksum) &&
-                    !strcasecmp(next_elt->key, key)) {
+                    !apr_cstr_casecmp(next_elt->key, key)) {
                     t->a.nelts--;
                     if (!dst_elt) {
                         dst_elt = next_elt;
@@ -639,6 +906,7 @@ add_new_elt:
     next_elt->key = (char *)key;
     next_elt->val = (char *)val;
     next_elt->key_checksum = checksum;
+    table_index_add(t, slot, khash, t->a.nelts - 1);
 }
 
 APR_DECLARE(void) apr_table_unset(apr_table_t *t, const char *key)
@@ -647,7 +915,11 @@ APR_DECLARE(void) apr_table_unset(apr_table_t *t, const char *key)
     apr_table_entry_t *end_elt;
     apr_table_entry_t *dst_elt;
     apr_uint32_t checksum;
+    table_slot_t *slot = NULL;
+    int removed[TABLE_UNSET_FIXUP];
+    int nremoved = 0;
     int hash;
+    int first;
     int must_reindex;
 
     hash = TABLE_HASH(key);
@@ -655,23 +927,41 @@ APR_DECLARE(void) apr_table_unset(apr_table_t *t, const char *key)
         return;
     }
     COMPUTE_KEY_CHECKSUM(key, checksum);
-    next_elt = ((apr_table_entry_t *) t->a.elts) + t->index_first[hash];
+    first = t->index_first[hash];
+    if (t->index_mask) {
+        slot = table_index_find(t, key, apr_cstr_casehash(key), checksum);
+        if (!slot->count) {
+            return;
+        }
+        first = slot->first;
+    }
+    next_elt = ((apr_table_entry_t *) t->a.elts) + first;
     end_elt = ((apr_table_entry_t *) t->a.elts) + t->index_last[hash];
     must_reindex = 0;
     for (; next_elt <= end_elt; next_elt++) {
 	if ((checksum == next_elt->key_checksum) &&
-            !strcasecmp(next_elt->key, key)) {
+            !apr_cstr_casecmp(next_elt->key, key)) {
 
             /* Found a match: remove this entry, plus any additional
              * matches for the same key that might follow
              */
             apr_table_entry_t *table_end = ((apr_table_entry_t *) t->a.elts) +
                 t->a.nelts;
+            removed[nremoved++] = (int)(next_elt -
+                                        (apr_table_entry_t *) t->a.elts);
             t->a.nelts--;
             dst_elt = next_elt;
-            for (next_elt++; next_elt <= end_elt; next_elt++) {
+            /* The full index knows when the last match is gone */
+            for (next_elt++; next_elt <= end_elt
+                             && (!slot || nremoved < slot->count);
+                 next_elt++) {
                 if ((checksum == next_elt->key_checksum) &&
-                    !strcasecmp(next_elt->key, key)) {
+                    !apr_cstr_casecmp(next_elt->key, key)) {
+                    if (nremoved < TABLE_UNSET_FIXUP) {
+                        removed[nremoved] = (int)(next_elt -
+                                           (apr_table_entry_t *) t->a.elts);
+                    }
+                    nremoved++;
                     t->a.nelts--;
                 }
                 else {
@@ -691,7 +981,12 @@ APR_DECLARE(void) apr_table_unset(apr_table_t *t, const char *key)
         }
     }
     if (must_reindex) {
-        table_reindex(t);
+        if (slot && nremoved <= TABLE_UNSET_FIXUP) {
+            table_unindex(t, hash, slot, removed, nremoved);
+        }
+        else {
+            table_reindex(t);
+        }
     }
 }
 
@@ -701,6 +996,8 @@ APR_DECLARE(void) apr_table_merge(apr_table_t *t, const char *key,
     apr_table_entry_t *next_elt;
     apr_table_entry_t *end_elt;
     apr_uint32_t checksum;
+    apr_uint32_t khash = 0;
+    table_slot_t *slot = NULL;
     int hash;
 
     COMPUTE_KEY_CHECKSUM(key, checksum);
@@ -710,12 +1007,23 @@ APR_DECLARE(void) apr_table_merge(apr_table_t *t, const char *key,
         TABLE_SET_INDEX_INITIALIZED(t, hash);
         goto add_new_elt;
     }
+    if (t->index_mask) {
+        khash = apr_cstr_casehash(key);
+        slot = table_index_find(t, key, khash, checksum);
+        if (!slot->count) {
+            goto add_new_elt;
+        }
+        next_elt = ((apr_table_entry_t *) t->a.elts) + slot->first;
+        next_elt->val = apr_pstrcat(t->a.pool, next_elt->val, ", ",
+                                    val, NULL);
+        return;
+    }
     next_elt = ((apr_table_entry_t *) t->a.elts) + t->index_first[hash];
     end_elt = ((apr_table_entry_t *) t->a.elts) + t->index_last[hash];
 
     for (; next_elt <= end_elt; next_elt++) {
 	if ((checksum == next_elt->key_checksum) &&
-            !strcasecmp(next_elt->key, key)) {
+            !apr_cstr_casecmp(next_elt->key, key)) {
 
             /* Found an existing entry with the same key, so merge with it */
 	    next_elt->val = apr_pstrcat(t->a.pool, next_elt->val, ", ",
@@ -730,6 +1038,7 @@ add_new_elt:
     next_elt->key = apr_pstrdup(t->a.pool, key);
     next_elt->val = apr_pstrdup(t->a.pool, val);
     next_elt->key_checksum = checksum;
+    table_index_add(t, slot, khash, t->a.nelts - 1);
 }
 
 APR_DECLARE(void) apr_table_mergen(apr_table_t *t, const char *key,
@@ -738,6 +1047,8 @@ APR_DECLARE(void) apr_table_mergen(apr_table_t *t, const char *key,
     apr_table_entry_t *next_elt;
     apr_table_entry_t *end_elt;
     apr_uint32_t checksum;
+    apr_uint32_t khash = 0;
+    table_slot_t *slot = NULL;
     int hash;
 
 #if APR_POOL_DEBUG
@@ -765,12 +1076,23 @@ APR_DECLARE(void) apr_table_mergen(apr_table_t *t, const char *key,
         TABLE_SET_INDEX_INITIALIZED(t, hash);
         goto add_new_elt;
     }
+    if (t->index_mask) {
+        khash = apr_cstr_casehash(key);
+        slot = table_index_find(t, key, khash, checksum);
+        if (!slot->count) {
+            goto add_new_elt;
+        }
+        next_elt = ((apr_table_entry_t *) t->a.elts) + slot->first;
+        next_elt->val = apr_pstrcat(t->a.pool, next_elt->val, ", ",
+                                    val, NULL);
+        return;
+    }
     next_elt = ((apr_table_entry_t *) t->a.elts) + t->index_first[hash];;
     end_elt = ((apr_table_entry_t *) t->a.elts) + t->index_last[hash];
 
     for (; next_elt <= end_elt; next_elt++) {
 	if ((checksum == next_elt->key_checksum) &&
-            !strcasecmp(next_elt->key, key)) {
+            !apr_cstr_casecmp(next_elt->key, key)) {
 
             /* Found an existing entry with the same key, so merge with it */
 	    next_elt->val = apr_pstrcat(t->a.pool, next_elt->val, ", ",
@@ -785,6 +1107,7 @@ add_new_elt:
     next_elt->key = (char *)key;
     next_elt->val = (char *)val;
     next_elt->key_checksum = checksum;
+    table_index_add(t, slot, khash, t->a.nelts - 1);
 }
 
 APR_DECLARE(void) apr_table_add(apr_table_t *t, const char *key,
@@ -805,6 +1128,7 @@ APR_DECLARE(void) apr_table_add(apr_table_t *t, const char *key,
     elts->key = apr_pstrdup(t->a.pool, key);
     elts->val = apr_pstrdup(t->a.pool, val);
     elts->key_checksum = checksum;
+    table_index_add(t, NULL, 0, t->a.nelts - 1);
 }
 
 APR_DECLARE(void) apr_table_addn(apr_table_t *t, const char *key,
@@ -838,6 +1162,7 @@ APR_DECLARE(void) apr_table_addn(apr_table_t *t, const char *key,
     elts->key = (char *)key;
     elts->val = (char *)val;
     elts->key_checksum = checksum;
+    table_index_add(t, NULL, 0, t->a.nelts - 1);
 }
 
 APR_DECLARE(apr_table_t *) apr_table_overlay(apr_pool_t *p,
@@ -868,6 +1193,8 @@ APR_DECLARE(apr_table_t *) apr_table_overlay(apr_pool_t *p,
     res->a.pool = p;
     copy_array_hdr_core(&res->a, &overlay->a);
     apr_array_cat(&res->a, &base->a);
+    res->index_slots = NULL;
+    res->index_nslots = 0;
     table_reindex(res);
     return res;
 }
@@ -973,11 +1300,19 @@ APR_DECLARE(int) apr_table_vdo(apr_table_do_callback_fn_t *comp,
             int hash = TABLE_HASH(argp);
             if (TABLE_INDEX_IS_INITIALIZED(t, hash)) {
                 apr_uint32_t checksum;
+                int first = t->index_first[hash];
                 COMPUTE_KEY_CHECKSUM(argp, checksum);
-                for (i = t->index_first[hash];
+                if (t->index_mask) {
+                    table_slot_t *slot;
+                    slot = table_index_find(t, argp, apr_cstr_casehash(argp),
+                                            checksum);
+                    first = slot->count ? slot->first
+                                        : t->index_last[hash] + 1;
+                }
+                for (i = first;
                      rv && (i <= t->index_last[hash]); ++i) {
                     if (elts[i].key && (checksum == elts[i].key_checksum) &&
-                                        !strcasecmp(elts[i].key, argp)) {
+                                        !apr_cstr_casecmp(elts[i].key, argp)) {
                         rv = (*comp) (rec, elts[i].key, elts[i].val);
                     }
                 }
@@ -1013,7 +1348,7 @@ static apr_table_entry_t **table_mergesort(apr_pool_t *pool,
 
     /* First pass: sort pairs of elements (blocksize=1) */
     for (i = 0; i + 1 < n; i += 2) {
-        if (strcasecmp(values[i]->key, values[i + 1]->key) > 0) {
+        if (apr_cstr_casecmp(values[i]->key, values[i + 1]->key) > 0) {
             apr_table_entry_t *swap = values[i];
             values[i] = values[i + 1];
             values[i + 1] = swap;
@@ -1063,7 +1398,7 @@ static apr_table_entry_t **table_mergesort(apr_pool_t *pool,
                     }
                     break;
                 }
-                if (strcasecmp(values[block1_start]->key,
+                if (apr_cstr_casecmp(values[block1_start]->key,
                                values[block2_start]->key) > 0) {
                     *dst++ = values[block2_start++];
                 }
@@ -1138,12 +1473,12 @@ APR_DECLARE(void) apr_table_compress(apr_table_t *t, unsigned flags)
     last = sort_next++;
     while (sort_next < sort_end) {
         if (((*sort_next)->key_checksum == (*last)->key_checksum) &&
-            !strcasecmp((*sort_next)->key, (*last)->key)) {
+            !apr_cstr_casecmp((*sort_next)->key, (*last)->key)) {
             apr_table_entry_t **dup_last = sort_next + 1;
             dups_found = 1;
             while ((dup_last < sort_end) &&
                    ((*dup_last)->key_checksum == (*last)->key_checksum) &&
-                   !strcasecmp((*dup_last)->key, (*last)->key)) {
+                   !apr_cstr_casecmp((*dup_last)->key, (*last)->key)) {
                 dup_last++;
             }
             dup_last--; /* Elements from last through dup_last, inclusive,
@@ -1215,19 +1550,28 @@ static void apr_table_cat(apr_table_t *t, const apr_table_t *s)
         memcpy(t->index_first,s->index_first,sizeof(int) * TABLE_HASH_SIZE);
         memcpy(t->index_last, s->index_last, sizeof(int) * TABLE_HASH_SIZE);
         t->index_initialized = s->index_initialized;
-        return;
     }
-
-    for (idx = 0; idx < TABLE_HASH_SIZE; ++idx) {
-        if (TABLE_INDEX_IS_INITIALIZED(s, idx)) {
-            t->index_last[idx] = s->index_last[idx] + n;
-            if (!TABLE_INDEX_IS_INITIALIZED(t, idx)) {
-                t->index_first[idx] = s->index_first[idx] + n;
+    else {
+        for (idx = 0; idx < TABLE_HASH_SIZE; ++idx) {
+            if (TABLE_INDEX_IS_INITIALIZED(s, idx)) {
+                t->index_last[idx] = s->index_last[idx] + n;
+                if (!TABLE_INDEX_IS_INITIALIZED(t, idx)) {
+                    t->index_first[idx] = s->index_first[idx] + n;
+                }
             }
         }
+
+        t->index_initialized |= s->index_initialized;
     }
 
-    t->index_initialized |= s->index_initialized;
+    if (t->index_mask) {
+        for (idx = n; idx < t->a.nelts; ++idx) {
+            table_index_add(t, NULL, 0, idx);
+        }
+    }
+    else if (t->a.nelts > TABLE_FULL_INDEX_MIN) {
+        table_index_build(t);
+    }
 }
 
 APR_DECLARE(void) apr_table_overlap(apr_table_t *a, const apr_table_t *b,
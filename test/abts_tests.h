@@ -41,6 +41,7 @@ const struct testlist {
     {testglobalmutex},
 #endif
     {testhash},
+    {testchash},
     {testhooks},
     {testipsub},
     {testlock},
@@ -91,6 +92,10 @@ const struct testlist {
     {testreslist},
     {testlfsabi},
     {testskiplist},
+    {testslab},
+    {testtimerwheel},
+    {testthreadpool},
+    {testringbuf},
     {testsiphash},
     {testjson},
     {testjose}
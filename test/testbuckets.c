@@ -511,6 +511,27 @@ static void test_write_putstrs(abts_case *tc, void *data)
     apr_bucket_alloc_destroy(ba);
 }
 
+static void test_alloc_aligned(abts_case *tc, void *data)
+{
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    char *mem[10];
+    int i;
+
+    for (i = 0; i < 10; i++) {
+        mem[i] = apr_bucket_alloc_aligned(100 * (i + 1), 64 << (i % 4), ba);
+        ABTS_PTR_NOTNULL(tc, mem[i]);
+        ABTS_INT_EQUAL(tc, 0, (apr_uintptr_t)mem[i] % (64 << (i % 4)));
+        memset(mem[i], 0xa, 100 * (i + 1));
+    }
+    for (i = 0; i < 10; i++) {
+        apr_bucket_free(mem[i]);
+    }
+
+    ABTS_PTR_EQUAL(tc, NULL, apr_bucket_alloc_aligned(100, 48, ba));
+
+    apr_bucket_alloc_destroy(ba);
+}
+
 abts_suite *testbuckets(abts_suite *suite)
 {
     suite = ADD_SUITE(suite);
@@ -528,6 +549,7 @@ abts_suite *testbuckets(abts_suite *suite)
     abts_run_test(suite, test_partition, NULL);
     abts_run_test(suite, test_write_split, NULL);
     abts_run_test(suite, test_write_putstrs, NULL);
+    abts_run_test(suite, test_alloc_aligned, NULL);
 
     return suite;
 }
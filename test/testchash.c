@@ -0,0 +1,299 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testutil.h"
+#include "apr.h"
+#include "apr_general.h"
+#include "apr_pools.h"
+#include "apr_atomic.h"
+#include "apr_hash.h"
+#include "apr_strings.h"
+#include "apr_thread_proc.h"
+#include "apr_chash.h"
+#if APR_HAVE_STRING_H
+#include <string.h>
+#endif
+
+#if APR_HAS_THREADS
+
+#define NUM_KEYS    5000
+#define NUM_THREADS 4
+#define NUM_LOOPS   20000
+
+static const char *keys[NUM_KEYS];
+static int vals[NUM_KEYS];
+
+static void make_keys(void)
+{
+    int i;
+
+    if (!keys[0]) {
+        for (i = 0; i < NUM_KEYS; i++) {
+            keys[i] = apr_psprintf(p, "key %d", i);
+            vals[i] = i;
+        }
+    }
+}
+
+static void count_free(void *baton, const void *key, apr_ssize_t klen,
+                       void *val)
+{
+    apr_atomic_inc32(baton);
+}
+
+static void chash_basic(abts_case *tc, void *data)
+{
+    apr_chash_t *ht;
+    apr_pool_t *pool;
+    apr_uint32_t freed = 0;
+    apr_status_t rv;
+    int x = 1, y = 2;
+
+    apr_pool_create(&pool, p);
+    rv = apr_chash_create(&ht, 0, count_free, &freed, pool);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_PTR_EQUAL(tc, NULL, apr_chash_get(ht, "a", APR_HASH_KEY_STRING));
+
+    rv = apr_chash_set(ht, "a", APR_HASH_KEY_STRING, &x);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_PTR_EQUAL(tc, &x, apr_chash_get(ht, "a", 1));
+    ABTS_PTR_EQUAL(tc, NULL, apr_chash_get(ht, "ab", APR_HASH_KEY_STRING));
+    ABTS_INT_EQUAL(tc, 1, apr_chash_count(ht));
+
+    ABTS_PTR_EQUAL(tc, &x, apr_chash_get_or_set(ht, "a", 1, &y));
+    ABTS_PTR_EQUAL(tc, &y, apr_chash_get_or_set(ht, "b", 1, &y));
+    ABTS_INT_EQUAL(tc, 2, apr_chash_count(ht));
+
+    rv = apr_chash_set(ht, "a", 1, &y);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_PTR_EQUAL(tc, &y, apr_chash_get(ht, "a", 1));
+    ABTS_INT_EQUAL(tc, 2, apr_chash_count(ht));
+
+    rv = apr_chash_set(ht, "a", 1, NULL);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_PTR_EQUAL(tc, NULL, apr_chash_get(ht, "a", 1));
+    ABTS_PTR_EQUAL(tc, &y, apr_chash_get(ht, "b", 1));
+    ABTS_INT_EQUAL(tc, 1, apr_chash_count(ht));
+
+    /* deleting a missing key is a noop */
+    rv = apr_chash_set(ht, "c", 1, NULL);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 1, apr_chash_count(ht));
+
+    apr_pool_destroy(pool);
+    ABTS_INT_EQUAL(tc, 3, apr_atomic_read32(&freed));
+}
+
+static int sum_vals(void *rec, const void *key, apr_ssize_t klen,
+                    const void *val)
+{
+    *(apr_size_t *)rec += *(const int *)val;
+    return 1;
+}
+
+static void chash_grow(abts_case *tc, void *data)
+{
+    apr_chash_t *ht;
+    apr_pool_t *pool;
+    apr_uint32_t freed = 0;
+    apr_size_t sum = 0;
+    apr_status_t rv;
+    int i, ok = 1;
+
+    make_keys();
+    apr_pool_create(&pool, p);
+    rv = apr_chash_create(&ht, 0, count_free, &freed, pool);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    for (i = 0; i < NUM_KEYS; i++) {
+        rv = apr_chash_set(ht, keys[i], APR_HASH_KEY_STRING, &vals[i]);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    ABTS_INT_EQUAL(tc, NUM_KEYS, apr_chash_count(ht));
+    for (i = 0; i < NUM_KEYS; i++) {
+        if (apr_chash_get(ht, keys[i], APR_HASH_KEY_STRING) != &vals[i]) {
+            ok = 0;
+        }
+    }
+    ABTS_TRUE(tc, ok);
+
+    ABTS_TRUE(tc, apr_chash_do(sum_vals, &sum, ht));
+    ABTS_INT_EQUAL(tc, (apr_size_t)NUM_KEYS * (NUM_KEYS - 1) / 2, sum);
+
+    /* growing retires entries without freeing the values */
+    ABTS_INT_EQUAL(tc, 0, apr_atomic_read32(&freed));
+
+    for (i = 0; i < NUM_KEYS; i += 2) {
+        apr_chash_set(ht, keys[i], APR_HASH_KEY_STRING, NULL);
+    }
+    ABTS_INT_EQUAL(tc, NUM_KEYS / 2, apr_chash_count(ht));
+
+    apr_pool_destroy(pool);
+    ABTS_INT_EQUAL(tc, NUM_KEYS, apr_atomic_read32(&freed));
+}
+
+static void chash_reclaim(abts_case *tc, void *data)
+{
+    apr_chash_t *ht;
+    apr_pool_t *pool;
+    apr_uint32_t freed = 0;
+    unsigned int token;
+    int x = 1, y = 2, z = 3;
+    void *val;
+
+    apr_pool_create(&pool, p);
+    apr_chash_create(&ht, 0, count_free, &freed, pool);
+    apr_chash_set(ht, "a", 1, &x);
+
+    token = apr_chash_read_begin(ht);
+    val = apr_chash_get(ht, "a", 1);
+    ABTS_PTR_EQUAL(tc, &x, val);
+    apr_chash_set(ht, "a", 1, &y);
+    apr_chash_set(ht, "a", 1, &z);
+    /* still readable in the section */
+    ABTS_INT_EQUAL(tc, 0, apr_atomic_read32(&freed));
+    ABTS_INT_EQUAL(tc, 1, *(int *)val);
+    apr_chash_read_end(ht, token);
+
+    /* reclaimed by the next update of the stripe */
+    apr_chash_set(ht, "a", 1, &x);
+    ABTS_TRUE(tc, apr_atomic_read32(&freed) >= 2);
+
+    apr_pool_destroy(pool);
+    ABTS_INT_EQUAL(tc, 4, apr_atomic_read32(&freed));
+}
+
+static void chash_cache(abts_case *tc, void *data)
+{
+    apr_chash_t *ht;
+    apr_pool_t *pool;
+    apr_uint32_t freed = 0;
+    apr_size_t count;
+    int i, hot = 0;
+
+    make_keys();
+    apr_pool_create(&pool, p);
+    apr_chash_create(&ht, 1000, count_free, &freed, pool);
+
+    for (i = 0; i < NUM_KEYS; i++) {
+        apr_chash_set(ht, keys[i], APR_HASH_KEY_STRING, &vals[i]);
+        ABTS_TRUE(tc, apr_chash_count(ht) <= 1000);
+        /* keep the first key used */
+        if (apr_chash_get(ht, keys[0], APR_HASH_KEY_STRING)) {
+            hot++;
+        }
+    }
+    count = apr_chash_count(ht);
+    ABTS_TRUE(tc, count > 500);
+    ABTS_INT_EQUAL(tc, NUM_KEYS, hot);
+    ABTS_PTR_EQUAL(tc, &vals[NUM_KEYS - 1],
+                   apr_chash_get(ht, keys[NUM_KEYS - 1], APR_HASH_KEY_STRING));
+
+    apr_pool_destroy(pool);
+    ABTS_INT_EQUAL(tc, NUM_KEYS, apr_atomic_read32(&freed));
+}
+
+typedef struct {
+    apr_chash_t *ht;
+    int id;
+    apr_uint32_t errors;
+} thread_baton_t;
+
+static void * APR_THREAD_FUNC chash_thread(apr_thread_t *thd, void *data)
+{
+    thread_baton_t *b = data;
+    unsigned int seed = b->id * 7919 + 1;
+    int i;
+
+    for (i = 0; i < NUM_LOOPS; i++) {
+        int k;
+        seed = seed * 1103515245 + 12345;
+        k = (seed >> 8) % NUM_KEYS;
+        if (i % 4 == b->id % 4) {
+            apr_chash_set(b->ht, keys[k], APR_HASH_KEY_STRING,
+                          (seed & 0x10000) ? &vals[k] : NULL);
+        }
+        else {
+            unsigned int token = apr_chash_read_begin(b->ht);
+            int *v = apr_chash_get(b->ht, keys[k], APR_HASH_KEY_STRING);
+            if (v && *v != k) {
+                b->errors++;
+            }
+            apr_chash_read_end(b->ht, token);
+        }
+    }
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static void chash_threads(abts_case *tc, void *data)
+{
+    apr_thread_t *threads[NUM_THREADS];
+    thread_baton_t batons[NUM_THREADS];
+    apr_chash_t *ht;
+    apr_pool_t *pool;
+    apr_uint32_t freed = 0;
+    apr_status_t rv, retval;
+    apr_size_t count;
+    int i;
+
+    make_keys();
+    apr_pool_create(&pool, p);
+    apr_chash_create(&ht, 0, count_free, &freed, pool);
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        batons[i].ht = ht;
+        batons[i].id = i;
+        batons[i].errors = 0;
+        rv = apr_thread_create(&threads[i], NULL, chash_thread, &batons[i],
+                               p);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    for (i = 0; i < NUM_THREADS; i++) {
+        apr_thread_join(&retval, threads[i]);
+        ABTS_INT_EQUAL(tc, 0, batons[i].errors);
+    }
+
+    count = 0;
+    for (i = 0; i < NUM_KEYS; i++) {
+        if (apr_chash_get(ht, keys[i], APR_HASH_KEY_STRING)) {
+            count++;
+        }
+    }
+    ABTS_INT_EQUAL(tc, count, apr_chash_count(ht));
+
+    /* everything inserted is eventually freed */
+    apr_chash_set(ht, "extra", APR_HASH_KEY_STRING, &vals[0]);
+    apr_pool_destroy(pool);
+    ABTS_TRUE(tc, apr_atomic_read32(&freed) > count);
+}
+
+#endif /* APR_HAS_THREADS */
+
+abts_suite *testchash(abts_suite *suite)
+{
+    suite = ADD_SUITE(suite)
+
+#if APR_HAS_THREADS
+    abts_run_test(suite, chash_basic, NULL);
+    abts_run_test(suite, chash_grow, NULL);
+    abts_run_test(suite, chash_reclaim, NULL);
+    abts_run_test(suite, chash_cache, NULL);
+    abts_run_test(suite, chash_threads, NULL);
+#endif /* APR_HAS_THREADS */
+
+    return suite;
+}
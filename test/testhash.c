@@ -20,6 +20,8 @@
 #include "apr_general.h"
 #include "apr_pools.h"
 #include "apr_hash.h"
+#include <stdlib.h>
+#include <string.h>
 
 #define MAX_LTH 256
 #define MAX_DEPTH 11
@@ -76,11 +78,33 @@ static void sum_hash(apr_pool_t *p, apr_hash_t *h, int *pcount, int *keySum, int
     *pcount=count;
 }
 
+/* The tests are run on both kinds of hash tables, with a non-NULL data
+ * for the flat ones, and some of them with SipHash keys.
+ */
+static int flat = 1;
+static int keyed = 2;
+
+static apr_hash_t *make_hash(void *data)
+{
+    if (data == &keyed) {
+        apr_hash_t *h = apr_hash_make(p);
+        apr_hash_algo_set(h, APR_HASH_ALGO_SIPHASH13);
+        return h;
+    }
+    return data ? apr_hash_make_flat(p) : apr_hash_make(p);
+}
+
+static apr_hash_t *make_hash_custom(void *data, apr_hashfunc_t hash_func)
+{
+    return data == &flat ? apr_hash_make_flat_custom(p, hash_func)
+                         : apr_hash_make_custom(p, hash_func);
+}
+
 static void hash_make(abts_case *tc, void *data)
 {
     apr_hash_t *h = NULL;
 
-    h = apr_hash_make(p);
+    h = make_hash(data);
     ABTS_PTR_NOTNULL(tc, h);
 }
 
@@ -89,7 +113,7 @@ static void hash_set(abts_case *tc, void *data)
     apr_hash_t *h = NULL;
     char *result = NULL;
 
-    h = apr_hash_make(p);
+    h = make_hash(data);
     ABTS_PTR_NOTNULL(tc, h);
 
     apr_hash_set(h, "key", APR_HASH_KEY_STRING, "value");
@@ -102,7 +126,7 @@ static void hash_get_or_set(abts_case *tc, void *data)
     apr_hash_t *h = NULL;
     char *result = NULL;
 
-    h = apr_hash_make(p);
+    h = make_hash(data);
     ABTS_PTR_NOTNULL(tc, h);
 
     result = apr_hash_get_or_set(h, "key", APR_HASH_KEY_STRING, "value");
@@ -130,7 +154,7 @@ static void hash_reset(abts_case *tc, void *data)
     apr_hash_t *h = NULL;
     char *result = NULL;
 
-    h = apr_hash_make(p);
+    h = make_hash(data);
     ABTS_PTR_NOTNULL(tc, h);
 
     apr_hash_set(h, "key", APR_HASH_KEY_STRING, "value");
@@ -147,7 +171,7 @@ static void same_value(abts_case *tc, void *data)
     apr_hash_t *h = NULL;
     char *result = NULL;
 
-    h = apr_hash_make(p);
+    h = make_hash(data);
     ABTS_PTR_NOTNULL(tc, h);
 
     apr_hash_set(h, "same1", APR_HASH_KEY_STRING, "same");
@@ -174,7 +198,7 @@ static void same_value_custom(abts_case *tc, void *data)
     apr_hash_t *h = NULL;
     char *result = NULL;
 
-    h = apr_hash_make_custom(p, hash_custom);
+    h = make_hash_custom(data, hash_custom);
     ABTS_PTR_NOTNULL(tc, h);
 
     apr_hash_set(h, "same1", 5, "same");
@@ -191,7 +215,7 @@ static void key_space(abts_case *tc, void *data)
     apr_hash_t *h = NULL;
     char *result = NULL;
 
-    h = apr_hash_make(p);
+    h = make_hash(data);
     ABTS_PTR_NOTNULL(tc, h);
 
     apr_hash_set(h, "key with space", APR_HASH_KEY_STRING, "value");
@@ -204,7 +228,7 @@ static void hash_clear(abts_case *tc, void *data)
     apr_hash_t *h;
     int i, *e;
 
-    h = apr_hash_make(p);
+    h = make_hash(data);
     ABTS_PTR_NOTNULL(tc, h);
 
     for (i = 1; i <= 10; i++) {
@@ -226,7 +250,7 @@ static void hash_traverse(abts_case *tc, void *data)
     apr_hash_t *h;
     char StrArray[MAX_DEPTH][MAX_LTH];
 
-    h = apr_hash_make(p);
+    h = make_hash(data);
     ABTS_PTR_NOTNULL(tc, h);
 
     apr_hash_set(h, "OVERWRITE", APR_HASH_KEY_STRING, "should not see this");
@@ -261,7 +285,7 @@ static void summation_test(abts_case *tc, void *data)
     int sumKeys, sumVal, trySumKey, trySumVal;
     int i, j, *val, *key;
 
-    h =apr_hash_make(p);
+    h =make_hash(data);
     ABTS_PTR_NOTNULL(tc, h);
 
     sumKeys = 0;
@@ -291,7 +315,7 @@ static void delete_key(abts_case *tc, void *data)
     apr_hash_t *h = NULL;
     char *result = NULL;
 
-    h = apr_hash_make(p);
+    h = make_hash(data);
     ABTS_PTR_NOTNULL(tc, h);
 
     apr_hash_set(h, "key", APR_HASH_KEY_STRING, "value");
@@ -317,7 +341,7 @@ static void hash_count_0(abts_case *tc, void *data)
     apr_hash_t *h = NULL;
     int count;
 
-    h = apr_hash_make(p);
+    h = make_hash(data);
     ABTS_PTR_NOTNULL(tc, h);
 
     count = apr_hash_count(h);
@@ -329,7 +353,7 @@ static void hash_count_1(abts_case *tc, void *data)
     apr_hash_t *h = NULL;
     int count;
 
-    h = apr_hash_make(p);
+    h = make_hash(data);
     ABTS_PTR_NOTNULL(tc, h);
 
     apr_hash_set(h, "key", APR_HASH_KEY_STRING, "value");
@@ -343,7 +367,7 @@ static void hash_count_5(abts_case *tc, void *data)
     apr_hash_t *h = NULL;
     int count;
 
-    h = apr_hash_make(p);
+    h = make_hash(data);
     ABTS_PTR_NOTNULL(tc, h);
 
     apr_hash_set(h, "key1", APR_HASH_KEY_STRING, "value1");
@@ -364,8 +388,8 @@ static void overlay_empty(abts_case *tc, void *data)
     int count;
     char StrArray[MAX_DEPTH][MAX_LTH];
 
-    base = apr_hash_make(p);
-    overlay = apr_hash_make(p);
+    base = make_hash(data);
+    overlay = make_hash(data);
     ABTS_PTR_NOTNULL(tc, base);
     ABTS_PTR_NOTNULL(tc, overlay);
 
@@ -398,8 +422,8 @@ static void overlay_2unique(abts_case *tc, void *data)
     int count;
     char StrArray[MAX_DEPTH][MAX_LTH];
 
-    base = apr_hash_make(p);
-    overlay = apr_hash_make(p);
+    base = make_hash(data);
+    overlay = make_hash(data);
     ABTS_PTR_NOTNULL(tc, base);
     ABTS_PTR_NOTNULL(tc, overlay);
 
@@ -442,7 +466,7 @@ static void overlay_same(abts_case *tc, void *data)
     int count;
     char StrArray[MAX_DEPTH][MAX_LTH];
 
-    base = apr_hash_make(p);
+    base = make_hash(data);
     ABTS_PTR_NOTNULL(tc, base);
 
     apr_hash_set(base, "base1", APR_HASH_KEY_STRING, "value1");
@@ -473,8 +497,8 @@ static void overlay_fetch(abts_case *tc, void *data)
     apr_hash_t *result = NULL;
     int count;
 
-    base = apr_hash_make(p);
-    overlay = apr_hash_make(p);
+    base = make_hash(data);
+    overlay = make_hash(data);
     ABTS_PTR_NOTNULL(tc, base);
     ABTS_PTR_NOTNULL(tc, overlay);
 
@@ -539,6 +563,383 @@ static void overlay_fetch(abts_case *tc, void *data)
                        apr_hash_get(overlay, "overlay5", APR_HASH_KEY_STRING));
 }
 
+#define FLAT_KEYS 5000
+
+static unsigned int hash_collide(const char *key, apr_ssize_t *klen)
+{
+    /* Few distinct hashes, many keys in the same groups */
+    if (*klen == APR_HASH_KEY_STRING)
+        *klen = strlen(key);
+    return (unsigned int)(*klen ? key[*klen - 1] % 4 : 0);
+}
+
+static const char **flat_keys(apr_pool_t *pool)
+{
+    const char **keys = apr_palloc(pool, FLAT_KEYS * sizeof(*keys));
+    int i;
+
+    for (i = 0; i < FLAT_KEYS; i++) {
+        keys[i] = apr_psprintf(pool, "key%d", i);
+    }
+    return keys;
+}
+
+/* Concatenates the values, or drops them (NULL) for the key "drop" */
+static void *merge_concat(apr_pool_t *pool, const void *key,
+                          apr_ssize_t klen, const void *h1_val,
+                          const void *h2_val, const void *data)
+{
+    if (strcmp(key, "drop") == 0) {
+        return NULL;
+    }
+    return apr_pstrcat(pool, h1_val, h2_val, NULL);
+}
+
+/* apr_hash_merge() gives the same result whichever of its tables are flat,
+ * including the entries merged to NULL.
+ */
+static void merge_mixed(abts_case *tc, void *data)
+{
+    static const char *base_kv[] = { "both", "b1", "drop", "b2",
+                                     "base", "b3" };
+    static const char *overlay_kv[] = { "both", "o1", "drop", "o2",
+                                        "overlay", "o3" };
+    apr_hash_t *base, *overlay, *res;
+    apr_hash_index_t *hi;
+    int i, k, n;
+
+    for (i = 0; i < 4; i++) {
+        base = (i & 1) ? apr_hash_make_flat(p) : apr_hash_make(p);
+        overlay = (i & 2) ? apr_hash_make_flat(p) : apr_hash_make(p);
+        for (k = 0; k < 6; k += 2) {
+            apr_hash_set(base, base_kv[k], APR_HASH_KEY_STRING,
+                         base_kv[k + 1]);
+            apr_hash_set(overlay, overlay_kv[k], APR_HASH_KEY_STRING,
+                         overlay_kv[k + 1]);
+        }
+
+        res = apr_hash_merge(p, overlay, base, merge_concat, NULL);
+        ABTS_INT_EQUAL(tc, 4, apr_hash_count(res));
+        ABTS_STR_EQUAL(tc, "o1b1",
+                       apr_hash_get(res, "both", APR_HASH_KEY_STRING));
+        ABTS_STR_EQUAL(tc, "b3",
+                       apr_hash_get(res, "base", APR_HASH_KEY_STRING));
+        ABTS_STR_EQUAL(tc, "o3",
+                       apr_hash_get(res, "overlay", APR_HASH_KEY_STRING));
+        ABTS_PTR_EQUAL(tc, NULL,
+                       apr_hash_get(res, "drop", APR_HASH_KEY_STRING));
+        for (n = 0, hi = apr_hash_first(p, res); hi; hi = apr_hash_next(hi)) {
+            if (strcmp(apr_hash_this_key(hi), "drop") == 0) {
+                ABTS_PTR_EQUAL(tc, NULL, apr_hash_this_val(hi));
+                n++;
+            }
+        }
+        ABTS_INT_EQUAL(tc, 1, n);
+
+        res = apr_hash_overlay(p, overlay, base);
+        ABTS_INT_EQUAL(tc, 4, apr_hash_count(res));
+        ABTS_STR_EQUAL(tc, "o2",
+                       apr_hash_get(res, "drop", APR_HASH_KEY_STRING));
+    }
+}
+
+static void flat_many(abts_case *tc, void *data)
+{
+    const char **keys = flat_keys(p);
+    apr_hash_index_t *hi;
+    apr_hash_t *h;
+    int i, n;
+
+    h = apr_hash_make_flat(p);
+    ABTS_PTR_NOTNULL(tc, h);
+
+    for (i = 0; i < FLAT_KEYS; i++) {
+        apr_hash_set(h, keys[i], APR_HASH_KEY_STRING, keys[i]);
+    }
+    ABTS_INT_EQUAL(tc, FLAT_KEYS, apr_hash_count(h));
+
+    for (i = 0; i < FLAT_KEYS; i += 2) {
+        apr_hash_set(h, keys[i], APR_HASH_KEY_STRING, NULL);
+    }
+    ABTS_INT_EQUAL(tc, FLAT_KEYS / 2, apr_hash_count(h));
+    for (i = 0; i < FLAT_KEYS; i++) {
+        const char *val = apr_hash_get(h, keys[i], APR_HASH_KEY_STRING);
+        if (i % 2) {
+            ABTS_PTR_EQUAL(tc, keys[i], val);
+        }
+        else {
+            ABTS_PTR_EQUAL(tc, NULL, val);
+        }
+    }
+
+    n = 0;
+    for (hi = apr_hash_first(p, h); hi; hi = apr_hash_next(hi)) {
+        const char *key = apr_hash_this_key(hi);
+        ABTS_PTR_EQUAL(tc, key, apr_hash_this_val(hi));
+        ABTS_INT_EQUAL(tc, 1, atoi(key + 3) % 2);
+        n++;
+    }
+    ABTS_INT_EQUAL(tc, FLAT_KEYS / 2, n);
+
+    h = apr_hash_copy(p, h);
+    ABTS_INT_EQUAL(tc, FLAT_KEYS / 2, apr_hash_count(h));
+    ABTS_PTR_EQUAL(tc, keys[1], apr_hash_get(h, keys[1], APR_HASH_KEY_STRING));
+    apr_hash_clear(h);
+    ABTS_INT_EQUAL(tc, 0, apr_hash_count(h));
+    ABTS_PTR_EQUAL(tc, NULL, apr_hash_get(h, keys[1], APR_HASH_KEY_STRING));
+}
+
+/* Random sets and deletes must give the same results as a chained table */
+static void flat_random(abts_case *tc, void *data)
+{
+    const char **keys = flat_keys(p);
+    apr_hash_t *h, *ref;
+    int i, k, same = 1;
+
+    srand(42);
+    h = data ? apr_hash_make_flat_custom(p, hash_collide)
+             : apr_hash_make_flat(p);
+    ref = apr_hash_make(p);
+
+    for (i = 0; i < 4 * FLAT_KEYS; i++) {
+        k = rand() % (data ? FLAT_KEYS / 10 : FLAT_KEYS);
+        if (rand() % 3) {
+            apr_hash_set(h, keys[k], APR_HASH_KEY_STRING, keys[i % FLAT_KEYS]);
+            apr_hash_set(ref, keys[k], APR_HASH_KEY_STRING,
+                         keys[i % FLAT_KEYS]);
+        }
+        else {
+            apr_hash_set(h, keys[k], APR_HASH_KEY_STRING, NULL);
+            apr_hash_set(ref, keys[k], APR_HASH_KEY_STRING, NULL);
+        }
+    }
+    ABTS_INT_EQUAL(tc, apr_hash_count(ref), apr_hash_count(h));
+    for (k = 0; k < FLAT_KEYS; k++) {
+        if (apr_hash_get(h, keys[k], APR_HASH_KEY_STRING)
+                != apr_hash_get(ref, keys[k], APR_HASH_KEY_STRING)) {
+            same = 0;
+        }
+    }
+    ABTS_TRUE(tc, same);
+}
+
+static void flat_delete_iterating(abts_case *tc, void *data)
+{
+    const char **keys = flat_keys(p);
+    apr_hash_index_t *hi;
+    apr_hash_t *h;
+    int i, n = 0;
+
+    h = apr_hash_make_flat_custom(p, hash_collide);
+    for (i = 0; i < FLAT_KEYS / 10; i++) {
+        apr_hash_set(h, keys[i], APR_HASH_KEY_STRING, keys[i]);
+    }
+    for (hi = apr_hash_first(NULL, h); hi; hi = apr_hash_next(hi)) {
+        apr_hash_set(h, apr_hash_this_key(hi), APR_HASH_KEY_STRING, NULL);
+        n++;
+    }
+    ABTS_INT_EQUAL(tc, FLAT_KEYS / 10, n);
+    ABTS_INT_EQUAL(tc, 0, apr_hash_count(h));
+}
+
+static void flat_reuse(abts_case *tc, void *data)
+{
+    const char **keys = flat_keys(p);
+    apr_pool_stats_t stats;
+    apr_size_t bytes = 0;
+    apr_pool_t *subp;
+    apr_hash_t *h;
+    int i, j;
+
+    apr_pool_create(&subp, p);
+    h = apr_hash_make_flat(subp);
+    for (j = 0; j < 10; j++) {
+        for (i = 0; i < FLAT_KEYS; i++) {
+            apr_hash_set(h, keys[i], APR_HASH_KEY_STRING, keys[i]);
+        }
+        for (i = 0; i < FLAT_KEYS; i++) {
+            apr_hash_set(h, keys[i], APR_HASH_KEY_STRING, NULL);
+        }
+        apr_pool_stats_get(subp, &stats);
+        if (j == 0) {
+            bytes = stats.bytes;
+        }
+    }
+    ABTS_INT_EQUAL(tc, 0, apr_hash_count(h));
+    ABTS_TRUE(tc, stats.bytes == bytes);
+
+    apr_pool_destroy(subp);
+}
+
+/* Whether h holds exactly keys[0..n[, valued with themselves */
+static int incremental_check(apr_hash_t *h, const char **keys, int n)
+{
+    apr_hash_index_t *hi;
+    int i, count = 0;
+
+    for (i = 0; i < n; i++) {
+        if (apr_hash_get(h, keys[i], APR_HASH_KEY_STRING) != keys[i]) {
+            return 0;
+        }
+    }
+    for (hi = apr_hash_first(NULL, h); hi; hi = apr_hash_next(hi)) {
+        if (apr_hash_this_key(hi) != apr_hash_this_val(hi)) {
+            return 0;
+        }
+        count++;
+    }
+    return count == n && apr_hash_count(h) == (unsigned int)n;
+}
+
+static void incremental_growth(abts_case *tc, void *data)
+{
+    const char **keys = flat_keys(p);
+    apr_hash_t *h, *h2;
+    int i, ok = 1;
+
+    h = apr_hash_make(p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, apr_hash_incremental_set(h, 1));
+
+    /* Check everything when a growth starts (at a power of two) and a
+     * few insertions later, while the buckets move.
+     */
+    for (i = 0; i < FLAT_KEYS; i++) {
+        int n = i + 1;
+        apr_hash_set(h, keys[i], APR_HASH_KEY_STRING, keys[i]);
+        if ((n & (n - 1)) == 0 || ((n - 3) & (n - 4)) == 0) {
+            ok &= incremental_check(h, keys, n);
+        }
+    }
+    ABTS_TRUE(tc, ok);
+    ABTS_TRUE(tc, incremental_check(h, keys, FLAT_KEYS));
+
+    /* Copy and overlay in the middle of a move (1024 buckets) */
+    h = apr_hash_make(p);
+    apr_hash_incremental_set(h, 1);
+    for (i = 0; i < 1030; i++) {
+        apr_hash_set(h, keys[i], APR_HASH_KEY_STRING, keys[i]);
+    }
+    h2 = apr_hash_copy(p, h);
+    ABTS_TRUE(tc, incremental_check(h2, keys, 1030));
+    h2 = apr_hash_overlay(p, h, apr_hash_make(p));
+    ABTS_TRUE(tc, incremental_check(h2, keys, 1030));
+    h2 = apr_hash_overlay(p, apr_hash_make(p), h);
+    ABTS_TRUE(tc, incremental_check(h2, keys, 1030));
+
+    /* Replacing and deleting don't move buckets, nor does a get_or_set
+     * of an existing key, but the move completes when disabled.
+     */
+    for (i = 0; i < 1030; i += 2) {
+        apr_hash_set(h, keys[i], APR_HASH_KEY_STRING, keys[i]);
+        apr_hash_get_or_set(h, keys[i + 1], APR_HASH_KEY_STRING, keys[i]);
+    }
+    ABTS_TRUE(tc, incremental_check(h, keys, 1030));
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, apr_hash_incremental_set(h, 0));
+    ABTS_TRUE(tc, incremental_check(h, keys, 1030));
+
+    ABTS_INT_EQUAL(tc, APR_ENOTIMPL,
+                   apr_hash_incremental_set(apr_hash_make_flat(p), 1));
+}
+
+static void incremental_delete_iterating(abts_case *tc, void *data)
+{
+    const char **keys = flat_keys(p);
+    apr_hash_index_t *hi;
+    apr_hash_t *h;
+    int i, n = 0;
+
+    h = apr_hash_make(p);
+    apr_hash_incremental_set(h, 1);
+    for (i = 0; i < 1030; i++) {
+        apr_hash_set(h, keys[i], APR_HASH_KEY_STRING, keys[i]);
+    }
+    for (hi = apr_hash_first(NULL, h); hi; hi = apr_hash_next(hi)) {
+        apr_hash_set(h, apr_hash_this_key(hi), APR_HASH_KEY_STRING, NULL);
+        n++;
+    }
+    ABTS_INT_EQUAL(tc, 1030, n);
+    ABTS_INT_EQUAL(tc, 0, apr_hash_count(h));
+
+    /* Still usable afterwards */
+    for (i = 0; i < FLAT_KEYS; i++) {
+        apr_hash_set(h, keys[i], APR_HASH_KEY_STRING, keys[i]);
+    }
+    ABTS_TRUE(tc, incremental_check(h, keys, FLAT_KEYS));
+}
+
+static void hash_algo(abts_case *tc, void *data)
+{
+    apr_hash_t *h1, *h2;
+
+    h1 = apr_hash_make(p);
+    ABTS_INT_EQUAL(tc, APR_EINVAL, apr_hash_algo_set(h1, 42));
+    ABTS_INT_EQUAL(tc, APR_SUCCESS,
+                   apr_hash_algo_set(h1, APR_HASH_ALGO_SIPHASH13));
+    apr_hash_set(h1, "key", APR_HASH_KEY_STRING, "value");
+    ABTS_INT_EQUAL(tc, APR_EBUSY,
+                   apr_hash_algo_set(h1, APR_HASH_ALGO_TIMES33));
+
+    ABTS_INT_EQUAL(tc, APR_EINVAL, apr_hash_algo_default_set(-1));
+    ABTS_INT_EQUAL(tc, APR_SUCCESS,
+                   apr_hash_algo_default_set(APR_HASH_ALGO_SIPHASH13));
+    h2 = apr_hash_make_flat(p);
+    apr_hash_algo_default_set(APR_HASH_ALGO_TIMES33);
+    apr_hash_set(h2, "key", APR_HASH_KEY_STRING, "value2");
+    apr_hash_set(h2, "other", 5, "value3");
+
+    /* Mixing algorithms */
+    h2 = apr_hash_overlay(p, h1, h2);
+    ABTS_INT_EQUAL(tc, 2, apr_hash_count(h2));
+    ABTS_STR_EQUAL(tc, "value", apr_hash_get(h2, "key", APR_HASH_KEY_STRING));
+    ABTS_STR_EQUAL(tc, "value3", apr_hash_get(h2, "other", 5));
+    h2 = apr_hash_overlay(p, h2, apr_hash_make(p));
+    ABTS_INT_EQUAL(tc, 2, apr_hash_count(h2));
+    ABTS_STR_EQUAL(tc, "value", apr_hash_get(h2, "key", APR_HASH_KEY_STRING));
+    ABTS_STR_EQUAL(tc, "value3", apr_hash_get(h2, "other", 5));
+}
+
+static void hash_get_many(abts_case *tc, void *data)
+{
+    const char **keys = flat_keys(p);
+    apr_ssize_t *klens;
+    void **vals;
+    apr_hash_t *h;
+    int i, ok = 1;
+
+    h = make_hash(data);
+    if (!data) {
+        /* in the middle of an incremental growth */
+        apr_hash_incremental_set(h, 1);
+    }
+    for (i = 0; i < 1030; i += 2) {
+        apr_hash_set(h, keys[i], APR_HASH_KEY_STRING, keys[i]);
+    }
+
+    vals = apr_palloc(p, 2000 * sizeof(*vals));
+    ABTS_INT_EQUAL(tc, 515, apr_hash_get_many(h, (const void **)keys,
+                                              NULL, vals, 2000));
+    for (i = 0; i < 2000; i++) {
+        if (vals[i] != apr_hash_get(h, keys[i], APR_HASH_KEY_STRING)) {
+            ok = 0;
+        }
+    }
+    ABTS_TRUE(tc, ok);
+
+    /* "key1" and "key10" look the same with a length of 4 */
+    klens = apr_palloc(p, 11 * sizeof(*klens));
+    for (i = 0; i < 11; i++) {
+        klens[i] = 4;
+    }
+    ABTS_INT_EQUAL(tc, 5, apr_hash_get_many(h, (const void **)keys,
+                                            klens, vals, 11));
+    ABTS_PTR_EQUAL(tc, keys[0], vals[0]);
+    ABTS_PTR_EQUAL(tc, NULL, vals[1]);
+    ABTS_PTR_EQUAL(tc, keys[8], vals[8]);
+    ABTS_PTR_EQUAL(tc, NULL, vals[10]);
+
+    ABTS_INT_EQUAL(tc, 0, apr_hash_get_many(h, NULL, NULL, NULL, 0));
+}
+
 abts_suite *testhash(abts_suite *suite)
 {
     suite = ADD_SUITE(suite)
@@ -565,6 +966,49 @@ abts_suite *testhash(abts_suite *suite)
     abts_run_test(suite, overlay_same, NULL);
     abts_run_test(suite, overlay_fetch, NULL);
 
+    abts_run_test(suite, hash_make, &flat);
+    abts_run_test(suite, hash_set, &flat);
+    abts_run_test(suite, hash_get_or_set, &flat);
+    abts_run_test(suite, hash_reset, &flat);
+    abts_run_test(suite, same_value, &flat);
+    abts_run_test(suite, same_value_custom, &flat);
+    abts_run_test(suite, key_space, &flat);
+    abts_run_test(suite, delete_key, &flat);
+    abts_run_test(suite, hash_count_0, &flat);
+    abts_run_test(suite, hash_count_1, &flat);
+    abts_run_test(suite, hash_count_5, &flat);
+    abts_run_test(suite, hash_clear, &flat);
+    abts_run_test(suite, hash_traverse, &flat);
+    abts_run_test(suite, summation_test, &flat);
+    abts_run_test(suite, overlay_empty, &flat);
+    abts_run_test(suite, overlay_2unique, &flat);
+    abts_run_test(suite, overlay_same, &flat);
+    abts_run_test(suite, overlay_fetch, &flat);
+
+    abts_run_test(suite, merge_mixed, NULL);
+    abts_run_test(suite, flat_many, NULL);
+    abts_run_test(suite, flat_random, NULL);
+    abts_run_test(suite, flat_random, &flat);
+    abts_run_test(suite, flat_delete_iterating, NULL);
+    abts_run_test(suite, flat_reuse, NULL);
+
+    abts_run_test(suite, incremental_growth, NULL);
+    abts_run_test(suite, incremental_delete_iterating, NULL);
+
+    abts_run_test(suite, hash_set, &keyed);
+    abts_run_test(suite, hash_get_or_set, &keyed);
+    abts_run_test(suite, hash_reset, &keyed);
+    abts_run_test(suite, key_space, &keyed);
+    abts_run_test(suite, delete_key, &keyed);
+    abts_run_test(suite, hash_traverse, &keyed);
+    abts_run_test(suite, summation_test, &keyed);
+    abts_run_test(suite, overlay_same, &keyed);
+    abts_run_test(suite, overlay_fetch, &keyed);
+    abts_run_test(suite, hash_algo, NULL);
+    abts_run_test(suite, hash_get_many, NULL);
+    abts_run_test(suite, hash_get_many, &flat);
+    abts_run_test(suite, hash_get_many, &keyed);
+
     return suite;
 }
 
@@ -0,0 +1,206 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Compares the hash algorithms of apr_hash_t (see apr_hash_algo_set())
+ * on a few kinds of keys: raw hashing speed, distribution in the buckets,
+ * and lookups one at a time or by batches with apr_hash_get_many().
+ */
+
+#include "apr_general.h"
+#include "apr_getopt.h"
+#include "apr_hash.h"
+#include "apr_siphash.h"
+#include "apr_strings.h"
+#include "apr_time.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_NUM_KEYS 100000
+#define DEFAULT_ROUNDS   10
+#define BATCH            64
+
+static int num_keys = DEFAULT_NUM_KEYS;
+static int rounds = DEFAULT_ROUNDS;
+static apr_pool_t *pool;
+
+static const char *algo_name[] = { "times33", "siphash13" };
+
+static const char **make_keys(const char *kind)
+{
+    const char **keys = apr_palloc(pool, num_keys * sizeof(*keys));
+    const char *pad = "";
+    int i;
+
+    if (strcmp(kind, "long") == 0) {
+        char *s = apr_palloc(pool, 241);
+        memset(s, 'x', 240);
+        s[240] = '\0';
+        pad = s;
+    }
+    for (i = 0; i < num_keys; i++) {
+        if (strcmp(kind, "short") == 0) {
+            keys[i] = apr_psprintf(pool, "k%d", i);
+        }
+        else if (strcmp(kind, "url") == 0) {
+            keys[i] = apr_psprintf(pool, "/api/v1/users/%d/sessions/%d",
+                                   i / 16, i % 16);
+        }
+        else {
+            keys[i] = apr_psprintf(pool, "%s/%d", pad, i);
+        }
+    }
+    return keys;
+}
+
+static unsigned int hash_one(int algo, const char *key,
+                             const unsigned char *secret)
+{
+    apr_ssize_t klen = APR_HASH_KEY_STRING;
+    apr_uint64_t h;
+
+    if (algo == APR_HASH_ALGO_TIMES33) {
+        return apr_hashfunc_default(key, &klen);
+    }
+    h = apr_siphash13(key, strlen(key), secret);
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+static void bench_hash(int algo, const char **keys)
+{
+    static const unsigned char secret[APR_SIPHASH_KSIZE] = {
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+    };
+    unsigned int *count, mask, max_chain = 0, empty = 0, sum = 0;
+    apr_time_t start, stop;
+    int i, r;
+
+    start = apr_time_now();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < num_keys; i++) {
+            sum += hash_one(algo, keys[i], secret);
+        }
+    }
+    stop = apr_time_now();
+
+    /* the buckets of a chained table holding all the keys */
+    for (mask = 15; mask < (unsigned int)num_keys - 1; mask = mask * 2 + 1)
+        ;
+    count = calloc(mask + 1, sizeof(*count));
+    for (i = 0; i < num_keys; i++) {
+        unsigned int c = ++count[hash_one(algo, keys[i], secret) & mask];
+        if (max_chain < c)
+            max_chain = c;
+    }
+    for (i = 0; i <= (int)mask; i++) {
+        if (!count[i])
+            empty++;
+    }
+    free(count);
+
+    printf("    %-10s hash: %7.1f ns/key, longest chain %u, "
+           "%.1f%% buckets empty (%08x)\n", algo_name[algo],
+           (double)(stop - start) * 1000.0 / ((double)rounds * num_keys),
+           max_chain, 100.0 * empty / (mask + 1), sum);
+}
+
+static void bench_lookup(int algo, int flat, const char **keys)
+{
+    apr_hash_t *ht;
+    void *vals[BATCH];
+    apr_time_t start, mid, stop;
+    apr_size_t found = 0;
+    int i, r;
+
+    ht = flat ? apr_hash_make_flat(pool) : apr_hash_make(pool);
+    apr_hash_algo_set(ht, algo);
+    for (i = 0; i < num_keys; i++) {
+        apr_hash_set(ht, keys[i], APR_HASH_KEY_STRING, keys[i]);
+    }
+
+    start = apr_time_now();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < num_keys; i++) {
+            if (apr_hash_get(ht, keys[i], APR_HASH_KEY_STRING))
+                found++;
+        }
+    }
+    mid = apr_time_now();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < num_keys; i += BATCH) {
+            found += apr_hash_get_many(ht, (const void **)keys + i, NULL,
+                                       vals, num_keys - i < BATCH
+                                             ? num_keys - i : BATCH);
+        }
+    }
+    stop = apr_time_now();
+
+    printf("    %-10s %-7s get: %7.1f ns/key, get_many: %7.1f ns/key%s\n",
+           algo_name[algo], flat ? "flat" : "chained",
+           (double)(mid - start) * 1000.0 / ((double)rounds * num_keys),
+           (double)(stop - mid) * 1000.0 / ((double)rounds * num_keys),
+           found == (apr_size_t)2 * rounds * num_keys ? "" : " (MISSED!)");
+}
+
+int main(int argc, const char *const *argv)
+{
+    static const char *kinds[] = { "short", "url", "long" };
+    apr_getopt_t *opt;
+    const char *optarg;
+    char optchar;
+    apr_status_t rv;
+    int k, algo;
+
+    apr_initialize();
+    atexit(apr_terminate);
+    apr_pool_create(&pool, NULL);
+
+    if (apr_getopt_init(&opt, pool, argc, argv)) {
+        return 1;
+    }
+    while ((rv = apr_getopt(opt, "n:r:", &optchar, &optarg)) == APR_SUCCESS) {
+        switch (optchar) {
+        case 'n':
+            num_keys = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        }
+    }
+    if (rv != APR_EOF || num_keys <= 0 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [-n keys] [-r rounds]\n", argv[0]);
+        return 1;
+    }
+
+    printf("APR hash table algorithms, %d keys, %d rounds\n",
+           num_keys, rounds);
+    for (k = 0; k < (int)(sizeof(kinds) / sizeof(kinds[0])); k++) {
+        const char **keys = make_keys(kinds[k]);
+
+        printf("%s keys (%d bytes):\n", kinds[k], (int)strlen(keys[0]));
+        for (algo = 0; algo <= APR_HASH_ALGO_SIPHASH13; algo++) {
+            bench_hash(algo, keys);
+        }
+        for (algo = 0; algo <= APR_HASH_ALGO_SIPHASH13; algo++) {
+            bench_lookup(algo, 0, keys);
+            bench_lookup(algo, 1, keys);
+        }
+    }
+
+    return 0;
+}
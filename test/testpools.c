@@ -19,6 +19,11 @@
 #include "apr_pools.h"
 #include "apr_errno.h"
 #include "apr_file_io.h"
+#include "apr_allocator.h"
+#include "private/apr_allocator_private.h"
+#include "apr_thread_proc.h"
+#include "apr_strings.h"
+#include "apr_time.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -176,6 +181,533 @@ static void test_tags(abts_case *tc, void *data)
     ABTS_STR_EQUAL(tc, "main pool", apr_pool_get_tag(pmain));
 }
 
+static void test_thread_cache(abts_case *tc, void *data)
+{
+    apr_allocator_t *allocator;
+    apr_memnode_t *node, *node2;
+    apr_status_t rv;
+
+    rv = apr_allocator_create(&allocator);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    rv = apr_allocator_thread_cache_set(allocator, 4);
+    if (rv == APR_ENOTIMPL) {
+        apr_allocator_destroy(allocator);
+        ABTS_NOT_IMPL(tc, "Per-thread allocator cache not implemented");
+        return;
+    }
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    /* A block freed in this thread is recycled first */
+    node = apr_allocator_alloc(allocator, ALLOC_BYTES);
+    ABTS_PTR_NOTNULL(tc, node);
+    apr_allocator_free(allocator, node);
+    node2 = apr_allocator_alloc(allocator, ALLOC_BYTES);
+    ABTS_PTR_EQUAL(tc, node, node2);
+
+    /* Blocks still cached are released with the allocator */
+    apr_allocator_free(allocator, node2);
+    apr_allocator_destroy(allocator);
+}
+
+static void test_allocator_arenas(abts_case *tc, void *data)
+{
+    apr_allocator_t *allocator;
+    apr_memnode_t *node, *big;
+    apr_pool_t *p;
+    apr_status_t rv;
+    char *mem;
+    int i;
+
+    rv = apr_allocator_create_ex(&allocator, APR_ALLOCATOR_HUGEPAGES);
+    if (rv == APR_ENOTIMPL) {
+        ABTS_NOT_IMPL(tc, "Allocator arenas not implemented");
+        return;
+    }
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    /* Give everything back to the system once freed */
+    apr_allocator_max_free_set(allocator, 1);
+
+    rv = apr_pool_create_unmanaged_ex(&p, NULL, allocator);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    for (i = 0; i < 1000; i++) {
+        mem = apr_palloc(p, ALLOC_BYTES * (i % 64 + 1));
+        ABTS_PTR_NOTNULL(tc, mem);
+        memset(mem, 0xa, ALLOC_BYTES * (i % 64 + 1));
+    }
+    apr_pool_clear(p);
+    mem = apr_pcalloc(p, 2 * 1024 * 1024);
+    ABTS_PTR_NOTNULL(tc, mem);
+    ABTS_TRUE(tc, mem[2 * 1024 * 1024 - 1] == 0);
+
+    /* A purged block is reused rather than carved again */
+    big = apr_allocator_alloc(allocator, 64 * 1024);
+    ABTS_PTR_NOTNULL(tc, big);
+    memset(big->first_avail, 0xa, big->endp - big->first_avail);
+    apr_allocator_free(allocator, big);
+    node = apr_allocator_alloc(allocator, 64 * 1024);
+    ABTS_PTR_EQUAL(tc, big, node);
+    memset(node->first_avail, 0xa, node->endp - node->first_avail);
+    apr_allocator_free(allocator, node);
+
+    apr_pool_destroy(p);
+    apr_allocator_destroy(allocator);
+}
+
+static void test_allocator_stats(abts_case *tc, void *data)
+{
+    apr_allocator_t *allocator;
+    apr_allocator_stats_t stats;
+    apr_memnode_t *node;
+    apr_status_t rv;
+
+    rv = apr_allocator_create(&allocator);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    node = apr_allocator_alloc(allocator, ALLOC_BYTES);
+    ABTS_PTR_NOTNULL(tc, node);
+    apr_allocator_stats_get(allocator, &stats);
+    ABTS_TRUE(tc, stats.misses == 1);
+    ABTS_TRUE(tc, stats.hits == 0);
+    ABTS_TRUE(tc, stats.held_bytes == (apr_size_t)(node->endp - (char *)node));
+    ABTS_TRUE(tc, stats.free_bytes == 0);
+
+    apr_allocator_free(allocator, node);
+    apr_allocator_stats_get(allocator, &stats);
+    ABTS_TRUE(tc, stats.free_bytes == stats.held_bytes);
+    ABTS_TRUE(tc, stats.free_blocks[node->index] == 1);
+
+    node = apr_allocator_alloc(allocator, ALLOC_BYTES);
+    ABTS_PTR_NOTNULL(tc, node);
+    apr_allocator_stats_get(allocator, &stats);
+    ABTS_TRUE(tc, stats.misses == 1);
+    ABTS_TRUE(tc, stats.hits == 1);
+    ABTS_TRUE(tc, stats.free_bytes == 0);
+
+    /* Nothing kept once freed */
+    apr_allocator_max_free_set(allocator, 1);
+    apr_allocator_free(allocator, node);
+    apr_allocator_stats_get(allocator, &stats);
+    ABTS_TRUE(tc, stats.held_bytes == 0);
+    ABTS_TRUE(tc, stats.peak_bytes > 0);
+    ABTS_TRUE(tc, stats.released_bytes == stats.peak_bytes);
+
+    apr_allocator_destroy(allocator);
+}
+
+#define OVERSIZED_NODES 64
+
+static apr_memnode_t *alloc_pages(apr_allocator_t *allocator,
+                                  apr_size_t pages)
+{
+    return apr_allocator_alloc(allocator, pages * apr_allocator_page_size()
+                                          - APR_MEMNODE_T_SIZE);
+}
+
+static void test_allocator_oversized(abts_case *tc, void *data)
+{
+    apr_allocator_t *allocator;
+    apr_allocator_stats_t stats;
+    apr_memnode_t *nodes[OVERSIZED_NODES], *node;
+    apr_status_t rv;
+    char *mem;
+    int i;
+
+    rv = apr_allocator_create(&allocator);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    /* Free in increasing sizes, some twice */
+    for (i = 0; i < OVERSIZED_NODES; i++) {
+        nodes[i] = alloc_pages(allocator, 30 + 2 * (i / 2));
+        ABTS_PTR_NOTNULL(tc, nodes[i]);
+        ABTS_INT_EQUAL(tc, 29 + 2 * (i / 2), nodes[i]->index);
+    }
+    for (i = 0; i < OVERSIZED_NODES; i++) {
+        apr_allocator_free(allocator, nodes[i]);
+    }
+    apr_allocator_stats_get(allocator, &stats);
+    ABTS_INT_EQUAL(tc, OVERSIZED_NODES,
+                   stats.free_blocks[APR_ALLOCATOR_STATS_SLOTS - 1]);
+    ABTS_TRUE(tc, stats.free_bytes == stats.held_bytes);
+
+    /* The best fit is always taken, in any order */
+    for (i = OVERSIZED_NODES - 1; i >= 0; i -= 2) {
+        node = alloc_pages(allocator, 29 + 2 * (i / 2));
+        ABTS_PTR_NOTNULL(tc, node);
+        ABTS_INT_EQUAL(tc, 29 + 2 * (i / 2), node->index);
+        nodes[i] = node;
+    }
+    for (i = 0; i < OVERSIZED_NODES; i += 2) {
+        node = alloc_pages(allocator, 30 + 2 * (i / 2));
+        ABTS_PTR_NOTNULL(tc, node);
+        ABTS_INT_EQUAL(tc, 29 + 2 * (i / 2), node->index);
+        mem = node->first_avail;
+        memset(mem, 0xa, node->endp - mem);
+        nodes[i] = node;
+    }
+    apr_allocator_stats_get(allocator, &stats);
+    ABTS_INT_EQUAL(tc, 0, stats.free_blocks[APR_ALLOCATOR_STATS_SLOTS - 1]);
+    ABTS_TRUE(tc, stats.misses == OVERSIZED_NODES);
+    ABTS_TRUE(tc, stats.hits == OVERSIZED_NODES);
+
+    /* Too large for any */
+    node = alloc_pages(allocator, 30 + OVERSIZED_NODES);
+    ABTS_PTR_NOTNULL(tc, node);
+    apr_allocator_stats_get(allocator, &stats);
+    ABTS_TRUE(tc, stats.misses == OVERSIZED_NODES + 1);
+    apr_allocator_free(allocator, node);
+
+    for (i = 0; i < OVERSIZED_NODES; i++) {
+        apr_allocator_free(allocator, nodes[i]);
+    }
+    apr_allocator_destroy(allocator);
+
+    /* Purged oversized arena nodes are split to fit */
+    rv = apr_allocator_create_ex(&allocator, APR_ALLOCATOR_ARENAS);
+    if (rv == APR_ENOTIMPL) {
+        return;
+    }
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    apr_allocator_max_free_set(allocator, 1);
+
+    node = alloc_pages(allocator, 100);
+    ABTS_PTR_NOTNULL(tc, node);
+    apr_allocator_free(allocator, node);
+
+    nodes[0] = alloc_pages(allocator, 30);
+    ABTS_PTR_EQUAL(tc, node, nodes[0]);
+    nodes[1] = alloc_pages(allocator, 30);
+    ABTS_PTR_EQUAL(tc, nodes[0]->endp, nodes[1]);
+    mem = nodes[1]->first_avail;
+    memset(mem, 0xa, nodes[1]->endp - mem);
+
+    apr_allocator_free(allocator, nodes[0]);
+    apr_allocator_free(allocator, nodes[1]);
+    apr_allocator_destroy(allocator);
+}
+
+static void test_allocator_numa(abts_case *tc, void *data)
+{
+    apr_allocator_t *allocator, *allocators[64];
+    apr_memnode_t *node;
+    apr_status_t rv;
+    unsigned int nodes, i;
+
+    nodes = apr_allocator_numa_nodes();
+    ABTS_TRUE(tc, nodes >= 1);
+    ABTS_TRUE(tc, apr_allocator_numa_node_current() < nodes);
+
+    rv = apr_allocator_create_ex(&allocator, APR_ALLOCATOR_NUMA_NODE(nodes));
+    ABTS_INT_EQUAL(tc, APR_EINVAL, rv);
+
+    rv = apr_allocator_create_ex(&allocator, APR_ALLOCATOR_NUMA_NODE(0));
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    node = apr_allocator_alloc(allocator, 100 * ALLOC_BYTES);
+    ABTS_PTR_NOTNULL(tc, node);
+    memset(node->first_avail, 0xa, node->endp - node->first_avail);
+    apr_allocator_free(allocator, node);
+    apr_allocator_destroy(allocator);
+
+    if (nodes > 64) {
+        nodes = 64;
+    }
+    rv = apr_allocator_create_numa(allocators, nodes, 0);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    for (i = 0; i < nodes; i++) {
+        node = apr_allocator_alloc(allocators[i], ALLOC_BYTES);
+        ABTS_PTR_NOTNULL(tc, node);
+        memset(node->first_avail, 0xa, ALLOC_BYTES);
+        apr_allocator_free(allocators[i], node);
+        apr_allocator_destroy(allocators[i]);
+    }
+}
+
+static void test_allocator_numa_parse(abts_case *tc, void *data)
+{
+    ABTS_INT_EQUAL(tc, 1, apr__numa_nodes_parse("0"));
+    ABTS_INT_EQUAL(tc, 1, apr__numa_nodes_parse("0\n"));
+    ABTS_INT_EQUAL(tc, 2, apr__numa_nodes_parse("0-1"));
+    ABTS_INT_EQUAL(tc, 2, apr__numa_nodes_parse("0-1\n"));
+    ABTS_INT_EQUAL(tc, 12, apr__numa_nodes_parse("0-3,8-11"));
+    ABTS_INT_EQUAL(tc, 3, apr__numa_nodes_parse("0,2"));
+    ABTS_INT_EQUAL(tc, 8, apr__numa_nodes_parse("4-7,1"));
+    ABTS_INT_EQUAL(tc, 1, apr__numa_nodes_parse(""));
+    ABTS_INT_EQUAL(tc, 1, apr__numa_nodes_parse("-1"));
+    ABTS_INT_EQUAL(tc, APR_NUMA_MAX_NODES,
+                   apr__numa_nodes_parse("0-4096"));
+}
+
+#define DECAY_NODES 10
+
+static void test_allocator_decay(abts_case *tc, void *data)
+{
+    apr_allocator_t *allocator;
+    apr_allocator_stats_t stats;
+    apr_memnode_t *nodes[DECAY_NODES];
+    apr_size_t size, released;
+    apr_status_t rv;
+    int i;
+
+    rv = apr_allocator_create(&allocator);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    /* Nothing to trim by default */
+    for (i = 0; i < DECAY_NODES; i++) {
+        nodes[i] = apr_allocator_alloc(allocator, ALLOC_BYTES);
+        ABTS_PTR_NOTNULL(tc, nodes[i]);
+    }
+    size = nodes[0]->endp - (char *)nodes[0];
+    for (i = 0; i < DECAY_NODES; i++) {
+        apr_allocator_free(allocator, nodes[i]);
+    }
+    ABTS_INT_EQUAL(tc, 0, apr_allocator_trim(allocator));
+
+    /* A long half-life releases (almost) nothing yet */
+    apr_allocator_decay_set(allocator, apr_time_from_sec(3600));
+    apr_sleep(1000);
+    ABTS_INT_EQUAL(tc, 0, apr_allocator_trim(allocator));
+
+    /* Half of the free memory was needed in the meantime, and the
+     * other half has (more than) fully decayed.
+     */
+    apr_allocator_decay_set(allocator, 1);
+    for (i = 0; i < DECAY_NODES / 2; i++) {
+        nodes[i] = apr_allocator_alloc(allocator, ALLOC_BYTES);
+        ABTS_PTR_NOTNULL(tc, nodes[i]);
+    }
+    for (i = 0; i < DECAY_NODES / 2; i++) {
+        apr_allocator_free(allocator, nodes[i]);
+    }
+    apr_sleep(1000);
+    released = apr_allocator_trim(allocator);
+    ABTS_TRUE(tc, released == DECAY_NODES / 2 * size);
+    apr_allocator_stats_get(allocator, &stats);
+    ABTS_TRUE(tc, stats.free_bytes == DECAY_NODES / 2 * size);
+    ABTS_TRUE(tc, stats.released_bytes == released);
+    ABTS_TRUE(tc, stats.held_bytes == stats.free_bytes);
+
+    /* Then the rest, unused since */
+    apr_sleep(1000);
+    ABTS_TRUE(tc, apr_allocator_trim(allocator) == DECAY_NODES / 2 * size);
+    apr_allocator_stats_get(allocator, &stats);
+    ABTS_TRUE(tc, stats.free_bytes == 0);
+    ABTS_TRUE(tc, stats.held_bytes == 0);
+
+    apr_allocator_destroy(allocator);
+}
+
+static void test_pool_stats(abts_case *tc, void *data)
+{
+    apr_pool_stats_t stats;
+    apr_size_t bytes;
+    apr_pool_t *p;
+
+    apr_pool_create(&p, pmain);
+    apr_pool_tag(p, "stats");
+
+    apr_pool_stats_get(p, &stats);
+    ABTS_STR_EQUAL(tc, "stats", stats.tag);
+    bytes = stats.bytes;
+    ABTS_TRUE(tc, stats.peak_bytes == bytes);
+
+    ABTS_PTR_NOTNULL(tc, apr_palloc(p, 100 * ALLOC_BYTES));
+    apr_pool_stats_get(p, &stats);
+    ABTS_TRUE(tc, stats.bytes >= bytes + 100 * ALLOC_BYTES);
+    ABTS_TRUE(tc, stats.peak_bytes == stats.bytes);
+    ABTS_TRUE(tc, stats.nodes > 0);
+
+    apr_pool_clear(p);
+    apr_pool_stats_get(p, &stats);
+    ABTS_TRUE(tc, stats.bytes <= bytes);
+    ABTS_TRUE(tc, stats.peak_bytes >= bytes + 100 * ALLOC_BYTES);
+
+    apr_pool_destroy(p);
+}
+
+static int mark_cleanups;
+
+static apr_status_t mark_cleanup(void *data)
+{
+    mark_cleanups++;
+    return APR_SUCCESS;
+}
+
+static void test_pool_mark(abts_case *tc, void *data)
+{
+    apr_pool_mark_t mark, inner;
+    apr_pool_stats_t stats;
+    apr_size_t bytes = 0;
+    apr_pool_t *p;
+    char *keep, *mem;
+    int i, j;
+
+    apr_pool_create(&p, pmain);
+    keep = apr_pstrdup(p, "kept");
+
+    mark_cleanups = 0;
+    for (i = 0; i < 100; i++) {
+        apr_pool_mark(p, &mark);
+        for (j = 0; j < 20; j++) {
+            mem = apr_palloc(p, ALLOC_BYTES * (j + 1));
+            ABTS_PTR_NOTNULL(tc, mem);
+            memset(mem, 0xa, ALLOC_BYTES * (j + 1));
+        }
+        mem = apr_psprintf(p, "%0*d", 3 * ALLOC_BYTES, i);
+        ABTS_SIZE_EQUAL(tc, 3 * ALLOC_BYTES, strlen(mem));
+        apr_pool_cleanup_register(p, NULL, mark_cleanup,
+                                  apr_pool_cleanup_null);
+
+        apr_pool_mark(p, &inner);
+        apr_pool_cleanup_register(p, p, mark_cleanup, apr_pool_cleanup_null);
+        ABTS_PTR_NOTNULL(tc, apr_palloc(p, 10 * ALLOC_BYTES));
+        apr_pool_rewind(p, &inner);
+        ABTS_INT_EQUAL(tc, 2 * i + 1, mark_cleanups);
+
+        apr_pool_rewind(p, &mark);
+        ABTS_INT_EQUAL(tc, 2 * i + 2, mark_cleanups);
+
+        /* The memory nodes are kept for the next round */
+        apr_pool_stats_get(p, &stats);
+        if (i == 0) {
+            bytes = stats.bytes;
+        }
+        ABTS_TRUE(tc, stats.bytes == bytes);
+    }
+    ABTS_STR_EQUAL(tc, "kept", keep);
+
+    /* A cleanup registered before the mark is left alone, even if some
+     * cleanup registered after it is killed.
+     */
+    apr_pool_cleanup_register(p, NULL, mark_cleanup, apr_pool_cleanup_null);
+    apr_pool_mark(p, &mark);
+    apr_pool_cleanup_kill(p, NULL, mark_cleanup);
+    apr_pool_rewind(p, &mark);
+    ABTS_INT_EQUAL(tc, 200, mark_cleanups);
+
+    /* Clearing forgets the marks */
+    apr_pool_mark(p, &mark);
+    ABTS_PTR_NOTNULL(tc, apr_palloc(p, 100 * ALLOC_BYTES));
+    apr_pool_clear(p);
+    ABTS_PTR_NOTNULL(tc, apr_palloc(p, 100 * ALLOC_BYTES));
+
+    apr_pool_destroy(p);
+}
+
+static void test_palloc_aligned(abts_case *tc, void *data)
+{
+    static const apr_size_t aligns[] = { 8, 16, 64, 256, 4096 };
+    apr_pool_t *p;
+    char *mem;
+    apr_size_t i;
+    int j, k;
+
+    apr_pool_create(&p, NULL);
+
+    for (i = 0; i < sizeof(aligns) / sizeof(aligns[0]); i++) {
+        for (j = 0; j < 100; j++) {
+            /* Misalign the pool on purpose */
+            apr_palloc(p, 8);
+
+            mem = apr_palloc_aligned(p, 24 + j, aligns[i]);
+            ABTS_PTR_NOTNULL(tc, mem);
+            ABTS_INT_EQUAL(tc, 0, (apr_uintptr_t)mem % aligns[i]);
+            memset(mem, 0xa, 24 + j);
+
+            mem = apr_pcalloc_aligned(p, 24 + j, aligns[i]);
+            ABTS_PTR_NOTNULL(tc, mem);
+            ABTS_INT_EQUAL(tc, 0, (apr_uintptr_t)mem % aligns[i]);
+            for (k = 0; k < 24 + j; k++) {
+                if (mem[k]) {
+                    break;
+                }
+            }
+            ABTS_INT_EQUAL(tc, 24 + j, k);
+        }
+    }
+
+    /* Bigger than a node */
+    mem = apr_palloc_aligned(p, 100 * ALLOC_BYTES, 64);
+    ABTS_PTR_NOTNULL(tc, mem);
+    ABTS_INT_EQUAL(tc, 0, (apr_uintptr_t)mem % 64);
+    memset(mem, 0xa, 100 * ALLOC_BYTES);
+
+    /* Not a power of two, or more than a page */
+    ABTS_PTR_EQUAL(tc, NULL, apr_palloc_aligned(p, 10, 24));
+    ABTS_PTR_EQUAL(tc, NULL, apr_palloc_aligned(p, 10,
+                                     apr_allocator_page_size() * 2));
+
+    apr_pool_destroy(p);
+}
+
+#if APR_HAS_THREADS
+
+#define CACHE_THREADS    8
+#define CACHE_ITERATIONS 1000
+
+static void * APR_THREAD_FUNC thread_cache_worker(apr_thread_t *thd,
+                                                  void *data)
+{
+    apr_pool_t *parent = data;
+    apr_pool_t *p;
+    char *mem;
+    int i;
+
+    for (i = 0; i < CACHE_ITERATIONS; i++) {
+        if (apr_pool_create(&p, parent) != APR_SUCCESS) {
+            apr_thread_exit(thd, APR_ENOMEM);
+        }
+        mem = apr_palloc(p, ALLOC_BYTES * (i % 16 + 1));
+        memset(mem, 0xa, ALLOC_BYTES * (i % 16 + 1));
+        apr_pool_destroy(p);
+    }
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static void test_thread_cache_threads(abts_case *tc, void *data)
+{
+    apr_allocator_t *allocator;
+    apr_thread_mutex_t *mutex;
+    apr_thread_t *threads[CACHE_THREADS];
+    apr_pool_t *pool;
+    apr_status_t rv, retval;
+    int i;
+
+    rv = apr_allocator_create(&allocator);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_allocator_thread_cache_set(allocator, 8);
+    if (rv == APR_ENOTIMPL) {
+        apr_allocator_destroy(allocator);
+        ABTS_NOT_IMPL(tc, "Per-thread allocator cache not implemented");
+        return;
+    }
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    rv = apr_pool_create_ex(&pool, NULL, NULL, allocator);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    apr_allocator_owner_set(allocator, pool);
+    rv = apr_thread_mutex_create(&mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    apr_allocator_mutex_set(allocator, mutex);
+
+    for (i = 0; i < CACHE_THREADS; i++) {
+        rv = apr_thread_create(&threads[i], NULL, thread_cache_worker,
+                               pool, pool);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    for (i = 0; i < CACHE_THREADS; i++) {
+        rv = apr_thread_join(&retval, threads[i]);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, retval);
+    }
+
+    apr_pool_destroy(pool);
+}
+
+#endif /* APR_HAS_THREADS */
+
 abts_suite *testpool(abts_suite *suite)
 {
     suite = ADD_SUITE(suite)
@@ -188,6 +720,19 @@ abts_suite *testpool(abts_suite *suite)
     abts_run_test(suite, calloc_bytes, NULL);
     abts_run_test(suite, test_cleanups, NULL);
     abts_run_test(suite, test_tags, NULL);
+    abts_run_test(suite, test_thread_cache, NULL);
+    abts_run_test(suite, test_allocator_arenas, NULL);
+    abts_run_test(suite, test_allocator_stats, NULL);
+    abts_run_test(suite, test_allocator_oversized, NULL);
+    abts_run_test(suite, test_allocator_numa, NULL);
+    abts_run_test(suite, test_allocator_numa_parse, NULL);
+    abts_run_test(suite, test_allocator_decay, NULL);
+    abts_run_test(suite, test_pool_stats, NULL);
+    abts_run_test(suite, test_pool_mark, NULL);
+    abts_run_test(suite, test_palloc_aligned, NULL);
+#if APR_HAS_THREADS
+    abts_run_test(suite, test_thread_cache_threads, NULL);
+#endif
 
     return suite;
 }
@@ -15,7 +15,9 @@
  */
 
 #include "apu.h"
+#include "apr_atomic.h"
 #include "apr_queue.h"
+#include "apr_thread_proc.h"
 #include "apr_thread_pool.h"
 #include "apr_time.h"
 #include "abts.h"
@@ -29,6 +31,10 @@
 #define PRODUCER_ACTIVITY   5
 #define QUEUE_SIZE          100
 
+#define MPMC_THREADS        4
+#define MPMC_ITEMS          20000
+#define MPMC_BATCH          16
+
 static apr_queue_t *queue;
 
 static void * APR_THREAD_FUNC consumer(apr_thread_t *thd, void *data)
@@ -96,7 +102,8 @@ static void test_queue_producer_consumer(abts_case *tc, void *data)
     /* XXX: non-portable */
     srand((unsigned int)apr_time_now());
 
-    rv = apr_queue_create(&queue, QUEUE_SIZE, p);
+    rv = apr_queue_create_ex(&queue, QUEUE_SIZE,
+                             (apr_uint32_t)(apr_uintptr_t)data, p);
     ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
 
     rv = apr_thread_pool_create(&thrp, 0, NUMBER_CONSUMERS + NUMBER_PRODUCERS, p);
@@ -129,7 +136,7 @@ static void test_queue_timeout(abts_case *tc, void *data)
     unsigned int i;
     void *value;
 
-    rv = apr_queue_create(&q, 5, p);
+    rv = apr_queue_create_ex(&q, 5, (apr_uint32_t)(apr_uintptr_t)data, p);
     ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
 
     for (i = 0; i < 2; ++i) {
@@ -170,15 +177,295 @@ static void test_queue_timeout(abts_case *tc, void *data)
     ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
 }
 
+static volatile apr_uint32_t mpmc_popped;
+static apr_uint32_t mpmc_errors;
+static int mpmc_batch;
+
+static void * APR_THREAD_FUNC mpmc_producer(apr_thread_t *thd, void *data)
+{
+    apr_uintptr_t id = (apr_uintptr_t)data, i, j;
+    void *items[MPMC_BATCH];
+    unsigned int n = 1, pushed;
+    apr_status_t rv;
+
+    for (i = 1; i <= MPMC_ITEMS; i += pushed) {
+        if (mpmc_batch) {
+            /* Vary the batch size */
+            n = (unsigned int)(i % MPMC_BATCH) + 1;
+            if (n > MPMC_ITEMS - i + 1) {
+                n = (unsigned int)(MPMC_ITEMS - i + 1);
+            }
+        }
+        for (j = 0; j < n; j++) {
+            items[j] = (void *)(id * MPMC_ITEMS + i + j);
+        }
+        do {
+            rv = apr_queue_push_batch(queue, items, n, &pushed);
+        } while (rv == APR_EINTR);
+        if (rv != APR_SUCCESS) {
+            apr_atomic_inc32(&mpmc_errors);
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void * APR_THREAD_FUNC mpmc_consumer(apr_thread_t *thd, void *data)
+{
+    apr_uintptr_t last[MPMC_THREADS] = { 0 }, v, id;
+    apr_uint64_t *sum = data;
+    void *items[MPMC_BATCH];
+    unsigned int i, popped;
+    apr_status_t rv;
+
+    for (;;) {
+        if (mpmc_batch) {
+            rv = apr_queue_pop_batch(queue, items, MPMC_BATCH, &popped);
+        }
+        else {
+            rv = apr_queue_pop(queue, &items[0]);
+            popped = 1;
+        }
+        if (rv == APR_EINTR) {
+            continue;
+        }
+        if (rv != APR_SUCCESS) {
+            break;
+        }
+        for (i = 0; i < popped; i++) {
+            v = (apr_uintptr_t)items[i];
+            id = (v - 1) / MPMC_ITEMS;
+            /* FIFO: the items of a producer come in order */
+            if (id >= MPMC_THREADS || v <= last[id]) {
+                apr_atomic_inc32(&mpmc_errors);
+            }
+            else {
+                last[id] = v;
+            }
+            *sum += v;
+        }
+        if (apr_atomic_add32(&mpmc_popped, popped) + popped
+                == MPMC_THREADS * MPMC_ITEMS) {
+            apr_queue_term(queue);
+        }
+    }
+    return NULL;
+}
+
+static void queue_mpmc(abts_case *tc, apr_uint32_t flags, int batch)
+{
+    apr_thread_t *producers[MPMC_THREADS], *consumers[MPMC_THREADS];
+    apr_uint64_t sums[MPMC_THREADS] = { 0 }, sum = 0, expected = 0;
+    apr_status_t rv, retval;
+    apr_uintptr_t i;
+
+    rv = apr_queue_create_ex(&queue, 64, flags, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    mpmc_popped = 0;
+    mpmc_errors = 0;
+    mpmc_batch = batch;
+
+    for (i = 0; i < MPMC_THREADS; i++) {
+        rv = apr_thread_create(&consumers[i], NULL, mpmc_consumer, &sums[i], p);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+        rv = apr_thread_create(&producers[i], NULL, mpmc_producer, (void *)i, p);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    for (i = 0; i < MPMC_THREADS; i++) {
+        apr_thread_join(&retval, producers[i]);
+        apr_thread_join(&retval, consumers[i]);
+        sum += sums[i];
+    }
+    for (i = 1; i <= MPMC_THREADS * MPMC_ITEMS; i++) {
+        expected += i;
+    }
+
+    ABTS_INT_EQUAL(tc, 0, mpmc_errors);
+    ABTS_INT_EQUAL(tc, MPMC_THREADS * MPMC_ITEMS, mpmc_popped);
+    ABTS_TRUE(tc, sum == expected);
+    ABTS_INT_EQUAL(tc, 0, apr_queue_size(queue));
+}
+
+static void test_queue_mpmc(abts_case *tc, void *data)
+{
+    queue_mpmc(tc, (apr_uint32_t)(apr_uintptr_t)data, 0);
+}
+
+static void test_queue_mpmc_batch(abts_case *tc, void *data)
+{
+    queue_mpmc(tc, (apr_uint32_t)(apr_uintptr_t)data, 1);
+}
+
+static void test_queue_batch(abts_case *tc, void *data)
+{
+    apr_queue_t *q;
+    void *items[8];
+    unsigned int i, n;
+    apr_status_t rv;
+
+    rv = apr_queue_create_ex(&q, 5, (apr_uint32_t)(apr_uintptr_t)data, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    for (i = 0; i < 8; i++) {
+        items[i] = (void *)(apr_uintptr_t)(i + 1);
+    }
+    rv = apr_queue_push_batch(q, items, 0, &n);
+    ABTS_INT_EQUAL(tc, APR_EINVAL, rv);
+
+    /* As many as there is room for */
+    rv = apr_queue_push_batch(q, items, 2, &n);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 2, n);
+    rv = apr_queue_trypush_batch(q, items + 2, 6, &n);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 3, n);
+    ABTS_INT_EQUAL(tc, 5, apr_queue_size(q));
+    rv = apr_queue_trypush_batch(q, items + 5, 3, &n);
+    ABTS_INT_EQUAL(tc, APR_EAGAIN, rv);
+    ABTS_INT_EQUAL(tc, 0, n);
+    rv = apr_queue_timedpush_batch(q, items + 5, 3, &n, 1000);
+    ABTS_INT_EQUAL(tc, APR_TIMEUP, rv);
+
+    /* As many as the queue holds, in order */
+    for (i = 0; i < 8; i++) {
+        items[i] = NULL;
+    }
+    rv = apr_queue_pop_batch(q, items, 3, &n);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 3, n);
+    rv = apr_queue_trypop_batch(q, items + 3, 5, &n);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 2, n);
+    for (i = 0; i < 5; i++) {
+        ABTS_PTR_EQUAL(tc, (void *)(apr_uintptr_t)(i + 1), items[i]);
+    }
+    ABTS_INT_EQUAL(tc, 0, apr_queue_size(q));
+    rv = apr_queue_trypop_batch(q, items, 8, &n);
+    ABTS_INT_EQUAL(tc, APR_EAGAIN, rv);
+    ABTS_INT_EQUAL(tc, 0, n);
+    rv = apr_queue_timedpop_batch(q, items, 8, &n, 1000);
+    ABTS_INT_EQUAL(tc, APR_TIMEUP, rv);
+
+    /* Wraps around */
+    rv = apr_queue_trypush_batch(q, items, 4, &n);
+    ABTS_INT_EQUAL(tc, 4, n);
+    rv = apr_queue_trypop_batch(q, items + 4, 4, &n);
+    ABTS_INT_EQUAL(tc, 4, n);
+    for (i = 0; i < 4; i++) {
+        ABTS_PTR_EQUAL(tc, items[i], items[i + 4]);
+    }
+
+    rv = apr_queue_term(q);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_queue_pop_batch(q, items, 8, &n);
+    ABTS_INT_EQUAL(tc, APR_EOF, rv);
+}
+
+static void test_queue_create_ex(abts_case *tc, void *data)
+{
+    apr_queue_t *q;
+    apr_status_t rv;
+
+    rv = apr_queue_create_ex(&q, 0, APR_QUEUE_LOCKFREE, p);
+    ABTS_INT_EQUAL(tc, APR_EINVAL, rv);
+
+    /* The bound holds with a number of slots above it */
+    rv = apr_queue_create_ex(&q, 3, APR_QUEUE_LOCKFREE, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, apr_queue_trypush(q, (void *)1));
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, apr_queue_trypush(q, (void *)2));
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, apr_queue_trypush(q, (void *)3));
+    ABTS_INT_EQUAL(tc, APR_EAGAIN, apr_queue_trypush(q, (void *)4));
+    ABTS_INT_EQUAL(tc, 3, apr_queue_size(q));
+
+    rv = apr_queue_interrupt_all(q);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_queue_term(q);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, APR_EOF, apr_queue_trypush(q, (void *)5));
+}
+
+#define IDLE_CONSUMERS 4
+
+static volatile apr_uint32_t idle_popped, idle_interrupted;
+
+static void * APR_THREAD_FUNC idle_consumer(apr_thread_t *thd, void *data)
+{
+    apr_queue_t *q = data;
+    apr_status_t rv;
+    void *v;
+
+    rv = apr_queue_pop(q, &v);
+    if (rv == APR_SUCCESS) {
+        apr_atomic_inc32(&idle_popped);
+    }
+    else if (rv == APR_EINTR) {
+        apr_atomic_inc32(&idle_interrupted);
+    }
+    apr_thread_exit(thd, rv);
+    return NULL;
+}
+
+/* Blocked poppers losing the race for an item keep waiting, only
+ * apr_queue_interrupt_all() makes them return APR_EINTR.
+ */
+static void test_queue_idle_consumers(abts_case *tc, void *data)
+{
+    apr_thread_t *t[IDLE_CONSUMERS];
+    apr_status_t rv, retval;
+    apr_queue_t *q;
+    int i;
+
+    idle_popped = idle_interrupted = 0;
+    rv = apr_queue_create_ex(&q, 16, (apr_uint32_t)(apr_uintptr_t)data, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    for (i = 0; i < IDLE_CONSUMERS; i++) {
+        rv = apr_thread_create(&t[i], NULL, idle_consumer, q, p);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    apr_sleep(apr_time_from_msec(100));
+
+    rv = apr_queue_push(q, (void *)1);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    apr_sleep(apr_time_from_msec(100));
+    ABTS_INT_EQUAL(tc, 1, apr_atomic_read32(&idle_popped));
+    ABTS_INT_EQUAL(tc, 0, apr_atomic_read32(&idle_interrupted));
+
+    rv = apr_queue_interrupt_all(q);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    for (i = 0; i < IDLE_CONSUMERS; i++) {
+        apr_thread_join(&retval, t[i]);
+    }
+    ABTS_INT_EQUAL(tc, 1, apr_atomic_read32(&idle_popped));
+    ABTS_INT_EQUAL(tc, IDLE_CONSUMERS - 1,
+                   apr_atomic_read32(&idle_interrupted));
+}
+
 #endif /* APR_HAS_THREADS */
 
 abts_suite *testqueue(abts_suite *suite)
 {
+#if APR_HAS_THREADS
+    void *lockfree = (void *)(apr_uintptr_t)APR_QUEUE_LOCKFREE;
+#endif
+
     suite = ADD_SUITE(suite);
 
 #if APR_HAS_THREADS
     abts_run_test(suite, test_queue_producer_consumer, NULL);
     abts_run_test(suite, test_queue_timeout, NULL);
+    abts_run_test(suite, test_queue_mpmc, NULL);
+    abts_run_test(suite, test_queue_mpmc_batch, NULL);
+    abts_run_test(suite, test_queue_batch, NULL);
+    abts_run_test(suite, test_queue_create_ex, NULL);
+    abts_run_test(suite, test_queue_idle_consumers, NULL);
+    abts_run_test(suite, test_queue_producer_consumer, lockfree);
+    abts_run_test(suite, test_queue_timeout, lockfree);
+    abts_run_test(suite, test_queue_mpmc, lockfree);
+    abts_run_test(suite, test_queue_mpmc_batch, lockfree);
+    abts_run_test(suite, test_queue_batch, lockfree);
+    abts_run_test(suite, test_queue_idle_consumers, lockfree);
 #endif /* APR_HAS_THREADS */
 
     return suite;
@@ -0,0 +1,314 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Passes items through an apr_queue_t from 1 to N producers to as many
+ * consumers, with the locked and the lock-free (APR_QUEUE_LOCKFREE)
+ * queues, one by one and by batches; then through the ring buffers from
+ * 1 (apr_ring_spsc_t) or N (apr_ring_mpsc_t) producers to one consumer.
+ */
+
+#include "apr_general.h"
+#include "apr_getopt.h"
+#include "apr_queue.h"
+#include "apr_ringbuf.h"
+#include "apr_thread_proc.h"
+#include "apr_time.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#if !APR_HAS_THREADS
+
+int main(void)
+{
+    fprintf(stderr, "this program requires APR thread support\n");
+    return 0;
+}
+
+#else
+
+#define DEFAULT_NUM_ITEMS 1000000
+#define DEFAULT_NUM_THREADS 4
+#define DEFAULT_CAPACITY 1024
+#define DEFAULT_BATCH 32
+
+#define MAX_THREADS 64
+#define MAX_BATCH 1024
+
+static int num_items = DEFAULT_NUM_ITEMS;
+static int num_threads = DEFAULT_NUM_THREADS;
+static int capacity = DEFAULT_CAPACITY;
+static int batch_size = DEFAULT_BATCH;
+
+static apr_queue_t *queue;
+static apr_ring_spsc_t *spsc;
+static apr_ring_mpsc_t *mpsc;
+static int items_per_thread;
+static int batch;
+
+static void *APR_THREAD_FUNC producer(apr_thread_t *thd, void *data)
+{
+    void *items[MAX_BATCH];
+    unsigned int n, pushed;
+    int i;
+
+    if (!batch) {
+        for (i = 0; i < items_per_thread; i++) {
+            while (apr_queue_push(queue, data) == APR_EINTR)
+                ;
+        }
+        return NULL;
+    }
+    for (i = 0; i < batch_size; i++) {
+        items[i] = data;
+    }
+    for (i = 0; i < items_per_thread; i += pushed) {
+        n = items_per_thread - i;
+        if (n > (unsigned int)batch_size) {
+            n = batch_size;
+        }
+        while (apr_queue_push_batch(queue, items, n, &pushed) == APR_EINTR)
+            ;
+    }
+    return NULL;
+}
+
+static void *APR_THREAD_FUNC consumer(apr_thread_t *thd, void *data)
+{
+    void *items[MAX_BATCH];
+    unsigned int n, popped;
+    int i;
+
+    if (!batch) {
+        for (i = 0; i < items_per_thread; i++) {
+            while (apr_queue_pop(queue, &items[0]) == APR_EINTR)
+                ;
+        }
+        return NULL;
+    }
+    for (i = 0; i < items_per_thread; i += popped) {
+        n = items_per_thread - i;
+        if (n > (unsigned int)batch_size) {
+            n = batch_size;
+        }
+        while (apr_queue_pop_batch(queue, items, n, &popped) == APR_EINTR)
+            ;
+    }
+    return NULL;
+}
+
+static void *APR_THREAD_FUNC ring_producer(apr_thread_t *thd, void *data)
+{
+    void *items[MAX_BATCH];
+    apr_uint32_t n, count;
+    int i;
+
+    for (i = 0; i < batch_size; i++) {
+        items[i] = data;
+    }
+    for (i = 0; i < items_per_thread; i += count) {
+        n = batch ? items_per_thread - i : 1;
+        if (n > (apr_uint32_t)batch_size) {
+            n = batch_size;
+        }
+        if (spsc) {
+            apr_ring_spsc_enqueue(spsc, items, n, &count, -1);
+        }
+        else {
+            apr_ring_mpsc_enqueue(mpsc, items, n, &count, -1);
+        }
+    }
+    return NULL;
+}
+
+static void ring_consume(int items)
+{
+    void *elts[MAX_BATCH];
+    apr_uint32_t n, count;
+    int i;
+
+    for (i = 0; i < items; i += count) {
+        n = batch ? items - i : 1;
+        if (n > (apr_uint32_t)batch_size) {
+            n = batch_size;
+        }
+        if (spsc) {
+            apr_ring_spsc_dequeue(spsc, elts, n, &count, -1);
+        }
+        else {
+            apr_ring_mpsc_dequeue(mpsc, elts, n, &count, -1);
+        }
+    }
+}
+
+static void bench_ring(apr_pool_t *pool, int threads, int by_batch)
+{
+    apr_thread_t *producers[MAX_THREADS];
+    apr_time_t start, stop;
+    apr_status_t rv;
+    apr_pool_t *p;
+    int i;
+
+    apr_pool_create(&p, pool);
+    spsc = NULL;
+    mpsc = NULL;
+    if (threads == 1) {
+        rv = apr_ring_spsc_create(&spsc, capacity, sizeof(void *),
+                                  APR_RING_BLOCKING, p);
+    }
+    else {
+        rv = apr_ring_mpsc_create(&mpsc, capacity, sizeof(void *),
+                                  APR_RING_BLOCKING, p);
+    }
+    if (rv != APR_SUCCESS) {
+        fprintf(stderr, "apr_ring_*_create failed\n");
+        exit(1);
+    }
+    items_per_thread = num_items / threads;
+    batch = by_batch;
+
+    start = apr_time_now();
+    for (i = 0; i < threads; i++) {
+        apr_thread_create(&producers[i], NULL, ring_producer, p, p);
+    }
+    ring_consume(items_per_thread * threads);
+    for (i = 0; i < threads; i++) {
+        apr_thread_join(&rv, producers[i]);
+    }
+    stop = apr_time_now();
+
+    printf("  %-9s %-6s %3d producers/consumer:  %7.1f ns/item, "
+           "%6.2f Mitems/s\n", spsc ? "spsc ring" : "mpsc ring",
+           by_batch ? "batch" : "single", threads,
+           (double)(stop - start) * 1000.0 / (items_per_thread * threads),
+           (double)items_per_thread * threads / (stop - start));
+
+    apr_pool_destroy(p);
+}
+
+static void bench(apr_pool_t *pool, int threads, apr_uint32_t flags,
+                  int by_batch)
+{
+    apr_thread_t *producers[MAX_THREADS], *consumers[MAX_THREADS];
+    apr_time_t start, stop;
+    apr_status_t rv;
+    apr_pool_t *p;
+    int i;
+
+    apr_pool_create(&p, pool);
+    if (apr_queue_create_ex(&queue, capacity, flags, p) != APR_SUCCESS) {
+        fprintf(stderr, "apr_queue_create_ex failed\n");
+        exit(1);
+    }
+    items_per_thread = num_items / threads;
+    batch = by_batch;
+
+    start = apr_time_now();
+    for (i = 0; i < threads; i++) {
+        apr_thread_create(&consumers[i], NULL, consumer, NULL, p);
+        apr_thread_create(&producers[i], NULL, producer, queue, p);
+    }
+    for (i = 0; i < threads; i++) {
+        apr_thread_join(&rv, producers[i]);
+        apr_thread_join(&rv, consumers[i]);
+    }
+    stop = apr_time_now();
+
+    printf("  %-9s %-6s %3d producers/consumers: %7.1f ns/item, "
+           "%6.2f Mitems/s\n", flags ? "lock-free" : "locked",
+           by_batch ? "batch" : "single", threads,
+           (double)(stop - start) * 1000.0 / (items_per_thread * threads),
+           (double)items_per_thread * threads / (stop - start));
+
+    apr_queue_term(queue);
+    apr_pool_destroy(p);
+}
+
+int main(int argc, const char *const *argv)
+{
+    apr_pool_t *pool;
+    apr_getopt_t *opt;
+    const char *optarg;
+    char optchar;
+    apr_status_t rv;
+    int threads;
+
+    apr_initialize();
+    atexit(apr_terminate);
+    apr_pool_create(&pool, NULL);
+
+    if (apr_getopt_init(&opt, pool, argc, argv)) {
+        return 1;
+    }
+    while ((rv = apr_getopt(opt, "n:t:c:b:", &optchar,
+                            &optarg)) == APR_SUCCESS) {
+        switch (optchar) {
+        case 'n':
+            num_items = atoi(optarg);
+            break;
+        case 't':
+            num_threads = atoi(optarg);
+            break;
+        case 'c':
+            capacity = atoi(optarg);
+            break;
+        case 'b':
+            batch_size = atoi(optarg);
+            break;
+        }
+    }
+    if (rv != APR_EOF || num_items <= 0 || num_threads <= 0
+        || num_threads > MAX_THREADS || capacity <= 0
+        || batch_size <= 0 || batch_size > MAX_BATCH) {
+        fprintf(stderr, "usage: %s [-n items] [-t max producers (<= %d)] "
+                "[-c capacity] [-b batch size (<= %d)]\n", argv[0],
+                MAX_THREADS, MAX_BATCH);
+        return 1;
+    }
+
+    printf("apr_queue_t, %d items, capacity %d, batches of %d, 1 to %d "
+           "producers and consumers\n", num_items, capacity, batch_size,
+           num_threads);
+    for (threads = 1; ; threads *= 2) {
+        if (threads > num_threads) {
+            threads = num_threads;
+        }
+        bench(pool, threads, 0, 0);
+        bench(pool, threads, 0, 1);
+        bench(pool, threads, APR_QUEUE_LOCKFREE, 0);
+        bench(pool, threads, APR_QUEUE_LOCKFREE, 1);
+        if (threads == num_threads) {
+            break;
+        }
+    }
+
+    printf("apr_ring_spsc_t/apr_ring_mpsc_t (blocking), same parameters, "
+           "one consumer\n");
+    for (threads = 1; ; threads *= 2) {
+        if (threads > num_threads) {
+            threads = num_threads;
+        }
+        bench_ring(pool, threads, 0);
+        bench_ring(pool, threads, 1);
+        if (threads == num_threads) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+#endif /* APR_HAS_THREADS */
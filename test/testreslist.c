@@ -18,6 +18,7 @@
 #include <stdlib.h>
 
 #include "apr_general.h"
+#include "apr_atomic.h"
 #include "apu.h"
 #include "apr_reslist.h"
 #include "apr_thread_pool.h"
@@ -44,8 +45,9 @@
 typedef struct {
     apr_interval_time_t sleep_upon_construct;
     apr_interval_time_t sleep_upon_destruct;
-    int c_count;
-    int d_count;
+    /* atomic, the maintainer calls the constructor and destructor unlocked */
+    volatile apr_uint32_t c_count;
+    volatile apr_uint32_t d_count;
 } my_parameters_t;
 
 typedef struct {
@@ -69,7 +71,7 @@ static apr_status_t my_constructor(void **resource, void *params,
 
     /* Create some resource */
     res = apr_palloc(pool, sizeof(*res));
-    res->id = my_params->c_count++;
+    res->id = apr_atomic_inc32(&my_params->c_count);
 
     /* Sleep for awhile, to simulate construction overhead. */
     apr_sleep(my_params->sleep_upon_construct);
@@ -84,7 +86,7 @@ static apr_status_t my_destructor(void *resource, void *params,
 {
     my_resource_t *res = resource;
     my_parameters_t *my_params = params;
-    res->id = my_params->d_count++;
+    res->id = apr_atomic_inc32(&my_params->d_count);
 
     apr_sleep(my_params->sleep_upon_destruct);
 
@@ -213,6 +215,9 @@ static void test_shrinking(abts_case *tc, apr_reslist_t *rl, int acquire_flags)
     }
 }
 
+/* Test flag (beside the acquire ones) to run with per-thread caches */
+#define RESLIST_CACHED 0x100
+
 static void test_reslist(abts_case *tc, void *data)
 {
     int i;
@@ -221,7 +226,8 @@ static void test_reslist(abts_case *tc, void *data)
     my_parameters_t *params;
     apr_thread_pool_t *thrp;
     my_thread_info_t thread_info[CONSUMER_THREADS];
-    int acquire_flags = (int)(apr_uintptr_t)data;
+    int acquire_flags = (int)(apr_uintptr_t)data & APR_RESLIST_ACQUIRE_MASK;
+    int cached = (int)(apr_uintptr_t)data & RESLIST_CACHED;
 
     rv = apr_thread_pool_create(&thrp, CONSUMER_THREADS/2, CONSUMER_THREADS, p);
     ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
@@ -238,6 +244,17 @@ static void test_reslist(abts_case *tc, void *data)
                             params, p);
     ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
 
+    if (cached) {
+        rv = apr_reslist_thread_cache_set(rl, APR_RESLIST_THREAD_CACHE_MAX);
+        if (rv == APR_ENOTIMPL) {
+            ABTS_NOT_IMPL(tc, "per-thread caches");
+            apr_thread_pool_destroy(thrp);
+            apr_reslist_destroy(rl);
+            return;
+        }
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+
     for (i = 0; i < CONSUMER_THREADS; i++) {
         thread_info[i].tid = i;
         thread_info[i].tc = tc;
@@ -299,6 +316,181 @@ static void test_reslist_no_ttl(abts_case *tc, void *data)
     ABTS_INT_EQUAL(tc, params->d_count, 1);
 }
 
+typedef struct {
+    apr_reslist_t *reslist;
+    void *resource; /* the one acquired */
+} my_cached_info_t;
+
+static void * APR_THREAD_FUNC cached_acquiring_thread(apr_thread_t *thd,
+                                                      void *data)
+{
+    my_cached_info_t *info = data;
+    apr_status_t rv;
+
+    rv = apr_reslist_acquire(info->reslist, &info->resource);
+    if (rv == APR_SUCCESS) {
+        rv = apr_reslist_release(info->reslist, info->resource);
+    }
+    apr_thread_exit(thd, rv);
+    return NULL;
+}
+
+static void test_reslist_cache(abts_case *tc, void *data)
+{
+    apr_status_t rv, retval;
+    apr_reslist_t *rl;
+    apr_thread_t *thd;
+    my_parameters_t *params;
+    my_resource_t *res, *res2;
+    my_cached_info_t info;
+
+    params = apr_pcalloc(p, sizeof(*params));
+
+    rv = apr_reslist_create(&rl, 0, 2, 2, 0,
+                            my_constructor, my_destructor, params, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    rv = apr_reslist_thread_cache_set(rl, APR_RESLIST_THREAD_CACHE_MAX + 1);
+    ABTS_INT_EQUAL(tc, APR_EINVAL, rv);
+    rv = apr_reslist_thread_cache_set(rl, 1);
+    if (rv == APR_ENOTIMPL) {
+        ABTS_NOT_IMPL(tc, "per-thread caches");
+        apr_reslist_destroy(rl);
+        return;
+    }
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    /* The cached resource is the one acquired again */
+    rv = apr_reslist_acquire(rl, (void **)&res);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 1, apr_reslist_acquired_count(rl));
+    rv = apr_reslist_release(rl, res);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 0, apr_reslist_acquired_count(rl));
+    rv = apr_reslist_acquire(rl, (void **)&res2);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_PTR_EQUAL(tc, res, res2);
+    ABTS_INT_EQUAL(tc, 1, params->c_count);
+
+    /* With both resources out (hmax) and then one released in our cache,
+     * another thread must steal it from there rather than block.
+     */
+    rv = apr_reslist_acquire(rl, (void **)&res2);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 2, params->c_count);
+    rv = apr_reslist_release(rl, res);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 1, apr_reslist_acquired_count(rl));
+
+    apr_reslist_timeout_set(rl, apr_time_from_sec(5));
+    info.reslist = rl;
+    info.resource = NULL;
+    rv = apr_thread_create(&thd, NULL, cached_acquiring_thread, &info, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_thread_join(&retval, thd);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, retval);
+    ABTS_PTR_EQUAL(tc, res, info.resource);
+    ABTS_INT_EQUAL(tc, 2, params->c_count);
+
+    /* And the resource it released (cached until exit) is still accounted
+     * for, while we hold the other one.
+     */
+    ABTS_INT_EQUAL(tc, 1, apr_reslist_acquired_count(rl));
+    rv = apr_reslist_release(rl, res2);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 0, apr_reslist_acquired_count(rl));
+
+    rv = apr_reslist_destroy(rl);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 2, params->d_count);
+}
+
+/* Wait for the maintainer to reach the given number of resources */
+static int wait_resources(my_parameters_t *params, int count)
+{
+    int i;
+
+    for (i = 0; i < 2000; i++) {
+        if ((int)(params->c_count - params->d_count) == count) {
+            return 1;
+        }
+        apr_sleep(APR_TIME_C(1000));
+    }
+    return 0;
+}
+
+static void test_reslist_maintenance(abts_case *tc, void *data)
+{
+    apr_status_t rv;
+    apr_reslist_t *rl;
+    my_parameters_t *params;
+    void *res[4];
+    apr_uint32_t count;
+    apr_time_t start;
+    int i;
+
+    params = apr_pcalloc(p, sizeof(*params));
+
+    rv = apr_reslist_create(&rl, 2, 2, 10, APR_TIME_C(10000) /* 10 ms */,
+                            my_constructor, my_destructor, params, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 2, params->c_count);
+
+    rv = apr_reslist_maintenance_set(rl, -1);
+    ABTS_INT_EQUAL(tc, APR_EINVAL, rv);
+    rv = apr_reslist_maintenance_set(rl, APR_TIME_C(1000));
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    /* Consuming the resources makes the maintainer prewarm min of them */
+    for (i = 0; i < 4; i++) {
+        rv = apr_reslist_acquire(rl, &res[i]);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    ABTS_TRUE(tc, wait_resources(params, 6));
+
+    /* Then expire the ones beyond smax once released */
+    for (i = 0; i < 4; i++) {
+        rv = apr_reslist_release(rl, res[i]);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    ABTS_TRUE(tc, wait_resources(params, 2));
+    ABTS_INT_EQUAL(tc, 0, apr_reslist_acquired_count(rl));
+
+    /* The requests are not held while the maintainer constructs */
+    params->sleep_upon_construct = APR_TIME_C(200000); /* 200 ms */
+    count = params->c_count;
+    for (i = 0; i < 2; i++) {
+        rv = apr_reslist_acquire(rl, &res[i]);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    for (i = 0; i < 2000 && params->c_count == count; i++) {
+        apr_sleep(APR_TIME_C(1000));
+    }
+    ABTS_TRUE(tc, params->c_count != count);
+    start = apr_time_now();
+    rv = apr_reslist_release(rl, res[0]);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_reslist_acquire(rl, &res[0]);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_TRUE(tc, apr_time_now() - start < APR_TIME_C(100000));
+    for (i = 0; i < 2; i++) {
+        rv = apr_reslist_release(rl, res[i]);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    params->sleep_upon_construct = 0;
+
+    rv = apr_reslist_maintenance_set(rl, 0);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    /* Restart it for apr_reslist_destroy() to stop it */
+    rv = apr_reslist_maintenance_set(rl, APR_TIME_C(1000));
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_reslist_destroy(rl);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, params->c_count, params->d_count);
+}
+
 #endif /* APR_HAS_THREADS */
 
 abts_suite *testreslist(abts_suite *suite)
@@ -310,7 +502,15 @@ abts_suite *testreslist(abts_suite *suite)
                   (void*)(apr_uintptr_t)APR_RESLIST_ACQUIRE_LIFO);
     abts_run_test(suite, test_reslist,
                   (void*)(apr_uintptr_t)APR_RESLIST_ACQUIRE_FIFO);
+    abts_run_test(suite, test_reslist,
+                  (void*)(apr_uintptr_t)(APR_RESLIST_ACQUIRE_LIFO
+                                         | RESLIST_CACHED));
+    abts_run_test(suite, test_reslist,
+                  (void*)(apr_uintptr_t)(APR_RESLIST_ACQUIRE_FIFO
+                                         | RESLIST_CACHED));
     abts_run_test(suite, test_reslist_no_ttl, NULL);
+    abts_run_test(suite, test_reslist_cache, NULL);
+    abts_run_test(suite, test_reslist_maintenance, NULL);
 #endif
 
     return suite;
@@ -0,0 +1,366 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testutil.h"
+#include "apr.h"
+#include "apr_general.h"
+#include "apr_pools.h"
+#include "apr_ringbuf.h"
+#include "apr_shm.h"
+#include "apr_thread_proc.h"
+#include "apr_time.h"
+
+#if APR_HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+/* The tests take the flags of the ring, and this one for an MPSC ring */
+#define TEST_MPSC 0x100
+
+#define NUM_PRODUCERS 4
+#define NUM_ITEMS 20000
+#define MAX_BATCH 16
+
+typedef struct item_t {
+    apr_uint32_t id;
+    apr_uint32_t seq;
+} item_t;
+
+static apr_status_t ring_create(void **ring, int mpsc, apr_uint32_t capacity,
+                                apr_size_t elt_size, apr_uint32_t flags)
+{
+    if (mpsc) {
+        return apr_ring_mpsc_create((apr_ring_mpsc_t **)ring, capacity,
+                                    elt_size, flags, p);
+    }
+    return apr_ring_spsc_create((apr_ring_spsc_t **)ring, capacity,
+                                elt_size, flags, p);
+}
+
+static apr_status_t ring_enqueue(void *ring, int mpsc, const void *elts,
+                                 apr_uint32_t n, apr_uint32_t *count,
+                                 apr_interval_time_t timeout)
+{
+    if (mpsc) {
+        return apr_ring_mpsc_enqueue(ring, elts, n, count, timeout);
+    }
+    return apr_ring_spsc_enqueue(ring, elts, n, count, timeout);
+}
+
+static apr_status_t ring_dequeue(void *ring, int mpsc, void *elts,
+                                 apr_uint32_t n, apr_uint32_t *count,
+                                 apr_interval_time_t timeout)
+{
+    if (mpsc) {
+        return apr_ring_mpsc_dequeue(ring, elts, n, count, timeout);
+    }
+    return apr_ring_spsc_dequeue(ring, elts, n, count, timeout);
+}
+
+static apr_uint32_t ring_count(void *ring, int mpsc)
+{
+    return mpsc ? apr_ring_mpsc_count(ring) : apr_ring_spsc_count(ring);
+}
+
+static void ring_close(void *ring, int mpsc)
+{
+    if (mpsc) {
+        apr_ring_mpsc_close(ring);
+    }
+    else {
+        apr_ring_spsc_close(ring);
+    }
+}
+
+static void test_ring_basic(abts_case *tc, void *data)
+{
+    apr_uint32_t flags = (apr_uint32_t)(apr_uintptr_t)data;
+    int mpsc = (flags & TEST_MPSC) != 0;
+    int in[10], out[10];
+    apr_uint32_t i, n;
+    apr_status_t rv;
+    void *ring;
+
+    flags &= ~TEST_MPSC;
+    ABTS_INT_EQUAL(tc, 0, apr_ring_spsc_size(0, sizeof(int)));
+    ABTS_INT_EQUAL(tc, 0, apr_ring_mpsc_size(8, 0));
+    rv = ring_create(&ring, mpsc, 0, sizeof(int), flags);
+    ABTS_INT_EQUAL(tc, APR_EINVAL, rv);
+
+    /* The capacity is rounded up to 8 */
+    rv = ring_create(&ring, mpsc, 5, sizeof(int), flags);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    for (i = 0; i < 10; i++) {
+        in[i] = i;
+    }
+    rv = ring_enqueue(ring, mpsc, in, 0, &n, 0);
+    ABTS_INT_EQUAL(tc, APR_EINVAL, rv);
+    rv = ring_enqueue(ring, mpsc, in, 10, &n, 0);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 8, n);
+    ABTS_INT_EQUAL(tc, 8, ring_count(ring, mpsc));
+    rv = ring_enqueue(ring, mpsc, in + 8, 2, &n, 0);
+    ABTS_INT_EQUAL(tc, APR_EAGAIN, rv);
+    ABTS_INT_EQUAL(tc, 0, n);
+    rv = ring_enqueue(ring, mpsc, in + 8, 2, &n, apr_time_from_msec(1));
+    ABTS_INT_EQUAL(tc, APR_TIMEUP, rv);
+
+    rv = ring_dequeue(ring, mpsc, out, 3, &n, 0);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 3, n);
+    rv = ring_dequeue(ring, mpsc, out + 3, 7, &n, -1);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 5, n);
+    for (i = 0; i < 8; i++) {
+        ABTS_INT_EQUAL(tc, i, out[i]);
+    }
+    ABTS_INT_EQUAL(tc, 0, ring_count(ring, mpsc));
+    rv = ring_dequeue(ring, mpsc, out, 10, &n, 0);
+    ABTS_INT_EQUAL(tc, APR_EAGAIN, rv);
+    rv = ring_dequeue(ring, mpsc, out, 10, &n, apr_time_from_msec(1));
+    ABTS_INT_EQUAL(tc, APR_TIMEUP, rv);
+
+    /* Wraps around */
+    rv = ring_enqueue(ring, mpsc, in, 6, &n, -1);
+    ABTS_INT_EQUAL(tc, 6, n);
+    rv = ring_dequeue(ring, mpsc, out, 10, &n, -1);
+    ABTS_INT_EQUAL(tc, 6, n);
+    for (i = 0; i < 6; i++) {
+        ABTS_INT_EQUAL(tc, i, out[i]);
+    }
+
+    /* The elements left are dequeued after the close */
+    rv = ring_enqueue(ring, mpsc, in, 2, &n, -1);
+    ABTS_INT_EQUAL(tc, 2, n);
+    ring_close(ring, mpsc);
+    rv = ring_enqueue(ring, mpsc, in, 1, &n, -1);
+    ABTS_INT_EQUAL(tc, APR_EOF, rv);
+    rv = ring_dequeue(ring, mpsc, out, 10, &n, -1);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 2, n);
+    rv = ring_dequeue(ring, mpsc, out, 10, &n, -1);
+    ABTS_INT_EQUAL(tc, APR_EOF, rv);
+}
+
+static void test_ring_attach(abts_case *tc, void *data)
+{
+    apr_size_t size = apr_ring_mpsc_size(16, sizeof(item_t));
+    apr_ring_spsc_t *spsc;
+    apr_ring_mpsc_t *mpsc, *mpsc2;
+    item_t item = { 1, 2 }, out;
+    apr_uint32_t n;
+    apr_status_t rv;
+    void *mem = apr_palloc(p, size);
+
+    ABTS_TRUE(tc, size >= apr_ring_spsc_size(16, sizeof(item_t)));
+    rv = apr_ring_mpsc_init(&mpsc, mem, size - 1, 16, sizeof(item_t), 0);
+    ABTS_INT_EQUAL(tc, APR_EINVAL, rv);
+    rv = apr_ring_mpsc_init(&mpsc, mem, size, 16, sizeof(item_t), 0);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_ring_spsc_attach(&spsc, mem);
+    ABTS_INT_EQUAL(tc, APR_EINVAL, rv);
+    rv = apr_ring_mpsc_attach(&mpsc2, mem);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    rv = apr_ring_mpsc_enqueue(mpsc2, &item, 1, &n, 0);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_ring_mpsc_dequeue(mpsc, &out, 1, &n, 0);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 1, out.id);
+    ABTS_INT_EQUAL(tc, 2, out.seq);
+}
+
+#if APR_HAS_THREADS
+
+static void *ring;
+static int ring_mpsc;
+
+static void *APR_THREAD_FUNC producer(apr_thread_t *thd, void *data)
+{
+    apr_uint32_t id = (apr_uint32_t)(apr_uintptr_t)data, i, j, n, count;
+    item_t items[MAX_BATCH];
+    apr_status_t rv = APR_SUCCESS;
+
+    for (i = 0; i < NUM_ITEMS; i += count) {
+        /* Vary the batch size */
+        n = (i % MAX_BATCH) + 1;
+        if (n > NUM_ITEMS - i) {
+            n = NUM_ITEMS - i;
+        }
+        for (j = 0; j < n; j++) {
+            items[j].id = id;
+            items[j].seq = i + j;
+        }
+        rv = ring_enqueue(ring, ring_mpsc, items, n, &count, -1);
+        if (rv != APR_SUCCESS) {
+            break;
+        }
+    }
+    apr_thread_exit(thd, rv);
+    return NULL;
+}
+
+static void test_ring_threads(abts_case *tc, void *data)
+{
+    apr_uint32_t flags = (apr_uint32_t)(apr_uintptr_t)data;
+    apr_thread_t *threads[NUM_PRODUCERS];
+    apr_uint32_t next[NUM_PRODUCERS] = { 0 };
+    apr_uint32_t i, n, total = 0, errors = 0;
+    int producers;
+    item_t items[MAX_BATCH];
+    apr_status_t rv, retval;
+
+    ring_mpsc = (flags & TEST_MPSC) != 0;
+    producers = ring_mpsc ? NUM_PRODUCERS : 1;
+    rv = ring_create(&ring, ring_mpsc, 64, sizeof(item_t),
+                     flags & ~TEST_MPSC);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    for (i = 0; i < (apr_uint32_t)producers; i++) {
+        rv = apr_thread_create(&threads[i], NULL, producer,
+                               (void *)(apr_uintptr_t)i, p);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+
+    while (total < (apr_uint32_t)producers * NUM_ITEMS) {
+        rv = ring_dequeue(ring, ring_mpsc, items, MAX_BATCH, &n,
+                          apr_time_from_sec(10));
+        if (rv != APR_SUCCESS) {
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            /* FIFO: the items of a producer come in order */
+            if (items[i].id >= (apr_uint32_t)producers
+                || items[i].seq != next[items[i].id]++) {
+                errors++;
+            }
+        }
+        total += n;
+    }
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, producers * NUM_ITEMS, total);
+    ABTS_INT_EQUAL(tc, 0, errors);
+
+    for (i = 0; i < (apr_uint32_t)producers; i++) {
+        apr_thread_join(&retval, threads[i]);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, retval);
+    }
+    ABTS_INT_EQUAL(tc, 0, ring_count(ring, ring_mpsc));
+}
+
+#endif /* APR_HAS_THREADS */
+
+#if APR_HAS_SHARED_MEMORY && APR_HAS_FORK
+
+static void test_ring_shm(abts_case *tc, void *data)
+{
+    apr_uint32_t flags = (apr_uint32_t)(apr_uintptr_t)data;
+    apr_size_t size = apr_ring_mpsc_size(64, sizeof(item_t));
+    apr_proc_t procs[NUM_PRODUCERS];
+    apr_uint32_t next[NUM_PRODUCERS] = { 0 };
+    apr_uint32_t i, j, n, count, total = 0, errors = 0;
+    item_t items[MAX_BATCH];
+    apr_ring_mpsc_t *mpsc;
+    apr_status_t rv;
+    apr_shm_t *shm;
+    int exitcode;
+
+    rv = apr_shm_create(&shm, size, NULL, p);
+    APR_ASSERT_SUCCESS(tc, "Error allocating shared memory block", rv);
+    if (rv != APR_SUCCESS) {
+        return;
+    }
+    rv = apr_ring_mpsc_init(&mpsc, apr_shm_baseaddr_get(shm), size, 64,
+                            sizeof(item_t), flags);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    for (i = 0; i < NUM_PRODUCERS; i++) {
+        rv = apr_proc_fork(&procs[i], p);
+        if (rv == APR_INCHILD) {
+            apr_ring_mpsc_t *child;
+
+            if (apr_ring_mpsc_attach(&child, apr_shm_baseaddr_get(shm))) {
+                exit(1);
+            }
+            for (j = 0; j < NUM_ITEMS; j += count) {
+                items[0].id = i;
+                items[0].seq = j;
+                if (apr_ring_mpsc_enqueue(child, items, 1, &count, -1)) {
+                    exit(1);
+                }
+            }
+            exit(0);
+        }
+        ABTS_INT_EQUAL(tc, APR_INPARENT, rv);
+    }
+
+    while (total < NUM_PRODUCERS * NUM_ITEMS) {
+        rv = apr_ring_mpsc_dequeue(mpsc, items, MAX_BATCH, &n,
+                                   apr_time_from_sec(10));
+        if (rv != APR_SUCCESS) {
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (items[i].id >= NUM_PRODUCERS
+                || items[i].seq != next[items[i].id]++) {
+                errors++;
+            }
+        }
+        total += n;
+    }
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, NUM_PRODUCERS * NUM_ITEMS, total);
+    ABTS_INT_EQUAL(tc, 0, errors);
+
+    for (i = 0; i < NUM_PRODUCERS; i++) {
+        apr_proc_wait(&procs[i], &exitcode, NULL, APR_WAIT);
+        ABTS_INT_EQUAL(tc, 0, exitcode);
+    }
+
+    rv = apr_shm_destroy(shm);
+    APR_ASSERT_SUCCESS(tc, "Error destroying shared memory block", rv);
+}
+
+#endif /* APR_HAS_SHARED_MEMORY && APR_HAS_FORK */
+
+abts_suite *testringbuf(abts_suite *suite)
+{
+    void *spsc = (void *)(apr_uintptr_t)0;
+    void *mpsc = (void *)(apr_uintptr_t)TEST_MPSC;
+    void *spsc_blocking = (void *)(apr_uintptr_t)APR_RING_BLOCKING;
+    void *mpsc_blocking = (void *)(apr_uintptr_t)(TEST_MPSC
+                                                  | APR_RING_BLOCKING);
+
+    suite = ADD_SUITE(suite)
+
+    abts_run_test(suite, test_ring_basic, spsc);
+    abts_run_test(suite, test_ring_basic, mpsc);
+    abts_run_test(suite, test_ring_basic, spsc_blocking);
+    abts_run_test(suite, test_ring_basic, mpsc_blocking);
+    abts_run_test(suite, test_ring_attach, NULL);
+#if APR_HAS_THREADS
+    abts_run_test(suite, test_ring_threads, spsc);
+    abts_run_test(suite, test_ring_threads, mpsc);
+    abts_run_test(suite, test_ring_threads, spsc_blocking);
+    abts_run_test(suite, test_ring_threads, mpsc_blocking);
+#endif
+#if APR_HAS_SHARED_MEMORY && APR_HAS_FORK
+    abts_run_test(suite, test_ring_shm, NULL);
+    abts_run_test(suite, test_ring_shm, (void *)APR_RING_BLOCKING);
+#endif
+
+    return suite;
+}
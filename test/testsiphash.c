@@ -138,11 +138,28 @@ static void test_siphash_vectors(abts_case *tc, void *data)
     ABTS_ASSERT(tc, "SipHash-2-4 test vectors", test_vectors());
 }
 
+static void test_siphash13(abts_case *tc, void *data)
+{
+    unsigned char in[MAXLEN], k[16];
+    int i, ok = 1;
+
+    for (i = 0; i < 16; ++i) k[i] = i;
+
+    for (i = 0; i < MAXLEN; ++i) {
+        in[i] = i;
+        if (apr_siphash13(in, i, k) != apr_siphash(in, i, k, 1, 3)) {
+            ok = 0;
+        }
+    }
+    ABTS_ASSERT(tc, "SipHash-1-3 matches apr_siphash(c=1, d=3)", ok);
+}
+
 abts_suite *testsiphash(abts_suite *suite)
 {
     suite = ADD_SUITE(suite);
 
     abts_run_test(suite, test_siphash_vectors, NULL);
+    abts_run_test(suite, test_siphash13, NULL);
 
     return suite;
 }
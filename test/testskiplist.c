@@ -519,6 +519,42 @@ static void skiplist_test(abts_case *tc, void *data) {
     apr_pool_clear(ptmp);
 }
 
+static void skiplist_alloc_reuse(abts_case *tc, void *data)
+{
+    apr_skiplist *list;
+    void *a, *b, *c;
+    int i, ok;
+
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, apr_skiplist_init(&list, ptmp));
+    a = apr_skiplist_alloc(list, 16);
+    b = apr_skiplist_alloc(list, 100);
+    c = apr_skiplist_alloc(list, 16);
+    ABTS_PTR_NOTNULL(tc, a);
+    ABTS_PTR_NOTNULL(tc, b);
+    ABTS_PTR_NOTNULL(tc, c);
+
+    /* each size reuses its own freed memory, last freed first */
+    apr_skiplist_free(list, a);
+    apr_skiplist_free(list, b);
+    apr_skiplist_free(list, c);
+    ABTS_PTR_EQUAL(tc, b, apr_skiplist_alloc(list, 100));
+    ABTS_PTR_EQUAL(tc, c, apr_skiplist_alloc(list, 16));
+    ABTS_PTR_EQUAL(tc, a, apr_skiplist_alloc(list, 16));
+
+    /* the churn of a queue doesn't take more memory */
+    for (i = 0, ok = 1; i < 1000; i++) {
+        apr_skiplist_free(list, a);
+        apr_skiplist_free(list, b);
+        if (apr_skiplist_alloc(list, 16) != a
+                || apr_skiplist_alloc(list, 100) != b) {
+            ok = 0;
+        }
+    }
+    ABTS_TRUE(tc, ok);
+
+    apr_pool_clear(ptmp);
+}
+
 
 abts_suite *testskiplist(abts_suite *suite)
 {
@@ -536,6 +572,7 @@ abts_suite *testskiplist(abts_suite *suite)
     abts_run_test(suite, skiplist_size, NULL);
     abts_run_test(suite, skiplist_remove, NULL);
     abts_run_test(suite, skiplist_random_loop, NULL);
+    abts_run_test(suite, skiplist_alloc_reuse, NULL);
 
     abts_run_test(suite, skiplist_test, NULL);
 
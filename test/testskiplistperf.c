@@ -0,0 +1,149 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Uses an apr_skiplist as a timer queue: fills it with timers, then pops
+ * the earliest one and inserts a new one for a while (the churn), with
+ * the timers allocated by apr_skiplist_alloc() from the pool of the
+ * skiplist or from malloc().
+ */
+
+#include "apr_general.h"
+#include "apr_getopt.h"
+#include "apr_skiplist.h"
+#include "apr_time.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DEFAULT_NUM_TIMERS 100000
+#define DEFAULT_NUM_CHURNS 1000000
+
+static int num_timers = DEFAULT_NUM_TIMERS;
+static int num_churns = DEFAULT_NUM_CHURNS;
+
+typedef struct {
+    apr_time_t when;
+    int id;
+} bench_timer_t;
+
+typedef struct {
+    char buf[100];
+} payload_t;
+
+static int timer_cmp(void *a, void *b)
+{
+    apr_time_t x = ((bench_timer_t *)a)->when, y = ((bench_timer_t *)b)->when;
+    return (x < y) ? -1 : (x > y);
+}
+
+static unsigned int rand_next(unsigned int *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+static void bench(apr_pool_t *pool)
+{
+    apr_skiplist *sl;
+    apr_time_t start, mid, stop, now = 0;
+    apr_pool_t *p = NULL;
+    unsigned int seed = 1;
+    bench_timer_t *t;
+    int i;
+
+    if (pool) {
+        apr_pool_create(&p, pool);
+    }
+    apr_skiplist_init(&sl, p);
+    apr_skiplist_set_compare(sl, timer_cmp, timer_cmp);
+
+    start = apr_time_now();
+    for (i = 0; i < num_timers; i++) {
+        t = apr_skiplist_alloc(sl, sizeof(*t));
+        t->when = rand_next(&seed) % 1000000;
+        t->id = i;
+        apr_skiplist_add(sl, t);
+    }
+    mid = apr_time_now();
+    for (i = 0; i < num_churns; i++) {
+        payload_t *payload;
+
+        t = apr_skiplist_pop(sl, NULL);
+        now = t->when;
+        apr_skiplist_free(sl, t);
+
+        /* what the timer would be running */
+        payload = apr_skiplist_alloc(sl, sizeof(*payload));
+        payload->buf[0] = (char)i;
+        apr_skiplist_free(sl, payload);
+
+        t = apr_skiplist_alloc(sl, sizeof(*t));
+        t->when = now + rand_next(&seed) % 1000000;
+        t->id = i;
+        apr_skiplist_add(sl, t);
+    }
+    stop = apr_time_now();
+
+    printf("  %-6s fill: %6.1f ns/timer, churn: %6.1f ns/timer\n",
+           pool ? "pool" : "malloc",
+           (double)(mid - start) * 1000.0 / num_timers,
+           (double)(stop - mid) * 1000.0 / num_churns);
+
+    if (p) {
+        apr_pool_destroy(p);
+    }
+    else {
+        apr_skiplist_destroy(sl, free);
+    }
+}
+
+int main(int argc, const char *const *argv)
+{
+    apr_pool_t *pool;
+    apr_getopt_t *opt;
+    const char *optarg;
+    char optchar;
+    apr_status_t rv;
+
+    apr_initialize();
+    atexit(apr_terminate);
+    apr_pool_create(&pool, NULL);
+
+    if (apr_getopt_init(&opt, pool, argc, argv)) {
+        return 1;
+    }
+    while ((rv = apr_getopt(opt, "n:c:", &optchar, &optarg)) == APR_SUCCESS) {
+        switch (optchar) {
+        case 'n':
+            num_timers = atoi(optarg);
+            break;
+        case 'c':
+            num_churns = atoi(optarg);
+            break;
+        }
+    }
+    if (rv != APR_EOF || num_timers <= 0 || num_churns < 0) {
+        fprintf(stderr, "usage: %s [-n timers] [-c churns]\n", argv[0]);
+        return 1;
+    }
+
+    printf("apr_skiplist timer queue, %d timers, %d churns\n",
+           num_timers, num_churns);
+    bench(pool);
+    bench(NULL);
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testutil.h"
+#include "apr.h"
+#include "apr_general.h"
+#include "apr_pools.h"
+#include "apr_slab.h"
+#if APR_HAVE_STRING_H
+#include <string.h>
+#endif
+
+#define NUM_OBJECTS 1000
+
+static void slab_create(abts_case *tc, void *data)
+{
+    apr_slab_t *slab;
+    apr_status_t rv;
+
+    rv = apr_slab_create(&slab, 3, 0, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_TRUE(tc, apr_slab_object_size(slab) >= sizeof(void *));
+    ABTS_TRUE(tc, apr_slab_object_size(slab) == APR_ALIGN_DEFAULT(
+                                              apr_slab_object_size(slab)));
+
+    rv = apr_slab_create(&slab, 40, APR_SLAB_CACHELINE, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, APR_SLAB_CACHELINE, apr_slab_object_size(slab));
+
+    rv = apr_slab_create(&slab, 40, 24, p);
+    ABTS_INT_EQUAL(tc, APR_EINVAL, rv);
+}
+
+static void slab_reuse(abts_case *tc, void *data)
+{
+    apr_slab_t *slab;
+    apr_slab_stats_t stats;
+    void *objs[NUM_OBJECTS];
+    apr_size_t bytes;
+    apr_status_t rv;
+    int i, j;
+
+    rv = apr_slab_create(&slab, 24, 0, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    for (i = 0; i < NUM_OBJECTS; i++) {
+        objs[i] = apr_slab_alloc(slab);
+        ABTS_PTR_NOTNULL(tc, objs[i]);
+        memset(objs[i], i & 0xff, 24);
+    }
+    for (i = 0; i < NUM_OBJECTS; i++) {
+        for (j = 0; j < 24; j++) {
+            if (((unsigned char *)objs[i])[j] != (i & 0xff)) {
+                break;
+            }
+        }
+        ABTS_INT_EQUAL(tc, 24, j);
+    }
+
+    apr_slab_stats_get(slab, &stats);
+    ABTS_INT_EQUAL(tc, NUM_OBJECTS, stats.objects);
+    ABTS_INT_EQUAL(tc, 0, stats.free_objects);
+    ABTS_TRUE(tc, stats.bytes >= NUM_OBJECTS * 24);
+    bytes = stats.bytes;
+
+    /* Last freed, first reused */
+    apr_slab_free(slab, objs[10]);
+    apr_slab_free(slab, objs[20]);
+    ABTS_PTR_EQUAL(tc, objs[20], apr_slab_alloc(slab));
+    ABTS_PTR_EQUAL(tc, objs[10], apr_slab_alloc(slab));
+
+    /* Churning does not take more memory from the pool */
+    for (j = 0; j < 10; j++) {
+        for (i = 0; i < NUM_OBJECTS; i++) {
+            apr_slab_free(slab, objs[i]);
+        }
+        for (i = 0; i < NUM_OBJECTS; i++) {
+            objs[i] = apr_slab_calloc(slab);
+            ABTS_PTR_NOTNULL(tc, objs[i]);
+        }
+    }
+    apr_slab_stats_get(slab, &stats);
+    ABTS_INT_EQUAL(tc, NUM_OBJECTS, stats.objects);
+    ABTS_TRUE(tc, stats.bytes == bytes);
+    ABTS_TRUE(tc, stats.allocs == stats.frees + NUM_OBJECTS);
+}
+
+static void slab_aligned(abts_case *tc, void *data)
+{
+    apr_slab_t *slab;
+    apr_status_t rv;
+    char *obj;
+    int i;
+
+    rv = apr_slab_create(&slab, 100, APR_SLAB_CACHELINE, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    /* Misalign the pool on purpose */
+    apr_palloc(p, 8);
+
+    for (i = 0; i < 100; i++) {
+        obj = apr_slab_alloc(slab);
+        ABTS_PTR_NOTNULL(tc, obj);
+        ABTS_INT_EQUAL(tc, 0, (apr_uintptr_t)obj % APR_SLAB_CACHELINE);
+        memset(obj, 0xa, 100);
+    }
+}
+
+abts_suite *testslab(abts_suite *suite)
+{
+    suite = ADD_SUITE(suite)
+
+    abts_run_test(suite, slab_create, NULL);
+    abts_run_test(suite, slab_reuse, NULL);
+    abts_run_test(suite, slab_aligned, NULL);
+
+    return suite;
+}
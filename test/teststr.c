@@ -407,6 +407,91 @@ static void pstrcat(abts_case *tc, void *data)
                    "abcdefghij12345");
 }
 
+static int sign(int x)
+{
+    return x < 0 ? -1 : x > 0;
+}
+
+static void case_compare(abts_case *tc, void *data)
+{
+    static const char *strs[] = {
+        "", "a", "A", "B", "ab", "Content-Type", "content-type",
+        "CONTENT-TYPE", "Content-Length", "X-Forwarded-For",
+        "x-forwarded-for-and-some-more-bytes", "X-FORWARDED-FOR-AND-SOME",
+        "[", "_", "@", "\xe9t\xe9", "\xc9T\xc9"
+    };
+    int n = sizeof(strs) / sizeof(strs[0]), i, j;
+    char *page, *buf, *upper;
+    apr_size_t k;
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            int expected = 0;
+            const unsigned char *s1 = (const unsigned char *)strs[i];
+            const unsigned char *s2 = (const unsigned char *)strs[j];
+            while (!expected) {
+                int c1 = (*s1 >= 'A' && *s1 <= 'Z') ? *s1 + 32 : *s1;
+                int c2 = (*s2 >= 'A' && *s2 <= 'Z') ? *s2 + 32 : *s2;
+                expected = c1 - c2;
+                if (!*s1++ || !*s2++)
+                    break;
+            }
+            ABTS_INT_EQUAL(tc, sign(expected),
+                           sign(apr_cstr_casecmp(strs[i], strs[j])));
+            if (!expected) {
+                ABTS_INT_EQUAL(tc, apr_cstr_casehash(strs[i]),
+                               apr_cstr_casehash(strs[j]));
+            }
+        }
+    }
+    /* ASCII only, not folded by the locale */
+    ABTS_TRUE(tc, apr_cstr_casecmp("\xe9", "\xc9") != 0);
+
+    ABTS_INT_EQUAL(tc, 0, apr_cstr_casecmpn("X-Forwarded-Proto",
+                                            "x-forwarded-PORT", 13));
+    ABTS_TRUE(tc, apr_cstr_casecmpn("X-Forwarded-Proto",
+                                    "x-forwarded-PORT", 14) > 0);
+    ABTS_INT_EQUAL(tc, 0, apr_cstr_casecmpn("X-Forwarded-For-Some-More-X",
+                                            "x-forwarded-for-some-more-Y", 26));
+    ABTS_TRUE(tc, apr_cstr_casecmpn("X-Forwarded-For-Some-More-X",
+                                    "x-forwarded-for-some-more-Y", 27) < 0);
+    ABTS_INT_EQUAL(tc, 0, apr_cstr_casecmpn("abc", "ABC", 100));
+    ABTS_INT_EQUAL(tc, 0, apr_cstr_casecmpn("abc", "xyz", 0));
+
+    /* Strings ending at every offset up to a page boundary, the next page
+     * may not be readable in production.
+     */
+    page = apr_palloc(p, 3 * 4096);
+    page = (char *)(((apr_uintptr_t)page + 4095) & ~(apr_uintptr_t)4095);
+    for (k = 1; k < 40; k++) {
+        buf = page + 4096 - k;
+        memset(buf, 'a', k - 1);
+        buf[k - 1] = '\0';
+        upper = apr_pstrndup(p, "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA", k);
+        ABTS_TRUE(tc, apr_cstr_casecmp(buf, upper) < 0);
+        ABTS_TRUE(tc, apr_cstr_casecmp(upper, buf) > 0);
+        upper[k - 1] = '\0';
+        ABTS_INT_EQUAL(tc, 0, apr_cstr_casecmp(buf, upper));
+        ABTS_INT_EQUAL(tc, 0, apr_cstr_casecmpn(buf, buf, k + 16));
+        ABTS_INT_EQUAL(tc, apr_cstr_casehash(buf),
+                       apr_cstr_casehash(apr_pstrdup(p, buf)));
+    }
+}
+
+static void case_hash(abts_case *tc, void *data)
+{
+    ABTS_INT_EQUAL(tc, apr_cstr_casehash("Accept-Encoding"),
+                   apr_cstr_casehash("ACCEPT-encoding"));
+    ABTS_INT_EQUAL(tc, apr_cstr_casehash("X-Forwarded-For-And-Some-More"),
+                   apr_cstr_casehash("x-forwarded-for-and-some-more"));
+    ABTS_TRUE(tc, apr_cstr_casehash("Accept") != apr_cstr_casehash("Accepts"));
+    ABTS_TRUE(tc, apr_cstr_casehash("") != apr_cstr_casehash("a"));
+    /* the bytes of a block are not all mixed alike */
+    ABTS_TRUE(tc, apr_cstr_casehash("ab") != apr_cstr_casehash("ba"));
+    ABTS_TRUE(tc, apr_cstr_casehash("0123456789abcdef0")
+                  != apr_cstr_casehash("0123456789abcdef1"));
+}
+
 abts_suite *teststr(abts_suite *suite)
 {
     suite = ADD_SUITE(suite)
@@ -426,6 +511,8 @@ abts_suite *teststr(abts_suite *suite)
     abts_run_test(suite, snprintf_overflow, NULL);
     abts_run_test(suite, skip_prefix, NULL);
     abts_run_test(suite, pstrcat, NULL);
+    abts_run_test(suite, case_compare, NULL);
+    abts_run_test(suite, case_hash, NULL);
 
     return suite;
 }
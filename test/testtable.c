@@ -222,6 +222,102 @@ static void table_overlap3(abts_case *tc, void *data)
 
 }
 
+#define NUM_HEADERS 300
+
+static void table_large(abts_case *tc, void *data)
+{
+    apr_table_t *t = apr_table_make(p, 1), *t2;
+    const char *val;
+    char key[32], ukey[32];
+    int i, ok;
+
+    /* keys sharing a prefix, past the size where they get fully indexed */
+    for (i = 0; i < NUM_HEADERS; i++) {
+        apr_snprintf(key, sizeof(key), "X-Header-%d", i);
+        apr_table_set(t, key, apr_itoa(p, i));
+    }
+    ABTS_INT_EQUAL(tc, NUM_HEADERS, apr_table_elts(t)->nelts);
+    for (i = 0, ok = 1; i < NUM_HEADERS; i++) {
+        apr_snprintf(ukey, sizeof(ukey), "x-HEADER-%d", i);
+        val = apr_table_get(t, ukey);
+        if (!val || atoi(val) != i) {
+            ok = 0;
+        }
+    }
+    ABTS_TRUE(tc, ok);
+    ABTS_PTR_EQUAL(tc, NULL, apr_table_get(t, "X-Header-"));
+    ABTS_PTR_EQUAL(tc, NULL, apr_table_get(t, "X-Header-1000"));
+
+    /* duplicates */
+    apr_table_add(t, "X-HEADER-7", "seven");
+    apr_table_add(t, "x-header-7", "sept");
+    ABTS_STR_EQUAL(tc, "7", apr_table_get(t, "X-Header-7"));
+    ABTS_STR_EQUAL(tc, "7,seven,sept", apr_table_getm(p, t, "X-Header-7"));
+    apr_table_set(t, "X-Header-7", "7.0");
+    ABTS_INT_EQUAL(tc, NUM_HEADERS, apr_table_elts(t)->nelts);
+    ABTS_STR_EQUAL(tc, "7.0", apr_table_getm(p, t, "X-Header-7"));
+
+    apr_table_merge(t, "X-Header-8", "8.0");
+    ABTS_STR_EQUAL(tc, "8, 8.0", apr_table_get(t, "X-Header-8"));
+    apr_table_merge(t, "X-Other", "o");
+    ABTS_STR_EQUAL(tc, "o", apr_table_get(t, "x-other"));
+    ABTS_INT_EQUAL(tc, NUM_HEADERS + 1, apr_table_elts(t)->nelts);
+
+    /* the offsets shift */
+    for (i = 0; i < NUM_HEADERS; i += 3) {
+        apr_snprintf(key, sizeof(key), "X-Header-%d", i);
+        apr_table_unset(t, key);
+    }
+    apr_table_unset(t, "X-Header-0");
+    ABTS_INT_EQUAL(tc, NUM_HEADERS - NUM_HEADERS / 3 + 1,
+                   apr_table_elts(t)->nelts);
+    for (i = 0, ok = 1; i < NUM_HEADERS; i++) {
+        apr_snprintf(key, sizeof(key), "X-Header-%d", i);
+        val = apr_table_get(t, key);
+        if (i % 3 == 0 ? val != NULL : (!val || atoi(val) != i)) {
+            ok = 0;
+        }
+    }
+    ABTS_TRUE(tc, ok);
+    ABTS_STR_EQUAL(tc, "o", apr_table_get(t, "X-Other"));
+
+    /* duplicates spread among other keys */
+    apr_table_add(t, "X-Header-5", "five");
+    apr_table_add(t, "X-Third", "3rd");
+    apr_table_add(t, "x-header-5", "cinq");
+    apr_table_unset(t, "X-HEADER-5");
+    ABTS_PTR_EQUAL(tc, NULL, apr_table_get(t, "X-Header-5"));
+    ABTS_STR_EQUAL(tc, "3rd", apr_table_get(t, "X-Third"));
+    ABTS_STR_EQUAL(tc, "4", apr_table_get(t, "X-Header-4"));
+    ABTS_STR_EQUAL(tc, "299", apr_table_get(t, "X-Header-299"));
+    ABTS_INT_EQUAL(tc, NUM_HEADERS - NUM_HEADERS / 3 + 1,
+                   apr_table_elts(t)->nelts);
+
+    t2 = apr_table_copy(p, t);
+    apr_table_set(t2, "X-Header-1", "one");
+    ABTS_STR_EQUAL(tc, "one", apr_table_get(t2, "X-Header-1"));
+    ABTS_STR_EQUAL(tc, "1", apr_table_get(t, "X-Header-1"));
+    ABTS_STR_EQUAL(tc, "o", apr_table_get(t2, "X-Other"));
+
+    apr_table_overlap(t2, t, APR_OVERLAP_TABLES_ADD);
+    ABTS_STR_EQUAL(tc, "one,1", apr_table_getm(p, t2, "X-Header-1"));
+    apr_table_compress(t2, APR_OVERLAP_TABLES_MERGE);
+    ABTS_INT_EQUAL(tc, apr_table_elts(t)->nelts, apr_table_elts(t2)->nelts);
+    ABTS_STR_EQUAL(tc, "one, 1", apr_table_get(t2, "X-Header-1"));
+    ABTS_STR_EQUAL(tc, "2, 2", apr_table_get(t2, "X-Header-2"));
+
+    t2 = apr_table_overlay(p, t, t);
+    ABTS_STR_EQUAL(tc, "2,2", apr_table_getm(p, t2, "X-Header-2"));
+
+    apr_table_clear(t);
+    ABTS_PTR_EQUAL(tc, NULL, apr_table_get(t, "X-Header-2"));
+    for (i = 0; i < NUM_HEADERS; i++) {
+        apr_snprintf(key, sizeof(key), "X-Header-%d", i);
+        apr_table_add(t, key, "again");
+    }
+    ABTS_STR_EQUAL(tc, "again", apr_table_get(t, "X-Header-2"));
+}
+
 abts_suite *testtable(abts_suite *suite)
 {
     suite = ADD_SUITE(suite)
@@ -239,6 +335,7 @@ abts_suite *testtable(abts_suite *suite)
     abts_run_test(suite, table_overlap, NULL);
     abts_run_test(suite, table_overlap2, NULL);
     abts_run_test(suite, table_overlap3, NULL);
+    abts_run_test(suite, table_large, NULL);
 
     return suite;
 }
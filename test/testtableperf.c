@@ -0,0 +1,252 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures the case-insensitive primitives of apr_cstr.h against their
+ * byte at a time equivalents, and the apr_table_t operations on a few
+ * realistic sets of HTTP header names.  Every figure is the best of
+ * the rounds, to leave out the noise of the machine.
+ */
+
+#include "apr_general.h"
+#include "apr_getopt.h"
+#include "apr_cstr.h"
+#include "apr_lib.h"
+#include "apr_strings.h"
+#include "apr_tables.h"
+#include "apr_time.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if APR_HAVE_STRINGS_H
+#include <strings.h>
+#endif
+
+#define DEFAULT_LOOPS  2000
+#define DEFAULT_ROUNDS 10
+#define NUM_CUSTOM     200
+
+static int loops = DEFAULT_LOOPS;
+static int rounds = DEFAULT_ROUNDS;
+static apr_pool_t *pool;
+
+static const char *browser_keys[] = {
+    "Host", "User-Agent", "Accept", "Accept-Language", "Accept-Encoding",
+    "Referer", "Connection", "Cookie", "Upgrade-Insecure-Requests",
+    "Sec-Fetch-Dest", "Sec-Fetch-Mode", "Sec-Fetch-Site", "Sec-Fetch-User",
+    "Cache-Control", "Pragma", "If-None-Match", "If-Modified-Since", "DNT",
+    NULL
+};
+
+static const char *gateway_keys[] = {
+    "Host", "User-Agent", "Accept", "Content-Type", "Content-Length",
+    "Content-Encoding", "Authorization", "X-Forwarded-For",
+    "X-Forwarded-Proto", "X-Forwarded-Host", "X-Forwarded-Port",
+    "X-Request-Id", "X-Real-IP", "X-Amzn-Trace-Id", "X-B3-TraceId",
+    "X-B3-SpanId", "X-B3-ParentSpanId", "X-B3-Sampled",
+    "X-Envoy-Attempt-Count", "X-Envoy-External-Address", "Traceparent",
+    "Tracestate", "Via", "Origin",
+    NULL
+};
+
+typedef struct {
+    const char **keys;  /* as sent */
+    const char **lower; /* as looked up */
+    int n;
+} key_set_t;
+
+static void make_set(key_set_t *set, const char **keys, int n)
+{
+    int i;
+
+    set->keys = keys;
+    set->lower = apr_palloc(pool, n * sizeof(*set->lower));
+    set->n = n;
+    for (i = 0; i < n; i++) {
+        char *c = apr_pstrdup(pool, keys[i]);
+        set->lower[i] = c;
+        for (; *c; c++) {
+            *c = apr_tolower(*c);
+        }
+    }
+}
+
+static void make_custom_set(key_set_t *set)
+{
+    const char **keys = apr_palloc(pool, NUM_CUSTOM * sizeof(*keys));
+    int i;
+
+    for (i = 0; i < NUM_CUSTOM; i++) {
+        keys[i] = apr_psprintf(pool, "X-Custom-Header-%d", i);
+    }
+    make_set(set, keys, NUM_CUSTOM);
+}
+
+static double ns_per_op(apr_time_t best, int ops)
+{
+    return (double)best * 1000.0 / ((double)loops * ops);
+}
+
+#define BEST_OF(best, code)                         \
+    do {                                            \
+        int r_, l_;                                 \
+        (best) = 0;                                 \
+        for (r_ = 0; r_ < rounds; r_++) {           \
+            apr_time_t t_ = apr_time_now();         \
+            for (l_ = 0; l_ < loops; l_++) {        \
+                code;                               \
+            }                                       \
+            t_ = apr_time_now() - t_;               \
+            if (!r_ || t_ < (best))                 \
+                (best) = t_;                        \
+        }                                           \
+    } while (0)
+
+static apr_uint32_t naive_casehash(const char *s)
+{
+    apr_uint32_t h = 0;
+
+    while (*s) {
+        h = h * 33 + apr_tolower(*s++);
+    }
+    return h;
+}
+
+static void bench_strings(const char *name, const key_set_t *set)
+{
+    apr_time_t libc, cstr, naive, hash;
+    volatile int sum = 0;
+    int i;
+
+    BEST_OF(libc, for (i = 0; i < set->n; i++)
+                      sum += !strcasecmp(set->keys[i], set->lower[i]));
+    BEST_OF(cstr, for (i = 0; i < set->n; i++)
+                      sum += !apr_cstr_casecmp(set->keys[i], set->lower[i]));
+    BEST_OF(naive, for (i = 0; i < set->n; i++)
+                       sum += naive_casehash(set->keys[i]));
+    BEST_OF(hash, for (i = 0; i < set->n; i++)
+                      sum += apr_cstr_casehash(set->keys[i]));
+
+    printf("  %-8s strcasecmp %5.1f ns, apr_cstr_casecmp %5.1f ns, "
+           "tolower hash %5.1f ns, apr_cstr_casehash %5.1f ns\n", name,
+           ns_per_op(libc, set->n), ns_per_op(cstr, set->n),
+           ns_per_op(naive, set->n), ns_per_op(hash, set->n));
+}
+
+static void bench_table(const char *name, const key_set_t *set)
+{
+    apr_time_t get, setn, merge, unset, compress;
+    apr_table_t *t, *tmp;
+    apr_pool_t *sub, *scratch;
+    apr_size_t found = 0;
+    int i;
+
+    apr_pool_create(&sub, pool);
+    apr_pool_create(&scratch, sub);
+    t = apr_table_make(sub, set->n);
+    for (i = 0; i < set->n; i++) {
+        apr_table_setn(t, set->keys[i], "value");
+    }
+
+    BEST_OF(get, for (i = 0; i < set->n; i++)
+                     found += apr_table_get(t, set->lower[i]) != NULL);
+    BEST_OF(setn, for (i = 0; i < set->n; i++)
+                      apr_table_setn(t, set->lower[i], "value"));
+    BEST_OF(merge, {
+        apr_pool_clear(scratch);
+        tmp = apr_table_make(scratch, set->n);
+        for (i = 0; i < set->n; i++) {
+            apr_table_mergen(tmp, set->keys[i], "a");
+            apr_table_mergen(tmp, set->lower[i], "b");
+        }
+    });
+    BEST_OF(unset, {
+        apr_pool_clear(scratch);
+        tmp = apr_table_copy(scratch, t);
+        for (i = 0; i < set->n; i++) {
+            apr_table_unset(tmp, set->lower[i]);
+        }
+    });
+    BEST_OF(compress, {
+        apr_pool_clear(scratch);
+        tmp = apr_table_copy(scratch, t);
+        for (i = 0; i < set->n; i++) {
+            apr_table_addn(tmp, set->lower[i], "c");
+        }
+        apr_table_compress(tmp, APR_OVERLAP_TABLES_MERGE);
+    });
+
+    printf("  %-8s get %5.1f ns, setn %5.1f ns, mergen %5.1f ns, "
+           "unset %5.1f ns, compress %5.1f ns%s\n", name,
+           ns_per_op(get, set->n), ns_per_op(setn, set->n),
+           ns_per_op(merge, 2 * set->n), ns_per_op(unset, set->n),
+           ns_per_op(compress, 2 * set->n),
+           found == (apr_size_t)rounds * loops * set->n ? "" : " (MISSED!)");
+    apr_pool_destroy(sub);
+}
+
+int main(int argc, const char *const *argv)
+{
+    key_set_t sets[3];
+    static const char *names[] = { "browser", "gateway", "custom" };
+    apr_getopt_t *opt;
+    const char *optarg;
+    char optchar;
+    apr_status_t rv;
+    int i, n;
+
+    apr_initialize();
+    atexit(apr_terminate);
+    apr_pool_create(&pool, NULL);
+
+    if (apr_getopt_init(&opt, pool, argc, argv)) {
+        return 1;
+    }
+    while ((rv = apr_getopt(opt, "l:r:", &optchar, &optarg)) == APR_SUCCESS) {
+        switch (optchar) {
+        case 'l':
+            loops = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        }
+    }
+    if (rv != APR_EOF || loops <= 0 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [-l loops] [-r rounds]\n", argv[0]);
+        return 1;
+    }
+
+    for (n = 0; browser_keys[n]; n++)
+        ;
+    make_set(&sets[0], browser_keys, n);
+    for (n = 0; gateway_keys[n]; n++)
+        ;
+    make_set(&sets[1], gateway_keys, n);
+    make_custom_set(&sets[2]);
+
+    printf("Case-insensitive keys, best of %d rounds of %d loops\n",
+           rounds, loops);
+    for (i = 0; i < 3; i++) {
+        bench_strings(names[i], &sets[i]);
+    }
+    printf("apr_table_t, per key:\n");
+    for (i = 0; i < 3; i++) {
+        bench_table(names[i], &sets[i]);
+    }
+
+    return 0;
+}
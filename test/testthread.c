@@ -107,6 +107,44 @@ static void check_thread_once(abts_case *tc, void *data)
     ABTS_INT_EQUAL(tc, 1, value);
 }
 
+static void * APR_THREAD_FUNC placed_func(apr_thread_t *thd, void *data)
+{
+    static const int cpu0[] = { 0 };
+    apr_status_t *rvs = data;
+
+    rvs[0] = apr_thread_name_set(NULL, "testthread-placed");
+    rvs[1] = apr_thread_affinity_set(NULL, cpu0, 1);
+    rvs[2] = apr_thread_affinity_set(NULL, cpu0, 0);
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static void check_placement(abts_case *tc, void *data)
+{
+    static const int cpu0[] = { 0 };
+    apr_status_t rv, rvs[3];
+    apr_threadattr_t *attr;
+    apr_thread_t *thd;
+
+    rv = apr_threadattr_create(&attr, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_threadattr_affinity_set(attr, cpu0, 1);
+    ABTS_TRUE(tc, rv == APR_SUCCESS || rv == APR_ENOTIMPL);
+    if (rv == APR_SUCCESS) {
+        rv = apr_threadattr_affinity_set(attr, cpu0, 0);
+        ABTS_INT_EQUAL(tc, APR_EINVAL, rv);
+    }
+
+    rv = apr_thread_create(&thd, attr, placed_func, rvs, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    apr_thread_join(&rv, thd);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_TRUE(tc, rvs[0] == APR_SUCCESS || rvs[0] == APR_ENOTIMPL);
+    ABTS_TRUE(tc, rvs[1] == APR_SUCCESS || rvs[1] == APR_ENOTIMPL);
+    ABTS_INT_EQUAL(tc, rvs[1] == APR_SUCCESS ? APR_EINVAL : APR_ENOTIMPL,
+                   rvs[2]);
+}
+
 #else
 
 static void threads_not_impl(abts_case *tc, void *data)
@@ -128,6 +166,7 @@ abts_suite *testthread(abts_suite *suite)
     abts_run_test(suite, join_threads, NULL);
     abts_run_test(suite, check_locks, NULL);
     abts_run_test(suite, check_thread_once, NULL);
+    abts_run_test(suite, check_placement, NULL);
 #endif
 
     return suite;
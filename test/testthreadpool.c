@@ -0,0 +1,609 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testutil.h"
+#include "apr.h"
+#include "apr_atomic.h"
+#include "apr_general.h"
+#include "apr_pools.h"
+#include "apr_thread_mutex.h"
+#include "apr_thread_pool.h"
+#include "apr_time.h"
+#include <string.h>
+
+#if APR_HAS_THREADS
+
+#define NUM_TASKS 10000
+#define TREE_DEPTH 10
+#define NUM_CHILDREN 100
+
+static apr_thread_pool_t *tp;
+static volatile apr_uint32_t counter;
+static volatile apr_uint32_t gate;
+static apr_thread_mutex_t *order_lock;
+static int order[32];
+static int order_cnt;
+static int child_owner;
+static int kept_owner;
+
+/* Wait up to 10 seconds for the value */
+static int wait_for(volatile apr_uint32_t *val, apr_uint32_t n)
+{
+    int i;
+
+    for (i = 0; i < 10000 && apr_atomic_read32(val) != n; i++) {
+        apr_sleep(apr_time_from_msec(1));
+    }
+    return apr_atomic_read32(val) == n;
+}
+
+static void wait_gate(void)
+{
+    while (!apr_atomic_read32(&gate)) {
+        apr_sleep(apr_time_from_msec(1));
+    }
+}
+
+static void *APR_THREAD_FUNC count_task(apr_thread_t *thd, void *data)
+{
+    apr_atomic_inc32(&counter);
+    return NULL;
+}
+
+static void *APR_THREAD_FUNC tree_task(apr_thread_t *thd, void *data)
+{
+    apr_uintptr_t depth = (apr_uintptr_t)data;
+
+    if (depth) {
+        apr_thread_pool_push(tp, tree_task, (void *)(depth - 1), 0, NULL);
+        apr_thread_pool_push(tp, tree_task, (void *)(depth - 1), 0, NULL);
+    }
+    apr_atomic_inc32(&counter);
+    return NULL;
+}
+
+static void *APR_THREAD_FUNC gate_task(apr_thread_t *thd, void *data)
+{
+    wait_gate();
+    return NULL;
+}
+
+static void *APR_THREAD_FUNC order_task(apr_thread_t *thd, void *data)
+{
+    apr_thread_mutex_lock(order_lock);
+    order[order_cnt++] = (int)(apr_uintptr_t)data;
+    apr_thread_mutex_unlock(order_lock);
+    apr_atomic_inc32(&counter);
+    return NULL;
+}
+
+static void *APR_THREAD_FUNC parent_task(apr_thread_t *thd, void *data)
+{
+    int i;
+
+    for (i = 0; i < NUM_CHILDREN; i++) {
+        apr_thread_pool_push(tp, count_task, NULL, 0, &child_owner);
+    }
+    wait_gate();
+    return NULL;
+}
+
+static void *APR_THREAD_FUNC noop_task(apr_thread_t *thd, void *data)
+{
+    return NULL;
+}
+
+static void *APR_THREAD_FUNC kept_task(apr_thread_t *thd, void *data)
+{
+    apr_uintptr_t depth = (apr_uintptr_t)data;
+
+    if (depth) {
+        apr_thread_pool_push(tp, kept_task, (void *)(depth - 1), 0,
+                             &kept_owner);
+        apr_thread_pool_push(tp, kept_task, (void *)(depth - 1), 0,
+                             &kept_owner);
+    }
+    apr_atomic_inc32(&counter);
+    return NULL;
+}
+
+static void *APR_THREAD_FUNC cancelled_task(apr_thread_t *thd, void *data)
+{
+    int i;
+
+    for (i = 0; i < NUM_CHILDREN; i++) {
+        apr_thread_pool_push(tp, noop_task, NULL, 0, &child_owner);
+    }
+    return NULL;
+}
+
+static void create_pool(abts_case *tc, apr_size_t init, apr_size_t max,
+                        apr_uint32_t flags)
+{
+    apr_status_t rv;
+
+    counter = 0;
+    gate = 0;
+    rv = apr_thread_pool_create_ex(&tp, init, max, flags, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+}
+
+static void pool_push(abts_case *tc, void *data)
+{
+    apr_uint32_t flags = (apr_uint32_t)(apr_uintptr_t)data;
+    apr_status_t rv;
+    int i;
+
+    create_pool(tc, 2, 4, flags);
+    for (i = 0; i < NUM_TASKS; i++) {
+        rv = apr_thread_pool_push(tp, count_task, NULL, (apr_byte_t)i, NULL);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    ABTS_TRUE(tc, wait_for(&counter, NUM_TASKS));
+    ABTS_TRUE(tc, apr_thread_pool_tasks_run_count(tp) >= NUM_TASKS);
+    ABTS_TRUE(tc, apr_thread_pool_threads_count(tp) <= 4);
+    apr_thread_pool_destroy(tp);
+}
+
+static void pool_nested(abts_case *tc, void *data)
+{
+    apr_uint32_t flags = (apr_uint32_t)(apr_uintptr_t)data;
+    apr_status_t rv;
+
+    create_pool(tc, 4, 4, flags);
+    rv = apr_thread_pool_push(tp, tree_task, (void *)TREE_DEPTH, 0, NULL);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_TRUE(tc, wait_for(&counter, (2 << TREE_DEPTH) - 1));
+    ABTS_INT_EQUAL(tc, 0, apr_thread_pool_tasks_count(tp));
+    apr_thread_pool_destroy(tp);
+}
+
+static void pool_priority(abts_case *tc, void *data)
+{
+    apr_uint32_t flags = (apr_uint32_t)(apr_uintptr_t)data;
+    static const int priorities[] = { 0, 200, 100, 255, 50, 150 };
+    apr_status_t rv;
+    int i;
+
+    rv = apr_thread_mutex_create(&order_lock, APR_THREAD_MUTEX_DEFAULT, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    order_cnt = 0;
+
+    /* One thread, held while the tasks are pushed */
+    create_pool(tc, 1, 1, flags);
+    rv = apr_thread_pool_push(tp, gate_task, NULL, 255, NULL);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    for (i = 0; i < 6; i++) {
+        rv = apr_thread_pool_push(tp, order_task,
+                                  (void *)(apr_uintptr_t)priorities[i],
+                                  (apr_byte_t)priorities[i], NULL);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    apr_atomic_set32(&gate, 1);
+    ABTS_TRUE(tc, wait_for(&counter, 6));
+    apr_thread_pool_destroy(tp);
+
+    ABTS_INT_EQUAL(tc, 6, order_cnt);
+    for (i = 1; i < order_cnt; i++) {
+        ABTS_TRUE(tc, order[i - 1] >= order[i]);
+    }
+}
+
+static void pool_cancel(abts_case *tc, void *data)
+{
+    apr_uint32_t flags = (apr_uint32_t)(apr_uintptr_t)data;
+    apr_status_t rv;
+    int i;
+
+    /* The children pushed by the held task wait in its thread */
+    create_pool(tc, 1, 1, flags);
+    rv = apr_thread_pool_push(tp, parent_task, NULL, 0, NULL);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    for (i = 0; i < 10000; i++) {
+        if (apr_thread_pool_tasks_count(tp) == NUM_CHILDREN) {
+            break;
+        }
+        apr_sleep(apr_time_from_msec(1));
+    }
+    ABTS_INT_EQUAL(tc, NUM_CHILDREN, apr_thread_pool_tasks_count(tp));
+
+    rv = apr_thread_pool_tasks_cancel(tp, &child_owner);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 0, apr_thread_pool_tasks_count(tp));
+
+    apr_atomic_set32(&gate, 1);
+    rv = apr_thread_pool_push(tp, count_task, NULL, 0, NULL);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_TRUE(tc, wait_for(&counter, 1));
+    apr_thread_pool_destroy(tp);
+    ABTS_INT_EQUAL(tc, 1, counter);
+}
+
+static void pool_cancel_recycled(abts_case *tc, void *data)
+{
+    apr_uint32_t flags = (apr_uint32_t)(apr_uintptr_t)data;
+    apr_uint32_t total = 0;
+    apr_status_t rv;
+    int round, i;
+
+    /* Cancel an owner while the tasks of another one are recycled, none of
+     * the latter may be dropped.
+     */
+    create_pool(tc, 4, 4, flags);
+    for (round = 0; round < 10; round++) {
+        rv = apr_thread_pool_push(tp, kept_task, (void *)TREE_DEPTH, 0,
+                                  &kept_owner);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+        total += (2 << TREE_DEPTH) - 1;
+        for (i = 0; i < 1000 && apr_atomic_read32(&counter) != total; i++) {
+            rv = apr_thread_pool_push(tp, cancelled_task, NULL, 0, NULL);
+            ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+            rv = apr_thread_pool_tasks_cancel(tp, &child_owner);
+            ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+        }
+        ABTS_TRUE(tc, wait_for(&counter, total));
+    }
+    apr_thread_pool_destroy(tp);
+}
+
+static void *APR_THREAD_FUNC double_task(apr_thread_t *thd, void *data)
+{
+    return (void *)((apr_uintptr_t)data * 2);
+}
+
+static void pool_submit(abts_case *tc, void *data)
+{
+    apr_uint32_t flags = (apr_uint32_t)(apr_uintptr_t)data;
+    apr_task_handle_t *handles[NUM_CHILDREN];
+    apr_size_t index;
+    apr_status_t rv;
+    void *result;
+    int i;
+
+    create_pool(tc, 2, 4, flags);
+    for (i = 0; i < NUM_CHILDREN; i++) {
+        rv = apr_thread_pool_submit(tp, &handles[i], double_task,
+                                    (void *)(apr_uintptr_t)i, 0, NULL, p);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    for (i = NUM_CHILDREN - 1; i >= 0; i--) {
+        result = NULL;
+        rv = apr_task_handle_wait(handles[i], &result, -1);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+        ABTS_INT_EQUAL(tc, i * 2, (int)(apr_uintptr_t)result);
+    }
+    rv = apr_task_handle_wait_all(handles, NUM_CHILDREN, 0);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    apr_thread_pool_destroy(tp);
+
+    /* One thread, held by the first task */
+    create_pool(tc, 1, 1, flags);
+    rv = apr_thread_pool_submit(tp, &handles[0], gate_task, NULL, 0, NULL, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_thread_pool_submit(tp, &handles[1], double_task, (void *)1, 0,
+                                NULL, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_task_handle_wait(handles[0], NULL, 0);
+    ABTS_INT_EQUAL(tc, APR_EAGAIN, rv);
+    rv = apr_task_handle_wait(handles[0], NULL, apr_time_from_msec(10));
+    ABTS_INT_EQUAL(tc, APR_TIMEUP, rv);
+    rv = apr_task_handle_wait_any(handles, 2, &index,
+                                  apr_time_from_msec(10));
+    ABTS_INT_EQUAL(tc, APR_TIMEUP, rv);
+    rv = apr_task_handle_wait_all(handles, 2, apr_time_from_msec(10));
+    ABTS_INT_EQUAL(tc, APR_TIMEUP, rv);
+
+    apr_atomic_set32(&gate, 1);
+    index = 2;
+    rv = apr_task_handle_wait_any(handles, 2, &index, -1);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_TRUE(tc, index < 2);
+    rv = apr_task_handle_wait_all(handles, 2, -1);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_task_handle_wait(handles[1], &result, 0);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 2, (int)(apr_uintptr_t)result);
+    apr_thread_pool_destroy(tp);
+}
+
+static void pool_submit_cancel(abts_case *tc, void *data)
+{
+    apr_uint32_t flags = (apr_uint32_t)(apr_uintptr_t)data;
+    apr_task_handle_t *handles[3];
+    apr_size_t index;
+    apr_status_t rv;
+    int i;
+
+    /* The submitted tasks wait behind the held one, then are cancelled */
+    create_pool(tc, 1, 1, flags);
+    rv = apr_thread_pool_push(tp, gate_task, NULL, 0, NULL);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    for (i = 0; i < 3; i++) {
+        rv = apr_thread_pool_submit(tp, &handles[i], count_task, NULL, 0,
+                                    &child_owner, p);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    rv = apr_thread_pool_tasks_cancel(tp, &child_owner);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    rv = apr_task_handle_wait(handles[0], NULL, -1);
+    ABTS_INT_EQUAL(tc, APR_EOF, rv);
+    rv = apr_task_handle_wait_any(handles, 3, &index, -1);
+    ABTS_INT_EQUAL(tc, APR_EOF, rv);
+    rv = apr_task_handle_wait_all(handles, 3, -1);
+    ABTS_INT_EQUAL(tc, APR_EOF, rv);
+
+    /* The one left is run, or cancelled by the destruction of the pool */
+    rv = apr_thread_pool_submit(tp, &handles[0], count_task, NULL, 0, NULL,
+                                p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    apr_atomic_set32(&gate, 1);
+    apr_thread_pool_destroy(tp);
+    rv = apr_task_handle_wait(handles[0], NULL, 0);
+    ABTS_TRUE(tc, rv == (counter ? APR_SUCCESS : APR_EOF));
+}
+
+#define RANGE_SIZE 100000
+
+static apr_uint32_t range_marks[RANGE_SIZE];
+
+static apr_status_t mark_range(apr_size_t begin, apr_size_t end, void *data)
+{
+    for (; begin < end; begin++) {
+        apr_atomic_inc32(&range_marks[begin]);
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t fail_range(apr_size_t begin, apr_size_t end, void *data)
+{
+    apr_size_t at = (apr_size_t)(apr_uintptr_t)data;
+
+    return begin <= at && at < end ? APR_EGENERAL : APR_SUCCESS;
+}
+
+static void check_marks(abts_case *tc, apr_size_t begin, apr_size_t end)
+{
+    apr_size_t i, wrong = 0;
+
+    for (i = 0; i < RANGE_SIZE; i++) {
+        if (range_marks[i] != (begin <= i && i < end)) {
+            wrong++;
+        }
+        range_marks[i] = 0;
+    }
+    ABTS_SIZE_EQUAL(tc, 0, wrong);
+}
+
+static void *APR_THREAD_FUNC parallel_for_in_task(apr_thread_t *thd,
+                                                  void *data)
+{
+    return (void *)(apr_uintptr_t)apr_parallel_for(tp, 0, RANGE_SIZE, 0,
+                                                   mark_range, NULL);
+}
+
+static void pool_parallel_for(abts_case *tc, void *data)
+{
+    apr_uint32_t flags = (apr_uint32_t)(apr_uintptr_t)data;
+    apr_task_handle_t *handle;
+    apr_status_t rv;
+    void *result;
+
+    create_pool(tc, 2, 4, flags);
+    rv = apr_parallel_for(tp, 0, RANGE_SIZE, 0, mark_range, NULL);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    check_marks(tc, 0, RANGE_SIZE);
+    rv = apr_parallel_for(tp, 10, RANGE_SIZE - 10, 7, mark_range, NULL);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    check_marks(tc, 10, RANGE_SIZE - 10);
+    rv = apr_parallel_for(tp, 5, 5, 0, mark_range, NULL);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    check_marks(tc, 0, 0);
+    rv = apr_parallel_for(tp, 0, RANGE_SIZE, 100, fail_range,
+                          (void *)(apr_uintptr_t)5000);
+    ABTS_INT_EQUAL(tc, APR_EGENERAL, rv);
+    apr_thread_pool_destroy(tp);
+
+    /* From the only thread of the pool, which helps itself */
+    create_pool(tc, 1, 1, flags);
+    rv = apr_thread_pool_submit(tp, &handle, parallel_for_in_task, NULL, 0,
+                                NULL, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_task_handle_wait(handle, &result, -1);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, (int)(apr_uintptr_t)result);
+    apr_thread_pool_destroy(tp);
+    check_marks(tc, 0, RANGE_SIZE);
+}
+
+static void thread_init(apr_thread_t *thd, apr_size_t index, void *data)
+{
+    apr_uint32_t *indexes = data;
+
+    apr_atomic_add32(indexes, 1u << index);
+    apr_atomic_inc32(&counter);
+}
+
+static void pool_options(abts_case *tc, void *data)
+{
+    static const int cpus[] = { 0 };
+    apr_thread_pool_options_t opts;
+    apr_uint32_t indexes = 0;
+    apr_status_t rv;
+    int i;
+
+    counter = 0;
+    memset(&opts, 0, sizeof(opts));
+    opts.flags = (apr_uint32_t)(apr_uintptr_t)data;
+    opts.cpus = cpus;
+    opts.ncpus = 1;
+    opts.cpus_per_thread = 1;
+    opts.name = "testpool";
+    opts.thread_init = thread_init;
+    opts.thread_init_data = &indexes;
+    rv = apr_thread_pool_create_opt(&tp, 3, 3, &opts, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    /* Each thread starts with its own index */
+    ABTS_TRUE(tc, wait_for(&counter, 3));
+    ABTS_INT_EQUAL(tc, 7, apr_atomic_read32(&indexes));
+
+    for (i = 0; i < NUM_CHILDREN; i++) {
+        rv = apr_thread_pool_push(tp, count_task, NULL, 0, NULL);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    ABTS_TRUE(tc, wait_for(&counter, 3 + NUM_CHILDREN));
+    apr_thread_pool_destroy(tp);
+}
+
+static volatile apr_uint32_t node_pools;
+
+static void *APR_THREAD_FUNC node_pool_task(apr_thread_t *thd, void *data)
+{
+    apr_pool_t *pool = apr_thread_pool_node_pool_get(thd);
+
+    if (pool && apr_pcalloc(pool, 64)) {
+        apr_atomic_inc32(&node_pools);
+    }
+    apr_atomic_inc32(&counter);
+    return NULL;
+}
+
+static void pool_numa(abts_case *tc, void *data)
+{
+    apr_uint32_t flags = (apr_uint32_t)(apr_uintptr_t)data;
+    apr_status_t rv;
+    int i;
+
+    /* Only the threads of a pool created with the flag have a node pool */
+    node_pools = 0;
+    create_pool(tc, 2, 2, flags);
+    for (i = 0; i < NUM_CHILDREN; i++) {
+        rv = apr_thread_pool_push(tp, node_pool_task, NULL, 0, NULL);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    ABTS_TRUE(tc, wait_for(&counter, NUM_CHILDREN));
+    apr_thread_pool_destroy(tp);
+    ABTS_INT_EQUAL(tc, 0, node_pools);
+
+    create_pool(tc, 2, 2, flags | APR_THREAD_POOL_NUMA);
+    for (i = 0; i < NUM_CHILDREN; i++) {
+        rv = apr_thread_pool_push(tp, node_pool_task, NULL, 0, NULL);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    ABTS_TRUE(tc, wait_for(&counter, NUM_CHILDREN));
+    apr_thread_pool_destroy(tp);
+    ABTS_INT_EQUAL(tc, NUM_CHILDREN, node_pools);
+}
+
+static apr_uint64_t stats_runs(apr_thread_pool_stats_t *stats)
+{
+    apr_uint64_t n = 0;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        n += stats->run[i].count;
+    }
+    return n;
+}
+
+static void pool_stats(abts_case *tc, void *data)
+{
+    apr_uint32_t flags = (apr_uint32_t)(apr_uintptr_t)data;
+    apr_thread_pool_stats_t *stats;
+    apr_uint64_t n;
+    apr_status_t rv;
+    apr_size_t i;
+    int b;
+
+    create_pool(tc, 2, 2, flags);
+    rv = apr_thread_pool_stats_get(tp, &stats, p);
+    ABTS_INT_EQUAL(tc, APR_ENOTIMPL, rv);
+    apr_thread_pool_destroy(tp);
+
+    create_pool(tc, 2, 2, flags | APR_THREAD_POOL_STATS);
+    for (i = 0; i < NUM_CHILDREN; i++) {
+        rv = apr_thread_pool_push(tp, count_task, NULL, 200, &child_owner);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+        rv = apr_thread_pool_push(tp, count_task, NULL, 0, NULL);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    /* The tasks are accounted when they return */
+    for (i = 0; i < 10000; i++) {
+        rv = apr_thread_pool_stats_get(tp, &stats, p);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+        if (stats_runs(stats) == 2 * NUM_CHILDREN) {
+            break;
+        }
+        apr_sleep(apr_time_from_msec(1));
+    }
+    ABTS_TRUE(tc, stats_runs(stats) == 2 * NUM_CHILDREN);
+    ABTS_TRUE(tc, stats->run[0].count == NUM_CHILDREN);
+    ABTS_TRUE(tc, stats->wait[3].count == NUM_CHILDREN);
+    for (n = 0, b = 0; b < APR_THREAD_POOL_STATS_BUCKETS; b++) {
+        n += stats->wait[3].buckets[b];
+    }
+    ABTS_TRUE(tc, n == NUM_CHILDREN);
+
+    ABTS_SIZE_EQUAL(tc, 2, stats->nowners);
+    for (i = 0; i < stats->nowners; i++) {
+        ABTS_TRUE(tc, stats->owners[i].owner == &child_owner
+                      || stats->owners[i].owner == NULL);
+        ABTS_TRUE(tc, stats->owners[i].run.count == NUM_CHILDREN);
+    }
+    ABTS_TRUE(tc, stats->other_owners.run.count == 0);
+    ABTS_TRUE(tc, stats->lock_acquired >= stats->lock_contended);
+    ABTS_TRUE(tc, stats->lock_acquired > 0);
+    apr_thread_pool_destroy(tp);
+}
+
+#endif /* APR_HAS_THREADS */
+
+abts_suite *testthreadpool(abts_suite *suite)
+{
+#if APR_HAS_THREADS
+    void *ws = (void *)(apr_uintptr_t)APR_THREAD_POOL_WORK_STEALING;
+#endif
+
+    suite = ADD_SUITE(suite)
+
+#if APR_HAS_THREADS
+    abts_run_test(suite, pool_push, NULL);
+    abts_run_test(suite, pool_push, ws);
+    abts_run_test(suite, pool_nested, NULL);
+    abts_run_test(suite, pool_nested, ws);
+    abts_run_test(suite, pool_priority, NULL);
+    abts_run_test(suite, pool_priority, ws);
+    abts_run_test(suite, pool_cancel, NULL);
+    abts_run_test(suite, pool_cancel, ws);
+    abts_run_test(suite, pool_cancel_recycled, NULL);
+    abts_run_test(suite, pool_cancel_recycled, ws);
+    abts_run_test(suite, pool_submit, NULL);
+    abts_run_test(suite, pool_submit, ws);
+    abts_run_test(suite, pool_submit_cancel, NULL);
+    abts_run_test(suite, pool_submit_cancel, ws);
+    abts_run_test(suite, pool_parallel_for, NULL);
+    abts_run_test(suite, pool_parallel_for, ws);
+    abts_run_test(suite, pool_options, NULL);
+    abts_run_test(suite, pool_options, ws);
+    abts_run_test(suite, pool_numa, NULL);
+    abts_run_test(suite, pool_numa, ws);
+    abts_run_test(suite, pool_stats, NULL);
+    abts_run_test(suite, pool_stats, ws);
+#endif
+
+    return suite;
+}
@@ -0,0 +1,201 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs tiny tasks (an atomic increment) through an apr_thread_pool with
+ * 1 to N threads, with and without work stealing: pushed from outside of
+ * the pool ("push"), or pushed by the tasks themselves as a binary tree
+ * ("fork"). With -p, the threads are pinned to the given number of CPUs,
+ * one each (round robin). With -s, the pools collect statistics
+ * (APR_THREAD_POOL_STATS), and the contention on their lock is shown.
+ */
+
+#include "apr_atomic.h"
+#include "apr_general.h"
+#include "apr_getopt.h"
+#include "apr_thread_pool.h"
+#include "apr_time.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !APR_HAS_THREADS
+
+int main(void)
+{
+    fprintf(stderr, "this program requires APR thread support\n");
+    return 0;
+}
+
+#else
+
+#define DEFAULT_NUM_TASKS 1000000
+#define DEFAULT_NUM_THREADS 4
+#define MAX_CPUS 256
+
+static int num_tasks = DEFAULT_NUM_TASKS;
+static int num_threads = DEFAULT_NUM_THREADS;
+static int num_cpus;
+static int with_stats;
+static int cpus[MAX_CPUS];
+
+static apr_thread_pool_t *tp;
+static volatile apr_uint32_t counter;
+
+static void *APR_THREAD_FUNC tiny_task(apr_thread_t *thd, void *data)
+{
+    apr_atomic_inc32(&counter);
+    return NULL;
+}
+
+/* Run the given number of tasks, this one included */
+static void *APR_THREAD_FUNC fork_task(apr_thread_t *thd, void *data)
+{
+    apr_uintptr_t n = (apr_uintptr_t)data - 1;
+
+    if (n > 1) {
+        apr_thread_pool_push(tp, fork_task, (void *)(n / 2), 0, NULL);
+        apr_thread_pool_push(tp, fork_task, (void *)(n - n / 2), 0, NULL);
+    }
+    else if (n) {
+        apr_thread_pool_push(tp, tiny_task, NULL, 0, NULL);
+    }
+    apr_atomic_inc32(&counter);
+    return NULL;
+}
+
+static void bench(apr_pool_t *pool, int threads, apr_uint32_t flags,
+                  int tree)
+{
+    apr_thread_pool_options_t opts;
+    apr_time_t start, stop;
+    int i;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.flags = flags | (with_stats ? APR_THREAD_POOL_STATS : 0);
+    opts.cpus = cpus;
+    opts.ncpus = num_cpus;
+    opts.cpus_per_thread = 1;
+    opts.name = "perf";
+    if (apr_thread_pool_create_opt(&tp, threads, threads, &opts,
+                                   pool) != APR_SUCCESS) {
+        fprintf(stderr, "apr_thread_pool_create_opt failed\n");
+        exit(1);
+    }
+    counter = 0;
+
+    start = apr_time_now();
+    if (tree) {
+        apr_thread_pool_push(tp, fork_task, (void *)(apr_uintptr_t)num_tasks,
+                             0, NULL);
+    }
+    else {
+        for (i = 0; i < num_tasks; i++) {
+            apr_thread_pool_push(tp, tiny_task, NULL, 0, NULL);
+        }
+    }
+    while (apr_atomic_read32(&counter) != (apr_uint32_t)num_tasks) {
+        apr_sleep(50);
+    }
+    stop = apr_time_now();
+
+    printf("  %-5s %-8s %3d threads%s: %7.1f ns/task, %6.2f Mtasks/s\n",
+           tree ? "fork" : "push", flags ? "stealing" : "locked", threads,
+           num_cpus ? " (pinned)" : "",
+           (double)(stop - start) * 1000.0 / num_tasks,
+           (double)num_tasks / (stop - start));
+    if (with_stats) {
+        apr_thread_pool_stats_t *stats;
+        apr_pool_t *p;
+
+        apr_pool_create(&p, pool);
+        if (apr_thread_pool_stats_get(tp, &stats, p) == APR_SUCCESS) {
+            printf("        lock taken %" APR_UINT64_T_FMT " times, "
+                   "contended %" APR_UINT64_T_FMT " times (%"
+                   APR_TIME_T_FMT " us), threads busy %" APR_TIME_T_FMT
+                   " us, idle %" APR_TIME_T_FMT " us\n",
+                   stats->lock_acquired, stats->lock_contended,
+                   stats->lock_wait, stats->busy_time, stats->idle_time);
+        }
+        apr_pool_destroy(p);
+    }
+
+    apr_thread_pool_destroy(tp);
+}
+
+int main(int argc, const char *const *argv)
+{
+    apr_pool_t *pool;
+    apr_getopt_t *opt;
+    const char *optarg;
+    char optchar;
+    apr_status_t rv;
+    int threads, tree, i;
+
+    apr_initialize();
+    atexit(apr_terminate);
+    apr_pool_create(&pool, NULL);
+
+    if (apr_getopt_init(&opt, pool, argc, argv)) {
+        return 1;
+    }
+    while ((rv = apr_getopt(opt, "n:t:p:s", &optchar,
+                            &optarg)) == APR_SUCCESS) {
+        switch (optchar) {
+        case 'n':
+            num_tasks = atoi(optarg);
+            break;
+        case 't':
+            num_threads = atoi(optarg);
+            break;
+        case 'p':
+            num_cpus = atoi(optarg);
+            break;
+        case 's':
+            with_stats = 1;
+            break;
+        }
+    }
+    if (rv != APR_EOF || num_tasks <= 0 || num_threads <= 0
+        || num_cpus < 0 || num_cpus > MAX_CPUS) {
+        fprintf(stderr, "usage: %s [-n tasks] [-t max threads] "
+                "[-p CPUs to pin the threads to (<= %d)] [-s]\n", argv[0],
+                MAX_CPUS);
+        return 1;
+    }
+    for (i = 0; i < num_cpus; i++) {
+        cpus[i] = i;
+    }
+
+    printf("apr_thread_pool, %d tiny tasks, 1 to %d threads\n",
+           num_tasks, num_threads);
+    for (tree = 0; tree <= 1; tree++) {
+        for (threads = 1; ; threads *= 2) {
+            if (threads > num_threads) {
+                threads = num_threads;
+            }
+            bench(pool, threads, 0, tree);
+            bench(pool, threads, APR_THREAD_POOL_WORK_STEALING, tree);
+            if (threads == num_threads) {
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+#endif /* APR_HAS_THREADS */
@@ -0,0 +1,287 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testutil.h"
+#include "apr.h"
+#include "apr_general.h"
+#include "apr_pools.h"
+#include "apr_thread_mutex.h"
+#include "apr_thread_pool.h"
+#include "apr_time.h"
+#include "apr_timer_wheel.h"
+
+#define NUM_TIMERS 5000
+#define RESOLUTION 1000
+
+static unsigned int rand_next(unsigned int *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+static apr_uint64_t tick_of(apr_time_t t)
+{
+    return ((apr_uint64_t)t + RESOLUTION - 1) / RESOLUTION;
+}
+
+static void wheel_create(abts_case *tc, void *data)
+{
+    apr_timer_wheel_t *wheel;
+    apr_status_t rv;
+    void *baton;
+
+    rv = apr_timer_wheel_create(&wheel, -1, p);
+    ABTS_INT_EQUAL(tc, APR_EINVAL, rv);
+
+    rv = apr_timer_wheel_create(&wheel, 0, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 0, apr_timer_wheel_count(wheel));
+    ABTS_INT_EQUAL(tc, -1, apr_timer_wheel_timeout(wheel, apr_time_now()));
+    rv = apr_timer_wheel_expire(wheel, apr_time_now(), &baton);
+    ABTS_INT_EQUAL(tc, APR_EAGAIN, rv);
+}
+
+static void wheel_expire(abts_case *tc, void *data)
+{
+    apr_timer_wheel_t *wheel;
+    apr_time_t times[NUM_TIMERS], now, base;
+    apr_uint64_t last = 0;
+    apr_size_t pending;
+    unsigned int seed = 7;
+    apr_status_t rv;
+    void *baton;
+    int i;
+
+    rv = apr_timer_wheel_create(&wheel, RESOLUTION, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    /* Mostly within a few minutes, some within days */
+    base = apr_time_now();
+    for (i = 0; i < NUM_TIMERS; i++) {
+        if (i % 10) {
+            times[i] = base + rand_next(&seed) % apr_time_from_sec(300);
+        }
+        else {
+            times[i] = base + (apr_time_t)rand_next(&seed) * 100;
+        }
+        rv = apr_timer_wheel_add(wheel, times[i], &times[i], NULL);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    ABTS_INT_EQUAL(tc, NUM_TIMERS, apr_timer_wheel_count(wheel));
+
+    now = base;
+    pending = NUM_TIMERS;
+    while (pending) {
+        apr_interval_time_t timeout = apr_timer_wheel_timeout(wheel, now);
+        apr_size_t expected = 0;
+
+        ABTS_TRUE(tc, timeout >= 0);
+        now += timeout + rand_next(&seed) % 5000;
+
+        while (apr_timer_wheel_expire(wheel, now, &baton) == APR_SUCCESS) {
+            apr_time_t t = *(apr_time_t *)baton;
+
+            /* Never early, in order */
+            ABTS_TRUE(tc, tick_of(t) <= (apr_uint64_t)now / RESOLUTION);
+            ABTS_TRUE(tc, tick_of(t) >= last);
+            last = tick_of(t);
+            pending--;
+        }
+
+        /* Never late */
+        for (i = 0; i < NUM_TIMERS; i++) {
+            if (tick_of(times[i]) > (apr_uint64_t)now / RESOLUTION) {
+                expected++;
+            }
+        }
+        ABTS_INT_EQUAL(tc, expected, pending);
+        ABTS_INT_EQUAL(tc, pending, apr_timer_wheel_count(wheel));
+    }
+    ABTS_INT_EQUAL(tc, -1, apr_timer_wheel_timeout(wheel, now));
+}
+
+static void wheel_cancel_reset(abts_case *tc, void *data)
+{
+    apr_timer_wheel_t *wheel;
+    apr_timer_t *timers[100];
+    apr_time_t base = apr_time_now(), now;
+    apr_status_t rv;
+    void *baton;
+    int i, n;
+
+    rv = apr_timer_wheel_create(&wheel, RESOLUTION, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    for (i = 0; i < 100; i++) {
+        rv = apr_timer_wheel_add(wheel, base + apr_time_from_sec(i + 1),
+                                 (void *)(apr_uintptr_t)i, &timers[i]);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+
+    /* Cancel the odd ones, push back the multiples of 4 by an hour */
+    for (i = 1; i < 100; i += 2) {
+        apr_timer_wheel_cancel(wheel, timers[i]);
+    }
+    for (i = 0; i < 100; i += 4) {
+        apr_timer_wheel_reset(wheel, timers[i],
+                              base + apr_time_from_sec(3600 + i));
+    }
+    ABTS_INT_EQUAL(tc, 50, apr_timer_wheel_count(wheel));
+
+    n = 0;
+    while (apr_timer_wheel_expire(wheel, base + apr_time_from_sec(200),
+                                  &baton) == APR_SUCCESS) {
+        i = (int)(apr_uintptr_t)baton;
+        ABTS_INT_EQUAL(tc, 2, i % 4);
+        n++;
+    }
+    ABTS_INT_EQUAL(tc, 25, n);
+
+    /* Bring one back to the past, it expires first */
+    now = base + apr_time_from_sec(200);
+    apr_timer_wheel_reset(wheel, timers[40], base);
+    ABTS_INT_EQUAL(tc, 0, apr_timer_wheel_timeout(wheel, now));
+    rv = apr_timer_wheel_expire(wheel, now, &baton);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 40, (int)(apr_uintptr_t)baton);
+
+    n = 0;
+    while (apr_timer_wheel_expire(wheel, base + apr_time_from_sec(7200),
+                                  &baton) == APR_SUCCESS) {
+        i = (int)(apr_uintptr_t)baton;
+        ABTS_INT_EQUAL(tc, 0, i % 4);
+        n++;
+    }
+    ABTS_INT_EQUAL(tc, 24, n);
+    ABTS_INT_EQUAL(tc, 0, apr_timer_wheel_count(wheel));
+}
+
+static void wheel_timeout(abts_case *tc, void *data)
+{
+    apr_timer_wheel_t *wheel;
+    apr_time_t base = apr_time_now(), when, now;
+    apr_interval_time_t timeout;
+    apr_status_t rv;
+    void *baton;
+    int wakeups = 0;
+
+    rv = apr_timer_wheel_create(&wheel, RESOLUTION, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    when = base + apr_time_from_sec(86400);
+    rv = apr_timer_wheel_add(wheel, when, &when, NULL);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    /* Sleeping for the timeouts reaches the timer in a few wakeups */
+    now = base;
+    for (;;) {
+        timeout = apr_timer_wheel_timeout(wheel, now);
+        ABTS_TRUE(tc, timeout >= 0);
+        ABTS_TRUE(tc, now + timeout <= when + RESOLUTION);
+        now += timeout;
+        wakeups++;
+        if (apr_timer_wheel_expire(wheel, now, &baton) == APR_SUCCESS) {
+            break;
+        }
+        ABTS_TRUE(tc, wakeups < 20);
+        if (wakeups >= 20) {
+            return;
+        }
+    }
+    ABTS_PTR_EQUAL(tc, &when, baton);
+    ABTS_TRUE(tc, now >= when);
+}
+
+#if APR_HAS_THREADS
+
+static apr_thread_mutex_t *order_lock;
+static int order[3];
+static int order_cnt;
+
+static void *APR_THREAD_FUNC scheduled_task(apr_thread_t *thd, void *data)
+{
+    apr_thread_mutex_lock(order_lock);
+    order[order_cnt++] = (int)(apr_uintptr_t)data;
+    apr_thread_mutex_unlock(order_lock);
+    return NULL;
+}
+
+static void thread_pool_schedule(abts_case *tc, void *data)
+{
+    apr_thread_pool_t *tp;
+    apr_status_t rv;
+    int owner, i;
+
+    rv = apr_thread_mutex_create(&order_lock, APR_THREAD_MUTEX_DEFAULT, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_thread_pool_create(&tp, 1, 2, p);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+
+    rv = apr_thread_pool_schedule(tp, scheduled_task, (void *)3,
+                                  apr_time_from_msec(300), NULL);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_thread_pool_schedule(tp, scheduled_task, (void *)1,
+                                  apr_time_from_msec(100), NULL);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    rv = apr_thread_pool_schedule(tp, scheduled_task, (void *)2,
+                                  apr_time_from_msec(200), NULL);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    for (i = 0; i < 10; i++) {
+        rv = apr_thread_pool_schedule(tp, scheduled_task, (void *)4,
+                                      apr_time_from_sec(60), &owner);
+        ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    }
+    ABTS_INT_EQUAL(tc, 13, apr_thread_pool_scheduled_tasks_count(tp));
+
+    rv = apr_thread_pool_tasks_cancel(tp, &owner);
+    ABTS_INT_EQUAL(tc, APR_SUCCESS, rv);
+    ABTS_INT_EQUAL(tc, 3, apr_thread_pool_scheduled_tasks_count(tp));
+
+    for (i = 0; i < 100; i++) {
+        int done;
+        apr_sleep(apr_time_from_msec(20));
+        apr_thread_mutex_lock(order_lock);
+        done = order_cnt;
+        apr_thread_mutex_unlock(order_lock);
+        if (done == 3) {
+            break;
+        }
+    }
+    ABTS_INT_EQUAL(tc, 0, apr_thread_pool_scheduled_tasks_count(tp));
+    apr_thread_pool_destroy(tp);
+
+    ABTS_INT_EQUAL(tc, 3, order_cnt);
+    ABTS_INT_EQUAL(tc, 1, order[0]);
+    ABTS_INT_EQUAL(tc, 2, order[1]);
+    ABTS_INT_EQUAL(tc, 3, order[2]);
+}
+
+#endif /* APR_HAS_THREADS */
+
+abts_suite *testtimerwheel(abts_suite *suite)
+{
+    suite = ADD_SUITE(suite)
+
+    abts_run_test(suite, wheel_create, NULL);
+    abts_run_test(suite, wheel_expire, NULL);
+    abts_run_test(suite, wheel_cancel_reset, NULL);
+    abts_run_test(suite, wheel_timeout, NULL);
+#if APR_HAS_THREADS
+    abts_run_test(suite, thread_pool_schedule, NULL);
+#endif
+
+    return suite;
+}
@@ -81,6 +81,7 @@ abts_suite *testfnmatch(abts_suite *suite);
 abts_suite *testgetopt(abts_suite *suite);
 abts_suite *testglobalmutex(abts_suite *suite);
 abts_suite *testhash(abts_suite *suite);
+abts_suite *testchash(abts_suite *suite);
 abts_suite *testhooks(abts_suite *suite);
 abts_suite *testipsub(abts_suite *suite);
 abts_suite *testlock(abts_suite *suite);
@@ -133,6 +134,10 @@ abts_suite *testrmm(abts_suite *suite);
 abts_suite *testdbm(abts_suite *suite);
 abts_suite *testlfsabi(abts_suite *suite);
 abts_suite *testskiplist(abts_suite *suite);
+abts_suite *testslab(abts_suite *suite);
+abts_suite *testtimerwheel(abts_suite *suite);
+abts_suite *testthreadpool(abts_suite *suite);
+abts_suite *testringbuf(abts_suite *suite);
 abts_suite *testsiphash(abts_suite *suite);
 abts_suite *testjson(abts_suite *suite);
 abts_suite *testjose(abts_suite *suite);
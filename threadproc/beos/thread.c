@@ -65,6 +65,13 @@ APR_DECLARE(apr_status_t) apr_threadattr_guardsize_set(apr_threadattr_t *attr,
     return APR_ENOTIMPL;
 }
 
+APR_DECLARE(apr_status_t) apr_threadattr_affinity_set(apr_threadattr_t *attr,
+                                                      const int *cpus,
+                                                      apr_size_t ncpus)
+{
+    return APR_ENOTIMPL;
+}
+
 static void *dummy_worker(void *opaque)
 {
     apr_thread_t *thd = (apr_thread_t*)opaque;
@@ -209,6 +216,19 @@ void apr_thread_yield()
 {
 }
 
+APR_DECLARE(apr_status_t) apr_thread_affinity_set(apr_thread_t *thd,
+                                                  const int *cpus,
+                                                  apr_size_t ncpus)
+{
+    return APR_ENOTIMPL;
+}
+
+APR_DECLARE(apr_status_t) apr_thread_name_set(apr_thread_t *thd,
+                                              const char *name)
+{
+    return APR_ENOTIMPL;
+}
+
 APR_DECLARE(apr_status_t) apr_thread_data_get(void **data, const char *key, apr_thread_t *thread)
 {
     return apr_pool_userdata_get(data, key, thread->pool);
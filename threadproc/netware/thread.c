@@ -67,6 +67,13 @@ APR_DECLARE(apr_status_t) apr_threadattr_guardsize_set(apr_threadattr_t *attr,
     return APR_ENOTIMPL;
 }
 
+APR_DECLARE(apr_status_t) apr_threadattr_affinity_set(apr_threadattr_t *attr,
+                                                      const int *cpus,
+                                                      apr_size_t ncpus)
+{
+    return APR_ENOTIMPL;
+}
+
 static void *dummy_worker(void *opaque)
 {
     apr_thread_t *thd = (apr_thread_t *)opaque;
@@ -188,6 +195,19 @@ void apr_thread_yield()
     NXThreadYield();
 }
 
+APR_DECLARE(apr_status_t) apr_thread_affinity_set(apr_thread_t *thd,
+                                                  const int *cpus,
+                                                  apr_size_t ncpus)
+{
+    return APR_ENOTIMPL;
+}
+
+APR_DECLARE(apr_status_t) apr_thread_name_set(apr_thread_t *thd,
+                                              const char *name)
+{
+    return APR_ENOTIMPL;
+}
+
 void apr_thread_exit(apr_thread_t *thd, apr_status_t retval)
 {
     thd->exitval = retval;
@@ -70,6 +70,13 @@ APR_DECLARE(apr_status_t) apr_threadattr_guardsize_set(apr_threadattr_t *attr,
     return APR_ENOTIMPL;
 }
 
+APR_DECLARE(apr_status_t) apr_threadattr_affinity_set(apr_threadattr_t *attr,
+                                                      const int *cpus,
+                                                      apr_size_t ncpus)
+{
+    return APR_ENOTIMPL;
+}
+
 static void apr_thread_begin(void *arg)
 {
   apr_thread_t *thread = (apr_thread_t *)arg;
@@ -222,6 +229,19 @@ void apr_thread_yield()
     DosSleep(0);
 }
 
+APR_DECLARE(apr_status_t) apr_thread_affinity_set(apr_thread_t *thd,
+                                                  const int *cpus,
+                                                  apr_size_t ncpus)
+{
+    return APR_ENOTIMPL;
+}
+
+APR_DECLARE(apr_status_t) apr_thread_name_set(apr_thread_t *thd,
+                                              const char *name)
+{
+    return APR_ENOTIMPL;
+}
+
 
 
 APR_DECLARE(apr_status_t) apr_os_thread_get(apr_os_thread_t **thethd, apr_thread_t *thd)
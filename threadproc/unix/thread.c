@@ -17,6 +17,12 @@
 #include "apr.h"
 #include "apr_portable.h"
 #include "apr_arch_threadproc.h"
+#include "apr_strings.h"
+
+#if defined(HAVE_PTHREAD_ATTR_SETAFFINITY_NP) \
+    || defined(HAVE_PTHREAD_SETAFFINITY_NP)
+#include <sched.h>
+#endif
 
 #if APR_HAS_THREADS
 
@@ -139,6 +145,49 @@ APR_DECLARE(apr_status_t) apr_threadattr_guardsize_set(apr_threadattr_t *attr,
 #endif
 }
 
+#if defined(HAVE_PTHREAD_ATTR_SETAFFINITY_NP) \
+    || defined(HAVE_PTHREAD_SETAFFINITY_NP)
+static apr_status_t cpuset_make(cpu_set_t *set, const int *cpus,
+                                apr_size_t ncpus)
+{
+    apr_size_t i;
+
+    if (!ncpus) {
+        return APR_EINVAL;
+    }
+    CPU_ZERO(set);
+    for (i = 0; i < ncpus; i++) {
+        if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+            return APR_EINVAL;
+        }
+        CPU_SET(cpus[i], set);
+    }
+    return APR_SUCCESS;
+}
+#endif
+
+APR_DECLARE(apr_status_t) apr_threadattr_affinity_set(apr_threadattr_t *attr,
+                                                      const int *cpus,
+                                                      apr_size_t ncpus)
+{
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+    cpu_set_t set;
+    apr_status_t rv;
+
+    rv = cpuset_make(&set, cpus, ncpus);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    rv = pthread_attr_setaffinity_np(&attr->attr, sizeof(set), &set);
+    if (rv == 0) {
+        return APR_SUCCESS;
+    }
+    return rv;
+#else
+    return APR_ENOTIMPL;
+#endif
+}
+
 static void *dummy_worker(void *opaque)
 {
     apr_thread_t *thread = (apr_thread_t*)opaque;
@@ -310,6 +359,57 @@ APR_DECLARE(void) apr_thread_yield(void)
 #endif
 }
 
+APR_DECLARE(apr_status_t) apr_thread_affinity_set(apr_thread_t *thd,
+                                                  const int *cpus,
+                                                  apr_size_t ncpus)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t set;
+    apr_status_t rv;
+
+    rv = cpuset_make(&set, cpus, ncpus);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    rv = pthread_setaffinity_np(thd ? *thd->td : pthread_self(),
+                                sizeof(set), &set);
+    if (rv == 0) {
+        return APR_SUCCESS;
+    }
+    return rv;
+#else
+    return APR_ENOTIMPL;
+#endif
+}
+
+APR_DECLARE(apr_status_t) apr_thread_name_set(apr_thread_t *thd,
+                                              const char *name)
+{
+#ifdef HAVE_PTHREAD_SETNAME_NP
+    char buf[16]; /* the limit of Linux, with the '\0' */
+    apr_status_t rv;
+
+    apr_cpystrn(buf, name, sizeof(buf));
+#if defined(__APPLE__)
+    /* Only the calling thread can be named */
+    if (thd && !pthread_equal(*thd->td, pthread_self())) {
+        return APR_ENOTIMPL;
+    }
+    rv = pthread_setname_np(buf);
+#elif defined(__NetBSD__)
+    rv = pthread_setname_np(thd ? *thd->td : pthread_self(), "%s", buf);
+#else
+    rv = pthread_setname_np(thd ? *thd->td : pthread_self(), buf);
+#endif
+    if (rv == 0) {
+        return APR_SUCCESS;
+    }
+    return rv;
+#else
+    return APR_ENOTIMPL;
+#endif
+}
+
 APR_DECLARE(apr_status_t) apr_thread_data_get(void **data, const char *key,
                                               apr_thread_t *thread)
 {
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include "apr_private.h"
 #include "apr.h"
 
 #if APR_HAVE_STDIO_H
@@ -31,7 +32,10 @@
 #include "apr_thread_mutex.h"
 #include "apr_thread_cond.h"
 #include "apr_errno.h"
+#include "apr_atomic.h"
+#include "apr_slab.h"
 #include "apr_queue.h"
+#include "apr_lockfree_private.h"
 
 #if APR_HAS_THREADS
 /* 
@@ -40,6 +44,15 @@
 #define QUEUE_DEBUG
  */
 
+/*
+ * A slot of the lock-free ring: its sequence number is the position of
+ * the next push into it while free, and that position + 1 while filled.
+ */
+typedef struct queue_slot_t {
+    volatile apr_uint32_t seq;
+    void *volatile data;
+} queue_slot_t;
+
 struct apr_queue_t {
     void              **data;
     unsigned int        nelts; /**< # elements */
@@ -51,7 +64,22 @@ struct apr_queue_t {
     apr_thread_mutex_t *one_big_mutex;
     apr_thread_cond_t  *not_empty;
     apr_thread_cond_t  *not_full;
-    int                 terminated;
+    volatile int        terminated;
+    /* APR_QUEUE_LOCKFREE, slots is NULL otherwise */
+    queue_slot_t       *slots; /**< power of two number of slots */
+    apr_uint32_t        mask;  /**< # slots - 1 */
+    char                pad_in[APR_SLAB_CACHELINE];
+    volatile apr_uint32_t in_pos;  /**< next push */
+    char                pad_out[APR_SLAB_CACHELINE - sizeof(apr_uint32_t)];
+    volatile apr_uint32_t out_pos; /**< next pop */
+    char                pad_epochs[APR_SLAB_CACHELINE - sizeof(apr_uint32_t)];
+    /* Waiters sleep on the epochs, bumped to wake them up, and count
+     * themselves in the waiting counters */
+    volatile apr_uint32_t full_epoch;
+    volatile apr_uint32_t full_waiting;
+    volatile apr_uint32_t empty_epoch;
+    volatile apr_uint32_t empty_waiting;
+    volatile apr_uint32_t intr_epoch; /**< bumped by apr_queue_interrupt_all */
 };
 
 #ifdef QUEUE_DEBUG
@@ -101,9 +129,23 @@ static apr_status_t queue_destroy(void *data)
 APR_DECLARE(apr_status_t) apr_queue_create(apr_queue_t **q, 
                                            unsigned int queue_capacity, 
                                            apr_pool_t *a)
+{
+    return apr_queue_create_ex(q, queue_capacity, 0, a);
+}
+
+APR_DECLARE(apr_status_t) apr_queue_create_ex(apr_queue_t **q,
+                                              unsigned int queue_capacity,
+                                              apr_uint32_t flags,
+                                              apr_pool_t *a)
 {
     apr_status_t rv;
     apr_queue_t *queue;
+
+    if ((flags & APR_QUEUE_LOCKFREE)
+        && (queue_capacity == 0 || queue_capacity > 0x40000000u)) {
+        return APR_EINVAL;
+    }
+
     queue = apr_palloc(a, sizeof(apr_queue_t));
     *q = queue;
 
@@ -125,8 +167,33 @@ APR_DECLARE(apr_status_t) apr_queue_create(apr_queue_t **q,
         return rv;
     }
 
-    /* Set all the data in the queue to NULL */
-    queue->data = apr_pcalloc(a, queue_capacity * sizeof(void*));
+    queue->slots = NULL;
+    queue->mask = 0;
+    queue->in_pos = 0;
+    queue->out_pos = 0;
+    queue->full_epoch = 0;
+    queue->full_waiting = 0;
+    queue->empty_epoch = 0;
+    queue->empty_waiting = 0;
+    queue->intr_epoch = 0;
+    if (flags & APR_QUEUE_LOCKFREE) {
+        apr_uint32_t i, n = 1;
+
+        while (n < queue_capacity) {
+            n <<= 1;
+        }
+        queue->slots = apr_palloc(a, n * sizeof(queue_slot_t));
+        for (i = 0; i < n; i++) {
+            queue->slots[i].seq = i;
+            queue->slots[i].data = NULL;
+        }
+        queue->mask = n - 1;
+        queue->data = NULL;
+    }
+    else {
+        /* Set all the data in the queue to NULL */
+        queue->data = apr_pcalloc(a, queue_capacity * sizeof(void*));
+    }
     queue->bounds = queue_capacity;
     queue->nelts = 0;
     queue->in = 0;
@@ -140,16 +207,333 @@ APR_DECLARE(apr_status_t) apr_queue_create(apr_queue_t **q,
     return APR_SUCCESS;
 }
 
+/*
+ * Lock-free mode (bounded MPMC ring of D. Vyukov): the pushers and poppers
+ * claim their position by a CAS on in_pos or out_pos, and the sequence
+ * number of the slot tells whether it is free or filled for that position.
+ * When the capacity is not a power of two (the number of slots), the
+ * pushers also check the bound against out_pos.
+ *
+ * The threads block only when the queue is full or empty: they count
+ * themselves as waiting for the condition, read its epoch, try again and
+ * sleep on the epoch (with a futex, or the condition variable otherwise).
+ * The other side bumps the epoch only when someone is waiting, and wakes
+ * up as many waiters as it moved items.  A waiter losing the race for the
+ * items goes back to sleep, only apr_queue_interrupt_all() (bumping the
+ * interrupt epoch) or apr_queue_term() make it return APR_EINTR or APR_EOF
+ * like the locked mode.
+ */
+
+typedef unsigned int (*lf_try_t)(apr_queue_t *queue, void **data,
+                                 unsigned int n);
+
+/* Push up to n items, returns how many */
+static unsigned int lf_trypush(apr_queue_t *queue, void **data,
+                               unsigned int n)
+{
+    apr_uint32_t pos = queue->in_pos, seq = 0, cur, i, k;
+    apr_int32_t room;
+    queue_slot_t *slot;
+
+    for (;;) {
+        /* The free slots can't be taken before in_pos is claimed */
+        for (k = 0; k < n; k++) {
+            slot = &queue->slots[(pos + k) & queue->mask];
+            seq = apr__load_acquire32(&slot->seq);
+            if (seq != pos + k) {
+                break;
+            }
+        }
+        if (k) {
+            if (queue->mask + 1 != queue->bounds) {
+                room = (apr_int32_t)queue->bounds
+                       - (apr_int32_t)(pos - queue->out_pos);
+                if (room <= 0) {
+                    return 0;
+                }
+                if (k > (apr_uint32_t)room) {
+                    k = room;
+                }
+            }
+            cur = apr_atomic_cas32(&queue->in_pos, pos + k, pos);
+            if (cur == pos) {
+                break;
+            }
+            pos = cur;
+        }
+        else if ((apr_int32_t)(seq - pos) < 0) {
+            /* full */
+            return 0;
+        }
+        else {
+            pos = queue->in_pos;
+        }
+    }
+
+    for (i = 0; i < k; i++) {
+        slot = &queue->slots[(pos + i) & queue->mask];
+        slot->data = data[i];
+        apr__store_release32(&slot->seq, pos + i + 1);
+    }
+    return k;
+}
+
+/* Pop up to n items, returns how many */
+static unsigned int lf_trypop(apr_queue_t *queue, void **data,
+                              unsigned int n)
+{
+    apr_uint32_t pos = queue->out_pos, seq = 0, cur, i, k;
+    queue_slot_t *slot;
+
+    for (;;) {
+        /* The filled slots can't be emptied before out_pos is claimed */
+        for (k = 0; k < n; k++) {
+            slot = &queue->slots[(pos + k) & queue->mask];
+            seq = apr__load_acquire32(&slot->seq);
+            if (seq != pos + k + 1) {
+                break;
+            }
+        }
+        if (k) {
+            cur = apr_atomic_cas32(&queue->out_pos, pos + k, pos);
+            if (cur == pos) {
+                break;
+            }
+            pos = cur;
+        }
+        else if ((apr_int32_t)(seq - (pos + 1)) < 0) {
+            /* empty */
+            return 0;
+        }
+        else {
+            pos = queue->out_pos;
+        }
+    }
+
+    for (i = 0; i < k; i++) {
+        slot = &queue->slots[(pos + i) & queue->mask];
+        data[i] = slot->data;
+        apr__store_release32(&slot->seq, pos + i + queue->mask + 1);
+    }
+    return k;
+}
+
+/* Wake up to n waiters of a condition, if any */
+static void lf_wake(apr_queue_t *queue, volatile apr_uint32_t *epoch,
+                    volatile apr_uint32_t *waiting, apr_thread_cond_t *cond,
+                    unsigned int n)
+{
+    apr_uint32_t w;
+
+    /* Pairs with the increment of waiting in lf_block() */
+    apr__memory_barrier();
+    w = *waiting;
+    if (!w) {
+        return;
+    }
+    if (n > w) {
+        n = w;
+    }
+    apr_atomic_inc32(epoch);
+#if APR_HAS_FUTEX
+    apr__futex_wake(epoch, n, 0);
+#else
+    apr_thread_mutex_lock(queue->one_big_mutex);
+    if (n < w) {
+        while (n--) {
+            apr_thread_cond_signal(cond);
+        }
+    }
+    else {
+        apr_thread_cond_broadcast(cond);
+    }
+    apr_thread_mutex_unlock(queue->one_big_mutex);
+#endif
+}
+
+/* Wake up all the waiters of a condition */
+static void lf_wake_all(apr_queue_t *queue, volatile apr_uint32_t *epoch,
+                        apr_thread_cond_t *cond)
+{
+    apr_atomic_inc32(epoch);
+#if APR_HAS_FUTEX
+    apr__futex_wake(epoch, APR_INT32_MAX, 0);
+#else
+    apr_thread_mutex_lock(queue->one_big_mutex);
+    apr_thread_cond_broadcast(cond);
+    apr_thread_mutex_unlock(queue->one_big_mutex);
+#endif
+}
+
+/* Sleep until the epoch of a condition changes, or the timeout expires,
+ * or spuriously.
+ */
+static apr_status_t lf_wait(apr_queue_t *queue, volatile apr_uint32_t *epoch,
+                            apr_uint32_t val, apr_thread_cond_t *cond,
+                            apr_interval_time_t timeout)
+{
+    apr_status_t rv;
+
+#if APR_HAS_FUTEX
+    rv = apr__futex_wait(epoch, val, timeout, 0);
+    if (rv == APR_EINTR) {
+        /* A signal, not apr_queue_interrupt_all() */
+        rv = APR_SUCCESS;
+    }
+#else
+    rv = apr_thread_mutex_lock(queue->one_big_mutex);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    if (*epoch == val) {
+        if (timeout > 0) {
+            rv = apr_thread_cond_timedwait(cond, queue->one_big_mutex,
+                                           timeout);
+        }
+        else {
+            rv = apr_thread_cond_wait(cond, queue->one_big_mutex);
+        }
+    }
+    apr_thread_mutex_unlock(queue->one_big_mutex);
+#endif
+    return rv;
+}
+
+/* Block until try_fn moves some items, the timeout expires (positive),
+ * or the queue is interrupted or terminated.
+ */
+static apr_status_t lf_block(apr_queue_t *queue, lf_try_t try_fn,
+                             void **data, unsigned int n,
+                             unsigned int *moved,
+                             volatile apr_uint32_t *epoch,
+                             volatile apr_uint32_t *waiting,
+                             apr_thread_cond_t *cond,
+                             apr_interval_time_t timeout)
+{
+    apr_time_t deadline = 0;
+    apr_uint32_t val, intr;
+    apr_status_t rv;
+
+    if (timeout > 0) {
+        deadline = apr_time_now() + timeout;
+    }
+    for (;;) {
+        intr = apr__load_acquire32(&queue->intr_epoch);
+        /* A full barrier, so that either the other side sees us waiting
+         * or we see what it moved */
+        apr_atomic_inc32(waiting);
+        val = apr__load_acquire32(epoch);
+        rv = APR_SUCCESS;
+        *moved = try_fn(queue, data, n);
+        if (!*moved && !queue->terminated
+                && intr == apr__load_acquire32(&queue->intr_epoch)) {
+            rv = lf_wait(queue, epoch, val, cond, timeout);
+            *moved = try_fn(queue, data, n);
+        }
+        apr_atomic_dec32(waiting);
+
+        if (*moved) {
+            return APR_SUCCESS;
+        }
+        if (queue->terminated) {
+            return APR_EOF; /* no more elements ever again */
+        }
+        if (intr != apr__load_acquire32(&queue->intr_epoch)) {
+            Q_DBG("queue (intr)", queue);
+            return APR_EINTR;
+        }
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        if (timeout > 0) {
+            timeout = deadline - apr_time_now();
+            if (timeout <= 0) {
+                return APR_TIMEUP;
+            }
+        }
+    }
+}
+
+static apr_status_t lf_queue_push(apr_queue_t *queue, void **data,
+                                  unsigned int n, unsigned int *count,
+                                  apr_interval_time_t timeout)
+{
+    apr_status_t rv;
+    unsigned int pushed;
+
+    *count = 0;
+    if (queue->terminated) {
+        return APR_EOF; /* no more elements ever again */
+    }
+
+    pushed = lf_trypush(queue, data, n);
+    if (!pushed) {
+        if (!timeout) {
+            return APR_EAGAIN;
+        }
+        rv = lf_block(queue, lf_trypush, data, n, &pushed,
+                      &queue->full_epoch, &queue->full_waiting,
+                      queue->not_full, timeout);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+    }
+
+    *count = pushed;
+    lf_wake(queue, &queue->empty_epoch, &queue->empty_waiting,
+            queue->not_empty, pushed);
+    return APR_SUCCESS;
+}
+
+static apr_status_t lf_queue_pop(apr_queue_t *queue, void **data,
+                                 unsigned int n, unsigned int *count,
+                                 apr_interval_time_t timeout)
+{
+    apr_status_t rv;
+    unsigned int popped;
+
+    *count = 0;
+    if (queue->terminated) {
+        return APR_EOF; /* no more elements ever again */
+    }
+
+    popped = lf_trypop(queue, data, n);
+    if (!popped) {
+        if (!timeout) {
+            return APR_EAGAIN;
+        }
+        rv = lf_block(queue, lf_trypop, data, n, &popped,
+                      &queue->empty_epoch, &queue->empty_waiting,
+                      queue->not_empty, timeout);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+    }
+
+    *count = popped;
+    lf_wake(queue, &queue->full_epoch, &queue->full_waiting,
+            queue->not_full, popped);
+    return APR_SUCCESS;
+}
+
 /**
- * Push new data onto the queue. Blocks if the queue is full. Once
- * the push operation has completed, it signals other threads waiting
- * in apr_queue_pop() that they may continue consuming sockets.
+ * Push up to n new data onto the queue, as many as it has room for. Blocks
+ * if the queue is full. Once the push operation has completed, it signals
+ * other threads waiting in apr_queue_pop() that they may continue consuming
+ * sockets.
  */
-static apr_status_t queue_push(apr_queue_t *queue, void *data,
+static apr_status_t queue_push(apr_queue_t *queue, void **data,
+                               unsigned int n, unsigned int *count,
                                apr_interval_time_t timeout)
 {
     apr_status_t rv;
+    unsigned int i;
 
+    if (queue->slots) {
+        return lf_queue_push(queue, data, n, count, timeout);
+    }
+
+    *count = 0;
     if (queue->terminated) {
         return APR_EOF; /* no more elements ever again */
     }
@@ -197,15 +581,26 @@ static apr_status_t queue_push(apr_queue_t *queue, void *data,
         }
     }
 
-    queue->data[queue->in] = data;
-    queue->in++;
-    if (queue->in >= queue->bounds)
-        queue->in -= queue->bounds;
-    queue->nelts++;
+    if (n > queue->bounds - queue->nelts) {
+        n = queue->bounds - queue->nelts;
+    }
+    for (i = 0; i < n; i++) {
+        queue->data[queue->in] = data[i];
+        queue->in++;
+        if (queue->in >= queue->bounds)
+            queue->in -= queue->bounds;
+    }
+    queue->nelts += n;
+    *count = n;
 
     if (queue->empty_waiters) {
         Q_DBG("sig !empty", queue);
-        rv = apr_thread_cond_signal(queue->not_empty);
+        if (n > 1 && queue->empty_waiters > 1) {
+            rv = apr_thread_cond_broadcast(queue->not_empty);
+        }
+        else {
+            rv = apr_thread_cond_signal(queue->not_empty);
+        }
         if (rv != APR_SUCCESS) {
             apr_thread_mutex_unlock(queue->one_big_mutex);
             return rv;
@@ -218,7 +613,9 @@ static apr_status_t queue_push(apr_queue_t *queue, void *data,
 
 APR_DECLARE(apr_status_t) apr_queue_push(apr_queue_t *queue, void *data)
 {
-    return queue_push(queue, data, -1);
+    unsigned int count;
+
+    return queue_push(queue, &data, 1, &count, -1);
 }
 
 /**
@@ -228,34 +625,88 @@ APR_DECLARE(apr_status_t) apr_queue_push(apr_queue_t *queue, void *data)
  */
 APR_DECLARE(apr_status_t) apr_queue_trypush(apr_queue_t *queue, void *data)
 {
-    return queue_push(queue, data, 0);
+    unsigned int count;
+
+    return queue_push(queue, &data, 1, &count, 0);
 }
 
 APR_DECLARE(apr_status_t) apr_queue_timedpush(apr_queue_t *queue, void *data,
                                               apr_interval_time_t timeout)
 {
-    return queue_push(queue, data, timeout);
+    unsigned int count;
+
+    return queue_push(queue, &data, 1, &count, timeout);
+}
+
+APR_DECLARE(apr_status_t) apr_queue_push_batch(apr_queue_t *queue,
+                                               void **data, unsigned int n,
+                                               unsigned int *pushed)
+{
+    if (!n) {
+        *pushed = 0;
+        return APR_EINVAL;
+    }
+    return queue_push(queue, data, n, pushed, -1);
+}
+
+APR_DECLARE(apr_status_t) apr_queue_trypush_batch(apr_queue_t *queue,
+                                                  void **data, unsigned int n,
+                                                  unsigned int *pushed)
+{
+    if (!n) {
+        *pushed = 0;
+        return APR_EINVAL;
+    }
+    return queue_push(queue, data, n, pushed, 0);
+}
+
+APR_DECLARE(apr_status_t) apr_queue_timedpush_batch(apr_queue_t *queue,
+                                                    void **data,
+                                                    unsigned int n,
+                                                    unsigned int *pushed,
+                                                    apr_interval_time_t timeout)
+{
+    if (!n) {
+        *pushed = 0;
+        return APR_EINVAL;
+    }
+    return queue_push(queue, data, n, pushed, timeout);
 }
 
 /**
  * not thread safe
  */
 APR_DECLARE(unsigned int) apr_queue_size(apr_queue_t *queue) {
+    if (queue->slots) {
+        apr_uint32_t out = queue->out_pos, n = queue->in_pos - out;
+
+        if ((apr_int32_t)n < 0) {
+            return 0;
+        }
+        return n < queue->bounds ? n : queue->bounds;
+    }
     return queue->nelts;
 }
 
 /**
- * Retrieves the next item from the queue. If there are no
+ * Retrieves up to n next items from the queue. If there are no
  * items available, it will either return APR_EAGAIN (timeout = 0),
  * or block until one becomes available (infinitely with timeout < 0,
  * otherwise until the given timeout expires). Once retrieved, the
- * item is placed into the address specified by 'data'.
+ * items are placed into the array specified by 'data'.
  */
 static apr_status_t queue_pop(apr_queue_t *queue, void **data,
+                              unsigned int n, unsigned int *count,
                               apr_interval_time_t timeout)
 {
     apr_status_t rv;
+    unsigned int i;
 
+    if (queue->slots) {
+        return lf_queue_pop(queue, data, n, count, timeout);
+    }
+
+    *count = 0;
     if (queue->terminated) {
         return APR_EOF; /* no more elements ever again */
     }
@@ -304,15 +755,26 @@ static apr_status_t queue_pop(apr_queue_t *queue, void **data,
         }
     } 
 
-    *data = queue->data[queue->out];
-    queue->nelts--;
+    if (n > queue->nelts) {
+        n = queue->nelts;
+    }
+    for (i = 0; i < n; i++) {
+        data[i] = queue->data[queue->out];
+        queue->out++;
+        if (queue->out >= queue->bounds)
+            queue->out -= queue->bounds;
+    }
+    queue->nelts -= n;
+    *count = n;
 
-    queue->out++;
-    if (queue->out >= queue->bounds)
-        queue->out -= queue->bounds;
     if (queue->full_waiters) {
         Q_DBG("signal !full", queue);
-        rv = apr_thread_cond_signal(queue->not_full);
+        if (n > 1 && queue->full_waiters > 1) {
+            rv = apr_thread_cond_broadcast(queue->not_full);
+        }
+        else {
+            rv = apr_thread_cond_signal(queue->not_full);
+        }
         if (rv != APR_SUCCESS) {
             apr_thread_mutex_unlock(queue->one_big_mutex);
             return rv;
@@ -325,24 +787,71 @@ static apr_status_t queue_pop(apr_queue_t *queue, void **data,
 
 APR_DECLARE(apr_status_t) apr_queue_pop(apr_queue_t *queue, void **data)
 {
-    return queue_pop(queue, data, -1);
+    unsigned int count;
+
+    return queue_pop(queue, data, 1, &count, -1);
 }
 
 APR_DECLARE(apr_status_t) apr_queue_trypop(apr_queue_t *queue, void **data)
 {
-    return queue_pop(queue, data, 0);
+    unsigned int count;
+
+    return queue_pop(queue, data, 1, &count, 0);
 }
 
 APR_DECLARE(apr_status_t) apr_queue_timedpop(apr_queue_t *queue, void **data,
                                              apr_interval_time_t timeout)
 {
-    return queue_pop(queue, data, timeout);
+    unsigned int count;
+
+    return queue_pop(queue, data, 1, &count, timeout);
+}
+
+APR_DECLARE(apr_status_t) apr_queue_pop_batch(apr_queue_t *queue,
+                                              void **data, unsigned int n,
+                                              unsigned int *popped)
+{
+    if (!n) {
+        *popped = 0;
+        return APR_EINVAL;
+    }
+    return queue_pop(queue, data, n, popped, -1);
+}
+
+APR_DECLARE(apr_status_t) apr_queue_trypop_batch(apr_queue_t *queue,
+                                                 void **data, unsigned int n,
+                                                 unsigned int *popped)
+{
+    if (!n) {
+        *popped = 0;
+        return APR_EINVAL;
+    }
+    return queue_pop(queue, data, n, popped, 0);
+}
+
+APR_DECLARE(apr_status_t) apr_queue_timedpop_batch(apr_queue_t *queue,
+                                                   void **data,
+                                                   unsigned int n,
+                                                   unsigned int *popped,
+                                                   apr_interval_time_t timeout)
+{
+    if (!n) {
+        *popped = 0;
+        return APR_EINVAL;
+    }
+    return queue_pop(queue, data, n, popped, timeout);
 }
 
 APR_DECLARE(apr_status_t) apr_queue_interrupt_all(apr_queue_t *queue)
 {
     apr_status_t rv;
     Q_DBG("intr all", queue);    
+    if (queue->slots) {
+        apr_atomic_inc32(&queue->intr_epoch);
+        lf_wake_all(queue, &queue->empty_epoch, queue->not_empty);
+        lf_wake_all(queue, &queue->full_epoch, queue->not_full);
+        return APR_SUCCESS;
+    }
     if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
         return rv;
     }
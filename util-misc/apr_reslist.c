@@ -15,14 +15,29 @@
  */
 
 #include <assert.h>
+#include <stdlib.h>     /* for calloc and free */
 
 #include "apu.h"
 #include "apr_reslist.h"
 #include "apr_errno.h"
 #include "apr_strings.h"
+#include "apr_atomic.h"
+#include "apr_portable.h"
+#include "apr_thread_proc.h"
 #include "apr_thread_mutex.h"
 #include "apr_thread_cond.h"
 #include "apr_ring.h"
+#include "apr_slab.h"
+
+/*
+ * The lock-free path and per-thread caches need native thread keys
+ * (with destructors), see apr_reslist_thread_cache_set().
+ */
+#if APR_HAS_THREADS && APR_HAVE_PTHREAD_H
+#define APR_RESLIST_THREAD_CACHE 1
+#else
+#define APR_RESLIST_THREAD_CACHE 0
+#endif
 
 /**
  * A single resource element.
@@ -40,6 +55,48 @@ typedef struct apr_res_t apr_res_t;
 APR_RING_HEAD(apr_resring_t, apr_res_t);
 typedef struct apr_resring_t apr_resring_t;
 
+#if APR_RESLIST_THREAD_CACHE
+/**
+ * A resource element of the lock-free path.  The nodes are preallocated
+ * and never freed before the reslist, so they are referenced by their
+ * (index + 1) in the stacks and caches, zero meaning none.
+ */
+typedef struct reslist_node_t {
+    apr_time_t freed;
+    void *opaque;
+    volatile apr_uint32_t next;
+} reslist_node_t;
+
+/* Lock-free stacks of nodes (Treiber), the head packs the top node, the
+ * number of nodes in the stack and a tag incremented by each change so
+ * that a concurrent pop/push of the same top (ABA) fails the CAS.
+ */
+#define STACK_TOP(h)    ((apr_uint32_t)(h) & 0xffff)
+#define STACK_COUNT(h)  ((apr_uint32_t)((h) >> 16) & 0xffff)
+#define STACK_TAG(h)    ((apr_uint32_t)((h) >> 32))
+#define STACK_MAKE(top, count, tag) \
+    (((apr_uint64_t)(apr_uint32_t)(tag) << 32) \
+     | ((apr_uint64_t)(count) << 16) | (apr_uint64_t)(top))
+
+/* Maximum number of nodes, resources released beyond go to the list */
+#define RESLIST_NODES_MAX 4096
+
+typedef struct reslist_cache_t reslist_cache_t;
+
+/*
+ * Per-thread cache of idle resources.  The owning thread puts (takes)
+ * its resources there without synchronizing with the other threads, but
+ * the slots are atomic so that they can be stolen by acquirers which
+ * would otherwise block, or be reaped by the maintenance.
+ */
+struct reslist_cache_t {
+    apr_reslist_t *reslist;
+    reslist_cache_t *next;
+    reslist_cache_t **ref;
+    volatile apr_uint32_t slots[APR_RESLIST_THREAD_CACHE_MAX];
+};
+#endif /* APR_RESLIST_THREAD_CACHE */
+
 struct apr_reslist_t {
     apr_pool_t *pool; /* the pool used in constructor and destructor calls */
     int ntotal;     /* total number of resources managed by this list */
@@ -53,10 +110,28 @@ struct apr_reslist_t {
     apr_reslist_destructor destructor;
     void *params; /* opaque data passed to constructor and destructor calls */
     apr_resring_t avail_list;
-    apr_resring_t free_list;
+    apr_slab_t *containers; /* resource containers, recycled once freed */
 #if APR_HAS_THREADS
     apr_thread_mutex_t *listlock;
     apr_thread_cond_t *avail;
+    /* Background maintenance, see apr_reslist_maintenance_set() */
+    apr_thread_t *maintainer;
+    apr_thread_cond_t *maintain_cond;
+    apr_pool_t *maintain_pool; /* the pool of the maintainer's calls */
+    apr_interval_time_t maintain_interval;
+    int maintain_stop;
+    int maintain_busy; /* resources the maintainer creates or destroys */
+#endif
+#if APR_RESLIST_THREAD_CACHE
+    /* Lock-free path, enabled by apr_reslist_thread_cache_set() */
+    reslist_node_t *nodes;      /* preallocated nodes, NULL if disabled */
+    volatile apr_uint64_t idle_stack; /* nodes of idle resources */
+    volatile apr_uint64_t free_stack; /* unused nodes */
+    volatile apr_uint32_t nwaiters;   /* acquirers in the slow path */
+    int cache_size; /* number of resources each thread may cache */
+    int cache_key_set;
+    apr_os_threadkey_t cache_key;
+    reslist_cache_t *caches; /* all the threads' caches */
 #endif
 };
 
@@ -103,27 +178,21 @@ static apr_status_t push_resource(apr_reslist_t *reslist,
 }
 
 /**
- * Get an resource container from the free list or create a new one.
+ * Get an resource container from the slab.
+ * Assumes: that the reslist is locked.
  */
 static apr_res_t *get_container(apr_reslist_t *reslist)
 {
-    apr_res_t *res;
-
-    if (!APR_RING_EMPTY(&reslist->free_list, apr_res_t, link)) {
-        res = APR_RING_FIRST(&reslist->free_list);
-        APR_RING_REMOVE(res, link);
-    }
-    else
-        res = apr_pcalloc(reslist->pool, sizeof(*res));
-    return res;
+    return apr_slab_calloc(reslist->containers);
 }
 
 /**
- * Free up a resource container by placing it on the free list.
+ * Free up a resource container by giving it back to the slab.
+ * Assumes: that the reslist is locked.
  */
 static void free_container(apr_reslist_t *reslist, apr_res_t *container)
 {
-    APR_RING_INSERT_TAIL(&reslist->free_list, container, apr_res_t, link);
+    apr_slab_free(reslist->containers, container);
 }
 
 /**
@@ -152,6 +221,345 @@ static apr_status_t destroy_resource(apr_reslist_t *reslist, apr_res_t *res)
     return reslist->destructor(res->opaque, reslist->params, reslist->pool);
 }
 
+#if APR_RESLIST_THREAD_CACHE
+
+static void stack_push(volatile apr_uint64_t *head, reslist_node_t *nodes,
+                       apr_uint32_t n)
+{
+    apr_uint64_t old, with;
+
+    do {
+        old = apr_atomic_read64(head);
+        nodes[n - 1].next = STACK_TOP(old);
+        with = STACK_MAKE(n, STACK_COUNT(old) + 1, STACK_TAG(old) + 1);
+    } while (apr_atomic_cas64(head, with, old) != old);
+}
+
+static apr_uint32_t stack_pop(volatile apr_uint64_t *head,
+                              reslist_node_t *nodes)
+{
+    apr_uint64_t old, with;
+    apr_uint32_t n;
+
+    do {
+        old = apr_atomic_read64(head);
+        if ((n = STACK_TOP(old)) == 0) {
+            return 0;
+        }
+        /* The node may be popped (and its next changed) concurrently, in
+         * which case the tag won't match anymore and we retry.
+         */
+        with = STACK_MAKE(nodes[n - 1].next, STACK_COUNT(old) - 1,
+                          STACK_TAG(old) + 1);
+    } while (apr_atomic_cas64(head, with, old) != old);
+
+    return n;
+}
+
+/* Thread key destructor, gives the thread's cached resources back to the
+ * idle stack when the thread exits.
+ */
+static void reslist_cache_destroy(void *data)
+{
+    reslist_cache_t *cache = data;
+    apr_reslist_t *reslist = cache->reslist;
+    apr_uint32_t n;
+    int i;
+
+    for (i = 0; i < APR_RESLIST_THREAD_CACHE_MAX; i++) {
+        if ((n = apr_atomic_xchg32(&cache->slots[i], 0)) != 0) {
+            stack_push(&reslist->idle_stack, reslist->nodes, n);
+        }
+    }
+
+    apr_thread_mutex_lock(reslist->listlock);
+    apr_pool_owner_set(reslist->pool, 0);
+
+    if ((*cache->ref = cache->next) != NULL) {
+        cache->next->ref = cache->ref;
+    }
+    if (apr_atomic_read32(&reslist->nwaiters)) {
+        apr_thread_cond_broadcast(reslist->avail);
+    }
+
+    apr_thread_mutex_unlock(reslist->listlock);
+
+    free(cache);
+}
+
+static reslist_cache_t *reslist_cache_get(apr_reslist_t *reslist)
+{
+    reslist_cache_t *cache;
+
+    cache = pthread_getspecific(reslist->cache_key);
+    if (cache == NULL) {
+        if ((cache = calloc(1, sizeof(reslist_cache_t))) == NULL) {
+            return NULL;
+        }
+        if (pthread_setspecific(reslist->cache_key, cache) != 0) {
+            free(cache);
+            return NULL;
+        }
+        cache->reslist = reslist;
+
+        apr_thread_mutex_lock(reslist->listlock);
+        apr_pool_owner_set(reslist->pool, 0);
+
+        if ((cache->next = reslist->caches) != NULL) {
+            cache->next->ref = &cache->next;
+        }
+        reslist->caches = cache;
+        cache->ref = &reslist->caches;
+
+        apr_thread_mutex_unlock(reslist->listlock);
+    }
+
+    return cache;
+}
+
+/**
+ * Take an idle node from the calling thread's cache, or the idle stack.
+ */
+static apr_uint32_t node_take(apr_reslist_t *reslist)
+{
+    reslist_cache_t *cache;
+    apr_uint32_t n;
+    int i;
+
+    if (reslist->cache_size && reslist->cache_key_set
+            && (cache = reslist_cache_get(reslist)) != NULL) {
+        for (i = 0; i < APR_RESLIST_THREAD_CACHE_MAX; i++) {
+            if (cache->slots[i]
+                    && (n = apr_atomic_xchg32(&cache->slots[i], 0)) != 0) {
+                return n;
+            }
+        }
+    }
+
+    return stack_pop(&reslist->idle_stack, reslist->nodes);
+}
+
+/**
+ * Put an idle node in the calling thread's cache, or the idle stack.
+ * Returns zero if neither can take it.
+ */
+static int node_put(apr_reslist_t *reslist, apr_uint32_t n)
+{
+    reslist_cache_t *cache;
+    int i;
+
+    if (reslist->cache_size && reslist->cache_key_set
+            && (cache = reslist_cache_get(reslist)) != NULL) {
+        for (i = 0; i < reslist->cache_size; i++) {
+            if (!cache->slots[i]
+                    && apr_atomic_cas32(&cache->slots[i], n, 0) == 0) {
+                return 1;
+            }
+        }
+    }
+
+    /* Without a maintainer the resources above smax need to be in the
+     * list for reslist_maintain() to expire them in order.
+     */
+    if (reslist->ttl && !reslist->maintainer
+            && STACK_COUNT(apr_atomic_read64(&reslist->idle_stack))
+               >= (apr_uint32_t)reslist->smax) {
+        return 0;
+    }
+
+    stack_push(&reslist->idle_stack, reslist->nodes, n);
+    return 1;
+}
+
+/**
+ * Destroy the resource of an idle node and recycle the node.
+ * Assumes: that the reslist is locked.
+ */
+static apr_status_t destroy_node(apr_reslist_t *reslist, apr_uint32_t n)
+{
+    apr_status_t rv;
+
+    rv = reslist->destructor(reslist->nodes[n - 1].opaque, reslist->params,
+                             reslist->pool);
+    reslist->ntotal--;
+    stack_push(&reslist->free_stack, reslist->nodes, n);
+    return rv;
+}
+
+/**
+ * Count the idle resources of the lock-free path.
+ * Assumes: that the reslist is locked.
+ */
+static int nodes_idle(apr_reslist_t *reslist)
+{
+    reslist_cache_t *cache;
+    int i, count;
+
+    if (!reslist->nodes) {
+        return 0;
+    }
+    count = STACK_COUNT(apr_atomic_read64(&reslist->idle_stack));
+    for (cache = reslist->caches; cache; cache = cache->next) {
+        for (i = 0; i < APR_RESLIST_THREAD_CACHE_MAX; i++) {
+            if (cache->slots[i]) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * Take an idle resource from the lock-free path, stealing it from any
+ * thread's cache if the idle stack is empty, and destroying the expired
+ * ones.  Returns APR_EAGAIN if there is none.
+ * Assumes: that the reslist is locked.
+ */
+static apr_status_t nodes_acquire(apr_reslist_t *reslist, void **resource)
+{
+    reslist_cache_t *cache;
+    apr_status_t rv;
+    apr_uint32_t n;
+    int i;
+
+    for (;;) {
+        n = stack_pop(&reslist->idle_stack, reslist->nodes);
+        for (cache = reslist->caches; cache && !n; cache = cache->next) {
+            for (i = 0; i < APR_RESLIST_THREAD_CACHE_MAX && !n; i++) {
+                if (cache->slots[i]) {
+                    n = apr_atomic_xchg32(&cache->slots[i], 0);
+                }
+            }
+        }
+        if (!n) {
+            return APR_EAGAIN;
+        }
+
+        if (reslist->ttl
+                && apr_time_now() - reslist->nodes[n - 1].freed
+                   >= reslist->ttl) {
+            if ((rv = destroy_node(reslist, n)) != APR_SUCCESS) {
+                return rv;
+            }
+            continue;
+        }
+
+        *resource = reslist->nodes[n - 1].opaque;
+        stack_push(&reslist->free_stack, reslist->nodes, n);
+        return APR_SUCCESS;
+    }
+}
+
+/**
+ * Take the resources of the lock-free path which reached their ttl out,
+ * as long as there are more than smax idle resources, and return them
+ * chained for nodes_destroy().
+ * Assumes: that the reslist is locked.
+ */
+static apr_uint32_t nodes_expire(apr_reslist_t *reslist, apr_time_t now,
+                                 int *idle)
+{
+    reslist_cache_t *cache;
+    apr_uint32_t n, kept = 0, expired = 0, count;
+    int i;
+
+    /* Unstack the idle nodes, keeping the fresh ones in order to restack
+     * them as they were.
+     */
+    count = STACK_COUNT(apr_atomic_read64(&reslist->idle_stack));
+    while (count-- && *idle > reslist->smax
+           && (n = stack_pop(&reslist->idle_stack, reslist->nodes)) != 0) {
+        if (now - reslist->nodes[n - 1].freed >= reslist->ttl) {
+            (*idle)--;
+            reslist->nodes[n - 1].next = expired;
+            expired = n;
+        }
+        else {
+            reslist->nodes[n - 1].next = kept;
+            kept = n;
+        }
+    }
+    while ((n = kept) != 0) {
+        kept = reslist->nodes[n - 1].next;
+        stack_push(&reslist->idle_stack, reslist->nodes, n);
+    }
+
+    for (cache = reslist->caches; cache; cache = cache->next) {
+        for (i = 0; i < APR_RESLIST_THREAD_CACHE_MAX; i++) {
+            if (*idle <= reslist->smax) {
+                return expired;
+            }
+            n = cache->slots[i];
+            if (n && now - reslist->nodes[n - 1].freed >= reslist->ttl
+                    && apr_atomic_cas32(&cache->slots[i], 0, n) == n) {
+                (*idle)--;
+                reslist->nodes[n - 1].next = expired;
+                expired = n;
+            }
+        }
+    }
+
+    return expired;
+}
+
+/**
+ * Destroy the resources of the nodes chained by nodes_expire() and recycle
+ * the nodes, the caller accounts for them.
+ */
+static apr_status_t nodes_destroy(apr_reslist_t *reslist, apr_uint32_t n,
+                                  apr_pool_t *pool)
+{
+    apr_status_t rv = APR_SUCCESS, rv1;
+    apr_uint32_t next;
+
+    for (; n; n = next) {
+        next = reslist->nodes[n - 1].next;
+        rv1 = reslist->destructor(reslist->nodes[n - 1].opaque,
+                                  reslist->params, pool);
+        if (rv1 != APR_SUCCESS) {
+            rv = rv1;
+        }
+        stack_push(&reslist->free_stack, reslist->nodes, n);
+    }
+    return rv;
+}
+
+#endif /* APR_RESLIST_THREAD_CACHE */
+
+/**
+ * Count all the idle resources.
+ * Assumes: that the reslist is locked.
+ */
+static int reslist_idle(apr_reslist_t *reslist)
+{
+#if APR_RESLIST_THREAD_CACHE
+    return reslist->nidle + nodes_idle(reslist);
+#else
+    return reslist->nidle;
+#endif
+}
+
+#if APR_HAS_THREADS
+static apr_status_t reslist_maintainer_stop(void *data_)
+{
+    apr_reslist_t *rl = data_;
+    apr_status_t rv;
+
+    if (!rl->maintainer) {
+        return APR_SUCCESS;
+    }
+
+    apr_thread_mutex_lock(rl->listlock);
+    rl->maintain_stop = 1;
+    apr_thread_cond_signal(rl->maintain_cond);
+    apr_thread_mutex_unlock(rl->listlock);
+
+    apr_thread_join(&rv, rl->maintainer);
+    rl->maintainer = NULL;
+    return APR_SUCCESS;
+}
+#endif
+
 static apr_status_t reslist_cleanup(void *data_)
 {
     apr_status_t rv = APR_SUCCESS;
@@ -159,10 +567,45 @@ static apr_status_t reslist_cleanup(void *data_)
     apr_res_t *res;
 
 #if APR_HAS_THREADS
+    reslist_maintainer_stop(rl);
+    apr_pool_cleanup_kill(rl->pool, rl, reslist_maintainer_stop);
+
     apr_thread_mutex_lock(rl->listlock);
     apr_pool_owner_set(rl->pool, 0);
 #endif
 
+#if APR_RESLIST_THREAD_CACHE
+    if (rl->nodes) {
+        reslist_cache_t *cache;
+        apr_uint32_t n;
+        int i;
+
+        /* Threads still alive won't see their cache anymore once the key
+         * is deleted, move all the cached resources to the idle stack to
+         * destroy them below.
+         */
+        if (rl->cache_key_set) {
+            pthread_key_delete(rl->cache_key);
+            rl->cache_key_set = 0;
+        }
+        while ((cache = rl->caches) != NULL) {
+            rl->caches = cache->next;
+            for (i = 0; i < APR_RESLIST_THREAD_CACHE_MAX; i++) {
+                if ((n = apr_atomic_xchg32(&cache->slots[i], 0)) != 0) {
+                    stack_push(&rl->idle_stack, rl->nodes, n);
+                }
+            }
+            free(cache);
+        }
+        while ((n = stack_pop(&rl->idle_stack, rl->nodes)) != 0) {
+            apr_status_t rv1 = destroy_node(rl, n);
+            if (rv1 != APR_SUCCESS) {
+                rv = rv1;
+            }
+        }
+    }
+#endif
+
     while (rl->nidle > 0) {
         apr_status_t rv1;
         res = pop_resource(rl, 0);
@@ -182,6 +625,12 @@ static apr_status_t reslist_cleanup(void *data_)
     apr_thread_mutex_unlock(rl->listlock);
     apr_thread_mutex_destroy(rl->listlock);
     apr_thread_cond_destroy(rl->avail);
+    apr_thread_cond_destroy(rl->maintain_cond);
+    if (rl->maintain_pool) {
+        apr_pool_owner_set(rl->maintain_pool, 0);
+        apr_pool_destroy(rl->maintain_pool);
+        rl->maintain_pool = NULL;
+    }
 #endif
 
     return rv;
@@ -197,9 +646,10 @@ static apr_status_t reslist_maintain(apr_reslist_t *reslist)
     apr_status_t rv;
     apr_res_t *res;
     int created_one = 0;
+    int idle = reslist_idle(reslist);
 
     /* Check if we need to create more resources, and if we are allowed to. */
-    while (reslist->nidle < reslist->min && reslist->ntotal < reslist->hmax) {
+    while (idle < reslist->min && reslist->ntotal < reslist->hmax) {
         /* Create the resource */
         rv = create_resource(reslist, &res);
         if (rv != APR_SUCCESS) {
@@ -211,6 +661,7 @@ static apr_status_t reslist_maintain(apr_reslist_t *reslist)
         if (rv != APR_SUCCESS) {
             return rv;
         }
+        idle++;
         created_one++;
     }
 
@@ -223,7 +674,7 @@ static apr_status_t reslist_maintain(apr_reslist_t *reslist)
 
     /* Check if we need to expire old resources */
     now = apr_time_now();
-    while (reslist->nidle > reslist->smax && reslist->nidle > 0) {
+    while (idle > reslist->smax && reslist->nidle > 0) {
         /* Peek at the oldest resource in the list */
         res = APR_RING_LAST(&reslist->avail_list);
         if (now - res->freed < reslist->ttl) {
@@ -235,6 +686,7 @@ static apr_status_t reslist_maintain(apr_reslist_t *reslist)
         APR_RING_REMOVE(res, link);
         reslist->nidle--;
         reslist->ntotal--;
+        idle--;
         rv = destroy_resource(reslist, res);
         free_container(reslist, res);
         if (rv != APR_SUCCESS) {
@@ -242,6 +694,16 @@ static apr_status_t reslist_maintain(apr_reslist_t *reslist)
         }
     }
 
+#if APR_RESLIST_THREAD_CACHE
+    /* Same for the lock-free path, not ordered by age though */
+    if (idle > reslist->smax && reslist->nodes) {
+        int expired = idle;
+        apr_uint32_t n = nodes_expire(reslist, now, &idle);
+        reslist->ntotal -= expired - idle;
+        return nodes_destroy(reslist, n, reslist->pool);
+    }
+#endif
+
     return APR_SUCCESS;
 }
 
@@ -300,7 +762,10 @@ APR_DECLARE(apr_status_t) apr_reslist_create(apr_reslist_t **reslist,
     rl->params = params;
 
     APR_RING_INIT(&rl->avail_list, apr_res_t, link);
-    APR_RING_INIT(&rl->free_list, apr_res_t, link);
+    rv = apr_slab_create(&rl->containers, sizeof(apr_res_t), 0, pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
 
 #if APR_HAS_THREADS
     rv = apr_thread_mutex_create(&rl->listlock, APR_THREAD_MUTEX_DEFAULT,
@@ -312,6 +777,10 @@ APR_DECLARE(apr_status_t) apr_reslist_create(apr_reslist_t **reslist,
     if (rv != APR_SUCCESS) {
         return rv;
     }
+    rv = apr_thread_cond_create(&rl->maintain_cond, pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
 #endif
 
     rv = reslist_maintain(rl);
@@ -341,19 +810,53 @@ static apr_status_t reslist_acquire(apr_reslist_t *reslist,
     apr_status_t rv;
     apr_res_t *res;
     int fifo;
+#if APR_RESLIST_THREAD_CACHE
+    apr_uint32_t n = 0;
+#endif
 
     if (flags & ~APR_RESLIST_ACQUIRE_MASK) {
         return APR_EINVAL;
     }
     fifo = flags & APR_RESLIST_ACQUIRE_FIFO;
 
+#if APR_RESLIST_THREAD_CACHE
+    /* Lock-free path first, unless the oldest resource is asked for */
+    if (reslist->nodes && !fifo
+            && (n = node_take(reslist)) != 0) {
+        reslist_node_t *node = &reslist->nodes[n - 1];
+        if (!reslist->ttl || apr_time_now() - node->freed < reslist->ttl) {
+            *resource = node->opaque;
+            stack_push(&reslist->free_stack, reslist->nodes, n);
+            return APR_SUCCESS;
+        }
+        /* Expired, destroy it below */
+    }
+#endif
+
 #if APR_HAS_THREADS
     apr_thread_mutex_lock(reslist->listlock);
     apr_pool_owner_set(reslist->pool, 0);
+#endif
+#if APR_RESLIST_THREAD_CACHE
+    if (n && (rv = destroy_node(reslist, n)) != APR_SUCCESS) {
+        apr_thread_mutex_unlock(reslist->listlock);
+        return rv;
+    }
+    /* Releasers need to signal us if they put a resource in the lock-free
+     * path (since we may be waiting for it), the atomic increment is a
+     * full barrier which pairs with theirs.
+     */
+    if (reslist->nodes) {
+        apr_atomic_inc32(&reslist->nwaiters);
+    }
 #endif
     /* If there are expired resources in the available list, kill
-     * them right away. */
+     * them right away (unless it's the maintainer's job). */
+#if APR_HAS_THREADS
+    if (reslist->ttl && reslist->nidle > 0 && !reslist->maintainer) {
+#else
     if (reslist->ttl && reslist->nidle > 0) {
+#endif
         apr_time_t now = apr_time_now();
         do {
             /* Peek at the oldest resource in the list */
@@ -370,67 +873,86 @@ static apr_status_t reslist_acquire(apr_reslist_t *reslist,
             rv = destroy_resource(reslist, res);
             free_container(reslist, res);
             if (rv != APR_SUCCESS) {
-#if APR_HAS_THREADS
-                apr_thread_mutex_unlock(reslist->listlock);
-#endif
-                return rv;  /* FIXME: this might cause unnecessary fails */
+                goto done;  /* FIXME: this might cause unnecessary fails */
             }
         } while (reslist->nidle > 0);
     }
-    /* If there is still an idle resource, use it right away */
-    if (reslist->nidle > 0) {
-        res = pop_resource(reslist, fifo);
-        *resource = res->opaque;
-        free_container(reslist, res);
+    for (;;) {
+        /* If there is an idle resource, use it right away */
+        if (reslist->nidle > 0) {
+            res = pop_resource(reslist, fifo);
 #if APR_HAS_THREADS
-        apr_thread_mutex_unlock(reslist->listlock);
+            /* Not reaped above, so check it */
+            if (reslist->maintainer && reslist->ttl
+                    && apr_time_now() - res->freed >= reslist->ttl) {
+                reslist->ntotal--;
+                rv = destroy_resource(reslist, res);
+                free_container(reslist, res);
+                if (rv != APR_SUCCESS) {
+                    goto done;
+                }
+                continue;
+            }
 #endif
-        return APR_SUCCESS;
-    }
-    /* If we've hit our max, block until we're allowed to create
-     * a new one, or something becomes free. */
-    while (reslist->ntotal >= reslist->hmax && reslist->nidle <= 0) {
+            *resource = res->opaque;
+            free_container(reslist, res);
+            rv = APR_SUCCESS;
+            goto done;
+        }
+#if APR_RESLIST_THREAD_CACHE
+        /* Or one from the lock-free path, possibly stolen from another
+         * thread's cache. */
+        if (reslist->nodes) {
+            rv = nodes_acquire(reslist, resource);
+            if (rv != APR_EAGAIN) {
+                goto done;
+            }
+        }
+#endif
+        /* If there is a new slot available, create a resource
+         * to fill the slot and use it. */
+        if (reslist->ntotal < reslist->hmax) {
+            break;
+        }
+        /* We've hit our max, block until we're allowed to create
+         * a new one, or something becomes free. */
 #if APR_HAS_THREADS
         if (reslist->timeout) {
-            if ((rv = apr_thread_cond_timedwait(reslist->avail, 
+            if ((rv = apr_thread_cond_timedwait(reslist->avail,
                 reslist->listlock, reslist->timeout)) != APR_SUCCESS) {
-                apr_thread_mutex_unlock(reslist->listlock);
-                return rv;
+                goto done;
             }
         }
         else {
             apr_thread_cond_wait(reslist->avail, reslist->listlock);
         }
+        apr_pool_owner_set(reslist->pool, 0);
 #else
         return APR_EAGAIN;
 #endif
     }
-    /* If we popped out of the loop, first try to see if there
-     * are new resources available for immediate use. */
-    if (reslist->nidle > 0) {
-        res = pop_resource(reslist, fifo);
+
+    rv = create_resource(reslist, &res);
+    if (rv == APR_SUCCESS) {
+        reslist->ntotal++;
         *resource = res->opaque;
-        free_container(reslist, res);
-#if APR_HAS_THREADS
-        apr_thread_mutex_unlock(reslist->listlock);
-#endif
-        return APR_SUCCESS;
     }
-    /* Otherwise the reason we dropped out of the loop
-     * was because there is a new slot available, so create
-     * a resource to fill the slot and use it. */
-    else {
-        rv = create_resource(reslist, &res);
-        if (rv == APR_SUCCESS) {
-            reslist->ntotal++;
-            *resource = res->opaque;
-        }
-        free_container(reslist, res);
-#if APR_HAS_THREADS
-        apr_thread_mutex_unlock(reslist->listlock);
+    free_container(reslist, res);
+
+done:
+#if APR_RESLIST_THREAD_CACHE
+    if (reslist->nodes) {
+        apr_atomic_dec32(&reslist->nwaiters);
+    }
 #endif
-        return rv;
+#if APR_HAS_THREADS
+    /* Let the maintainer prewarm what we consumed */
+    if (reslist->maintainer && reslist_idle(reslist) < reslist->min) {
+        apr_thread_cond_signal(reslist->maintain_cond);
     }
+    apr_thread_mutex_unlock(reslist->listlock);
+#endif
+    return rv;
 }
 
 APR_DECLARE(apr_status_t) apr_reslist_acquire_ex(apr_reslist_t *reslist,
@@ -451,6 +973,35 @@ APR_DECLARE(apr_status_t) apr_reslist_release(apr_reslist_t *reslist,
     apr_status_t rv;
     apr_res_t *res;
 
+#if APR_RESLIST_THREAD_CACHE
+    /* Lock-free path first, unless someone is waiting in the slow path
+     * already (then better give the resource directly).
+     */
+    if (reslist->nodes && !apr_atomic_read32(&reslist->nwaiters)) {
+        apr_uint32_t n = stack_pop(&reslist->free_stack, reslist->nodes);
+        if (n) {
+            reslist_node_t *node = &reslist->nodes[n - 1];
+            node->opaque = resource;
+            if (reslist->ttl) {
+                node->freed = apr_time_now();
+            }
+            if (node_put(reslist, n)) {
+                /* The atomic put is a full barrier, so if an acquirer
+                 * entered the slow path after we checked nwaiters we see
+                 * it now, and it may have missed our resource.
+                 */
+                if (apr_atomic_read32(&reslist->nwaiters)) {
+                    apr_thread_mutex_lock(reslist->listlock);
+                    apr_thread_cond_signal(reslist->avail);
+                    apr_thread_mutex_unlock(reslist->listlock);
+                }
+                return APR_SUCCESS;
+            }
+            stack_push(&reslist->free_stack, reslist->nodes, n);
+        }
+    }
+#endif
+
 #if APR_HAS_THREADS
     apr_thread_mutex_lock(reslist->listlock);
     apr_pool_owner_set(reslist->pool, 0);
@@ -458,6 +1009,12 @@ APR_DECLARE(apr_status_t) apr_reslist_release(apr_reslist_t *reslist,
     res = get_container(reslist);
     res->opaque = resource;
     push_resource(reslist, res, 0);
+#if APR_HAS_THREADS
+    if (reslist->maintainer) {
+        rv = APR_SUCCESS;
+    }
+    else
+#endif
     rv = reslist_maintain(reslist);
 #if APR_HAS_THREADS
     apr_thread_mutex_unlock(reslist->listlock);
@@ -479,8 +1036,9 @@ APR_DECLARE(apr_uint32_t) apr_reslist_acquired_count(apr_reslist_t *reslist)
     apr_thread_mutex_lock(reslist->listlock);
     apr_pool_owner_set(reslist->pool, 0);
 #endif
-    count = reslist->ntotal - reslist->nidle;
+    count = reslist->ntotal - reslist_idle(reslist);
 #if APR_HAS_THREADS
+    count -= reslist->maintain_busy;
     apr_thread_mutex_unlock(reslist->listlock);
 #endif
 
@@ -514,3 +1072,216 @@ APR_DECLARE(void) apr_reslist_cleanup_order_set(apr_reslist_t *rl,
         apr_pool_cleanup_register(rl->pool, rl, reslist_cleanup,
                                   apr_pool_cleanup_null);
 }
+
+APR_DECLARE(apr_status_t) apr_reslist_thread_cache_set(apr_reslist_t *reslist,
+                                                       int count)
+{
+#if APR_RESLIST_THREAD_CACHE
+    apr_status_t rv = APR_SUCCESS;
+    apr_uint32_t n;
+
+    if (count < 0 || count > APR_RESLIST_THREAD_CACHE_MAX) {
+        return APR_EINVAL;
+    }
+
+    apr_thread_mutex_lock(reslist->listlock);
+    apr_pool_owner_set(reslist->pool, 0);
+
+    if (!reslist->nodes) {
+        n = reslist->hmax < RESLIST_NODES_MAX ? reslist->hmax
+                                              : RESLIST_NODES_MAX;
+        reslist->nodes = apr_pcalloc(reslist->pool, n * sizeof(reslist_node_t));
+        while (n) {
+            stack_push(&reslist->free_stack, reslist->nodes, n--);
+        }
+    }
+    if (count && !reslist->cache_key_set) {
+        rv = pthread_key_create(&reslist->cache_key, reslist_cache_destroy);
+        if (rv == APR_SUCCESS) {
+            reslist->cache_key_set = 1;
+        }
+    }
+    if (rv == APR_SUCCESS) {
+        reslist->cache_size = count;
+    }
+
+    apr_thread_mutex_unlock(reslist->listlock);
+    return rv;
+#else
+    return APR_ENOTIMPL;
+#endif
+}
+
+#if APR_HAS_THREADS
+/**
+ * Call the constructor or destructor from the maintainer, unlocked and with
+ * its own pool so that the requests are not held meanwhile.
+ * Assumes: that the reslist is locked (by the maintainer).
+ */
+static apr_status_t maintainer_call(apr_reslist_t *rl, apr_res_t *res,
+                                    int construct)
+{
+    apr_status_t rv;
+
+    rl->maintain_busy++;
+    apr_thread_mutex_unlock(rl->listlock);
+    if (construct) {
+        rv = rl->constructor(&res->opaque, rl->params, rl->maintain_pool);
+    }
+    else {
+        rv = rl->destructor(res->opaque, rl->params, rl->maintain_pool);
+    }
+    apr_thread_mutex_lock(rl->listlock);
+    apr_pool_owner_set(rl->pool, 0);
+    rl->maintain_busy--;
+    return rv;
+}
+
+/**
+ * Same as reslist_maintain() for the maintainer, which reserves the slot of
+ * a resource it creates, and releases the one of a resource it destroys,
+ * around the (unlocked) call.
+ * Assumes: that the reslist is locked (by the maintainer).
+ */
+static void reslist_maintainer_run(apr_reslist_t *rl)
+{
+    apr_time_t now;
+    apr_res_t *res;
+    int created_one = 0;
+
+    while (!rl->maintain_stop && reslist_idle(rl) < rl->min
+           && rl->ntotal < rl->hmax) {
+        rl->ntotal++;
+        res = get_container(rl);
+        if (maintainer_call(rl, res, 1) != APR_SUCCESS) {
+            /* Retried on the next round */
+            rl->ntotal--;
+            free_container(rl, res);
+            apr_thread_cond_signal(rl->avail);
+            return;
+        }
+        push_resource(rl, res, 0);
+        created_one++;
+    }
+
+    if (created_one || !rl->ttl) {
+        return;
+    }
+
+    now = apr_time_now();
+    while (!rl->maintain_stop && rl->nidle > 0
+           && reslist_idle(rl) > rl->smax) {
+        /* Peek at the oldest resource in the list */
+        res = APR_RING_LAST(&rl->avail_list);
+        if (now - res->freed < rl->ttl) {
+            break;
+        }
+        APR_RING_REMOVE(res, link);
+        rl->nidle--;
+        maintainer_call(rl, res, 0);
+        rl->ntotal--;
+        free_container(rl, res);
+        apr_thread_cond_signal(rl->avail);
+    }
+
+#if APR_RESLIST_THREAD_CACHE
+    if (!rl->maintain_stop && rl->nodes) {
+        int idle = reslist_idle(rl), expired = idle;
+        apr_uint32_t n;
+
+        if (idle > rl->smax
+                && (n = nodes_expire(rl, now, &idle)) != 0) {
+            expired -= idle;
+            rl->maintain_busy += expired;
+            apr_thread_mutex_unlock(rl->listlock);
+            nodes_destroy(rl, n, rl->maintain_pool);
+            apr_thread_mutex_lock(rl->listlock);
+            apr_pool_owner_set(rl->pool, 0);
+            rl->maintain_busy -= expired;
+            rl->ntotal -= expired;
+            apr_thread_cond_broadcast(rl->avail);
+        }
+    }
+#endif
+}
+
+static void *APR_THREAD_FUNC reslist_maintainer(apr_thread_t *thd, void *data)
+{
+    apr_reslist_t *rl = data;
+
+    apr_pool_owner_set(rl->maintain_pool, 0);
+    apr_thread_mutex_lock(rl->listlock);
+    apr_pool_owner_set(rl->pool, 0);
+    while (!rl->maintain_stop) {
+        /* Errors (of the constructor or destructor) are retried on the
+         * next round. */
+        reslist_maintainer_run(rl);
+        if (rl->maintain_stop) {
+            break;
+        }
+        apr_thread_cond_timedwait(rl->maintain_cond, rl->listlock,
+                                  rl->maintain_interval);
+        apr_pool_owner_set(rl->pool, 0);
+    }
+    apr_thread_mutex_unlock(rl->listlock);
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+#endif
+
+APR_DECLARE(apr_status_t) apr_reslist_maintenance_set(apr_reslist_t *reslist,
+                                                      apr_interval_time_t interval)
+{
+#if APR_HAS_THREADS
+    apr_thread_t *thd;
+    apr_status_t rv;
+
+    if (interval < 0) {
+        return APR_EINVAL;
+    }
+    if (!interval) {
+        rv = reslist_maintainer_stop(reslist);
+        apr_pool_cleanup_kill(reslist->pool, reslist,
+                              reslist_maintainer_stop);
+        return rv;
+    }
+
+    apr_thread_mutex_lock(reslist->listlock);
+    apr_pool_owner_set(reslist->pool, 0);
+    reslist->maintain_interval = interval;
+    if (reslist->maintainer) {
+        apr_thread_cond_signal(reslist->maintain_cond);
+        apr_thread_mutex_unlock(reslist->listlock);
+        return APR_SUCCESS;
+    }
+    reslist->maintain_stop = 0;
+
+    /* The maintainer calls the constructor and destructor without the lock,
+     * so it can't use the reslist's pool which is used under the lock only.
+     * Its own lives as long as the reslist, like the resources it creates.
+     */
+    if (!reslist->maintain_pool) {
+        rv = apr_pool_create_unmanaged_ex(&reslist->maintain_pool, NULL, NULL);
+        if (rv != APR_SUCCESS) {
+            apr_thread_mutex_unlock(reslist->listlock);
+            return rv;
+        }
+        apr_pool_tag(reslist->maintain_pool, "apr_reslist_maintainer");
+    }
+    rv = apr_thread_create(&thd, NULL, reslist_maintainer, reslist,
+                           reslist->pool);
+    if (rv == APR_SUCCESS) {
+        reslist->maintainer = thd;
+        /* The maintainer must be stopped before the pool's subpools (the
+         * thread's pool) are destroyed. */
+        apr_pool_pre_cleanup_register(reslist->pool, reslist,
+                                      reslist_maintainer_stop);
+    }
+
+    apr_thread_mutex_unlock(reslist->listlock);
+    return rv;
+#else
+    return APR_ENOTIMPL;
+#endif
+}
@@ -0,0 +1,585 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "apr_private.h"
+
+#include "apr_general.h"
+#include "apr_ringbuf.h"
+#include "apr_slab.h"
+#include "apr_thread_proc.h"
+#include "apr_lockfree_private.h"
+
+#if APR_HAVE_STRING_H
+#include <string.h>
+#endif
+
+/* The ring is a header followed (for an MPSC ring) by the sequence number
+ * of each slot, then by the elements, all in one block of memory without
+ * pointers so that it can be shared between processes.
+ *
+ * The positions of the producers (head) and of the consumer (tail) are
+ * free running 32-bit counters, the slot of a position being the position
+ * modulo the (power of two) number of slots, so head - tail is the number
+ * of elements in the ring. The consumer releases the slots by storing the
+ * tail after copying the elements out (with release semantics), and the
+ * producers load the tail (with acquire semantics) before overwriting them.
+ *
+ * The single producer of an SPSC ring publishes its elements by storing
+ * the head after copying them in, each side caching the last position of
+ * the other one it loaded to only load it again (and pull the cache line
+ * of the other side) when the ring looks full or empty.
+ *
+ * The producers of an MPSC ring claim their slots by a CAS on the head,
+ * and publish each element by storing the position + 1 as the sequence
+ * number of its slot, so that the consumer knows which slots of the
+ * claimed ones are filled already.
+ *
+ * The waiters yield the processor a few times first, since the other side
+ * usually makes room (or elements) quickly. Then the waiters of the
+ * not_empty or not_full condition of a blocking ring set the low bit of
+ * its epoch, try again and sleep on the epoch; the other side bumps the
+ * epoch (clearing the bit) and wakes them up when the bit is set. The
+ * waiters of a non-blocking ring poll, sleeping for a growing while.
+ */
+
+#define RING_MAGIC_SPSC 0x52535053 /* RSPS */
+#define RING_MAGIC_MPSC 0x524d5053 /* RMPS */
+
+#define RING_CAPACITY_MAX 0x40000000
+
+/* Waiting: the number of yields, then the sleeps when polling */
+#define RING_YIELDS 16
+#define RING_SLEEP_MIN 8
+#define RING_SLEEP_MAX 1024
+
+typedef struct ring_t {
+    apr_uint32_t magic;
+    apr_uint32_t flags;
+    apr_uint32_t mask;     /* # slots - 1 */
+    apr_uint32_t elt_size;
+    apr_uint32_t shared;   /* created in the caller's memory */
+    volatile apr_uint32_t closed;
+    char pad_head[APR_SLAB_CACHELINE - 6 * sizeof(apr_uint32_t)];
+    /* The producer(s) */
+    volatile apr_uint32_t head;
+    apr_uint32_t tail_cache;
+    char pad_tail[APR_SLAB_CACHELINE - 2 * sizeof(apr_uint32_t)];
+    /* The consumer */
+    volatile apr_uint32_t tail;
+    apr_uint32_t head_cache;
+    char pad_not_empty[APR_SLAB_CACHELINE - 2 * sizeof(apr_uint32_t)];
+    volatile apr_uint32_t not_empty;
+    char pad_not_full[APR_SLAB_CACHELINE - sizeof(apr_uint32_t)];
+    volatile apr_uint32_t not_full;
+    char pad_end[APR_SLAB_CACHELINE - sizeof(apr_uint32_t)];
+} ring_t;
+
+struct apr_ring_spsc_t {
+    ring_t ring;
+};
+
+struct apr_ring_mpsc_t {
+    ring_t ring;
+};
+
+typedef apr_uint32_t (*ring_try_fn)(ring_t *ring, void *elts,
+                                    apr_uint32_t n);
+
+static apr_uint32_t ring_slots(apr_uint32_t capacity)
+{
+    apr_uint32_t n = 1;
+
+    if (!capacity || capacity > RING_CAPACITY_MAX) {
+        return 0;
+    }
+    while (n < capacity) {
+        n <<= 1;
+    }
+    return n;
+}
+
+static apr_size_t ring_seqs_size(apr_uint32_t magic, apr_uint32_t slots)
+{
+    if (magic != RING_MAGIC_MPSC) {
+        return 0;
+    }
+    return APR_ALIGN(slots * sizeof(apr_uint32_t), APR_SLAB_CACHELINE);
+}
+
+static apr_size_t ring_size(apr_uint32_t magic, apr_uint32_t capacity,
+                            apr_size_t elt_size)
+{
+    apr_uint32_t slots = ring_slots(capacity);
+
+    if (!slots || !elt_size || elt_size > APR_UINT32_MAX
+        || elt_size > (APR_SIZE_MAX - 2 * sizeof(ring_t)) / slots) {
+        return 0;
+    }
+    return sizeof(ring_t) + ring_seqs_size(magic, slots)
+           + (apr_size_t)slots * elt_size;
+}
+
+static APR_INLINE volatile apr_uint32_t *ring_seqs(ring_t *ring)
+{
+    return (volatile apr_uint32_t *)(ring + 1);
+}
+
+static APR_INLINE char *ring_elts(ring_t *ring)
+{
+    return (char *)(ring + 1) + ring_seqs_size(ring->magic, ring->mask + 1);
+}
+
+static apr_status_t ring_init(ring_t **pring, apr_uint32_t magic,
+                              void *mem, apr_size_t size,
+                              apr_uint32_t capacity, apr_size_t elt_size,
+                              apr_uint32_t flags, int shared)
+{
+    apr_size_t needed = ring_size(magic, capacity, elt_size);
+    ring_t *ring = mem;
+
+    if (!needed || size < needed) {
+        return APR_EINVAL;
+    }
+
+    memset(ring, 0, sizeof(*ring) + ring_seqs_size(magic,
+                                                   ring_slots(capacity)));
+    ring->flags = flags;
+    ring->mask = ring_slots(capacity) - 1;
+    ring->elt_size = (apr_uint32_t)elt_size;
+    ring->shared = shared;
+    /* Last, for attach */
+    apr__store_release32(&ring->magic, magic);
+
+    *pring = ring;
+    return APR_SUCCESS;
+}
+
+static apr_status_t ring_create(ring_t **ring, apr_uint32_t magic,
+                                apr_uint32_t capacity, apr_size_t elt_size,
+                                apr_uint32_t flags, apr_pool_t *pool)
+{
+    apr_size_t size = ring_size(magic, capacity, elt_size);
+    void *mem;
+
+    if (!size) {
+        return APR_EINVAL;
+    }
+    mem = apr_palloc(pool, size + APR_SLAB_CACHELINE - 1);
+    mem = (void *)APR_ALIGN((apr_uintptr_t)mem, APR_SLAB_CACHELINE);
+    return ring_init(ring, magic, mem, size, capacity, elt_size, flags, 0);
+}
+
+static apr_status_t ring_attach(ring_t **ring, apr_uint32_t magic,
+                                void *mem)
+{
+    if (apr__load_acquire32(&((ring_t *)mem)->magic) != magic) {
+        return APR_EINVAL;
+    }
+    *ring = mem;
+    return APR_SUCCESS;
+}
+
+/* Copy n elements in (out of) the slots from the one of pos */
+static void ring_copy_in(ring_t *ring, apr_uint32_t pos, const char *elts,
+                         apr_uint32_t n)
+{
+    apr_size_t size = ring->elt_size;
+    apr_uint32_t slot = pos & ring->mask, first = ring->mask + 1 - slot;
+
+    if (first > n) {
+        first = n;
+    }
+    memcpy(ring_elts(ring) + slot * size, elts, first * size);
+    if (first < n) {
+        memcpy(ring_elts(ring), elts + first * size, (n - first) * size);
+    }
+}
+
+static void ring_copy_out(ring_t *ring, apr_uint32_t pos, char *elts,
+                          apr_uint32_t n)
+{
+    apr_size_t size = ring->elt_size;
+    apr_uint32_t slot = pos & ring->mask, first = ring->mask + 1 - slot;
+
+    if (first > n) {
+        first = n;
+    }
+    memcpy(elts, ring_elts(ring) + slot * size, first * size);
+    if (first < n) {
+        memcpy(elts + first * size, ring_elts(ring), (n - first) * size);
+    }
+}
+
+static apr_uint32_t spsc_tryenqueue(ring_t *ring, void *elts,
+                                    apr_uint32_t n)
+{
+    apr_uint32_t head = ring->head, room;
+
+    room = ring->mask + 1 - (head - ring->tail_cache);
+    if (room < n) {
+        ring->tail_cache = apr__load_acquire32(&ring->tail);
+        room = ring->mask + 1 - (head - ring->tail_cache);
+        if (!room) {
+            return 0;
+        }
+        n = room < n ? room : n;
+    }
+
+    ring_copy_in(ring, head, elts, n);
+    apr__store_release32(&ring->head, head + n);
+    return n;
+}
+
+static apr_uint32_t spsc_trydequeue(ring_t *ring, void *elts,
+                                    apr_uint32_t n)
+{
+    apr_uint32_t tail = ring->tail, avail;
+
+    avail = ring->head_cache - tail;
+    if (avail < n) {
+        ring->head_cache = apr__load_acquire32(&ring->head);
+        avail = ring->head_cache - tail;
+        if (!avail) {
+            return 0;
+        }
+        n = avail < n ? avail : n;
+    }
+
+    ring_copy_out(ring, tail, elts, n);
+    apr__store_release32(&ring->tail, tail + n);
+    return n;
+}
+
+static apr_uint32_t mpsc_tryenqueue(ring_t *ring, void *elts,
+                                    apr_uint32_t n)
+{
+    volatile apr_uint32_t *seqs = ring_seqs(ring);
+    apr_uint32_t head = ring->head, room, cur, k, i;
+
+    for (;;) {
+        room = ring->mask + 1 - (head - apr__load_acquire32(&ring->tail));
+        if (room > ring->mask + 1) {
+            /* The head moved on since we loaded it */
+            head = ring->head;
+            continue;
+        }
+        if (!room) {
+            return 0;
+        }
+        k = room < n ? room : n;
+        cur = apr_atomic_cas32(&ring->head, head + k, head);
+        if (cur == head) {
+            break;
+        }
+        head = cur;
+    }
+
+    ring_copy_in(ring, head, elts, k);
+    for (i = 0; i < k; i++) {
+        apr__store_release32(&seqs[(head + i) & ring->mask], head + i + 1);
+    }
+    return k;
+}
+
+static apr_uint32_t mpsc_trydequeue(ring_t *ring, void *elts,
+                                    apr_uint32_t n)
+{
+    volatile apr_uint32_t *seqs = ring_seqs(ring);
+    apr_uint32_t tail = ring->tail, k;
+
+    for (k = 0; k < n; k++) {
+        if (apr__load_acquire32(&seqs[(tail + k) & ring->mask])
+                != tail + k + 1) {
+            break;
+        }
+    }
+    if (!k) {
+        return 0;
+    }
+
+    ring_copy_out(ring, tail, elts, k);
+    apr__store_release32(&ring->tail, tail + k);
+    return k;
+}
+
+#if APR_HAS_FUTEX
+
+/* Announce a waiter of a condition, returns the epoch to sleep on */
+static apr_uint32_t ring_sleeping(volatile apr_uint32_t *epoch)
+{
+    apr_uint32_t val = *epoch, cur;
+
+    while (!(val & 1)) {
+        cur = apr_atomic_cas32(epoch, val | 1, val);
+        if (cur == val) {
+            break;
+        }
+        val = cur;
+    }
+    return val | 1;
+}
+
+#endif /* APR_HAS_FUTEX */
+
+/* Wake up the waiters of a condition if any (or anyway if forced) */
+static void ring_wake(ring_t *ring, volatile apr_uint32_t *epoch, int force)
+{
+#if APR_HAS_FUTEX
+    apr_uint32_t val, cur;
+
+    apr__memory_barrier();
+    val = *epoch;
+    if (force) {
+        while ((cur = apr_atomic_cas32(epoch, (val | 1) + 1, val)) != val) {
+            val = cur;
+        }
+    }
+    else if (!(val & 1) || apr_atomic_cas32(epoch, val + 1, val) != val) {
+        /* No waiter, or woken up by someone else already */
+        return;
+    }
+    apr__futex_wake(epoch, APR_INT32_MAX, ring->shared);
+#endif
+}
+
+static apr_status_t ring_transfer(ring_t *ring, ring_try_fn try_fn,
+                                  int enqueue, void *elts, apr_uint32_t n,
+                                  apr_uint32_t *count,
+                                  apr_interval_time_t timeout)
+{
+    volatile apr_uint32_t *epoch = enqueue ? &ring->not_full
+                                           : &ring->not_empty;
+    apr_interval_time_t wait = timeout, delay = RING_SLEEP_MIN;
+    apr_time_t deadline = 0;
+    apr_uint32_t k;
+    int yields = 0;
+
+    *count = 0;
+    if (!n) {
+        return APR_EINVAL;
+    }
+    if (timeout > 0) {
+        deadline = apr_time_now() + timeout;
+    }
+
+    for (;;) {
+        if (enqueue && ring->closed) {
+            return APR_EOF;
+        }
+        k = try_fn(ring, elts, n);
+        if (k) {
+            break;
+        }
+        if (!enqueue && ring->closed) {
+            /* The elements enqueued before the close are still due */
+            k = try_fn(ring, elts, n);
+            if (k) {
+                break;
+            }
+            return APR_EOF;
+        }
+        if (!timeout) {
+            return APR_EAGAIN;
+        }
+        if (timeout > 0) {
+            wait = deadline - apr_time_now();
+            if (wait <= 0) {
+                return APR_TIMEUP;
+            }
+        }
+
+        /* The other side is likely to be done soon */
+        if (yields < RING_YIELDS) {
+            yields++;
+#if APR_HAS_THREADS
+            apr_thread_yield();
+#else
+            apr_sleep(0);
+#endif
+            continue;
+        }
+
+#if APR_HAS_FUTEX
+        if (ring->flags & APR_RING_BLOCKING) {
+            apr_uint32_t val = ring_sleeping(epoch);
+
+            k = try_fn(ring, elts, n);
+            if (k) {
+                break;
+            }
+            if (!ring->closed) {
+                apr__futex_wait(epoch, val, wait, ring->shared);
+            }
+            continue;
+        }
+#endif
+
+        apr_sleep(timeout > 0 && wait < delay ? wait : delay);
+        if (delay < RING_SLEEP_MAX) {
+            delay <<= 1;
+        }
+    }
+
+    *count = k;
+    if (ring->flags & APR_RING_BLOCKING) {
+        ring_wake(ring, enqueue ? &ring->not_empty : &ring->not_full, 0);
+    }
+    return APR_SUCCESS;
+}
+
+static apr_uint32_t ring_count(ring_t *ring)
+{
+    apr_uint32_t tail = ring->tail, n = ring->head - tail;
+
+    if (n > ring->mask + 1) {
+        /* The tail moved on since we loaded it */
+        return 0;
+    }
+    return n;
+}
+
+static void ring_close(ring_t *ring)
+{
+    ring->closed = 1;
+    if (ring->flags & APR_RING_BLOCKING) {
+        ring_wake(ring, &ring->not_empty, 1);
+        ring_wake(ring, &ring->not_full, 1);
+    }
+}
+
+APR_DECLARE(apr_size_t) apr_ring_spsc_size(apr_uint32_t capacity,
+                                           apr_size_t elt_size)
+{
+    return ring_size(RING_MAGIC_SPSC, capacity, elt_size);
+}
+
+APR_DECLARE(apr_status_t) apr_ring_spsc_create(apr_ring_spsc_t **ring,
+                                               apr_uint32_t capacity,
+                                               apr_size_t elt_size,
+                                               apr_uint32_t flags,
+                                               apr_pool_t *pool)
+{
+    return ring_create((ring_t **)ring, RING_MAGIC_SPSC, capacity,
+                       elt_size, flags, pool);
+}
+
+APR_DECLARE(apr_status_t) apr_ring_spsc_init(apr_ring_spsc_t **ring,
+                                             void *mem, apr_size_t size,
+                                             apr_uint32_t capacity,
+                                             apr_size_t elt_size,
+                                             apr_uint32_t flags)
+{
+    return ring_init((ring_t **)ring, RING_MAGIC_SPSC, mem, size, capacity,
+                     elt_size, flags, 1);
+}
+
+APR_DECLARE(apr_status_t) apr_ring_spsc_attach(apr_ring_spsc_t **ring,
+                                               void *mem)
+{
+    return ring_attach((ring_t **)ring, RING_MAGIC_SPSC, mem);
+}
+
+APR_DECLARE(apr_status_t) apr_ring_spsc_enqueue(apr_ring_spsc_t *ring,
+                                                const void *elts,
+                                                apr_uint32_t n,
+                                                apr_uint32_t *count,
+                                                apr_interval_time_t timeout)
+{
+    return ring_transfer(&ring->ring, spsc_tryenqueue, 1, (void *)elts, n,
+                         count, timeout);
+}
+
+APR_DECLARE(apr_status_t) apr_ring_spsc_dequeue(apr_ring_spsc_t *ring,
+                                                void *elts,
+                                                apr_uint32_t n,
+                                                apr_uint32_t *count,
+                                                apr_interval_time_t timeout)
+{
+    return ring_transfer(&ring->ring, spsc_trydequeue, 0, elts, n,
+                         count, timeout);
+}
+
+APR_DECLARE(apr_uint32_t) apr_ring_spsc_count(apr_ring_spsc_t *ring)
+{
+    return ring_count(&ring->ring);
+}
+
+APR_DECLARE(void) apr_ring_spsc_close(apr_ring_spsc_t *ring)
+{
+    ring_close(&ring->ring);
+}
+
+APR_DECLARE(apr_size_t) apr_ring_mpsc_size(apr_uint32_t capacity,
+                                           apr_size_t elt_size)
+{
+    return ring_size(RING_MAGIC_MPSC, capacity, elt_size);
+}
+
+APR_DECLARE(apr_status_t) apr_ring_mpsc_create(apr_ring_mpsc_t **ring,
+                                               apr_uint32_t capacity,
+                                               apr_size_t elt_size,
+                                               apr_uint32_t flags,
+                                               apr_pool_t *pool)
+{
+    return ring_create((ring_t **)ring, RING_MAGIC_MPSC, capacity,
+                       elt_size, flags, pool);
+}
+
+APR_DECLARE(apr_status_t) apr_ring_mpsc_init(apr_ring_mpsc_t **ring,
+                                             void *mem, apr_size_t size,
+                                             apr_uint32_t capacity,
+                                             apr_size_t elt_size,
+                                             apr_uint32_t flags)
+{
+    return ring_init((ring_t **)ring, RING_MAGIC_MPSC, mem, size, capacity,
+                     elt_size, flags, 1);
+}
+
+APR_DECLARE(apr_status_t) apr_ring_mpsc_attach(apr_ring_mpsc_t **ring,
+                                               void *mem)
+{
+    return ring_attach((ring_t **)ring, RING_MAGIC_MPSC, mem);
+}
+
+APR_DECLARE(apr_status_t) apr_ring_mpsc_enqueue(apr_ring_mpsc_t *ring,
+                                                const void *elts,
+                                                apr_uint32_t n,
+                                                apr_uint32_t *count,
+                                                apr_interval_time_t timeout)
+{
+    return ring_transfer(&ring->ring, mpsc_tryenqueue, 1, (void *)elts, n,
+                         count, timeout);
+}
+
+APR_DECLARE(apr_status_t) apr_ring_mpsc_dequeue(apr_ring_mpsc_t *ring,
+                                                void *elts,
+                                                apr_uint32_t n,
+                                                apr_uint32_t *count,
+                                                apr_interval_time_t timeout)
+{
+    return ring_transfer(&ring->ring, mpsc_trydequeue, 0, elts, n,
+                         count, timeout);
+}
+
+APR_DECLARE(apr_uint32_t) apr_ring_mpsc_count(apr_ring_mpsc_t *ring)
+{
+    return ring_count(&ring->ring);
+}
+
+APR_DECLARE(void) apr_ring_mpsc_close(apr_ring_mpsc_t *ring)
+{
+    ring_close(&ring->ring);
+}
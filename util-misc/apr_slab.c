@@ -0,0 +1,184 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "apr_general.h"
+#include "apr_slab.h"
+
+#define APR_WANT_MEMFUNC
+#include "apr_want.h"
+
+/* The objects are carved out of chunks allocated from the pool.  The
+ * first chunk holds SLAB_MIN_OBJECTS objects, and each new chunk twice
+ * as many as the previous one until it reaches SLAB_MAX_CHUNK bytes, so
+ * that small structures don't take more than a few objects from their
+ * pool while big ones do not call apr_palloc() for every other object.
+ *
+ * The freed objects are chained through their first bytes in a LIFO
+ * list, the last freed object (the most likely to be in the cache) is
+ * the first reused.
+ */
+#define SLAB_MIN_OBJECTS 4
+#define SLAB_MAX_CHUNK   (16 * 1024)
+
+typedef struct slab_object_t slab_object_t;
+struct slab_object_t {
+    slab_object_t *next;
+};
+
+struct apr_slab_t {
+    apr_pool_t     *pool;
+    slab_object_t  *free;           /* freed objects, ready for reuse */
+    char           *first_avail;    /* next object of the current chunk */
+    char           *endp;           /* end of the current chunk */
+    apr_size_t      size;           /* aligned object size */
+    apr_size_t      align;
+    apr_size_t      chunk_objects;  /* number of objects in next chunk */
+    apr_size_t      objects;
+    apr_size_t      free_objects;
+    apr_size_t      chunks;
+    apr_size_t      bytes;
+    apr_uint64_t    allocs;
+    apr_uint64_t    frees;
+};
+
+APR_DECLARE(apr_status_t) apr_slab_create(apr_slab_t **slab, apr_size_t size,
+                                          apr_size_t align, apr_pool_t *pool)
+{
+    apr_slab_t *s;
+
+    if (align < APR_ALIGN_DEFAULT(1)) {
+        align = APR_ALIGN_DEFAULT(1);
+    }
+    else if (align & (align - 1)) {
+        return APR_EINVAL;
+    }
+    if (size < sizeof(slab_object_t)) {
+        size = sizeof(slab_object_t);
+    }
+    if (APR_ALIGN(size, align) < size) {
+        return APR_EINVAL;
+    }
+
+    s = apr_pcalloc(pool, sizeof(apr_slab_t));
+    if (!s) {
+        return APR_ENOMEM;
+    }
+    s->pool = pool;
+    s->size = APR_ALIGN(size, align);
+    s->align = align;
+    s->chunk_objects = SLAB_MIN_OBJECTS;
+
+    *slab = s;
+    return APR_SUCCESS;
+}
+
+static apr_status_t slab_grow(apr_slab_t *slab)
+{
+    apr_size_t n = slab->chunk_objects, len;
+    char *chunk;
+
+    if (slab->size > SLAB_MAX_CHUNK / n) {
+        n = SLAB_MAX_CHUNK / slab->size;
+        if (n == 0) {
+            n = 1;
+        }
+    }
+    else if (n * 2 <= SLAB_MAX_CHUNK / slab->size) {
+        slab->chunk_objects = n * 2;
+    }
+
+    /* The pool only guarantees the default alignment */
+    len = n * slab->size + slab->align - APR_ALIGN_DEFAULT(1);
+    chunk = apr_palloc(slab->pool, len);
+    if (!chunk) {
+        return APR_ENOMEM;
+    }
+    slab->chunks++;
+    slab->bytes += len;
+
+    slab->first_avail = (char *)APR_ALIGN((apr_uintptr_t)chunk, slab->align);
+    slab->endp = slab->first_avail + n * slab->size;
+
+    return APR_SUCCESS;
+}
+
+APR_DECLARE(void *) apr_slab_alloc(apr_slab_t *slab)
+{
+    void *mem;
+
+    if (slab->free) {
+        mem = slab->free;
+        slab->free = slab->free->next;
+        slab->free_objects--;
+    }
+    else {
+        if (slab->first_avail == slab->endp
+                && slab_grow(slab) != APR_SUCCESS) {
+            return NULL;
+        }
+        mem = slab->first_avail;
+        slab->first_avail += slab->size;
+    }
+
+    slab->objects++;
+    slab->allocs++;
+
+    return mem;
+}
+
+APR_DECLARE(void *) apr_slab_calloc(apr_slab_t *slab)
+{
+    void *mem;
+
+    if ((mem = apr_slab_alloc(slab)) != NULL) {
+        memset(mem, 0, slab->size);
+    }
+
+    return mem;
+}
+
+APR_DECLARE(void) apr_slab_free(apr_slab_t *slab, void *mem)
+{
+    slab_object_t *obj = mem;
+
+    if (!obj) {
+        return;
+    }
+
+    obj->next = slab->free;
+    slab->free = obj;
+    slab->free_objects++;
+
+    slab->objects--;
+    slab->frees++;
+}
+
+APR_DECLARE(apr_size_t) apr_slab_object_size(const apr_slab_t *slab)
+{
+    return slab->size;
+}
+
+APR_DECLARE(void) apr_slab_stats_get(const apr_slab_t *slab,
+                                     apr_slab_stats_t *stats)
+{
+    stats->object_size = slab->size;
+    stats->objects = slab->objects;
+    stats->free_objects = slab->free_objects;
+    stats->chunks = slab->chunks;
+    stats->bytes = slab->bytes;
+    stats->allocs = slab->allocs;
+    stats->frees = slab->frees;
+}
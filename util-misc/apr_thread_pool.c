@@ -17,16 +17,43 @@
  */
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "apr_private.h"
 #include "apr_thread_pool.h"
 #include "apr_ring.h"
+#include "apr_atomic.h"
+#include "apr_slab.h"
 #include "apr_thread_cond.h"
 #include "apr_portable.h"
+#include "apr_strings.h"
+#include "apr_timer_wheel.h"
+#include "apr_allocator.h"
+#include "apr_lockfree_private.h"
 
 #if APR_HAS_THREADS
 
 #define TASK_PRIORITY_SEGS 4
 #define TASK_PRIORITY_SEG(x) (((x)->dispatch.priority & 0xFF) / 64)
 
+/* Work stealing: the size of the deques of the threads (per priority
+ * segment), the number of recycled tasks a thread keeps for itself, and
+ * the states of a task (its low bits, the others count its reuses so that
+ * a stale pointer to a reused task can't be cancelled).
+ */
+#define WS_DEQUE_SIZE 256
+#define WS_DEQUE_MASK (WS_DEQUE_SIZE - 1)
+#define WS_FREE_MAX 64
+#define TASK_QUEUED 0
+#define TASK_RUNNING 1
+#define TASK_CANCELLED 2
+#define TASK_STATE_MASK 3
+#define TASK_STATE(x) ((x) & TASK_STATE_MASK)
+#define TASK_REUSE 4
+
+/* The index of a thread which has none (yet) */
+#define NO_INDEX ((apr_size_t)-1)
+
 typedef struct apr_thread_pool_task
 {
     APR_RING_ENTRY(apr_thread_pool_task) link;
@@ -38,16 +65,69 @@ typedef struct apr_thread_pool_task
         apr_byte_t priority;
         apr_time_t time;
     } dispatch;
+    apr_timer_t *timer;
+    volatile apr_uint32_t state;
+    apr_time_t queued;          /* stats: when it was pushed (or due) */
+    int seg;                    /* stats: its priority segment */
 } apr_thread_pool_task_t;
 
 APR_RING_HEAD(apr_thread_pool_tasks, apr_thread_pool_task);
 
+/*
+ * Work stealing deque (Chase-Lev), pushed and taken at the bottom by its
+ * thread only, stolen at the top by the others.
+ */
+typedef struct ws_deque
+{
+    volatile apr_uint32_t top;
+    char pad_top[APR_SLAB_CACHELINE - sizeof(apr_uint32_t)];
+    volatile apr_uint32_t bottom;
+    char pad_bottom[APR_SLAB_CACHELINE - sizeof(apr_uint32_t)];
+    apr_thread_pool_task_t *volatile tasks[WS_DEQUE_SIZE];
+} ws_deque_t;
+
+typedef struct ws_worker
+{
+    ws_deque_t deques[TASK_PRIORITY_SEGS];
+    volatile apr_uint32_t claiming;     /* odd while taking a task */
+    struct apr_thread_list_elt *elt;    /* NULL if no thread uses it */
+    struct apr_thread_pool_tasks free;  /* recycled tasks */
+    apr_size_t free_cnt;
+    apr_size_t tasks_run;
+    /* The tasks in the deques are those pushed by the threads, less those
+     * they claimed and the cancelled ones, without a shared counter.
+     */
+    volatile apr_size_t pushed;
+    volatile apr_size_t claimed;
+    apr_uint32_t seed;
+} ws_worker_t;
+
+/*
+ * The statistics of a thread, updated by the thread only and merged on
+ * read. The owners have a few slots (hashed), the others share one.
+ */
+#define STATS_OWNERS 16
+
+typedef struct thread_stats
+{
+    apr_thread_pool_histogram_t wait[TASK_PRIORITY_SEGS];
+    apr_thread_pool_histogram_t run[TASK_PRIORITY_SEGS];
+    apr_thread_pool_owner_stats_t owners[STATS_OWNERS];
+    apr_thread_pool_owner_stats_t other_owners;
+    apr_interval_time_t busy_time;
+    apr_interval_time_t idle_time;
+} thread_stats_t;
+
 struct apr_thread_list_elt
 {
     APR_RING_ENTRY(apr_thread_list_elt) link;
     apr_thread_t *thd;
     volatile void *current_owner;
     volatile enum { TH_RUN, TH_STOP, TH_PROBATION } state;
+    volatile apr_uint32_t running;      /* work stealing: running a task */
+    ws_worker_t *ws;
+    apr_size_t index;
+    thread_stats_t *stats;      /* NULL unless APR_THREAD_POOL_STATS */
 };
 
 APR_RING_HEAD(apr_thread_list, apr_thread_list_elt);
@@ -70,6 +150,7 @@ struct apr_thread_pool
     volatile apr_size_t thd_timed_out;
     struct apr_thread_pool_tasks *tasks;
     struct apr_thread_pool_tasks *scheduled_tasks;
+    apr_timer_wheel_t *timers;
     struct apr_thread_list *busy_thds;
     struct apr_thread_list *idle_thds;
     struct apr_thread_list *dead_thds;
@@ -78,16 +159,46 @@ struct apr_thread_pool
     apr_thread_cond_t *all_done;
     apr_thread_mutex_t *lock;
     volatile int terminated;
-    int waiting_work_done;
+    volatile apr_uint32_t waiting_work_done; /* number of waiters */
     struct apr_thread_pool_tasks *recycled_tasks;
     struct apr_thread_list *recycled_thds;
     apr_thread_pool_task_t *task_idx[TASK_PRIORITY_SEGS];
+    volatile int tasks_seg;     /* segment of the first task, or -1 */
+    /* Work stealing, workers is NULL otherwise */
+    ws_worker_t *volatile *workers;
+    apr_size_t workers_max;
+    apr_threadkey_t *ws_key;
+    volatile apr_size_t ws_cancelled;   /* tasks cancelled in the deques */
+    volatile apr_uint32_t ws_parked;
+    volatile apr_uint32_t ws_epoch;
+    volatile apr_time_t sched_due;
+    /* Task handles and apr_parallel_for(), see task_notify() */
+    apr_thread_mutex_t *done_lock;
+    apr_thread_cond_t *done_cond;
+    volatile apr_uint32_t done_waiters;
+    /* The options of the threads, and the bitmap of the indexes in use
+     * (the slots of the workers with work stealing)
+     */
+    apr_thread_pool_options_t opts;
+    apr_uint32_t *indexes;
+    apr_size_t indexes_words;
+    /* APR_THREAD_POOL_STATS: the stats of the dead threads, and those of
+     * the lock (updated with the lock held)
+     */
+    thread_stats_t *stats;
+    apr_uint64_t lock_acquired;
+    apr_uint64_t lock_contended;
+    apr_interval_time_t lock_wait;
 };
 
+static void task_dropped(apr_thread_start_t func, void *param);
+static apr_status_t remove_tasks(apr_thread_pool_t *me, void *owner);
+
 static apr_status_t thread_pool_construct(apr_thread_pool_t **tp,
-                                          apr_size_t init_threads,
-                                          apr_size_t max_threads,
-                                          apr_pool_t *pool)
+                                apr_size_t init_threads,
+                                apr_size_t max_threads,
+                                const apr_thread_pool_options_t *opts,
+                                apr_pool_t *pool)
 {
     apr_status_t rv;
     apr_thread_pool_t *me;
@@ -96,6 +207,7 @@ static apr_status_t thread_pool_construct(apr_thread_pool_t **tp,
     me->thd_max = max_threads;
     me->idle_max = init_threads;
     me->threshold = init_threads / 2;
+    me->tasks_seg = -1;
 
     /* This pool will be used by different threads. As we cannot ensure that
      * our caller won't use the pool without acquiring the mutex, we must
@@ -140,6 +252,58 @@ static apr_status_t thread_pool_construct(apr_thread_pool_t **tp,
         goto CATCH_ENOMEM;
     }
     APR_RING_INIT(me->scheduled_tasks, apr_thread_pool_task, link);
+    /* Scheduled tasks are timed by a wheel, scheduled_tasks only links
+     * them (unordered) for apr_thread_pool_tasks_cancel()
+     */
+    rv = apr_timer_wheel_create(&me->timers, 1, me->pool);
+    if (APR_SUCCESS != rv) {
+        goto CATCH_ENOMEM;
+    }
+    rv = apr_thread_mutex_create(&me->done_lock, APR_THREAD_MUTEX_DEFAULT,
+                                 me->pool);
+    if (APR_SUCCESS != rv) {
+        goto CATCH_ENOMEM;
+    }
+    rv = apr_thread_cond_create(&me->done_cond, me->pool);
+    if (APR_SUCCESS != rv) {
+        goto CATCH_ENOMEM;
+    }
+    me->opts = *opts;
+    if (opts->cpus && opts->ncpus) {
+        me->opts.cpus = apr_pmemdup(me->pool, opts->cpus,
+                                    opts->ncpus * sizeof(int));
+    }
+    else {
+        me->opts.cpus = NULL;
+        me->opts.ncpus = 0;
+    }
+    if (opts->name) {
+        me->opts.name = apr_pstrdup(me->pool, opts->name);
+    }
+    if (opts->flags & APR_THREAD_POOL_STATS) {
+        me->stats = apr_pcalloc(me->pool, sizeof(*me->stats));
+        if (!me->stats) {
+            goto CATCH_ENOMEM;
+        }
+    }
+    if (opts->flags & APR_THREAD_POOL_WORK_STEALING) {
+        /* The slots of the threads, allocated on their first use */
+        me->workers_max = max_threads > init_threads ? max_threads
+                                                     : init_threads;
+        if (!me->workers_max) {
+            me->workers_max = 1;
+        }
+        me->thd_max = me->workers_max;
+        me->workers = apr_pcalloc(me->pool,
+                                  me->workers_max * sizeof(*me->workers));
+        if (!me->workers) {
+            goto CATCH_ENOMEM;
+        }
+        rv = apr_threadkey_private_create(&me->ws_key, NULL, me->pool);
+        if (APR_SUCCESS != rv) {
+            goto CATCH_ENOMEM;
+        }
+    }
     me->recycled_tasks = apr_palloc(me->pool, sizeof(*me->recycled_tasks));
     if (!me->recycled_tasks) {
         goto CATCH_ENOMEM;
@@ -176,6 +340,49 @@ static apr_status_t thread_pool_construct(apr_thread_pool_t **tp,
     return rv;
 }
 
+/*
+ * Update the time when a thread should look for the next scheduled task
+ * (work stealing), and the segment of the first normal task.
+ * NOTE: These functions are not thread safe by themselves. Caller should hold
+ * the lock
+ */
+static void scheduled_tasks_changed(apr_thread_pool_t *me)
+{
+    if (me->workers) {
+        apr_time_t now = apr_time_now();
+        me->sched_due = me->scheduled_task_cnt
+            ? now + apr_timer_wheel_timeout(me->timers, now)
+            : APR_INT64_MAX;
+    }
+}
+
+static void tasks_changed(apr_thread_pool_t *me)
+{
+    me->tasks_seg = me->task_cnt ? TASK_PRIORITY_SEG(APR_RING_FIRST(me->tasks))
+                                 : -1;
+}
+
+/*
+ * NOTE: This function is not thread safe by itself. Caller should hold the lock
+ */
+static apr_thread_pool_task_t *pop_scheduled_task(apr_thread_pool_t * me)
+{
+    apr_thread_pool_task_t *task = NULL;
+    void *baton;
+
+    /* check for scheduled tasks, if it's time */
+    if (me->scheduled_task_cnt > 0
+        && apr_timer_wheel_expire(me->timers, apr_time_now(),
+                                  &baton) == APR_SUCCESS) {
+        task = baton;
+        task->timer = NULL;
+        --me->scheduled_task_cnt;
+        APR_RING_REMOVE(task, link);
+        scheduled_tasks_changed(me);
+    }
+    return task;
+}
+
 /*
  * NOTE: This function is not thread safe by itself. Caller should hold the lock
  */
@@ -184,19 +391,9 @@ static apr_thread_pool_task_t *pop_task(apr_thread_pool_t * me)
     apr_thread_pool_task_t *task = NULL;
     int seg;
 
-    /* check for scheduled tasks */
-    if (me->scheduled_task_cnt > 0) {
-        task = APR_RING_FIRST(me->scheduled_tasks);
-        assert(task != NULL);
-        assert(task !=
-               APR_RING_SENTINEL(me->scheduled_tasks, apr_thread_pool_task,
-                                 link));
-        /* if it's time */
-        if (task->dispatch.time <= apr_time_now()) {
-            --me->scheduled_task_cnt;
-            APR_RING_REMOVE(task, link);
-            return task;
-        }
+    task = pop_scheduled_task(me);
+    if (task) {
+        return task;
     }
     /* check for normal tasks if we're not returning a scheduled task */
     if (me->task_cnt == 0) {
@@ -217,19 +414,13 @@ static apr_thread_pool_task_t *pop_task(apr_thread_pool_t * me)
         }
     }
     APR_RING_REMOVE(task, link);
+    tasks_changed(me);
     return task;
 }
 
 static apr_interval_time_t waiting_time(apr_thread_pool_t * me)
 {
-    apr_thread_pool_task_t *task = NULL;
-
-    task = APR_RING_FIRST(me->scheduled_tasks);
-    assert(task != NULL);
-    assert(task !=
-           APR_RING_SENTINEL(me->scheduled_tasks, apr_thread_pool_task,
-                             link));
-    return task->dispatch.time - apr_time_now();
+    return apr_timer_wheel_timeout(me->timers, apr_time_now());
 }
 
 /*
@@ -245,6 +436,13 @@ static struct apr_thread_list_elt *elt_new(apr_thread_pool_t * me,
         if (NULL == elt) {
             return NULL;
         }
+        elt->stats = NULL;
+        if (me->stats) {
+            elt->stats = apr_pcalloc(me->pool, sizeof(*elt->stats));
+            if (NULL == elt->stats) {
+                return NULL;
+            }
+        }
     }
     else {
         elt = APR_RING_FIRST(me->recycled_thds);
@@ -255,9 +453,279 @@ static struct apr_thread_list_elt *elt_new(apr_thread_pool_t * me,
     elt->thd = t;
     elt->current_owner = NULL;
     elt->state = TH_RUN;
+    elt->running = 0;
+    elt->ws = NULL;
+    elt->index = NO_INDEX;
     return elt;
 }
 
+/*
+ * Give the lowest free index to a thread, and take it back.
+ * NOTE: These functions are not thread safe by themselves. Caller should hold
+ * the lock
+ */
+static apr_status_t index_get(apr_thread_pool_t *me, apr_size_t *index)
+{
+    apr_uint32_t *indexes;
+    apr_size_t i, n;
+    int bit;
+
+    for (i = 0; i < me->indexes_words; i++) {
+        if (me->indexes[i] != 0xFFFFFFFF) {
+            for (bit = 0; me->indexes[i] & (1u << bit); bit++)
+                ;
+            me->indexes[i] |= 1u << bit;
+            *index = i * 32 + bit;
+            return APR_SUCCESS;
+        }
+    }
+
+    n = me->indexes_words ? me->indexes_words * 2 : 1;
+    indexes = apr_pcalloc(me->pool, n * sizeof(*indexes));
+    if (!indexes) {
+        return APR_ENOMEM;
+    }
+    if (me->indexes_words) {
+        memcpy(indexes, me->indexes, me->indexes_words * sizeof(*indexes));
+    }
+    indexes[i] = 1;
+    me->indexes = indexes;
+    me->indexes_words = n;
+    *index = i * 32;
+    return APR_SUCCESS;
+}
+
+static void index_put(apr_thread_pool_t *me, apr_size_t index)
+{
+    if (index != NO_INDEX && !me->workers) {
+        me->indexes[index / 32] &= ~(1u << (index % 32));
+    }
+}
+
+/*
+ * Lock the pool, counting the contention with APR_THREAD_POOL_STATS.
+ */
+static void thread_pool_lock(apr_thread_pool_t *me)
+{
+    if (me->stats) {
+        if (apr_thread_mutex_trylock(me->lock) != APR_SUCCESS) {
+            apr_time_t start = apr_time_now();
+
+            apr_thread_mutex_lock(me->lock);
+            ++me->lock_contended;
+            me->lock_wait += apr_time_now() - start;
+        }
+        ++me->lock_acquired;
+    }
+    else {
+        apr_thread_mutex_lock(me->lock);
+    }
+}
+
+static void histogram_add(apr_thread_pool_histogram_t *h,
+                          apr_interval_time_t t)
+{
+    apr_uint64_t v = t > 0 ? (apr_uint64_t)t : 0;
+    int b;
+
+    ++h->count;
+    h->total += v;
+    if (h->max < v) {
+        h->max = v;
+    }
+    for (b = 0; v && b < APR_THREAD_POOL_STATS_BUCKETS - 1; b++) {
+        v >>= 1;
+    }
+    ++h->buckets[b];
+}
+
+static void histogram_merge(apr_thread_pool_histogram_t *h,
+                            const apr_thread_pool_histogram_t *from)
+{
+    int b;
+
+    h->count += from->count;
+    h->total += from->total;
+    if (h->max < from->max) {
+        h->max = from->max;
+    }
+    for (b = 0; b < APR_THREAD_POOL_STATS_BUCKETS; b++) {
+        h->buckets[b] += from->buckets[b];
+    }
+}
+
+static void owner_stats_merge(apr_thread_pool_owner_stats_t *o,
+                              const apr_thread_pool_owner_stats_t *from)
+{
+    histogram_merge(&o->wait, &from->wait);
+    histogram_merge(&o->run, &from->run);
+}
+
+/* Account the task run by the thread from start to end */
+static void thread_stats_task(thread_stats_t *ts,
+                              apr_thread_pool_task_t *task,
+                              apr_time_t start, apr_time_t end)
+{
+    apr_thread_pool_owner_stats_t *o = &ts->other_owners;
+    apr_size_t i, h;
+
+    histogram_add(&ts->wait[task->seg], start - task->queued);
+    histogram_add(&ts->run[task->seg], end - start);
+    ts->busy_time += end - start;
+
+    h = (apr_size_t)(((apr_uintptr_t)task->owner >> 4) % STATS_OWNERS);
+    for (i = 0; i < STATS_OWNERS; i++) {
+        apr_thread_pool_owner_stats_t *slot;
+
+        slot = &ts->owners[(h + i) % STATS_OWNERS];
+        if (!slot->run.count) {
+            slot->owner = task->owner;
+        }
+        if (slot->owner == task->owner) {
+            o = slot;
+            break;
+        }
+    }
+    histogram_add(&o->wait, start - task->queued);
+    histogram_add(&o->run, end - start);
+}
+
+static void thread_stats_merge(thread_stats_t *ts, const thread_stats_t *from)
+{
+    int i;
+
+    for (i = 0; i < TASK_PRIORITY_SEGS; i++) {
+        histogram_merge(&ts->wait[i], &from->wait[i]);
+        histogram_merge(&ts->run[i], &from->run[i]);
+    }
+    for (i = 0; i < STATS_OWNERS; i++) {
+        if (from->owners[i].run.count) {
+            apr_size_t j, h;
+
+            h = (apr_size_t)(((apr_uintptr_t)from->owners[i].owner >> 4)
+                             % STATS_OWNERS);
+            for (j = 0; j < STATS_OWNERS; j++) {
+                apr_thread_pool_owner_stats_t *slot;
+
+                slot = &ts->owners[(h + j) % STATS_OWNERS];
+                if (!slot->run.count) {
+                    slot->owner = from->owners[i].owner;
+                }
+                if (slot->owner == from->owners[i].owner) {
+                    owner_stats_merge(slot, &from->owners[i]);
+                    break;
+                }
+            }
+            if (j == STATS_OWNERS) {
+                owner_stats_merge(&ts->other_owners, &from->owners[i]);
+            }
+        }
+    }
+    owner_stats_merge(&ts->other_owners, &from->other_owners);
+    ts->busy_time += from->busy_time;
+    ts->idle_time += from->idle_time;
+}
+
+/*
+ * Keep the stats of a dying thread in the pool's.
+ * NOTE: This function is not thread safe by itself. Caller should hold the lock
+ */
+static void thread_stats_release(apr_thread_pool_t *me,
+                                 struct apr_thread_list_elt *elt)
+{
+    if (elt->stats) {
+        thread_stats_merge(me->stats, elt->stats);
+        memset(elt->stats, 0, sizeof(*elt->stats));
+    }
+}
+
+/*
+ * Run the task (or drop it if terminated already), once dequeued so that
+ * neither the lock nor the search for it account as its wait or run time.
+ */
+static void task_run(apr_thread_pool_t *me, struct apr_thread_list_elt *elt,
+                     apr_thread_t *t, apr_thread_pool_task_t *task)
+{
+    apr_time_t start;
+
+    if (me->terminated) {
+        task_dropped(task->func, task->param);
+        return;
+    }
+    apr_thread_data_set(task, "apr_thread_pool_task", NULL, t);
+    if (!elt->stats) {
+        task->func(t, task->param);
+        return;
+    }
+    start = apr_time_now();
+    task->func(t, task->param);
+    thread_stats_task(elt->stats, task, start, apr_time_now());
+}
+
+static APR_INLINE int thread_has_setup(apr_thread_pool_t *me)
+{
+    return me->opts.name || me->opts.ncpus || me->opts.thread_init
+           || (me->opts.flags & APR_THREAD_POOL_NUMA);
+}
+
+/*
+ * Create the pool of the thread on the NUMA node it runs on (once pinned),
+ * a subpool of the thread's with an allocator of its own.
+ */
+static void thread_node_pool_create(apr_thread_t *t)
+{
+    apr_allocator_t *allocator;
+    apr_pool_t *pool;
+    unsigned int node = apr_allocator_numa_node_current();
+
+    if (apr_allocator_create_ex(&allocator, APR_ALLOCATOR_NUMA_NODE(node))
+            != APR_SUCCESS
+        && apr_allocator_create(&allocator) != APR_SUCCESS) {
+        return;
+    }
+    if (apr_pool_create_ex(&pool, apr_thread_pool_get(t), NULL, allocator)
+            != APR_SUCCESS) {
+        apr_allocator_destroy(allocator);
+        return;
+    }
+    apr_allocator_owner_set(allocator, pool);
+    apr_pool_tag(pool, "apr_thread_pool_node");
+    apr_thread_data_set(pool, "apr_thread_pool_node_pool", NULL, t);
+}
+
+/*
+ * Name and pin the calling thread, create its NUMA node's pool, and call
+ * the thread_init function.
+ */
+static void thread_setup(apr_thread_pool_t *me, apr_thread_t *t,
+                         apr_size_t index)
+{
+    apr_size_t per = me->opts.cpus_per_thread;
+
+    if (me->opts.name) {
+        char name[16];
+        apr_snprintf(name, sizeof(name), "%s-%" APR_SIZE_T_FMT,
+                     me->opts.name, index);
+        apr_thread_name_set(NULL, name);
+    }
+    if (me->opts.ncpus) {
+        if (per && per < me->opts.ncpus) {
+            apr_thread_affinity_set(NULL, me->opts.cpus
+                                          + index % (me->opts.ncpus / per)
+                                            * per, per);
+        }
+        else {
+            apr_thread_affinity_set(NULL, me->opts.cpus, me->opts.ncpus);
+        }
+    }
+    if (me->opts.flags & APR_THREAD_POOL_NUMA) {
+        thread_node_pool_create(t);
+    }
+    if (me->opts.thread_init) {
+        me->opts.thread_init(t, index, me->opts.thread_init_data);
+    }
+}
+
 /*
  * The worker thread function. Take a task from the queue and perform it if
  * there is any. Otherwise, put itself into the idle thread list and waiting
@@ -271,16 +739,23 @@ static void *APR_THREAD_FUNC thread_pool_func(apr_thread_t * t, void *param)
     apr_thread_pool_t *me = param;
     apr_thread_pool_task_t *task = NULL;
     apr_interval_time_t wait;
+    apr_time_t idle;
     struct apr_thread_list_elt *elt;
 
-    apr_thread_mutex_lock(me->lock);
+    thread_pool_lock(me);
     apr_pool_owner_set(me->pool, 0);
 
     elt = elt_new(me, t);
-    if (!elt) {
+    if (!elt || index_get(me, &elt->index) != APR_SUCCESS) {
         apr_thread_mutex_unlock(me->lock);
         apr_thread_exit(t, APR_ENOMEM);
     }
+    if (thread_has_setup(me)) {
+        apr_thread_mutex_unlock(me->lock);
+        thread_setup(me, t, elt->index);
+        thread_pool_lock(me);
+        apr_pool_owner_set(me->pool, 0);
+    }
 
     for (;;) {
         /* Test if not new element, it is awakened from idle */
@@ -302,26 +777,28 @@ static void *APR_THREAD_FUNC thread_pool_func(apr_thread_t * t, void *param)
                 elt->current_owner = task->owner;
                 apr_thread_mutex_unlock(me->lock);
 
-                /* Run the task (or drop it if terminated already) */
-                if (!me->terminated) {
-                    apr_thread_data_set(task, "apr_thread_pool_task", NULL, t);
-                    task->func(t, task->param);
-                }
+                task_run(me, elt, t, task);
 
-                apr_thread_mutex_lock(me->lock);
+                thread_pool_lock(me);
                 apr_pool_owner_set(me->pool, 0);
                 APR_RING_INSERT_TAIL(me->recycled_tasks, task,
                                      apr_thread_pool_task, link);
                 elt->current_owner = NULL;
                 if (me->waiting_work_done) {
-                    apr_thread_cond_signal(me->work_done);
+                    apr_thread_cond_broadcast(me->work_done);
                     apr_thread_mutex_unlock(me->lock);
-                    apr_thread_mutex_lock(me->lock);
+                    thread_pool_lock(me);
                     apr_pool_owner_set(me->pool, 0);
                 }
             } while (elt->state != TH_STOP);
             APR_RING_REMOVE(elt, link);
             --me->busy_cnt;
+            /* The waiter may have checked the busy threads after the
+             * signal above, while we were still one of them.
+             */
+            if (me->waiting_work_done) {
+                apr_thread_cond_broadcast(me->work_done);
+            }
         }
         assert(NULL == elt->current_owner);
 
@@ -354,6 +831,7 @@ static void *APR_THREAD_FUNC thread_pool_func(apr_thread_t * t, void *param)
         else
             wait = -1;
 
+        idle = elt->stats ? apr_time_now() : 0;
         if (wait >= 0) {
             apr_thread_cond_timedwait(me->more_work, me->lock, wait);
         }
@@ -361,9 +839,14 @@ static void *APR_THREAD_FUNC thread_pool_func(apr_thread_t * t, void *param)
             apr_thread_cond_wait(me->more_work, me->lock);
         }
         apr_pool_owner_set(me->pool, 0);
+        if (elt->stats) {
+            elt->stats->idle_time += apr_time_now() - idle;
+        }
     }
 
     /* Dead thread, to be joined */
+    index_put(me, elt->index);
+    thread_stats_release(me, elt);
     APR_RING_INSERT_TAIL(me->dead_thds, elt, apr_thread_list_elt, link);
     if (--me->thd_cnt == 0 && me->terminated) {
         apr_thread_cond_signal(me->all_done);
@@ -374,6 +857,579 @@ static void *APR_THREAD_FUNC thread_pool_func(apr_thread_t * t, void *param)
     return NULL;                /* should not be here, safe net */
 }
 
+/*
+ * Work stealing.
+ *
+ * The tasks pushed by a task go to the deque of its thread for their priority
+ * segment, without the lock. The tasks pushed from outside go to the tasks of
+ * the pool under the lock, as without work stealing. A thread looks for a
+ * task in its own deques, then in the tasks of the pool, then in the deques of
+ * the others (starting from a random one), from the highest priority segment
+ * to the lowest, and parks when there is none: the pushers bump ws_epoch and
+ * wake up a parked thread if any, which waits on ws_epoch (with a futex, or
+ * the more_work condition otherwise).
+ *
+ * The thread which takes a task out of a deque claims it by changing its
+ * state from QUEUED to RUNNING, apr_thread_pool_tasks_cancel() by changing it
+ * to CANCELLED, and a cancelled task is recycled by whoever takes it out. The
+ * canceller then waits for the threads taking a task (claiming is odd) to
+ * have claimed it, so that it sees all the tasks of the owner still running.
+ */
+
+static void tasks_insert(apr_thread_pool_t *me, apr_thread_pool_task_t *t,
+                         int push);
+
+static APR_INLINE int ws_deque_empty(const ws_deque_t *d)
+{
+    return (apr_int32_t)(d->bottom - d->top) <= 0;
+}
+
+/* Push a task at the bottom, by the thread of the deque only */
+static int ws_deque_push(ws_deque_t *d, apr_thread_pool_task_t *task)
+{
+    apr_uint32_t b = d->bottom;
+
+    if (b - d->top >= WS_DEQUE_SIZE) {
+        return 0;
+    }
+    d->tasks[b & WS_DEQUE_MASK] = task;
+    apr__memory_barrier();
+    d->bottom = b + 1;
+    return 1;
+}
+
+/* Take the task at the bottom, by the thread of the deque only */
+static apr_thread_pool_task_t *ws_deque_take(ws_deque_t *d)
+{
+    apr_uint32_t b = d->bottom - 1, t;
+    apr_thread_pool_task_t *task;
+
+    d->bottom = b;
+    apr__memory_barrier();
+    t = d->top;
+    if ((apr_int32_t)(b - t) < 0) {
+        d->bottom = b + 1;
+        return NULL;
+    }
+    task = d->tasks[b & WS_DEQUE_MASK];
+    if (b == t) {
+        /* The last one, race with the thieves */
+        if (apr_atomic_cas32(&d->top, t + 1, t) != t) {
+            task = NULL;
+        }
+        d->bottom = b + 1;
+    }
+    return task;
+}
+
+/* Steal the task at the top, NULL if none or lost to another thread */
+static apr_thread_pool_task_t *ws_deque_steal(ws_deque_t *d)
+{
+    apr_uint32_t t, b;
+    apr_thread_pool_task_t *task;
+
+    t = d->top;
+    apr__memory_barrier();
+    b = d->bottom;
+    if ((apr_int32_t)(b - t) <= 0) {
+        return NULL;
+    }
+    apr__memory_barrier();
+    task = d->tasks[t & WS_DEQUE_MASK];
+    if (apr_atomic_cas32(&d->top, t + 1, t) != t) {
+        return NULL;
+    }
+    return task;
+}
+
+/*
+ * Give a free slot to the thread.
+ * NOTE: This function is not thread safe by itself. Caller should hold the lock
+ */
+static ws_worker_t *ws_worker_get(apr_thread_pool_t *me,
+                                  struct apr_thread_list_elt *elt)
+{
+    ws_worker_t *w = NULL;
+    apr_size_t i;
+
+    for (i = 0; i < me->workers_max; i++) {
+        w = me->workers[i];
+        if (!w) {
+            w = apr_pcalloc(me->pool, sizeof(*w));
+            if (!w) {
+                return NULL;
+            }
+            APR_RING_INIT(&w->free, apr_thread_pool_task, link);
+            w->seed = (apr_uint32_t)i + 1;
+            apr_atomic_casptr((void *volatile *)&me->workers[i], w, NULL);
+            break;
+        }
+        if (!w->elt) {
+            break;
+        }
+        w = NULL;
+    }
+    if (w) {
+        w->elt = elt;
+        elt->ws = w;
+        elt->index = i;
+    }
+    return w;
+}
+
+static void ws_wake(apr_thread_pool_t *me, int all)
+{
+    apr__memory_barrier();
+    if (me->ws_parked) {
+        apr_atomic_inc32(&me->ws_epoch);
+#if APR_HAS_FUTEX
+        apr__futex_wake(&me->ws_epoch, all ? APR_INT32_MAX : 1, 0);
+#else
+        thread_pool_lock(me);
+        if (all) {
+            apr_thread_cond_broadcast(me->more_work);
+        }
+        else {
+            apr_thread_cond_signal(me->more_work);
+        }
+        apr_thread_mutex_unlock(me->lock);
+#endif
+    }
+}
+
+/* Whether there may be a task to take, without the lock */
+static int ws_has_task(apr_thread_pool_t *me)
+{
+    apr_size_t i;
+    int seg;
+
+    if (me->tasks_seg >= 0) {
+        return 1;
+    }
+    for (i = 0; i < me->workers_max; i++) {
+        ws_worker_t *w = me->workers[i];
+        if (!w) {
+            continue;
+        }
+        for (seg = 0; seg < TASK_PRIORITY_SEGS; seg++) {
+            if (!ws_deque_empty(&w->deques[seg])) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void ws_recycle(apr_thread_pool_t *me, ws_worker_t *w,
+                       apr_thread_pool_task_t *task)
+{
+    APR_RING_INSERT_HEAD(&w->free, task, apr_thread_pool_task, link);
+    if (++w->free_cnt > WS_FREE_MAX) {
+        /* Give half of them back to the pool */
+        thread_pool_lock(me);
+        apr_pool_owner_set(me->pool, 0);
+        while (w->free_cnt > WS_FREE_MAX / 2) {
+            task = APR_RING_LAST(&w->free);
+            APR_RING_REMOVE(task, link);
+            APR_RING_INSERT_TAIL(me->recycled_tasks, task,
+                                 apr_thread_pool_task, link);
+            --w->free_cnt;
+        }
+        apr_thread_mutex_unlock(me->lock);
+    }
+}
+
+/* The thread is done with its task, wake up the cancellers waiting for it */
+static void ws_done(apr_thread_pool_t *me, struct apr_thread_list_elt *elt)
+{
+    elt->current_owner = NULL;
+    elt->running = 0;
+    apr__memory_barrier();
+    if (apr_atomic_read32(&me->waiting_work_done)) {
+        thread_pool_lock(me);
+        apr_thread_cond_broadcast(me->work_done);
+        apr_thread_mutex_unlock(me->lock);
+    }
+}
+
+/* Take a task out of a deque (ours or stolen) and claim it */
+static apr_thread_pool_task_t *ws_take_task(apr_thread_pool_t *me,
+                                            ws_worker_t *w,
+                                            struct apr_thread_list_elt *elt,
+                                            ws_deque_t *d, int steal)
+{
+    apr_thread_pool_task_t *task;
+    apr_uint32_t state;
+    int claimed = 0;
+
+    apr_atomic_inc32(&w->claiming);
+    task = steal ? ws_deque_steal(d) : ws_deque_take(d);
+    if (task) {
+        state = apr__load_acquire32(&task->state);
+        if (TASK_STATE(state) == TASK_QUEUED) {
+            elt->current_owner = task->owner;
+            elt->running = 1;
+            claimed = (apr_atomic_cas32(&task->state, state + TASK_RUNNING,
+                                        state) == state);
+        }
+    }
+    apr_atomic_inc32(&w->claiming);
+
+    if (claimed) {
+        ++w->claimed;
+    }
+    else if (task) {
+        /* Cancelled */
+        if (elt->running) {
+            ws_done(me, elt);
+        }
+        ws_recycle(me, w, task);
+        task = NULL;
+    }
+    return task;
+}
+
+/*
+ * Claim a task of the pool.
+ * NOTE: This function is not thread safe by itself. Caller should hold the lock
+ */
+static void ws_claim_locked(struct apr_thread_list_elt *elt,
+                            apr_thread_pool_task_t *task)
+{
+    task->state += TASK_RUNNING;
+    elt->current_owner = task->owner;
+    elt->running = 1;
+}
+
+static apr_thread_pool_task_t *ws_next_task(apr_thread_pool_t *me,
+                                            ws_worker_t *w,
+                                            struct apr_thread_list_elt *elt)
+{
+    apr_thread_pool_task_t *task;
+    apr_size_t i, n, start;
+    int seg;
+
+    /* The scheduled tasks when it's time */
+    if (me->scheduled_task_cnt && apr_time_now() >= me->sched_due) {
+        thread_pool_lock(me);
+        apr_pool_owner_set(me->pool, 0);
+        task = pop_scheduled_task(me);
+        if (task) {
+            ws_claim_locked(elt, task);
+        }
+        apr_thread_mutex_unlock(me->lock);
+        if (task) {
+            return task;
+        }
+    }
+
+    for (seg = TASK_PRIORITY_SEGS - 1; seg >= 0; seg--) {
+        /* Our own tasks first */
+        while (!ws_deque_empty(&w->deques[seg])) {
+            task = ws_take_task(me, w, elt, &w->deques[seg], 0);
+            if (task) {
+                return task;
+            }
+        }
+
+        /* Then the ones pushed from outside */
+        if (me->tasks_seg >= seg) {
+            task = NULL;
+            thread_pool_lock(me);
+            apr_pool_owner_set(me->pool, 0);
+            if (me->tasks_seg >= seg) {
+                task = pop_task(me);
+                if (task) {
+                    ws_claim_locked(elt, task);
+                }
+            }
+            apr_thread_mutex_unlock(me->lock);
+            if (task) {
+                return task;
+            }
+        }
+
+        /* Then the others' */
+        n = me->workers_max;
+        w->seed = w->seed * 1103515245 + 12345;
+        start = (w->seed >> 16) % n;
+        for (i = 0; i < n; i++) {
+            ws_worker_t *v = me->workers[(start + i) % n];
+            if (!v || v == w) {
+                continue;
+            }
+            while (!ws_deque_empty(&v->deques[seg])) {
+                task = ws_take_task(me, w, elt, &v->deques[seg], 1);
+                if (task) {
+                    return task;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Park the thread until a task is pushed, or the next scheduled task or the
+ * idle wait is due. Returns zero if the thread should die instead.
+ */
+static int ws_park(apr_thread_pool_t *me, struct apr_thread_list_elt *elt)
+{
+    apr_interval_time_t wait;
+    apr_uint32_t epoch;
+
+    thread_pool_lock(me);
+    apr_pool_owner_set(me->pool, 0);
+
+    /* thread should die? */
+    if (me->terminated
+            || elt->state != TH_RUN
+            || (me->idle_cnt >= me->idle_max
+                && (me->idle_max || !me->scheduled_task_cnt)
+                && !me->idle_wait)) {
+        if ((TH_PROBATION == elt->state) && me->idle_wait)
+            ++me->thd_timed_out;
+        apr_thread_mutex_unlock(me->lock);
+        return 0;
+    }
+
+    /* busy thread become idle */
+    APR_RING_REMOVE(elt, link);
+    --me->busy_cnt;
+    ++me->idle_cnt;
+    APR_RING_INSERT_TAIL(me->idle_thds, elt, apr_thread_list_elt, link);
+
+    if (me->scheduled_task_cnt)
+        wait = waiting_time(me);
+    else if (me->idle_cnt > me->idle_max) {
+        wait = me->idle_wait;
+        elt->state = TH_PROBATION;
+    }
+    else
+        wait = -1;
+
+    epoch = me->ws_epoch;
+    apr_atomic_inc32(&me->ws_parked);
+    apr_thread_mutex_unlock(me->lock);
+
+    /* A task may have been pushed before we were counted as parked */
+    if (wait && !ws_has_task(me)) {
+        apr_time_t idle = elt->stats ? apr_time_now() : 0;
+
+#if APR_HAS_FUTEX
+        apr__futex_wait(&me->ws_epoch, epoch, wait, 0);
+#else
+        thread_pool_lock(me);
+        if (me->ws_epoch == epoch) {
+            if (wait >= 0) {
+                apr_thread_cond_timedwait(me->more_work, me->lock, wait);
+            }
+            else {
+                apr_thread_cond_wait(me->more_work, me->lock);
+            }
+        }
+        apr_thread_mutex_unlock(me->lock);
+#endif
+        if (elt->stats) {
+            elt->stats->idle_time += apr_time_now() - idle;
+        }
+    }
+    apr_atomic_dec32(&me->ws_parked);
+
+    thread_pool_lock(me);
+    apr_pool_owner_set(me->pool, 0);
+    APR_RING_REMOVE(elt, link);
+    --me->idle_cnt;
+    ++me->busy_cnt;
+    APR_RING_INSERT_TAIL(me->busy_thds, elt, apr_thread_list_elt, link);
+    apr_thread_mutex_unlock(me->lock);
+    return 1;
+}
+
+/*
+ * Hand the tasks left in the deques of a dying thread over to the pool.
+ * NOTE: This function is not thread safe by itself. Caller should hold the lock
+ */
+static void ws_worker_release(apr_thread_pool_t *me, ws_worker_t *w)
+{
+    apr_thread_pool_task_t *task;
+    int seg, moved = 0;
+
+    for (seg = 0; seg < TASK_PRIORITY_SEGS; seg++) {
+        while (!ws_deque_empty(&w->deques[seg])) {
+            task = ws_deque_take(&w->deques[seg]);
+            if (!task) {
+                continue;
+            }
+            if (TASK_STATE(task->state) == TASK_QUEUED) {
+                ++w->claimed;
+                tasks_insert(me, task, 1);
+                moved = 1;
+            }
+            else {
+                APR_RING_INSERT_TAIL(me->recycled_tasks, task,
+                                     apr_thread_pool_task, link);
+            }
+        }
+    }
+    APR_RING_CONCAT(me->recycled_tasks, &w->free, apr_thread_pool_task, link);
+    w->free_cnt = 0;
+    me->tasks_run += w->tasks_run;
+    w->tasks_run = 0;
+    w->elt->ws = NULL;
+    w->elt = NULL;
+    if (moved) {
+        ws_wake(me, 0);
+    }
+}
+
+/*
+ * The worker thread function with work stealing, see thread_pool_func().
+ */
+static void *APR_THREAD_FUNC ws_thread_func(apr_thread_t * t, void *param)
+{
+    apr_thread_pool_t *me = param;
+    apr_thread_pool_task_t *task;
+    struct apr_thread_list_elt *elt;
+    ws_worker_t *w = NULL;
+
+    thread_pool_lock(me);
+    apr_pool_owner_set(me->pool, 0);
+
+    elt = elt_new(me, t);
+    if (elt) {
+        w = ws_worker_get(me, elt);
+    }
+    if (!w) {
+        if (elt) {
+            APR_RING_INSERT_TAIL(me->dead_thds, elt, apr_thread_list_elt, link);
+        }
+        if (--me->thd_cnt == 0 && me->terminated) {
+            apr_thread_cond_signal(me->all_done);
+        }
+        apr_thread_mutex_unlock(me->lock);
+        apr_thread_exit(t, APR_ENOMEM);
+    }
+    ++me->busy_cnt;
+    APR_RING_INSERT_TAIL(me->busy_thds, elt, apr_thread_list_elt, link);
+    apr_thread_mutex_unlock(me->lock);
+
+    if (thread_has_setup(me)) {
+        thread_setup(me, t, elt->index);
+    }
+    apr_threadkey_private_set(w, me->ws_key);
+
+    while (!me->terminated && elt->state != TH_STOP) {
+        task = ws_next_task(me, w, elt);
+        if (!task) {
+            int parked;
+
+            parked = ws_park(me, elt);
+            if (!parked) {
+                break;
+            }
+            continue;
+        }
+        ++w->tasks_run;
+
+        task_run(me, elt, t, task);
+
+        ws_done(me, elt);
+        ws_recycle(me, w, task);
+    }
+
+    apr_threadkey_private_set(NULL, me->ws_key);
+
+    thread_pool_lock(me);
+    apr_pool_owner_set(me->pool, 0);
+    ws_worker_release(me, w);
+    APR_RING_REMOVE(elt, link);
+    --me->busy_cnt;
+    if (me->waiting_work_done) {
+        apr_thread_cond_broadcast(me->work_done);
+    }
+
+    /* Dead thread, to be joined */
+    index_put(me, elt->index);
+    thread_stats_release(me, elt);
+    APR_RING_INSERT_TAIL(me->dead_thds, elt, apr_thread_list_elt, link);
+    if (--me->thd_cnt == 0 && me->terminated) {
+        apr_thread_cond_signal(me->all_done);
+    }
+    apr_thread_mutex_unlock(me->lock);
+
+    apr_thread_exit(t, APR_SUCCESS);
+    return NULL;                /* should not be here, safe net */
+}
+
+#define THREAD_POOL_FUNC(me) ((me)->workers ? ws_thread_func : thread_pool_func)
+
+/*
+ * Cancel the tasks of the owner which are in the deques.
+ * NOTE: This function is not thread safe by itself. Caller should hold the lock
+ */
+static void ws_cancel_tasks(apr_thread_pool_t *me, void *owner)
+{
+    apr_size_t i;
+    int seg;
+
+    for (i = 0; i < me->workers_max; i++) {
+        ws_worker_t *w = me->workers[i];
+        if (!w) {
+            continue;
+        }
+        for (seg = 0; seg < TASK_PRIORITY_SEGS; seg++) {
+            ws_deque_t *d = &w->deques[seg];
+            apr_uint32_t t, b;
+
+            t = d->top;
+            apr__memory_barrier();
+            b = d->bottom;
+            apr__memory_barrier();
+            for (; (apr_int32_t)(b - t) > 0; t++) {
+                apr_thread_pool_task_t *task = d->tasks[t & WS_DEQUE_MASK];
+                apr_thread_start_t func;
+                void *param;
+                apr_uint32_t state;
+
+                if (!task) {
+                    continue;
+                }
+                state = apr__load_acquire32(&task->state);
+                if (TASK_STATE(state) != TASK_QUEUED
+                    || (owner && task->owner != owner)) {
+                    continue;
+                }
+                /* Once cancelled, the task may be taken and reused at any
+                 * time, so what it runs is read before (a reuse in between
+                 * changes the state and fails the CAS).
+                 */
+                func = task->func;
+                param = task->param;
+                if (apr_atomic_cas32(&task->state, state + TASK_CANCELLED,
+                                     state) == state) {
+                    ++me->ws_cancelled;
+                    task_dropped(func, param);
+                }
+            }
+        }
+    }
+
+    /* Wait for the tasks being taken to be claimed (or cancelled) */
+    for (i = 0; i < me->workers_max; i++) {
+        ws_worker_t *w = me->workers[i];
+        apr_uint32_t claiming;
+
+        if (!w) {
+            continue;
+        }
+        claiming = w->claiming;
+        while ((claiming & 1) && w->claiming == claiming) {
+            apr_thread_yield();
+        }
+    }
+}
+
 /* Must be locked by the caller */
 static void join_dead_threads(apr_thread_pool_t *me)
 {
@@ -387,7 +1443,7 @@ static void join_dead_threads(apr_thread_pool_t *me)
 
         apr_thread_join(&status, elt->thd);
 
-        apr_thread_mutex_lock(me->lock);
+        thread_pool_lock(me);
         apr_pool_owner_set(me->pool, 0);
         APR_RING_INSERT_TAIL(me->recycled_thds, elt,
                              apr_thread_list_elt, link);
@@ -401,7 +1457,7 @@ static apr_status_t thread_pool_cleanup(void *me)
     _myself->terminated = 1;
     apr_thread_pool_tasks_cancel(_myself, NULL);
     apr_thread_pool_thread_max_set(_myself, 0);
-    apr_thread_mutex_lock(_myself->lock);
+    thread_pool_lock(_myself);
     apr_pool_owner_set(_myself->pool, 0);
 
     if (_myself->thd_cnt) {
@@ -412,6 +1468,9 @@ static apr_status_t thread_pool_cleanup(void *me)
     /* All threads should be dead now, join them */
     join_dead_threads(_myself);
 
+    /* Drop the tasks the threads left (e.g. in their deques) */
+    remove_tasks(_myself, NULL);
+
     apr_thread_mutex_unlock(_myself->lock);
 
     return APR_SUCCESS;
@@ -421,6 +1480,29 @@ APR_DECLARE(apr_status_t) apr_thread_pool_create(apr_thread_pool_t ** me,
                                                  apr_size_t init_threads,
                                                  apr_size_t max_threads,
                                                  apr_pool_t * pool)
+{
+    return apr_thread_pool_create_ex(me, init_threads, max_threads, 0, pool);
+}
+
+APR_DECLARE(apr_status_t) apr_thread_pool_create_ex(apr_thread_pool_t ** me,
+                                                    apr_size_t init_threads,
+                                                    apr_size_t max_threads,
+                                                    apr_uint32_t flags,
+                                                    apr_pool_t * pool)
+{
+    apr_thread_pool_options_t opts;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.flags = flags;
+    return apr_thread_pool_create_opt(me, init_threads, max_threads, &opts,
+                                      pool);
+}
+
+APR_DECLARE(apr_status_t) apr_thread_pool_create_opt(apr_thread_pool_t ** me,
+                                    apr_size_t init_threads,
+                                    apr_size_t max_threads,
+                                    const apr_thread_pool_options_t *options,
+                                    apr_pool_t * pool)
 {
     apr_thread_t *t;
     apr_status_t rv = APR_SUCCESS;
@@ -428,7 +1510,8 @@ APR_DECLARE(apr_status_t) apr_thread_pool_create(apr_thread_pool_t ** me,
 
     *me = NULL;
 
-    rv = thread_pool_construct(&tp, init_threads, max_threads, pool);
+    rv = thread_pool_construct(&tp, init_threads, max_threads, options,
+                               pool);
     if (APR_SUCCESS != rv)
         return rv;
     apr_pool_pre_cleanup_register(tp->pool, tp, thread_pool_cleanup);
@@ -438,9 +1521,9 @@ APR_DECLARE(apr_status_t) apr_thread_pool_create(apr_thread_pool_t ** me,
          * allocate from (*me)->pool. This is dangerous if there are multiple 
          * initial threads to create.
          */
-        apr_thread_mutex_lock(tp->lock);
+        thread_pool_lock(tp);
         apr_pool_owner_set(tp->pool, 0);
-        rv = apr_thread_create(&t, NULL, thread_pool_func, tp, tp->pool);
+        rv = apr_thread_create(&t, NULL, THREAD_POOL_FUNC(tp), tp, tp->pool);
         if (APR_SUCCESS != rv) {
             apr_thread_mutex_unlock(tp->lock);
             break;
@@ -469,10 +1552,7 @@ APR_DECLARE(apr_status_t) apr_thread_pool_destroy(apr_thread_pool_t * me)
 /*
  * NOTE: This function is not thread safe by itself. Caller should hold the lock
  */
-static apr_thread_pool_task_t *task_new(apr_thread_pool_t * me,
-                                        apr_thread_start_t func,
-                                        void *param, apr_byte_t priority,
-                                        void *owner, apr_time_t time)
+static apr_thread_pool_task_t *task_alloc(apr_thread_pool_t * me)
 {
     apr_thread_pool_task_t *t;
 
@@ -481,22 +1561,88 @@ static apr_thread_pool_task_t *task_new(apr_thread_pool_t * me,
         if (NULL == t) {
             return NULL;
         }
+        t->state = TASK_QUEUED;
     }
     else {
         t = APR_RING_FIRST(me->recycled_tasks);
         APR_RING_REMOVE(t, link);
     }
+    return t;
+}
+
+static void task_init(apr_thread_pool_t *me, apr_thread_pool_task_t *t,
+                      apr_thread_start_t func, void *param,
+                      apr_byte_t priority, void *owner, apr_time_t time)
+{
     APR_RING_ELEM_INIT(t, link);
 
+    t->timer = NULL;
     t->func = func;
     t->param = param;
     t->owner = owner;
+    t->seg = priority / 64;
     if (time > 0) {
         t->dispatch.time = apr_time_now() + time;
+        t->queued = t->dispatch.time;
     }
     else {
         t->dispatch.priority = priority;
+        if (me->stats) {
+            t->queued = apr_time_now();
+        }
+    }
+    /* Queued again, last: a stale slot of its previous use may still be
+     * read by ws_cancel_tasks(), which must not see the new state with the
+     * old owner (nor a stale cancel of the previous use match).
+     */
+    apr__store_release32(&t->state,
+                         (t->state & ~TASK_STATE_MASK) + TASK_REUSE);
+}
+
+/*
+ * NOTE: This function is not thread safe by itself. Caller should hold the lock
+ */
+static apr_thread_pool_task_t *task_new(apr_thread_pool_t * me,
+                                        apr_thread_start_t func,
+                                        void *param, apr_byte_t priority,
+                                        void *owner, apr_time_t time)
+{
+    apr_thread_pool_task_t *t;
+
+    t = task_alloc(me);
+    if (NULL != t) {
+        task_init(me, t, func, param, priority, owner, time);
+    }
+    return t;
+}
+
+/*
+ * Create a task pushed by a task of the pool, from the recycled tasks of its
+ * thread first (work stealing).
+ */
+static apr_thread_pool_task_t *ws_task_new(apr_thread_pool_t * me,
+                                           ws_worker_t *w,
+                                           apr_thread_start_t func,
+                                           void *param, apr_byte_t priority,
+                                           void *owner)
+{
+    apr_thread_pool_task_t *t;
+
+    if (!APR_RING_EMPTY(&w->free, apr_thread_pool_task, link)) {
+        t = APR_RING_FIRST(&w->free);
+        APR_RING_REMOVE(t, link);
+        --w->free_cnt;
     }
+    else {
+        thread_pool_lock(me);
+        apr_pool_owner_set(me->pool, 0);
+        t = task_alloc(me);
+        apr_thread_mutex_unlock(me->lock);
+        if (NULL == t) {
+            return NULL;
+        }
+    }
+    task_init(me, t, func, param, priority, owner, 0);
     return t;
 }
 
@@ -526,36 +1672,85 @@ static apr_thread_pool_task_t *add_if_empty(apr_thread_pool_t * me,
                 return t_next;
             }
         }
-        return t_next;
+        return t_next;
+    }
+
+    for (next = seg - 1; next >= 0; next--) {
+        if (me->task_idx[next]) {
+            APR_RING_INSERT_BEFORE(me->task_idx[next], t, link);
+            break;
+        }
+    }
+    if (0 > next) {
+        APR_RING_INSERT_TAIL(me->tasks, t, apr_thread_pool_task, link);
+    }
+    me->task_idx[seg] = t;
+    return NULL;
+}
+
+/*
+ * Insert the task in the tasks of the pool, after (push) or before (top) the
+ * tasks of the same priority.
+ *
+ * NOTE: This function is not thread safe by itself. Caller should hold the lock
+ */
+static void tasks_insert(apr_thread_pool_t *me, apr_thread_pool_task_t *t,
+                         int push)
+{
+    apr_thread_pool_task_t *t_loc;
+
+    t_loc = add_if_empty(me, t);
+    if (NULL != t_loc) {
+        if (push) {
+            apr_thread_pool_task_t *t_end;
+            int next;
+
+            /* Most often after the last task of the segment, don't walk the
+             * ones of the same priority for that.
+             */
+            t_end = APR_RING_SENTINEL(me->tasks, apr_thread_pool_task, link);
+            for (next = TASK_PRIORITY_SEG(t) - 1; next >= 0; next--) {
+                if (me->task_idx[next]) {
+                    t_end = me->task_idx[next];
+                    break;
+                }
+            }
+            if (APR_RING_PREV(t_end, link)->dispatch.priority
+                    >= t->dispatch.priority) {
+                t_loc = t_end;
+            }
+            while (APR_RING_SENTINEL(me->tasks, apr_thread_pool_task, link) !=
+                   t_loc && t_loc->dispatch.priority >= t->dispatch.priority) {
+                t_loc = APR_RING_NEXT(t_loc, link);
+            }
+        }
+        APR_RING_INSERT_BEFORE(t_loc, t, link);
+        if (!push) {
+            if (t_loc == me->task_idx[TASK_PRIORITY_SEG(t)]) {
+                me->task_idx[TASK_PRIORITY_SEG(t)] = t;
+            }
+        }
     }
 
-    for (next = seg - 1; next >= 0; next--) {
-        if (me->task_idx[next]) {
-            APR_RING_INSERT_BEFORE(me->task_idx[next], t, link);
-            break;
-        }
-    }
-    if (0 > next) {
-        APR_RING_INSERT_TAIL(me->tasks, t, apr_thread_pool_task, link);
-    }
-    me->task_idx[seg] = t;
-    return NULL;
+    me->task_cnt++;
+    if (me->task_cnt > me->tasks_high)
+        me->tasks_high = me->task_cnt;
+    tasks_changed(me);
 }
 
 /*
-*   schedule a task to run in "time" microseconds. Find the spot in the ring where
-*   the time fits. Adjust the short_time so the thread wakes up when the time is reached.
+*   schedule a task to run in "time" microseconds. The timer wheel gives
+*   the tasks in time order, and the time to wait for the next one.
 */
 static apr_status_t schedule_task(apr_thread_pool_t *me,
                                   apr_thread_start_t func, void *param,
                                   void *owner, apr_interval_time_t time)
 {
     apr_thread_pool_task_t *t;
-    apr_thread_pool_task_t *t_loc;
     apr_thread_t *thd;
     apr_status_t rv = APR_SUCCESS;
 
-    apr_thread_mutex_lock(me->lock);
+    thread_pool_lock(me);
     apr_pool_owner_set(me->pool, 0);
 
     if (me->terminated) {
@@ -572,51 +1767,91 @@ static apr_status_t schedule_task(apr_thread_pool_t *me,
         apr_thread_mutex_unlock(me->lock);
         return APR_ENOMEM;
     }
-    t_loc = APR_RING_FIRST(me->scheduled_tasks);
-    while (NULL != t_loc) {
-        /* if the time is less than the entry insert ahead of it */
-        if (t->dispatch.time < t_loc->dispatch.time) {
-            ++me->scheduled_task_cnt;
-            APR_RING_INSERT_BEFORE(t_loc, t, link);
-            break;
-        }
-        else {
-            t_loc = APR_RING_NEXT(t_loc, link);
-            if (t_loc ==
-                APR_RING_SENTINEL(me->scheduled_tasks, apr_thread_pool_task,
-                                  link)) {
-                ++me->scheduled_task_cnt;
-                APR_RING_INSERT_TAIL(me->scheduled_tasks, t,
-                                     apr_thread_pool_task, link);
-                break;
-            }
-        }
+    if (time <= 0) {
+        t->dispatch.time = apr_time_now();
+        t->queued = t->dispatch.time;
     }
+    rv = apr_timer_wheel_add(me->timers, t->dispatch.time, t, &t->timer);
+    if (APR_SUCCESS != rv) {
+        APR_RING_INSERT_TAIL(me->recycled_tasks, t,
+                             apr_thread_pool_task, link);
+        apr_thread_mutex_unlock(me->lock);
+        return rv;
+    }
+    ++me->scheduled_task_cnt;
+    APR_RING_INSERT_TAIL(me->scheduled_tasks, t, apr_thread_pool_task, link);
+    scheduled_tasks_changed(me);
     /* there should be at least one thread for scheduled tasks */
     if (0 == me->thd_cnt) {
-        rv = apr_thread_create(&thd, NULL, thread_pool_func, me, me->pool);
+        rv = apr_thread_create(&thd, NULL, THREAD_POOL_FUNC(me), me, me->pool);
         if (APR_SUCCESS == rv) {
             ++me->thd_cnt;
             if (me->thd_cnt > me->thd_high)
                 me->thd_high = me->thd_cnt;
         }
     }
-    apr_thread_cond_signal(me->more_work);
+    if (!me->workers) {
+        apr_thread_cond_signal(me->more_work);
+    }
     apr_thread_mutex_unlock(me->lock);
+    if (me->workers) {
+        /* not holding the lock the woken up thread will want */
+        ws_wake(me, 0);
+    }
 
     return rv;
 }
 
+/*
+ * Push a task from a task of the pool to the deque of its thread (work
+ * stealing), or to the tasks of the pool if the deque is full.
+ */
+static apr_status_t ws_add_task(apr_thread_pool_t *me, ws_worker_t *w,
+                                apr_thread_start_t func, void *param,
+                                apr_byte_t priority, void *owner)
+{
+    apr_thread_pool_task_t *t;
+
+    if (me->terminated) {
+        /* Let the caller know that we are done */
+        return APR_NOTFOUND;
+    }
+
+    t = ws_task_new(me, w, func, param, priority, owner);
+    if (NULL == t) {
+        return APR_ENOMEM;
+    }
+    ++w->pushed;
+    if (!ws_deque_push(&w->deques[TASK_PRIORITY_SEG(t)], t)) {
+        --w->pushed;
+        thread_pool_lock(me);
+        apr_pool_owner_set(me->pool, 0);
+        tasks_insert(me, t, 1);
+        apr_thread_mutex_unlock(me->lock);
+    }
+    ws_wake(me, 0);
+
+    return APR_SUCCESS;
+}
+
 static apr_status_t add_task(apr_thread_pool_t *me, apr_thread_start_t func,
                              void *param, apr_byte_t priority, int push,
                              void *owner)
 {
     apr_thread_pool_task_t *t;
-    apr_thread_pool_task_t *t_loc;
     apr_thread_t *thd;
     apr_status_t rv = APR_SUCCESS;
 
-    apr_thread_mutex_lock(me->lock);
+    /* From a task of the pool, to the deque of its thread */
+    if (me->workers) {
+        void *w = NULL;
+        apr_threadkey_private_get(&w, me->ws_key);
+        if (w) {
+            return ws_add_task(me, w, func, param, priority, owner);
+        }
+    }
+
+    thread_pool_lock(me);
     apr_pool_owner_set(me->pool, 0);
 
     if (me->terminated) {
@@ -633,32 +1868,11 @@ static apr_status_t add_task(apr_thread_pool_t *me, apr_thread_start_t func,
         apr_thread_mutex_unlock(me->lock);
         return APR_ENOMEM;
     }
+    tasks_insert(me, t, push);
 
-    t_loc = add_if_empty(me, t);
-    if (NULL == t_loc) {
-        goto FINAL_EXIT;
-    }
-
-    if (push) {
-        while (APR_RING_SENTINEL(me->tasks, apr_thread_pool_task, link) !=
-               t_loc && t_loc->dispatch.priority >= t->dispatch.priority) {
-            t_loc = APR_RING_NEXT(t_loc, link);
-        }
-    }
-    APR_RING_INSERT_BEFORE(t_loc, t, link);
-    if (!push) {
-        if (t_loc == me->task_idx[TASK_PRIORITY_SEG(t)]) {
-            me->task_idx[TASK_PRIORITY_SEG(t)] = t;
-        }
-    }
-
-  FINAL_EXIT:
-    me->task_cnt++;
-    if (me->task_cnt > me->tasks_high)
-        me->tasks_high = me->task_cnt;
     if (0 == me->thd_cnt || (0 == me->idle_cnt && me->thd_cnt < me->thd_max &&
                              me->task_cnt > me->threshold)) {
-        rv = apr_thread_create(&thd, NULL, thread_pool_func, me, me->pool);
+        rv = apr_thread_create(&thd, NULL, THREAD_POOL_FUNC(me), me, me->pool);
         if (APR_SUCCESS == rv) {
             ++me->thd_cnt;
             if (me->thd_cnt > me->thd_high)
@@ -666,8 +1880,14 @@ static apr_status_t add_task(apr_thread_pool_t *me, apr_thread_start_t func,
         }
     }
 
-    apr_thread_cond_signal(me->more_work);
+    if (!me->workers) {
+        apr_thread_cond_signal(me->more_work);
+    }
     apr_thread_mutex_unlock(me->lock);
+    if (me->workers) {
+        /* not holding the lock the woken up thread will want */
+        ws_wake(me, 0);
+    }
 
     return rv;
 }
@@ -713,10 +1933,16 @@ static apr_status_t remove_scheduled_tasks(apr_thread_pool_t *me,
         /* if this is the owner remove it */
         if (!owner || t_loc->owner == owner) {
             --me->scheduled_task_cnt;
+            apr_timer_wheel_cancel(me->timers, t_loc->timer);
+            t_loc->timer = NULL;
             APR_RING_REMOVE(t_loc, link);
+            task_dropped(t_loc->func, t_loc->param);
+            APR_RING_INSERT_TAIL(me->recycled_tasks, t_loc,
+                                 apr_thread_pool_task, link);
         }
         t_loc = next;
     }
+    scheduled_tasks_changed(me);
     return APR_SUCCESS;
 }
 
@@ -742,9 +1968,13 @@ static apr_status_t remove_tasks(apr_thread_pool_t *me, void *owner)
                 }
             }
             APR_RING_REMOVE(t_loc, link);
+            task_dropped(t_loc->func, t_loc->param);
+            APR_RING_INSERT_TAIL(me->recycled_tasks, t_loc,
+                                 apr_thread_pool_task, link);
         }
         t_loc = next;
     }
+    tasks_changed(me);
     return APR_SUCCESS;
 }
 
@@ -758,7 +1988,8 @@ static void wait_on_busy_threads(apr_thread_pool_t *me, void *owner)
 
     elt = APR_RING_FIRST(me->busy_thds);
     while (elt != APR_RING_SENTINEL(me->busy_thds, apr_thread_list_elt, link)) {
-        if (owner && elt->current_owner != owner) {
+        if ((owner && elt->current_owner != owner)
+            || (me->workers && !elt->running)) {
             elt = APR_RING_NEXT(elt, link);
             continue;
         }
@@ -774,10 +2005,16 @@ static void wait_on_busy_threads(apr_thread_pool_t *me, void *owner)
 #endif
 #endif
 
-        me->waiting_work_done = 1;
-        apr_thread_cond_wait(me->work_done, me->lock);
-        apr_pool_owner_set(me->pool, 0);
-        me->waiting_work_done = 0;
+        /* A thread stealing work signals without the lock when its task
+         * is done, unless it did before seeing us waiting.
+         */
+        apr_atomic_inc32(&me->waiting_work_done);
+        if (!me->workers || (elt->running
+                             && (!owner || elt->current_owner == owner))) {
+            apr_thread_cond_wait(me->work_done, me->lock);
+            apr_pool_owner_set(me->pool, 0);
+        }
+        apr_atomic_dec32(&me->waiting_work_done);
 
         /* Restart */
         elt = APR_RING_FIRST(me->busy_thds);
@@ -792,7 +2029,7 @@ APR_DECLARE(apr_status_t) apr_thread_pool_tasks_cancel(apr_thread_pool_t *me,
 {
     apr_status_t rv = APR_SUCCESS;
 
-    apr_thread_mutex_lock(me->lock);
+    thread_pool_lock(me);
     apr_pool_owner_set(me->pool, 0);
 
     if (me->task_cnt > 0) {
@@ -801,6 +2038,9 @@ APR_DECLARE(apr_status_t) apr_thread_pool_tasks_cancel(apr_thread_pool_t *me,
     if (me->scheduled_task_cnt > 0) {
         rv = remove_scheduled_tasks(me, owner);
     }
+    if (me->workers) {
+        ws_cancel_tasks(me, owner);
+    }
 
     wait_on_busy_threads(me, owner);
 
@@ -811,7 +2051,22 @@ APR_DECLARE(apr_status_t) apr_thread_pool_tasks_cancel(apr_thread_pool_t *me,
 
 APR_DECLARE(apr_size_t) apr_thread_pool_tasks_count(apr_thread_pool_t *me)
 {
-    return me->task_cnt;
+    apr_size_t n = me->task_cnt, i;
+
+    if (me->workers) {
+        apr_ssize_t ws_cnt = -(apr_ssize_t)me->ws_cancelled;
+
+        for (i = 0; i < me->workers_max; i++) {
+            ws_worker_t *w = me->workers[i];
+            if (w) {
+                ws_cnt += (apr_ssize_t)(w->pushed - w->claimed);
+            }
+        }
+        if (ws_cnt > 0) {
+            n += ws_cnt;
+        }
+    }
+    return n;
 }
 
 APR_DECLARE(apr_size_t)
@@ -838,7 +2093,14 @@ APR_DECLARE(apr_size_t) apr_thread_pool_idle_count(apr_thread_pool_t *me)
 APR_DECLARE(apr_size_t)
     apr_thread_pool_tasks_run_count(apr_thread_pool_t * me)
 {
-    return me->tasks_run;
+    apr_size_t n = me->tasks_run, i;
+
+    for (i = 0; i < me->workers_max; i++) {
+        if (me->workers[i]) {
+            n += me->workers[i]->tasks_run;
+        }
+    }
+    return n;
 }
 
 APR_DECLARE(apr_size_t)
@@ -881,7 +2143,7 @@ static void stop_threads(apr_thread_pool_t *me, apr_size_t *cnt, int idle)
     struct apr_thread_list_elt *elt, *last;
     apr_size_t n, i;
 
-    apr_thread_mutex_lock(me->lock);
+    thread_pool_lock(me);
     apr_pool_owner_set(me->pool, 0);
 
     if (idle) {
@@ -922,10 +2184,13 @@ static apr_size_t stop_idle_threads(apr_thread_pool_t *me, apr_size_t cnt)
 {
     stop_threads(me, &cnt, 1);
     if (cnt) {
-        apr_thread_mutex_lock(me->lock);
+        thread_pool_lock(me);
         apr_pool_owner_set(me->pool, 0);
         apr_thread_cond_broadcast(me->more_work);
         apr_thread_mutex_unlock(me->lock);
+        if (me->workers) {
+            ws_wake(me, 1);
+        }
     }
     return cnt;
 }
@@ -969,6 +2234,10 @@ APR_DECLARE(apr_size_t) apr_thread_pool_thread_max_set(apr_thread_pool_t *me,
 {
     apr_size_t n, i;
 
+    if (me->workers && cnt > me->workers_max) {
+        /* no more threads than slots */
+        cnt = me->workers_max;
+    }
     me->thd_max = cnt;
     n = me->thd_cnt;
     if (n <= cnt) {
@@ -1001,6 +2270,17 @@ APR_DECLARE(apr_size_t) apr_thread_pool_threshold_set(apr_thread_pool_t *me,
     return ov;
 }
 
+APR_DECLARE(apr_pool_t *) apr_thread_pool_node_pool_get(apr_thread_t *thd)
+{
+    void *data;
+
+    if (apr_thread_data_get(&data, "apr_thread_pool_node_pool", thd)
+            != APR_SUCCESS) {
+        return NULL;
+    }
+    return data;
+}
+
 APR_DECLARE(apr_status_t) apr_thread_pool_task_owner_get(apr_thread_t *thd,
                                                          void **owner)
 {
@@ -1023,6 +2303,420 @@ APR_DECLARE(apr_status_t) apr_thread_pool_task_owner_get(apr_thread_t *thd,
     return APR_SUCCESS;
 }
 
+APR_DECLARE(apr_status_t) apr_thread_pool_stats_get(apr_thread_pool_t *me,
+                                            apr_thread_pool_stats_t **stats,
+                                            apr_pool_t *pool)
+{
+    struct apr_thread_list *lists[2];
+    apr_thread_pool_stats_t *st;
+    thread_stats_t *ts;
+    int i, n;
+
+    if (!me->stats) {
+        return APR_ENOTIMPL;
+    }
+    ts = apr_palloc(pool, sizeof(*ts));
+    st = apr_pcalloc(pool, sizeof(*st));
+
+    /* The threads update their stats without the lock, their last updates
+     * may be missed.
+     */
+    thread_pool_lock(me);
+    *ts = *me->stats;
+    lists[0] = me->busy_thds;
+    lists[1] = me->idle_thds;
+    for (i = 0; i < 2; i++) {
+        struct apr_thread_list_elt *elt;
+
+        for (elt = APR_RING_FIRST(lists[i]);
+             elt != APR_RING_SENTINEL(lists[i], apr_thread_list_elt, link);
+             elt = APR_RING_NEXT(elt, link)) {
+            if (elt->stats) {
+                thread_stats_merge(ts, elt->stats);
+            }
+        }
+    }
+    st->lock_acquired = me->lock_acquired;
+    st->lock_contended = me->lock_contended;
+    st->lock_wait = me->lock_wait;
+    apr_thread_mutex_unlock(me->lock);
+
+    for (i = 0; i < TASK_PRIORITY_SEGS; i++) {
+        st->wait[i] = ts->wait[i];
+        st->run[i] = ts->run[i];
+    }
+    for (i = 0, n = 0; i < STATS_OWNERS; i++) {
+        if (ts->owners[i].run.count) {
+            ts->owners[n++] = ts->owners[i];
+        }
+    }
+    st->owners = ts->owners;
+    st->nowners = n;
+    st->other_owners = ts->other_owners;
+    st->busy_time = ts->busy_time;
+    st->idle_time = ts->idle_time;
+
+    *stats = st;
+    return APR_SUCCESS;
+}
+
+/*
+ * Task handles and apr_parallel_for().
+ * A handle is completed (or cancelled) by a release store of its state,
+ * and task_notify() wakes up the waiters, taking done_lock only when
+ * someone is waiting, so completing a task nobody waits for costs a memory
+ * barrier only.
+ */
+#define HANDLE_PENDING 0
+#define HANDLE_DONE 1
+#define HANDLE_CANCELLED 2
+
+struct apr_task_handle_t
+{
+    apr_thread_pool_t *tp;
+    apr_thread_start_t func;
+    void *param;
+    void *result;
+    volatile apr_uint32_t state;
+};
+
+typedef struct parallel_for_t
+{
+    apr_thread_pool_t *tp;
+    apr_parallel_for_fn_t fn;
+    void *data;
+    apr_size_t begin;
+    apr_size_t end;
+    apr_size_t grain;
+    apr_uint32_t chunks;
+    volatile apr_uint32_t next;     /* next chunk to claim */
+    volatile apr_uint32_t done;     /* chunks run (or skipped) */
+    volatile apr_uint32_t failed;
+    volatile apr_uint32_t refs;     /* the caller and the helper tasks */
+    apr_status_t rv;
+} parallel_for_t;
+
+static void task_notify(apr_thread_pool_t *me)
+{
+    apr__memory_barrier();
+    if (apr_atomic_read32(&me->done_waiters)) {
+        apr_thread_mutex_lock(me->done_lock);
+        apr_thread_cond_broadcast(me->done_cond);
+        apr_thread_mutex_unlock(me->done_lock);
+    }
+}
+
+/*
+ * Wait for done(baton) to be true, rechecked whenever a task completes.
+ */
+static apr_status_t task_wait(apr_thread_pool_t *me, int (*done)(void *),
+                              void *baton, apr_interval_time_t timeout)
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_time_t deadline = 0;
+
+    if (done(baton)) {
+        return APR_SUCCESS;
+    }
+    if (timeout == 0) {
+        return APR_EAGAIN;
+    }
+    if (timeout > 0) {
+        deadline = apr_time_now() + timeout;
+    }
+
+    apr_atomic_inc32(&me->done_waiters);
+    apr_thread_mutex_lock(me->done_lock);
+    while (!done(baton)) {
+        if (timeout < 0) {
+            apr_thread_cond_wait(me->done_cond, me->done_lock);
+        }
+        else {
+            apr_interval_time_t left = deadline - apr_time_now();
+            if (left <= 0) {
+                rv = APR_TIMEUP;
+                break;
+            }
+            apr_thread_cond_timedwait(me->done_cond, me->done_lock, left);
+        }
+    }
+    apr_thread_mutex_unlock(me->done_lock);
+    apr_atomic_dec32(&me->done_waiters);
+
+    return rv;
+}
+
+static void *APR_THREAD_FUNC handle_task(apr_thread_t *thd, void *param)
+{
+    apr_task_handle_t *h = param;
+    apr_thread_pool_t *me = h->tp; /* h may be gone once completed */
+
+    h->result = h->func(thd, h->param);
+    apr__store_release32(&h->state, HANDLE_DONE);
+    task_notify(me);
+    return NULL;
+}
+
+static void parallel_for_release(parallel_for_t *pf)
+{
+    if (!apr_atomic_dec32(&pf->refs)) {
+        free(pf);
+    }
+}
+
+/* Run the chunks of the range until none is left to claim */
+static void parallel_for_run(parallel_for_t *pf)
+{
+    apr_uint32_t i;
+
+    while ((i = apr_atomic_inc32(&pf->next)) < pf->chunks) {
+        if (!apr_atomic_read32(&pf->failed)) {
+            apr_size_t b = pf->begin + (apr_size_t)i * pf->grain;
+            apr_size_t e = pf->end - b > pf->grain ? b + pf->grain : pf->end;
+            apr_status_t rv = pf->fn(b, e, pf->data);
+            if (rv != APR_SUCCESS
+                && apr_atomic_cas32(&pf->failed, 1, 0) == 0) {
+                pf->rv = rv;
+            }
+        }
+        if (apr_atomic_inc32(&pf->done) + 1 == pf->chunks) {
+            task_notify(pf->tp);
+        }
+    }
+}
+
+static void *APR_THREAD_FUNC parallel_for_task(apr_thread_t *thd,
+                                               void *param)
+{
+    parallel_for_run(param);
+    parallel_for_release(param);
+    return NULL;
+}
+
+static int parallel_for_done(void *baton)
+{
+    parallel_for_t *pf = baton;
+    return apr__load_acquire32(&pf->done) == pf->chunks;
+}
+
+/*
+ * Called for the tasks removed without being run, to complete their
+ * handle or release their apr_parallel_for() (which runs the chunks
+ * itself).
+ */
+static void task_dropped(apr_thread_start_t func, void *param)
+{
+    if (func == handle_task) {
+        apr_task_handle_t *h = param;
+        apr_thread_pool_t *me = h->tp;
+
+        apr__store_release32(&h->state, HANDLE_CANCELLED);
+        task_notify(me);
+    }
+    else if (func == parallel_for_task) {
+        parallel_for_release(param);
+    }
+}
+
+APR_DECLARE(apr_status_t) apr_thread_pool_submit(apr_thread_pool_t *me,
+                                                 apr_task_handle_t **handle,
+                                                 apr_thread_start_t func,
+                                                 void *param,
+                                                 apr_byte_t priority,
+                                                 void *owner,
+                                                 apr_pool_t *pool)
+{
+    apr_task_handle_t *h;
+    apr_status_t rv;
+
+    h = apr_palloc(pool, sizeof(*h));
+    h->tp = me;
+    h->func = func;
+    h->param = param;
+    h->result = NULL;
+    h->state = HANDLE_PENDING;
+
+    rv = add_task(me, handle_task, h, priority, 1, owner);
+    if (rv == APR_SUCCESS) {
+        *handle = h;
+    }
+    return rv;
+}
+
+static APR_INLINE apr_status_t handle_status(apr_task_handle_t *h)
+{
+    return apr__load_acquire32(&h->state) == HANDLE_DONE ? APR_SUCCESS
+                                                         : APR_EOF;
+}
+
+static int handle_done(void *baton)
+{
+    apr_task_handle_t *h = baton;
+    return apr__load_acquire32(&h->state) != HANDLE_PENDING;
+}
+
+typedef struct handles_t
+{
+    apr_task_handle_t *const *handles;
+    apr_size_t n;
+    apr_size_t index;
+} handles_t;
+
+static int handles_any_done(void *baton)
+{
+    handles_t *hs = baton;
+    apr_size_t i;
+
+    for (i = 0; i < hs->n; i++) {
+        if (handle_done(hs->handles[i])) {
+            hs->index = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int handles_all_done(void *baton)
+{
+    handles_t *hs = baton;
+
+    /* The ones done stay done, start from the first pending one */
+    for (; hs->index < hs->n; hs->index++) {
+        if (!handle_done(hs->handles[hs->index])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+APR_DECLARE(apr_status_t) apr_task_handle_wait(apr_task_handle_t *handle,
+                                               void **result,
+                                               apr_interval_time_t timeout)
+{
+    apr_status_t rv;
+
+    rv = task_wait(handle->tp, handle_done, handle, timeout);
+    if (rv == APR_SUCCESS) {
+        rv = handle_status(handle);
+        if (rv == APR_SUCCESS && result) {
+            *result = handle->result;
+        }
+    }
+    return rv;
+}
+
+APR_DECLARE(apr_status_t) apr_task_handle_wait_any(
+                                        apr_task_handle_t *const *handles,
+                                        apr_size_t n, apr_size_t *index,
+                                        apr_interval_time_t timeout)
+{
+    handles_t hs;
+    apr_status_t rv;
+
+    if (!n) {
+        return APR_EINVAL;
+    }
+    hs.handles = handles;
+    hs.n = n;
+    hs.index = 0;
+    rv = task_wait(handles[0]->tp, handles_any_done, &hs, timeout);
+    if (rv == APR_SUCCESS) {
+        *index = hs.index;
+        rv = handle_status(handles[hs.index]);
+    }
+    return rv;
+}
+
+APR_DECLARE(apr_status_t) apr_task_handle_wait_all(
+                                        apr_task_handle_t *const *handles,
+                                        apr_size_t n,
+                                        apr_interval_time_t timeout)
+{
+    handles_t hs;
+    apr_status_t rv;
+    apr_size_t i;
+
+    if (!n) {
+        return APR_SUCCESS;
+    }
+    hs.handles = handles;
+    hs.n = n;
+    hs.index = 0;
+    rv = task_wait(handles[0]->tp, handles_all_done, &hs, timeout);
+    for (i = 0; rv == APR_SUCCESS && i < n; i++) {
+        rv = handle_status(handles[i]);
+    }
+    return rv;
+}
+
+APR_DECLARE(apr_status_t) apr_parallel_for(apr_thread_pool_t *me,
+                                           apr_size_t begin, apr_size_t end,
+                                           apr_size_t grain,
+                                           apr_parallel_for_fn_t fn,
+                                           void *data)
+{
+    parallel_for_t *pf;
+    apr_size_t len, helpers, i;
+    apr_status_t rv;
+
+    if (begin >= end) {
+        return APR_SUCCESS;
+    }
+    len = end - begin;
+
+    /* About four chunks per thread (and the caller) by default, for the
+     * load to be balanced, and no more than 2^30 chunks
+     */
+    helpers = me->thd_max;
+    if (!grain) {
+        grain = len / (4 * (helpers + 1));
+        if (!grain) {
+            grain = 1;
+        }
+    }
+    if ((len - 1) / grain >= 0x40000000) {
+        grain = (len - 1) / 0x40000000 + 1;
+    }
+
+    pf = malloc(sizeof(*pf));
+    if (!pf) {
+        return APR_ENOMEM;
+    }
+    pf->tp = me;
+    pf->fn = fn;
+    pf->data = data;
+    pf->begin = begin;
+    pf->end = end;
+    pf->grain = grain;
+    pf->chunks = (apr_uint32_t)((len - 1) / grain + 1);
+    pf->next = 0;
+    pf->done = 0;
+    pf->failed = 0;
+    pf->rv = APR_SUCCESS;
+
+    /* The caller runs chunks too, so one helper less than chunks */
+    if (helpers > pf->chunks - 1) {
+        helpers = pf->chunks - 1;
+    }
+    pf->refs = (apr_uint32_t)helpers + 1;
+    for (i = 0; i < helpers; i++) {
+        if (apr_thread_pool_push(me, parallel_for_task, pf,
+                                 APR_THREAD_TASK_PRIORITY_NORMAL,
+                                 NULL) != APR_SUCCESS) {
+            /* The chunks will be run by the others */
+            apr_atomic_sub32(&pf->refs, (apr_uint32_t)(helpers - i));
+            break;
+        }
+    }
+
+    parallel_for_run(pf);
+    task_wait(me, parallel_for_done, pf, -1);
+    rv = pf->rv;
+    parallel_for_release(pf);
+
+    return rv;
+}
+
 #endif /* APR_HAS_THREADS */
 
 /* vim: set ts=4 sw=4 et cin tw=80: */
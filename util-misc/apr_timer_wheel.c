@@ -0,0 +1,341 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "apr_general.h"
+#include "apr_ring.h"
+#include "apr_slab.h"
+#include "apr_timer_wheel.h"
+
+/* The times are counted in ticks of the resolution, a timer expiring at
+ * the first tick not before its time.  The wheel has WHEEL_LEVELS levels
+ * of WHEEL_SLOTS slots, the slots of level n spanning 64^n ticks, enough
+ * for the 64 bits of the ticks.
+ *
+ * A timer expiring at tick t, with the wheel at tick cur (t > cur), is
+ * in the level of the highest bit of (t ^ cur), and in the slot of its
+ * digit of t at that level: the timers of a level are all within the
+ * current slot of the level above, and in a slot after the current one
+ * of their level, so the lowest occupied slot of the lowest occupied
+ * level holds the next timers to expire.  When the wheel reaches the
+ * first tick of an occupied slot above level 0 the timers of the slot
+ * are distributed to the levels below (or expire), when it reaches an
+ * occupied slot of level 0 its timers expire.  Each level has a bitmap
+ * of its occupied slots, so the wheel jumps from one occupied slot to
+ * the next instead of stepping through the ticks.
+ */
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS ((64 + WHEEL_BITS - 1) / WHEEL_BITS)
+
+/* The slot of an expired timer, not taken by apr_timer_wheel_expire() */
+#define WHEEL_EXPIRED (WHEEL_LEVELS * WHEEL_SLOTS)
+
+struct apr_timer_t {
+    APR_RING_ENTRY(apr_timer_t) link;
+    apr_uint64_t tick;
+    void *baton;
+    unsigned int slot;
+};
+
+APR_RING_HEAD(timer_ring_t, apr_timer_t);
+
+struct apr_timer_wheel_t {
+    apr_pool_t *pool;
+    apr_slab_t *slab;
+    apr_interval_time_t resolution;
+    apr_uint64_t cur;
+    apr_size_t count;
+    apr_uint64_t occupied[WHEEL_LEVELS];
+    /* The slots of all the levels, followed by the expired timers */
+    struct timer_ring_t slots[WHEEL_LEVELS * WHEEL_SLOTS + 1];
+};
+
+#define SLOT_EMPTY(w, s) APR_RING_EMPTY(&(w)->slots[s], apr_timer_t, link)
+
+/* Index of the highest bit set of a (non-zero) value */
+static APR_INLINE unsigned int wheel_last(apr_uint64_t x)
+{
+#if defined(__GNUC__)
+    return 63 - (unsigned int)__builtin_clzll(x);
+#else
+    unsigned int n = 0;
+    while (x >>= 1) {
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* Index of the lowest bit set of a (non-zero) value */
+static APR_INLINE unsigned int wheel_first(apr_uint64_t x)
+{
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_ctzll(x);
+#else
+    unsigned int n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+static APR_INLINE apr_uint64_t wheel_tick_after(const apr_timer_wheel_t *w,
+                                                apr_time_t t)
+{
+    if (t <= 0) {
+        return 0;
+    }
+    return ((apr_uint64_t)t + (apr_uint64_t)w->resolution - 1)
+           / (apr_uint64_t)w->resolution;
+}
+
+static APR_INLINE apr_uint64_t wheel_tick_before(const apr_timer_wheel_t *w,
+                                                 apr_time_t t)
+{
+    if (t <= 0) {
+        return 0;
+    }
+    return (apr_uint64_t)t / (apr_uint64_t)w->resolution;
+}
+
+static void wheel_insert(apr_timer_wheel_t *w, apr_timer_t *timer)
+{
+    unsigned int level, slot;
+
+    if (timer->tick <= w->cur) {
+        slot = WHEEL_EXPIRED;
+    }
+    else {
+        level = wheel_last(timer->tick ^ w->cur) / WHEEL_BITS;
+        slot = (unsigned int)(timer->tick >> (level * WHEEL_BITS))
+               & WHEEL_MASK;
+        w->occupied[level] |= APR_UINT64_C(1) << slot;
+        slot += level * WHEEL_SLOTS;
+    }
+    timer->slot = slot;
+    APR_RING_INSERT_TAIL(&w->slots[slot], timer, apr_timer_t, link);
+}
+
+static void wheel_remove(apr_timer_wheel_t *w, apr_timer_t *timer)
+{
+    unsigned int slot = timer->slot;
+
+    APR_RING_REMOVE(timer, link);
+    if (slot != WHEEL_EXPIRED && SLOT_EMPTY(w, slot)) {
+        w->occupied[slot / WHEEL_SLOTS] &=
+            ~(APR_UINT64_C(1) << (slot & WHEEL_MASK));
+    }
+}
+
+/* The first tick of the lowest occupied slot of the level */
+static APR_INLINE apr_uint64_t wheel_next_tick(const apr_timer_wheel_t *w,
+                                               unsigned int level)
+{
+    unsigned int shift = level * WHEEL_BITS;
+    apr_uint64_t tick;
+
+    tick = (apr_uint64_t)wheel_first(w->occupied[level]) << shift;
+    if (shift + WHEEL_BITS < 64) {
+        tick |= w->cur & ~((APR_UINT64_C(1) << (shift + WHEEL_BITS)) - 1);
+    }
+    return tick;
+}
+
+/* Move the wheel up to the given tick, expiring the timers on the way */
+static void wheel_advance(apr_timer_wheel_t *w, apr_uint64_t to)
+{
+    while (w->cur < to) {
+        apr_uint64_t next = to;
+        unsigned int level, found = 0;
+
+        /* the lowest occupied level holds the next slot to process */
+        for (level = 0; level < WHEEL_LEVELS; level++) {
+            if (w->occupied[level]) {
+                apr_uint64_t tick = wheel_next_tick(w, level);
+                if (tick <= next) {
+                    next = tick;
+                    found = 1;
+                }
+                break;
+            }
+        }
+        w->cur = next;
+        if (!found) {
+            break;
+        }
+
+        /* process the slot, the timers of a slot of level 0 expire and
+         * the others go to the levels below (or expire)
+         */
+        {
+            unsigned int slot = (unsigned int)(next >> (level * WHEEL_BITS))
+                                & WHEEL_MASK;
+            struct timer_ring_t *ring = &w->slots[level * WHEEL_SLOTS + slot];
+
+            w->occupied[level] &= ~(APR_UINT64_C(1) << slot);
+            if (level == 0) {
+                apr_timer_t *timer;
+                for (timer = APR_RING_FIRST(ring);
+                     timer != APR_RING_SENTINEL(ring, apr_timer_t, link);
+                     timer = APR_RING_NEXT(timer, link)) {
+                    timer->slot = WHEEL_EXPIRED;
+                }
+                APR_RING_CONCAT(&w->slots[WHEEL_EXPIRED], ring,
+                                apr_timer_t, link);
+                continue;
+            }
+            while (!APR_RING_EMPTY(ring, apr_timer_t, link)) {
+                apr_timer_t *timer = APR_RING_FIRST(ring);
+                APR_RING_REMOVE(timer, link);
+                wheel_insert(w, timer);
+            }
+        }
+    }
+}
+
+APR_DECLARE(apr_status_t) apr_timer_wheel_create(apr_timer_wheel_t **wheel,
+                                                 apr_interval_time_t resolution,
+                                                 apr_pool_t *pool)
+{
+    apr_timer_wheel_t *w;
+    apr_status_t rv;
+    unsigned int i;
+
+    if (resolution < 0) {
+        return APR_EINVAL;
+    }
+
+    w = apr_palloc(pool, sizeof(*w));
+    if (!w) {
+        return APR_ENOMEM;
+    }
+    rv = apr_slab_create(&w->slab, sizeof(apr_timer_t), 0, pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    w->pool = pool;
+    w->resolution = resolution ? resolution : apr_time_from_msec(1);
+    w->cur = wheel_tick_before(w, apr_time_now());
+    w->count = 0;
+    for (i = 0; i < WHEEL_LEVELS; i++) {
+        w->occupied[i] = 0;
+    }
+    for (i = 0; i <= WHEEL_EXPIRED; i++) {
+        APR_RING_INIT(&w->slots[i], apr_timer_t, link);
+    }
+
+    *wheel = w;
+    return APR_SUCCESS;
+}
+
+APR_DECLARE(apr_status_t) apr_timer_wheel_add(apr_timer_wheel_t *wheel,
+                                              apr_time_t when, void *baton,
+                                              apr_timer_t **timer)
+{
+    apr_timer_t *t;
+
+    t = apr_slab_alloc(wheel->slab);
+    if (!t) {
+        return APR_ENOMEM;
+    }
+    t->tick = wheel_tick_after(wheel, when);
+    t->baton = baton;
+    wheel_insert(wheel, t);
+    wheel->count++;
+
+    if (timer) {
+        *timer = t;
+    }
+    return APR_SUCCESS;
+}
+
+APR_DECLARE(void) apr_timer_wheel_reset(apr_timer_wheel_t *wheel,
+                                        apr_timer_t *timer, apr_time_t when)
+{
+    apr_uint64_t tick = wheel_tick_after(wheel, when);
+
+    if (tick != timer->tick || timer->slot == WHEEL_EXPIRED) {
+        wheel_remove(wheel, timer);
+        timer->tick = tick;
+        wheel_insert(wheel, timer);
+    }
+}
+
+APR_DECLARE(void) apr_timer_wheel_cancel(apr_timer_wheel_t *wheel,
+                                         apr_timer_t *timer)
+{
+    wheel_remove(wheel, timer);
+    wheel->count--;
+    apr_slab_free(wheel->slab, timer);
+}
+
+APR_DECLARE(apr_status_t) apr_timer_wheel_expire(apr_timer_wheel_t *wheel,
+                                                 apr_time_t now, void **baton)
+{
+    struct timer_ring_t *expired = &wheel->slots[WHEEL_EXPIRED];
+    apr_timer_t *timer;
+
+    if (APR_RING_EMPTY(expired, apr_timer_t, link)) {
+        if (!wheel->count) {
+            return APR_EAGAIN;
+        }
+        wheel_advance(wheel, wheel_tick_before(wheel, now));
+        if (APR_RING_EMPTY(expired, apr_timer_t, link)) {
+            return APR_EAGAIN;
+        }
+    }
+
+    timer = APR_RING_FIRST(expired);
+    APR_RING_REMOVE(timer, link);
+    wheel->count--;
+    *baton = timer->baton;
+    apr_slab_free(wheel->slab, timer);
+    return APR_SUCCESS;
+}
+
+APR_DECLARE(apr_interval_time_t) apr_timer_wheel_timeout(
+                                     apr_timer_wheel_t *wheel, apr_time_t now)
+{
+    apr_interval_time_t timeout;
+    unsigned int level;
+
+    if (!wheel->count) {
+        return -1;
+    }
+    if (!SLOT_EMPTY(wheel, WHEEL_EXPIRED)) {
+        return 0;
+    }
+
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        if (wheel->occupied[level]) {
+            break;
+        }
+    }
+    /* the first tick of the slot, exact at level 0 and a lower bound
+     * above (the timers will be distributed when it's reached)
+     */
+    timeout = (apr_interval_time_t)(wheel_next_tick(wheel, level)
+                                    * (apr_uint64_t)wheel->resolution) - now;
+    return timeout > 0 ? timeout : 0;
+}
+
+APR_DECLARE(apr_size_t) apr_timer_wheel_count(const apr_timer_wheel_t *wheel)
+{
+    return wheel->count;
+}